@@ -8,8 +8,13 @@
 
 #include <iostream>
 #include <sstream>
+#include <vector>
 #include <stdlib.h>
 
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
+
 
 /*
 
@@ -434,3 +439,94 @@ string nextToken(string s, string::size_type from, string::size_type& tokenEnd,
 }
 
 
+
+// myRandom - returns a pseudo-random number in [0, 1]. If seed is NULL, rand() is used as usual. Otherwise,
+// the number is drawn from a xorshift generator whose state is kept in seed (and nowhere else), so that the 
+// sequence depends on the starting seed only, and not on what other threads are drawing.
+double myRandom(unsigned int* seed) {
+  
+  if (!seed) {
+    return ((double)rand() / (double)RAND_MAX);
+  }
+  
+  unsigned int x = *seed;
+  if (x == 0) x = 2463534242u; // xorshift gets stuck at zero
+  x ^= (x << 13);
+  x ^= (x >> 17);
+  x ^= (x << 5);
+  *seed = x;
+  
+  return ((double)x / 4294967295.0);
+}
+
+// mySeed - derives a seed for the item named s (e.g. a peptide) from seed, by hashing s (FNV-1a) into it. 
+// Gives the same seed for the same item no matter in which order, or by which thread, the items are processed.
+unsigned int mySeed(unsigned int seed, string s) {
+  
+  unsigned int h = 2166136261u ^ seed;
+  for (string::size_type i = 0; i < s.length(); i++) {
+    h ^= (unsigned char)(s[i]);
+    h *= 16777619u;
+  }
+  return (h == 0 ? 1 : h);
+}
+
+// a share of the items given to runInShares, and what to do with it
+typedef struct _sharethreadarg {
+  void (*doShare)(void* context, unsigned int first, unsigned int step);
+  void* context;
+  unsigned int first;
+  unsigned int step;
+} ShareThreadArg;
+
+// doShareInThread - does one share of runInShares
+static void* doShareInThread(void* arg) {
+  
+  ShareThreadArg* a = (ShareThreadArg*)arg;
+  a->doShare(a->context, a->first, a->step);
+  return (NULL);
+}
+
+// runInShares - calls doShare(context, first, step) for each share of count items, using numThreads threads (but no 
+// more than there are items). Share 0 is done by this thread; any share a thread cannot be started for is done 
+// here as well. Returns when all shares are done. Which items are in which share does not depend on whether the 
+// threads could be started, so neither does the result, as long as doShare touches nothing but its own items.
+void runInShares(void (*doShare)(void* context, unsigned int first, unsigned int step), void* context,
+                 unsigned int count, unsigned int numThreads) {
+  
+  if (numThreads > count) {
+    numThreads = count;
+  }
+  if (numThreads < 1) {
+    numThreads = 1;
+  }
+  
+  vector<ShareThreadArg> args(numThreads);
+  for (unsigned int t = 0; t < numThreads; t++) {
+    args[t].doShare = doShare;
+    args[t].context = context;
+    args[t].first = t;
+    args[t].step = numThreads;
+  }
+  
+#ifndef _MSC_VER
+  vector<pthread_t> threads(numThreads);
+  vector<bool> started(numThreads, false);
+  for (unsigned int t = 1; t < numThreads; t++) {
+    started[t] = (pthread_create(&(threads[t]), NULL, doShareInThread, &(args[t])) == 0);
+  }
+  doShareInThread(&(args[0]));
+  for (unsigned int t = 1; t < numThreads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      doShareInThread(&(args[t]));
+    }
+  }
+#else
+  for (unsigned int t = 0; t < numThreads; t++) {
+    doShareInThread(&(args[t]));
+  }
+#endif
+  
+}
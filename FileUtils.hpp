@@ -120,5 +120,20 @@ string crop(string s);
 
 string nextToken(string s, string::size_type from, string::size_type& tokenEnd, const char* delim = " \t\r\n", const char* skipover = " \t\r\n");
 
+// RANDOM NUMBERS
+
+// a number in [0, 1]. Drawn from rand() if seed is NULL, else from (and advancing) the private state in seed,
+// such that each thread can have its own reproducible sequence
+double myRandom(unsigned int* seed = NULL);
+
+// deriving an independent seed for the item named s from seed
+unsigned int mySeed(unsigned int seed, string s);
+
+// THREADS
+
+// doing count items in numThreads shares, share k being items k, k + numThreads, k + 2 * numThreads, ...
+void runInShares(void (*doShare)(void* context, unsigned int first, unsigned int step), void* context,
+                 unsigned int count, unsigned int numThreads);
+
 
 #endif /*FILEUTILS_HPP_*/
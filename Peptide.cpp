@@ -9,6 +9,9 @@
 #include <math.h>
 #include <stdlib.h>
 
+// the longest peptides for which isHomolog keeps its alignment table on the stack
+#define HOMOLOG_STACK_LENGTH 64
+
 /*
 
 Library       : Peptide
@@ -294,14 +297,14 @@ bool Peptide::isSubsequence(Peptide& other, bool ignoreMods) {
 // vs DEFG-HIK (1+2+2+2+1+2 = 10 points)
 //    DEFFG-HI-
 // vs YEF-GGHIK (1+2+1+1+2 = 7 points)
+// The residues are compared as integer symbols (see getHomologSymbols), and only two rows of the table are kept,
+// on the stack for peptides of up to HOMOLOG_STACK_LENGTH residues. Unmodified peptides of that length need no heap
+// allocation at all; each modified residue still costs a mod token string (see getModToken).
 bool Peptide::isHomolog(Peptide& other, double threshold, int& identity) {
 	
   unsigned int m = (unsigned int)(stripped.length());
   unsigned int n = (unsigned int)(other.stripped.length());
   
-  vector<string> aa1(m + 1);
-  vector<string> aa2(n + 1);
-  
   string::size_type shorter = m;
   if (m > n) shorter = n;
   
@@ -309,62 +312,80 @@ bool Peptide::isHomolog(Peptide& other, double threshold, int& identity) {
   // so we are calculating our threshold identity score by multiplying the specified threshold by this "perfect" score
   double minIdentity = threshold * (shorter * 2 - 1);
   
-  int** alignedLength = new int*[m + 1];
-  int** identical = new int*[m + 1];
-    
+  int stackBuffer[4 * (HOMOLOG_STACK_LENGTH + 1)];
+  vector<int> heapBuffer;
+  int* aa1 = stackBuffer;
+  if (m > HOMOLOG_STACK_LENGTH || n > HOMOLOG_STACK_LENGTH) {
+    heapBuffer.resize((m + 1) + 3 * (n + 1));
+    aa1 = &(heapBuffer[0]);
+  }
+  int* aa2 = aa1 + (m + 1);
+  int* prevRow = aa2 + (n + 1);
+  int* thisRow = prevRow + (n + 1);
+  
+  // mod tokens seen in either peptide, numbered in order of appearance
+  vector<string> modTokens;
+  getHomologSymbols(aa1, modTokens);
+  other.getHomologSymbols(aa2, modTokens);
+  
+  // alignedLength[i][j] is kept in thisRow[j] (row i) and prevRow[j] (row i - 1). An aligned AA gets a bonus point
+  // if the previous AA of both sequences are aligned too, i.e. identical[i - 1][j - 1] of the full table, which is
+  // simply whether aa1[i - 1] and aa2[j - 1] are the same.
   unsigned int i = 0;
   unsigned int j = 0;
-
-  for (i = 0; i <= m; i++) {
-    alignedLength[i] = new int[n + 1];
-    identical[i] = new int[n + 1];
-    
-    alignedLength[i][0] = 0;
-    if (i > 0) aa1[i] = interactStyleAA(i - 1);
-  
-    for (j = 0; j <= n; j++) {
-      identical[i][j] = 0;
-    }
-  }  
   
   for (j = 0; j <= n; j++) {
-    alignedLength[0][j] = 0;
-    if (j > 0) aa2[j] = other.interactStyleAA(j - 1);
+    prevRow[j] = 0;
   }
   
   for (i = 1; i <= m; i++) {
+    thisRow[0] = 0;
     for (j = 1; j <= n; j++) {
-      if (aa1[i] == aa2[j] ||
-          (aa1[i] == "L" && aa2[j] == "I") || // we consider I and L the same, K and Q the same
-          (aa1[i] == "I" && aa2[j] == "L") ||
-          (aa1[i] == "K" && aa2[j] == "Q") ||
-          (aa1[i] == "Q" && aa2[j] == "K")) {
-        alignedLength[i][j] = alignedLength[i - 1][j - 1] + 1 + identical[i - 1][j - 1];
-        identical[i][j] = 1;
+      if (aa1[i] == aa2[j]) {
+        thisRow[j] = prevRow[j - 1] + 1 + (i > 1 && j > 1 && aa1[i - 1] == aa2[j - 1] ? 1 : 0);
+      } else if (prevRow[j] > thisRow[j - 1]) {
+        thisRow[j] = prevRow[j];
       } else {
-        if (alignedLength[i - 1][j] > alignedLength[i][j - 1]) {
-          alignedLength[i][j] = alignedLength[i - 1][j];
-        } else {
-          alignedLength[i][j] = alignedLength[i][j - 1];
-        }
-       
+        thisRow[j] = thisRow[j - 1];
       }
     }
+    int* swapRow = prevRow;
+    prevRow = thisRow;
+    thisRow = swapRow;
   }
  
-  identity = alignedLength[m][n];
-  bool result = ((double)(alignedLength[m][n]) >= minIdentity);
- 
+  identity = prevRow[n];
+  return ((double)(prevRow[n]) >= minIdentity);
+  
+}
 
-  for (unsigned int r = 0; r <= m; r++) {
-    delete[] alignedLength[r];
-    delete[] identical[r];
+// getHomologSymbols - encodes the residues of the peptide as integers for isHomolog, into symbols[1] ... symbols[length].
+// Two residues get the same symbol if and only if their interactStyleAA tokens are the same, except that I and L are 
+// considered the same, and K and Q the same. Unmodified residues are their own characters; modified ones are numbered
+// from 256 up by their tokens, which are looked up in (and added to) modTokens.
+void Peptide::getHomologSymbols(int* symbols, vector<string>& modTokens) {
+  
+  unsigned int length = (unsigned int)(stripped.length());
+  
+  symbols[0] = 0;
+  for (unsigned int pos = 0; pos < length; pos++) {
+    char aa = stripped[pos];
+    if (aa == 'I') aa = 'L';
+    if (aa == 'Q') aa = 'K';
+    symbols[pos + 1] = (int)((unsigned char)aa);
   }
-  delete[] alignedLength;
-  delete[] identical;
   
-  return (result);
+  if (!isModsSet) return;
   
+  for (map<int, string>::iterator mod = mods.begin(); mod != mods.end(); mod++) {
+    if (mod->first < 0 || mod->first >= (int)length) continue; // terminal mods are not part of any residue token
+    
+    string token = getModToken(stripped[mod->first], mod->second);
+    unsigned int t = 0;
+    while (t < (unsigned int)(modTokens.size()) && modTokens[t] != token) t++;
+    if (t == (unsigned int)(modTokens.size())) modTokens.push_back(token);
+    symbols[mod->first + 1] = 256 + (int)t;
+  }
 }
 
 	
@@ -2660,8 +2681,9 @@ string Peptide::nextAAToken(string s, string::size_type start, string::size_type
 
 
 // shufflePeptideSequence - randomly shuffles the peptide sequence (returns the shuffled sequence).
-// multiple calls to this method will return different results.
-Peptide* Peptide::shufflePeptideSequence(map<int, set<string> >& allSequences) {
+// multiple calls to this method will return different results. If randSeed is given, the random numbers are
+// drawn from it instead of rand(), so the shuffle is reproducible from the seed.
+Peptide* Peptide::shufflePeptideSequence(map<int, set<string> >& allSequences, unsigned int* randSeed) {
   
   // this randomizer tries to keep the N-terminal K/R, P, KP and RP and modified amino acids where they are
   // if not enough movable AAs exist then it will start loosening, first allowing P and modified amino acids to move
@@ -2697,7 +2719,7 @@ Peptide* Peptide::shufflePeptideSequence(map<int, set<string> >& allSequences) {
 	continue;
       }
       
-      unsigned int randIndex = (unsigned int)((double)rand() / (double)RAND_MAX * (double)(tmpMovableAA.size()));
+      unsigned int randIndex = (unsigned int)(myRandom(randSeed) * (double)(tmpMovableAA.size()));
       if (randIndex >= tmpMovableAA.size()) randIndex--; // out-of-bound safeguard: apparently on some platform this could happen
       list<char>::iterator j = tmpMovableAA.begin();
       for (unsigned int i = 0; i < randIndex; i++) j++; // step forward movable AA indexed by randIndex
@@ -2746,14 +2768,14 @@ Peptide* Peptide::shufflePeptideSequence(map<int, set<string> >& allSequences) {
     
     Peptide* newNewPep = NULL;
     do {
-      unsigned int randIndex = (unsigned int)((double)rand() / (double)RAND_MAX * (double)(aas.length()));
+      unsigned int randIndex = (unsigned int)(myRandom(randSeed) * (double)(aas.length()));
       if (randIndex >= aas.length()) randIndex--; // out-of-bound safeguard: apparently on some platform this could happen
 
       string newPepStr = newPep->interactStyle();
       string newPepLastAAStr = (*newPep)[newPep->NAA() - 1];
       newPepStr += aas[randIndex];
       
-      randIndex = (unsigned int)((double)rand() / (double)RAND_MAX * (double)(aas.length()));
+      randIndex = (unsigned int)(myRandom(randSeed) * (double)(aas.length()));
       if (randIndex >= aas.length()) randIndex--; // out-of-bound safeguard: apparently on some platform this could happen
       
       newPepStr += aas[randIndex];
@@ -149,7 +149,7 @@ public:
 
   // method to shuffle the peptide sequence randomly
   // string shufflePeptideSequence();
-  Peptide* shufflePeptideSequence(map<int, set<string> >& allSequences);
+  Peptide* shufflePeptideSequence(map<int, set<string> >& allSequences, unsigned int* randSeed = NULL);
 
   // method to compute the isoelectric point
   double computePI();
@@ -211,6 +211,9 @@ private:
   // private parsing methods
   bool stripPeptide(string pep);
   
+  // private method to encode the residues for isHomolog
+  void getHomologSymbols(int* symbols, vector<string>& modTokens);
+  
   static double calcApproximateAverageMass(double monoisotopicMass);
 	
 
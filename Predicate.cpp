@@ -52,6 +52,7 @@ using namespace std;
 Predicate::Predicate(string refName, string oper, string refValue, bool defaultBool) :
   m_refName(refName), 
   m_oper(oper),
+  m_operCode(parseOper(oper)),
   m_type('S'),
   m_refValueS(refValue),
   m_refValueI(0),
@@ -64,6 +65,7 @@ Predicate::Predicate(string refName, string oper, string refValue, bool defaultB
 Predicate::Predicate(string refName, string oper, int refValue, bool defaultBool) : 
   m_refName(refName), 
   m_oper(oper),
+  m_operCode(parseOper(oper)),
   m_type('I'),
   m_refValueS(""),
   m_refValueI(refValue),
@@ -76,6 +78,7 @@ Predicate::Predicate(string refName, string oper, int refValue, bool defaultBool
 Predicate::Predicate(string refName, string oper, double refValue, bool defaultBool) :
   m_refName(refName), 
   m_oper(oper),
+  m_operCode(parseOper(oper)),
   m_type('D'),
   m_refValueS(""),
   m_refValueI(0),
@@ -89,32 +92,58 @@ Predicate::~Predicate() {
 
 }
 
+// parseOper - converts the operator string to its code, so that it is not string-compared on every comparison
+int Predicate::parseOper(string oper) {
+  
+  if (oper == "==") {
+    return (PRED_OP_EQ);
+  } else if (oper == "!=") {
+    return (PRED_OP_NE);
+  } else if (oper == "<=") {
+    return (PRED_OP_LE);
+  } else if (oper == ">=") {
+    return (PRED_OP_GE);
+  } else if (oper == "<") {
+    return (PRED_OP_LT);
+  } else if (oper == ">") {
+    return (PRED_OP_GT);
+  } else if (oper == "=~") {
+    return (PRED_OP_CONTAINS);
+  } else if (oper == "!~") {
+    return (PRED_OP_NOT_CONTAINS);
+  } else {
+    return (PRED_OP_UNKNOWN);
+  }
+}
+
+// compare - compares two values of the same type by the operator. The substring operators only apply to strings;
+// for the other types they return the default.
+template<class T> bool Predicate::compare(const T& value1, const T& value2) {
+  
+  switch (m_operCode) {
+  case PRED_OP_EQ : return (value1 == value2);
+  case PRED_OP_NE : return (value1 != value2);
+  case PRED_OP_LE : return (value1 <= value2);
+  case PRED_OP_GE : return (value1 >= value2);
+  case PRED_OP_LT : return (value1 < value2);
+  case PRED_OP_GT : return (value1 > value2);
+  default : return (m_default);
+  }
+}
+
 // compRef - compare to reference value
 bool Predicate::compRef(string value) {
   if (m_type != 'S') {
     return (m_default);
   }
   
-  if (m_oper == "==") {
-    return (value == m_refValueS);  
-  } else if (m_oper == "!=") {
-    return (value != m_refValueS);  
-  } else if (m_oper == "<=") {
-    return (value <= m_refValueS);  
-  } else if (m_oper == ">=") {
-    return (value >= m_refValueS);  
-  } else if (m_oper == "<") {
-    return (value < m_refValueS);  
-  } else if (m_oper == ">") {
-    return (value > m_refValueS);  
-  } else if (m_oper == "=~") {
+  if (m_operCode == PRED_OP_CONTAINS) {
     return (value.find(m_refValueS, 0) != string::npos);  
-  
     // TODO: may want to have real regular expression support later
-  } else if (m_oper == "!~") {
+  } else if (m_operCode == PRED_OP_NOT_CONTAINS) {
     return (value.find(m_refValueS, 0) == string::npos); 
   } else {
-    return (m_default);
+    return (compare(value, m_refValueS));
   }
 } 
     
@@ -124,25 +153,7 @@ bool Predicate::compRef(int value) {
     return (m_default);
   }
   
-  if (m_oper == "==") {
-    return (value == m_refValueI);  
-  } else if (m_oper == "!=") {
-    return (value != m_refValueI);  
-  } else if (m_oper == "<=") {
-    return (value <= m_refValueI);  
-  } else if (m_oper == ">=") {
-    return (value >= m_refValueI);  
-  } else if (m_oper == "<") {
-    return (value < m_refValueI);  
-  } else if (m_oper == ">") {
-    return (value > m_refValueI);  
-  } else if (m_oper == "=~") {
-    return (m_default);  
-  } else if (m_oper == "!~") {
-    return (m_default); 
-  } else {
-    return (m_default);
-  }
+  return (compare(value, m_refValueI));
 }
   
 // compRef - compare to reference value
@@ -150,25 +161,8 @@ bool Predicate::compRef(double value) {
   if (m_type != 'D') {
     return (m_default);
   }
-  if (m_oper == "==") {
-    return (value == m_refValueD);  
-  } else if (m_oper == "!=") {
-    return (value != m_refValueD);  
-  } else if (m_oper == "<=") {
-    return (value <= m_refValueD);  
-  } else if (m_oper == ">=") {
-    return (value >= m_refValueD);  
-  } else if (m_oper == "<") {
-    return (value < m_refValueD);  
-  } else if (m_oper == ">") {
-    return (value > m_refValueD);  
-  } else if (m_oper == "=~") {
-    return (m_default);  
-  } else if (m_oper == "!~") {
-    return (m_default); 
-  } else {
-    return (m_default);
-  }
+  
+  return (compare(value, m_refValueD));
 }
 
 // comp - compare two values
@@ -177,24 +171,12 @@ bool Predicate::comp(string value1, string value2) {
     return (m_default);
   }
   
-  if (m_oper == "==") {
-    return (value1 == value2);  
-  } else if (m_oper == "!=") {
-    return (value1 != value2);  
-  } else if (m_oper == "<=") {
-    return (value1 <= value2);  
-  } else if (m_oper == ">=") {
-    return (value1 >= value2);  
-  } else if (m_oper == "<") {
-    return (value1 < value2);  
-  } else if (m_oper == ">") {
-    return (value1 > value2);  
-  } else if (m_oper == "=~") {
+  if (m_operCode == PRED_OP_CONTAINS) {
     return (value1.find(value2, 0) != string::npos);  
-  } else if (m_oper == "!~") {
+  } else if (m_operCode == PRED_OP_NOT_CONTAINS) {
     return (value1.find(value2, 0) == string::npos); 
   } else {
-    return (m_default);
+    return (compare(value1, value2));
   }  
 }
 
@@ -204,25 +186,7 @@ bool Predicate::comp(int value1, int value2) {
     return (m_default);
   }
   
-  if (m_oper == "==") {
-    return (value1 == value2);  
-  } else if (m_oper == "!=") {
-    return (value1 != value2);  
-  } else if (m_oper == "<=") {
-    return (value1 <= value2);  
-  } else if (m_oper == ">=") {
-    return (value1 >= value2);  
-  } else if (m_oper == "<") {
-    return (value1 < value2);  
-  } else if (m_oper == ">") {
-    return (value1 > value2);  
-  } else if (m_oper == "=~") {
-    return (m_default);  
-  } else if (m_oper == "!~") {
-    return (m_default); 
-  } else {
-    return (m_default);
-  }
+  return (compare(value1, value2));
 }
 
 // comp - compare two values
@@ -231,24 +195,32 @@ bool Predicate::comp(double value1, double value2) {
     return (m_default);
   }
   
-  if (m_oper == "==") {
-    return (value1 == value2);  
-  } else if (m_oper == "!=") {
-    return (value1 != value2);  
-  } else if (m_oper == "<=") {
-    return (value1 <= value2);  
-  } else if (m_oper == ">=") {
-    return (value1 >= value2);  
-  } else if (m_oper == "<") {
-    return (value1 < value2);  
-  } else if (m_oper == ">") {
-    return (value1 > value2);  
-  } else if (m_oper == "=~") {
-    return (m_default);  
-  } else if (m_oper == "!~") {
-    return (m_default); 
-  } else {
-    return (m_default);
+  return (compare(value1, value2));
+}
+
+// compRefRange - finds out whether compRef(value) can be true, and whether it can be false, for a value 
+// anywhere in [low, high) (low < high), without knowing the value itself
+void Predicate::compRefRange(double low, double high, bool& canBeTrue, bool& canBeFalse) {
+  
+  canBeTrue = true;
+  canBeFalse = true;
+  
+  if (m_type != 'D') {
+    canBeTrue = m_default;
+    canBeFalse = !m_default;
+    return;
+  }
+  
+  double r = m_refValueD;
+  
+  switch (m_operCode) {
+  case PRED_OP_EQ : canBeTrue = (low <= r && r < high); break;
+  case PRED_OP_NE : canBeFalse = (low <= r && r < high); break;
+  case PRED_OP_LE : canBeTrue = (low <= r); canBeFalse = (high > r); break;
+  case PRED_OP_GE : canBeTrue = (high > r); canBeFalse = (low < r); break;
+  case PRED_OP_LT : canBeTrue = (low < r); canBeFalse = (high > r); break;
+  case PRED_OP_GT : canBeTrue = (high > r); canBeFalse = (low <= r); break;
+  default : canBeTrue = m_default; canBeFalse = !m_default; break;
   }
 }
 
@@ -3,6 +3,17 @@
 
 #include <string>
 
+// the operators, parsed once from the operator string. 
+#define PRED_OP_UNKNOWN 0
+#define PRED_OP_EQ 1
+#define PRED_OP_NE 2
+#define PRED_OP_LE 3
+#define PRED_OP_GE 4
+#define PRED_OP_LT 5
+#define PRED_OP_GT 6
+#define PRED_OP_CONTAINS 7
+#define PRED_OP_NOT_CONTAINS 8
+
 /*
 
 Library       : Predicate
@@ -50,6 +61,7 @@ class Predicate {
     
     string getRefName() { return (m_refName); }      
     char getType() { return (m_type); }
+    int getOperCode() { return (m_operCode); }
 
     
     // compare to reference value
@@ -62,11 +74,15 @@ class Predicate {
     bool comp(int value1, int value2);
     bool comp(double value1, double value2);
     
+    // find out what comparing to the reference value can give for any value in [low, high)
+    void compRefRange(double low, double high, bool& canBeTrue, bool& canBeFalse);
+    
     // change the type (int, double, string) to compare
     void changeType(char newType);
     
   private:
     string m_oper; // operand, can be ==, !=, >, >=, <, <=, =~, !~
+    int m_operCode; // m_oper as one of the PRED_OP_* codes
     
     char m_type;
     
@@ -77,6 +93,10 @@ class Predicate {
     
     bool m_default; // default return value for failed comparison
     
+    static int parseOper(string oper);
+    
+    template<class T> bool compare(const T& value1, const T& value2);
+    
 };
 
 #endif
@@ -26,7 +26,10 @@ HEADERS += FileUtils.hpp \
            SpectraSTDtaSearchTask.hpp \
            SpectraSTFastaFileHandler.hpp \
            SpectraSTFileList.hpp \
+           SpectraSTGzipStreamBuf.hpp \
+           SpectraSTMappedFile.hpp \
            SpectraSTHtmlSearchOutput.hpp \
+           SpectraSTPerLibrarySearchOutput.hpp \
            SpectraSTLib.hpp \
            SpectraSTLibEntry.hpp \
            SpectraSTLibImporter.hpp \
@@ -37,6 +40,13 @@ HEADERS += FileUtils.hpp \
            SpectraSTMspLibImporter.hpp \
            SpectraSTMspSearchTask.hpp \
            SpectraSTMzLibIndex.hpp \
+           SpectraSTFragmentIndex.hpp \
+           SpectraSTSketchIndex.hpp \
+           SpectraSTQuerySelection.hpp \
+           SpectraSTPeakListPool.hpp \
+           SpectraSTSpectrumPlotter.hpp \
+           SpectraSTStageStats.hpp \
+           SpectraSTFilterExpression.hpp \
            SpectraSTMzXMLLibImporter.hpp \
            SpectraSTMzXMLSearchTask.hpp \
            SpectraSTPeakList.hpp \
@@ -45,6 +55,8 @@ HEADERS += FileUtils.hpp \
            SpectraSTPepXMLSearchOutput.hpp \
            SpectraSTQuery.hpp \
            SpectraSTReplicates.hpp \
+           SpectraSTResultCache.hpp \
+           SpectraSTScanHeaderCache.hpp \
            SpectraSTSearch.hpp \
            SpectraSTSearchOutput.hpp \
            SpectraSTSearchParams.hpp \
@@ -74,7 +86,10 @@ SOURCES += FileUtils.cpp \
            SpectraSTDtaSearchTask.cpp \
            SpectraSTFastaFileHandler.cpp \
            SpectraSTFileList.cpp \
+           SpectraSTGzipStreamBuf.cpp \
+           SpectraSTMappedFile.cpp \
            SpectraSTHtmlSearchOutput.cpp \
+           SpectraSTPerLibrarySearchOutput.cpp \
            SpectraSTLib.cpp \
            SpectraSTLibEntry.cpp \
            SpectraSTLibImporter.cpp \
@@ -86,6 +101,13 @@ SOURCES += FileUtils.cpp \
            SpectraSTMspLibImporter.cpp \
            SpectraSTMspSearchTask.cpp \
            SpectraSTMzLibIndex.cpp \
+           SpectraSTFragmentIndex.cpp \
+           SpectraSTSketchIndex.cpp \
+           SpectraSTQuerySelection.cpp \
+           SpectraSTPeakListPool.cpp \
+           SpectraSTSpectrumPlotter.cpp \
+           SpectraSTStageStats.cpp \
+           SpectraSTFilterExpression.cpp \
            SpectraSTMzXMLLibImporter.cpp \
            SpectraSTMzXMLSearchTask.cpp \
            SpectraSTPeakList.cpp \
@@ -94,6 +116,8 @@ SOURCES += FileUtils.cpp \
            SpectraSTPepXMLSearchOutput.cpp \
            SpectraSTQuery.cpp \
            SpectraSTReplicates.cpp \
+           SpectraSTResultCache.cpp \
+           SpectraSTScanHeaderCache.cpp \
            SpectraSTSearch.cpp \
            SpectraSTSearchOutput.cpp \
            SpectraSTSearchParams.cpp \
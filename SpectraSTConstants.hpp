@@ -27,6 +27,10 @@
 // but opening too many files can bog down the file system, and may not be efficient. 
 #define MAX_NUM_OPEN_FILES 50
 
+// in a binary .splib, a number of peaks with this bit set is followed by a compressed peak block
+// (see SpectraSTPeakList::writeCompressedPeaks) instead of the peaks themselves
+#define COMPRESSED_PEAKS_FLAG 0x80000000
+
 //#define DECOY_BATCH_SIZE 100
 //#define DECOY_PIECE_SIZE 200
 
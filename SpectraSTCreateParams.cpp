@@ -72,6 +72,7 @@ SpectraSTCreateParams& SpectraSTCreateParams::operator=(SpectraSTCreateParams& s
   this->paramsFileName = s.paramsFileName;
   this->outputFileName = s.outputFileName;
   this->binaryFormat = s.binaryFormat;
+  this->compressPeaks = s.compressPeaks;
   this->annotatePeaks = s.annotatePeaks;
   this->remark = s.remark;  
   this->writeDtaFiles = s.writeDtaFiles;
@@ -98,6 +99,8 @@ SpectraSTCreateParams& SpectraSTCreateParams::operator=(SpectraSTCreateParams& s
   this->centroidPeaks = s.centroidPeaks;
   this->setFragmentation = s.setFragmentation;
   this->skipRawAnnotation = s.skipRawAnnotation;
+  this->cacheScanHeaders = s.cacheScanHeaders;
+  this->importParseThread = s.importParseThread;
   this->evaluatePhosphoSiteAssignment = s.evaluatePhosphoSiteAssignment;
   this->keepRawIntensities = s.keepRawIntensities;
   this->bracketSpectra = s.bracketSpectra;
@@ -106,6 +109,7 @@ SpectraSTCreateParams& SpectraSTCreateParams::operator=(SpectraSTCreateParams& s
   this->combineAction = s.combineAction;
   this->buildAction = s.buildAction;
   this->plotSpectra = s.plotSpectra;
+  this->plotArchive = s.plotArchive;
   this->reduceSpectrum = s.reduceSpectrum;
  
   
@@ -119,6 +123,8 @@ SpectraSTCreateParams& SpectraSTCreateParams::operator=(SpectraSTCreateParams& s
   this->recordRawSpectra = s.recordRawSpectra;
   this->useBayesianDenoiser = s.useBayesianDenoiser;
   this->trainBayesianDenoiser = s.trainBayesianDenoiser;
+  this->updateLibrary = s.updateLibrary;
+  this->verifyUpdate = s.verifyUpdate;
 
   this->qualityLevelRemove = s.qualityLevelRemove;  
   this->qualityLevelMark = s.qualityLevelMark;
@@ -128,6 +134,8 @@ SpectraSTCreateParams& SpectraSTCreateParams::operator=(SpectraSTCreateParams& s
   
   this->decoyConcatenate = s.decoyConcatenate;
   this->decoySizeRatio = s.decoySizeRatio;
+  this->decoyRandomSeed = s.decoyRandomSeed;
+  this->numThreads = s.numThreads;
   
   this->allowableModTokens = s.allowableModTokens;
   
@@ -520,6 +528,16 @@ void SpectraSTCreateParams::finalizeAdvancedOption(string option) {
       valid = true;
     } 	
     
+  } else if (optionType == "CPK") {  
+      
+    if (optionValue.empty()) {
+      compressPeaks = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      compressPeaks = false;
+      valid = true;
+    } 	
+    
   } else if (optionType == "DTA") {
       
     if (optionValue.empty()) {
@@ -675,6 +693,16 @@ void SpectraSTCreateParams::finalizeAdvancedOption(string option) {
       valid = true;
     }
 
+  } else if (optionType == "PLA") {
+
+    if (optionValue.empty()) {
+      plotArchive = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      plotArchive = false;
+      valid = true;
+    }
+
   } else if (optionType == "CEN") {
 
     if (optionValue.empty()) {
@@ -695,6 +723,46 @@ void SpectraSTCreateParams::finalizeAdvancedOption(string option) {
       valid = true;
     } 	      
 
+  } else if (optionType == "HDC") {
+
+    if (optionValue.empty()) {
+      cacheScanHeaders = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      cacheScanHeaders = false;
+      valid = true;
+    }
+
+  } else if (optionType == "PTH") {
+
+    if (optionValue.empty()) {
+      importParseThread = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      importParseThread = false;
+      valid = true;
+    }
+
+  } else if (optionType == "SED") {
+
+    if (!optionValue.empty()) {
+      k = atoi(optionValue.c_str());
+      if (k >= 0) {
+        decoyRandomSeed = (unsigned int)k;
+        valid = true;
+      }
+    }
+
+  } else if (optionType == "THR") {
+
+    if (!optionValue.empty()) {
+      k = atoi(optionValue.c_str());
+      if (k >= 1) {
+        numThreads = (unsigned int)k;
+        valid = true;
+      }
+    }
+
   } else if (optionType == "WGT") {
 
     if (!optionValue.empty()) {
@@ -766,6 +834,21 @@ void SpectraSTCreateParams::finalizeAdvancedOption(string option) {
       }
     }
 
+  } else if (optionType == "INC") {
+
+    updateLibrary = optionValue;
+    valid = true;
+
+  } else if (optionType == "INV") {
+
+    if (optionValue.empty()) {
+      verifyUpdate = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      verifyUpdate = false;
+      valid = true;
+    }
+
   } else if (optionType == "RRS") {
 
     if (optionValue.empty()) {
@@ -961,6 +1044,7 @@ void SpectraSTCreateParams::setDefault() {
   outputFileName = "";
   annotatePeaks = false;
   binaryFormat = true;
+  compressPeaks = false;
   writeDtaFiles = false;
   writeMgfFile = false;
   writePAIdent = false;
@@ -986,6 +1070,8 @@ void SpectraSTCreateParams::setDefault() {
   centroidPeaks = false;
   setFragmentation = "";
   skipRawAnnotation = false;
+  cacheScanHeaders = false;
+  importParseThread = false;
   evaluatePhosphoSiteAssignment = false;
   keepRawIntensities = false;
   bracketSpectra = false;
@@ -996,6 +1082,7 @@ void SpectraSTCreateParams::setDefault() {
   combineAction = "UNION";
   buildAction = "";
   plotSpectra = "";
+  plotArchive = false;
   reduceSpectrum = 0;
   
   // CONSENSUS
@@ -1010,6 +1097,8 @@ void SpectraSTCreateParams::setDefault() {
   useBayesianDenoiser = false;
   trainBayesianDenoiser = false;
   denoiserMinimumSignalProb = 0.5;
+  updateLibrary = "";
+  verifyUpdate = false;
   
   // QUALITY FILTER
   qualityLevelRemove = 2;
@@ -1021,6 +1110,8 @@ void SpectraSTCreateParams::setDefault() {
   // DECOY 
   decoyConcatenate = false;
   decoySizeRatio = 1;
+  decoyRandomSeed = 0;
+  numThreads = 1;
  
   // REFRESH PROTEIN MAPPINGS
   refreshDatabase = "";
@@ -1084,6 +1175,9 @@ void SpectraSTCreateParams::readFromFile() {
     } else if (param == "binaryFormat") {
       binaryFormat = (value == "true");
       valid = true;
+    } else if (param == "compressPeaks") {
+      compressPeaks = (value == "true");
+      valid = true;
     } else if (param == "remark") {
       if (!value.empty()) {
         remark = value;
@@ -1220,6 +1314,12 @@ void SpectraSTCreateParams::readFromFile() {
     } else if (param == "skipRawAnnotation") {
       skipRawAnnotation = (value == "true");
       valid = true;
+    } else if (param == "cacheScanHeaders") {
+      cacheScanHeaders = (value == "true");
+      valid = true;
+    } else if (param == "importParseThread") {
+      importParseThread = (value == "true");
+      valid = true;
     } else if (param == "evaluatePhosphoSiteAssignment") {
       evaluatePhosphoSiteAssignment = (value == "true");
       valid = true;
@@ -1254,6 +1354,9 @@ void SpectraSTCreateParams::readFromFile() {
 	buildAction = value;
         valid = true;
       }      
+    } else if (param == "plotArchive") {
+      plotArchive = (value == "true");
+      valid = true;
     } else if (param == "plotSpectra") {
       plotSpectra = value;
       valid = true;
@@ -1316,6 +1419,12 @@ void SpectraSTCreateParams::readFromFile() {
 	  valid = true;
 	}
       }
+    } else if (param == "updateLibrary") {
+      updateLibrary = value;
+      valid = true;
+    } else if (param == "verifyUpdate") {
+      verifyUpdate = (value == "true");
+      valid = true;
     } else if (param == "recordRawSpectra") {
       recordRawSpectra = (value == "true");
       valid = true;
@@ -1380,6 +1489,22 @@ void SpectraSTCreateParams::readFromFile() {
 	  valid = true;
 	}
       }
+    } else if (param == "decoyRandomSeed") {
+      if (!value.empty()) {
+	k = atoi(value.c_str());
+	if (k >= 0) {
+	  decoyRandomSeed = (unsigned int)k;
+	  valid = true;
+	}
+      }
+    } else if (param == "numThreads" || param == "decoyNumThreads") {
+      if (!value.empty()) {
+	k = atoi(value.c_str());
+	if (k >= 1) {
+	  numThreads = (unsigned int)k;
+	  valid = true;
+	}
+      }
       
     // REFRESH PROTEIN MAPPINGS
     } else if (param == "refreshDatabase") {
@@ -1487,6 +1612,8 @@ void SpectraSTCreateParams::printUsage(ostream& out) {
   out << "         LIBRARY MANIPULATION OPTIONS (Applicable with .splib files)" << endl;
   out << "         -cf<pred>    Filter library. Keep only those entries satisfying the predicate <pred>. " << endl;
   out << "                           <pred> should be a C-style predicate in quotes. " << endl;
+  out << "                           Criteria can be combined with & and |, negated with ! and grouped with parentheses. " << endl;
+  out << "                           (e.g. -cf\"Charge == 2 & !(Mods =~ Oxidation)\")" << endl;
   out << "         -cJU         Union. Include all the peptide ions in all the files. " << endl;
   out << "         -cJI         Intersection. Only include peptide ions that are present in all the files. " << endl;
   out << "         -cJS         Subtraction. Only include peptide ions in the first file that are not present in any of the other files." << endl;
@@ -1557,6 +1684,8 @@ void SpectraSTCreateParams::printAdvancedOptions(ostream& out) {
   out << "         -c_ANN          Re-annotate peaks (Turn off with -c_ANN!). " << endl;
   out << "         -c_BIN          Write library in binary format (Enables quicker search). (Turn off with -c_BIN!) " << endl;
   out << "                           A human-readable text-format library file will also be created." << endl;
+  out << "         -c_CPK          Compress the peaks of the binary library: m/z to 0.0001 Th, intensities to within 0.05%. (Turn off with -c_CPK!)" << endl;
+  out << "                           Makes the library smaller and quicker to read. Compressed libraries are read like any other." << endl;
   out << "         -c_DTA          Write all library spectra as .dta files. (Turn off with -c_DTA!) " << endl;
   out << "         -c_Q3L          Specify the lower m/z limit for Q3 in MRM table generation." << endl;
   out << "         -c_Q3H          Specify the upper m/z limit for Q3 in MRM table generation. " << endl;
@@ -1573,10 +1702,16 @@ void SpectraSTCreateParams::printAdvancedOptions(ostream& out) {
   out << "         -c_CEN          Centroid peaks." << endl;
   out << "         -c_XAN          Skip the annotation of raw spectra. Saves importing time." << endl;
   out << "                           Use when raw library is only used to create consensus, and when the dataset is huge." << endl;
+  out << "         -c_HDC          Cache the scan headers of imported mzXML files in <file>.scancache. (Turn off with -c_HDC!)" << endl;
+  out << "                           Speeds up repeated imports of the same files. The cache is rebuilt if the file changes." << endl;
+  out << "         -c_PTH          Parse imported .msp files in a separate thread, while the entries are being written. (Turn off with -c_PTH!)" << endl;
+  out << "                           For .tsv files, read the spectra from the mzXML files in a separate thread, while the entries are being processed." << endl;
   // HIDDEN for now: out << "         -c_PHO          Evaluate the phosphosite assignments (if any) and include the PSiteConf score in the Comment." << endl;
   out << "         -c_PLT<crit>    Plot the library spectra as they are created. Turn off with (-c_PLT!)" << endl;
   out << "                           <crit> empty or <crit> = ALL: plot every spectrum." << endl;
   out << "                           Else: plot when either the Status or the Spec comment value = <crit>." << endl;
+  out << "                           The plots are written as .svg files in <output>_spplot/, using -c_THR threads." << endl;
+  out << "         -c_PLA          Pack the plots of -c_PLT into one archive, <output>_spplot.tar. (Turn off with -c_PLA!)" << endl;
   out << "         -c_BRK          Bracket import: for each confident ID, also search neighboring scan numbers for repeated scans to import. (Turn off with -c_BRK!)" << endl;
   out << "         -c_BRM          Merge bracketed spectra: merge repeated scans of a bracket into one consensus spectrum for import. (Turn off with -c_BRM!)" << endl;
   
@@ -1601,6 +1736,12 @@ void SpectraSTCreateParams::printAdvancedOptions(ostream& out) {
   out << "         -c_BDN          Use Bayesian denoiser. Default parameters are used unless trained on the fly with -c_TBD. (Turn off with -c_BDN!)" << endl;
   out << "         -c_TBD          Train Bayesian denoiser. Only active in consensus mode (-cAC)." << endl;
   out << "         -c_MSP<thres>   Minimum signal probability to retain a peak when denoiser is used." << endl;
+  out << "         -c_INC<file>    Incremental update: build the library as if from scratch, but copy the peptide ions whose replicates" << endl;
+  out << "                           are unchanged from the existing library <file> (.splib) instead of recomputing them." << endl;
+  out << "                           List the same input files as before (same names, same order), then the new ones." << endl;
+  out << "                           Needs the .repidx file written when <file> was built with -cAC or -cAB. Leave <file> empty to turn off." << endl;
+  out << "         -c_INV          Verify incremental update: also recompute the copied peptide ions, and use the recomputed" << endl;
+  out << "                           spectra (logging any differences). (Turn off with -c_INV!)" << endl;
   
   out << "QUALITY FILTER OPTIONS:" << endl;
   out << "         -c_QP1          Apply stricter thresholds to singleton spectra during quality filters. (Turn off with -c_QP1!)" << endl;
@@ -1609,6 +1750,12 @@ void SpectraSTCreateParams::printAdvancedOptions(ostream& out) {
   out << "         -c_QIE          Make spectra identified by multiple sequence search engines immune to quality filters. (Turn off with -c_QIE!)" << endl;
   out << endl;
   
+  out << "DECOY CREATION OPTIONS:" << endl;
+  out << "         -c_SED<num>     Seed the shuffling with <num>, such that the same decoy library is created every time." << endl;
+  out << "                           <num> = 0: seed from the clock (a different decoy library every time)." << endl;
+  out << "         -c_THR<num>     Use <num> threads to create the decoy spectra (and to look for homologs with -cJH, or to read several .mzXML files at once). The result does not depend on <num>." << endl;
+  out << endl;
+
   out << "REFRESH PEPTIDE-PROTEIN MAPPINGS OPTIONS:" << endl;
   out << "         -c_RTO          Only map peptide to protein when the peptide is tryptic in that particular protein. (Turn off with -c_RTO!)" << endl;
   out << endl;
@@ -1624,6 +1771,41 @@ void SpectraSTCreateParams::printAdvancedOptions(ostream& out) {
   
 }
 
+// printEntryContentParams - prints, one per line, all the options that can change the entries built from the same
+// replicates by a library build (but not those that only change how the library is written). MUST BE modified whenever
+// such an option is added, or an incremental update (see SpectraSTSpLibImporter::openUpdateLibrary) will copy stale entries.
+void SpectraSTCreateParams::printEntryContentParams(ostream& out) {
+
+  stringstream ss;
+  ss.precision(15);
+
+  ss << "buildAction = " << buildAction << '\n';
+  ss << "combineAction = " << combineAction << '\n';
+  ss << "minimumNumReplicates = " << minimumNumReplicates << '\n';
+  ss << "setFragmentation = " << setFragmentation << '\n';
+  ss << "peakQuorum = " << peakQuorum << '\n';
+  ss << "maximumNumReplicates = " << maximumNumReplicates << '\n';
+  ss << "replicateWeight = " << replicateWeight << '\n';
+  ss << "removeDissimilarReplicates = " << (removeDissimilarReplicates ? "true" : "false") << '\n';
+  ss << "maximumNumPeaksKept = " << maximumNumPeaksKept << '\n';
+  ss << "maximumNumPeaksUsed = " << maximumNumPeaksUsed << '\n';
+  ss << "recordRawSpectra = " << (recordRawSpectra ? "true" : "false") << '\n';
+  ss << "keepRawIntensities = " << (keepRawIntensities ? "true" : "false") << '\n';
+  ss << "useBayesianDenoiser = " << (useBayesianDenoiser ? "true" : "false") << '\n';
+  ss << "trainBayesianDenoiser = " << (trainBayesianDenoiser ? "true" : "false") << '\n';
+  ss << "denoiserMinimumSignalProb = " << denoiserMinimumSignalProb << '\n';
+  ss << "filterCriteria = " << filterCriteria << '\n';
+  ss << "useProbTable = " << useProbTable << '\n';
+  ss << "useProteinList = " << useProteinList << '\n';
+  ss << "annotatePeaks = " << (annotatePeaks ? "true" : "false") << '\n';
+  ss << "reduceSpectrum = " << reduceSpectrum << '\n';
+  ss << "minimumMRMQ3MZ = " << minimumMRMQ3MZ << '\n';
+  ss << "maximumMRMQ3MZ = " << maximumMRMQ3MZ << '\n';
+  ss << "refreshDatabase = " << refreshDatabase << '\n';
+
+  out << ss.str();
+}
+
 string SpectraSTCreateParams::constructDescrStr(string fileList, string fileType) {
 
   stringstream ss;
@@ -1670,6 +1852,9 @@ string SpectraSTCreateParams::constructDescrStr(string fileList, string fileType
       ss << " [" << buildAction;  
       ss << ";c=" << (decoyConcatenate ? "TRUE" : "FALSE");
       ss << ";y=" << decoySizeRatio;
+      if (decoyRandomSeed > 0) {
+        ss << ";_SED=" << decoyRandomSeed;
+      }
       ss << ";I=" << setFragmentation;
       ss << "]";
 
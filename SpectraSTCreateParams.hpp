@@ -65,6 +65,7 @@ public:
   string paramsFileName; // -cF
   string outputFileName; // -cN
   bool binaryFormat; // -cb  -c_BIN
+  bool compressPeaks; // -c_CPK
   bool annotatePeaks; // -ca  -c_ANN 
   bool writeDtaFiles; // -cD  -c_DTA
   bool writeMgfFile; // -c_MGF
@@ -92,6 +93,8 @@ public:
   bool centroidPeaks; // -c_CEN
   string setFragmentation; // -cI
   bool skipRawAnnotation; // -c_XAN
+  bool cacheScanHeaders; // -c_HDC
+  bool importParseThread; // -c_PTH
   bool evaluatePhosphoSiteAssignment; // -c_PHO
   bool keepRawIntensities; // -c_RWI
   bool bracketSpectra; // -c_BRK
@@ -101,6 +104,7 @@ public:
   string combineAction; // -cJ
   string buildAction; // -cA
   string plotSpectra; // -cz
+  bool plotArchive; // -c_PLA
   int reduceSpectrum; // -cQ
   
   // CONSENSUS
@@ -115,6 +119,8 @@ public:
   bool useBayesianDenoiser; // -c_BDN (this will be done for consensus, best-replicate, and similarity clustering)
   bool trainBayesianDenoiser; // -c_TBD (does nothing unless it's building consensus) 
   double denoiserMinimumSignalProb; // -c_MSP
+  string updateLibrary; // -c_INC
+  bool verifyUpdate; // -c_INV
  
   // QUALITY FILTER
   int qualityLevelRemove; // -cL
@@ -126,6 +132,8 @@ public:
   // DECOY CREATION
   bool decoyConcatenate; // -cc  
   int decoySizeRatio; // -cy
+  unsigned int decoyRandomSeed; // -c_SED
+  unsigned int numThreads; // -c_THR, for decoy creation and SUBTRACT_HOMOLOGS
 
   // REFRESH PROTEIN MAPPINGS
   string refreshDatabase; // -cD
@@ -150,6 +158,7 @@ public:
   
   void readFromFile();
   string constructDescrStr(string fileList, string fileType);
+  void printEntryContentParams(ostream& out);
   
   static void printUsage(ostream& out);
   static void printAdvancedOptions(ostream& out);
@@ -1,5 +1,6 @@
 #include "SpectraSTDtaSearchTask.hpp"
 #include "SpectraSTConstants.hpp"
+#include "SpectraSTStageStats.hpp"
 #include "SpectraSTQuery.hpp"
 #include "SpectraSTPeakList.hpp"
 #include "SpectraSTSearch.hpp"
@@ -122,6 +123,9 @@ void SpectraSTDtaSearchTask::searchOneFile(unsigned int fileIndex) {
 
   SpectraSTQuery* query = new SpectraSTQuery(name, precursorMz, charge, "", peakList);
   
+  SpectraSTStageStats& stageStats = SpectraSTStageStats::local();
+  double decodeStartTime = SpectraSTStageStats::now();
+  
   while (nextLine(fin, line, "", "")) {
     pos = 0;
     double mz = atof((nextToken(line, 0, pos)).c_str());
@@ -130,7 +134,12 @@ void SpectraSTDtaSearchTask::searchOneFile(unsigned int fileIndex) {
     
   }	
   
+  double filterStartTime = SpectraSTStageStats::now();
+  stageStats.addTime(STAGE_PEAK_DECODE, filterStartTime - decodeStartTime);
+  
   if (!peakList->passFilter(m_params)) {
+    stageStats.addTime(STAGE_FILTER, SpectraSTStageStats::now() - filterStartTime);
+    
     // Bad spectra, ignore
     delete query;
     m_outputs[fileIndex]->printAbortedQuery(name, "BAD_SPECTRUM_NOT_SEARCHED");
@@ -138,6 +147,7 @@ void SpectraSTDtaSearchTask::searchOneFile(unsigned int fileIndex) {
   } else {
     
     double retained = peakList->simplify(m_params.filterMaxPeaksUsed, m_params.filterMaxDynamicRange);
+    stageStats.addTime(STAGE_FILTER, SpectraSTStageStats::now() - filterStartTime);
     
     // create the search based on what is read, then search
     SpectraSTSearch* s = new SpectraSTSearch(query, m_params, m_outputs[fileIndex]);
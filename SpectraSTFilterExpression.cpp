@@ -0,0 +1,466 @@
+#include "SpectraSTFilterExpression.hpp"
+#include "SpectraSTPeptideLibIndex.hpp"
+#include "FileUtils.hpp"
+
+#include <stdlib.h>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTFilterExpression
+ *
+ * A library filter (-cf) compiled into an expression tree. See SpectraSTFilterExpression.hpp.
+ *
+ * The criteria string is of the form <expr>, where
+ *   <expr> := <term> [| <term>]...
+ *   <term> := <factor> [& <factor>]...
+ *   <factor> := !<factor> | (<expr>) | <attr> <op> <value>
+ * <attr> is any of the fields of the entry or any of the fields in the comments. 
+ * <op> can be != (not equal), == (equal), <= (less than or equal), >= (greater than or equal)
+ * > (greater than), < (smaller than), =~ (contains as a substring) and !~ (does not contain)
+ * <value> can be numerical or string. It will figure out what it should be (hopefully).
+ *
+ */
+
+// constructor - compiles the criteria string
+SpectraSTFilterExpression::SpectraSTFilterExpression(string criteria) :
+  m_criteria(criteria),
+  m_nodes(),
+  m_root(0),
+  m_wellFormed(true) {
+
+  string::size_type pos = 0;
+  m_root = parseOr(pos);
+  
+  skipSpaces(pos);
+  if (pos < m_criteria.length()) {
+    // something (an unmatched ')') left over, ignored
+    m_wellFormed = false;
+  }
+}
+
+// destructor
+SpectraSTFilterExpression::~SpectraSTFilterExpression() {
+
+  for (vector<FilterNode>::iterator n = m_nodes.begin(); n != m_nodes.end(); n++) {
+    if (n->predicate) {
+      delete (n->predicate);
+    }
+  }
+}
+
+// isSatisfiedBy - checks if the entry satisfies the criteria
+bool SpectraSTFilterExpression::isSatisfiedBy(SpectraSTLibEntry* entry) {
+
+  return (canBeTrue(evaluate(m_root, entry, NULL)));
+}
+
+// mayBeSatisfiedByPeptideIon - checks if any entry of the peptide ion, as keyed in the peptide index, can satisfy the
+// criteria. Charge is known from the subkey; so are the mods, unless the key is that of a non-peptide (starting with '_').
+bool SpectraSTFilterExpression::mayBeSatisfiedByPeptideIon(string peptide, string subkey) {
+
+  SpectraSTFilterKnownFields known;
+  string frag("");
+  SpectraSTPeptideLibIndex::parseSubkey(subkey, known.charge, known.mods, frag);
+  known.knowsCharge = true;
+  known.knowsMods = (!peptide.empty() && peptide[0] != '_');
+  known.knowsPrecursorMzRange = false;
+  known.lowPrecursorMz = 0.0;
+  known.highPrecursorMz = 0.0;
+  
+  return (canBeTrue(evaluate(m_root, NULL, &known)));
+}
+
+// mayBeSatisfiedByPrecursorMzRange - checks if any entry with precursor m/z in [lowMz, highMz) can satisfy the criteria
+bool SpectraSTFilterExpression::mayBeSatisfiedByPrecursorMzRange(double lowMz, double highMz) {
+
+  SpectraSTFilterKnownFields known;
+  known.knowsCharge = false;
+  known.charge = 0;
+  known.knowsMods = false;
+  known.mods = "";
+  known.knowsPrecursorMzRange = true;
+  known.lowPrecursorMz = lowMz;
+  known.highPrecursorMz = highMz;
+  
+  return (canBeTrue(evaluate(m_root, NULL, &known)));
+}
+
+// parseOr - parses <term> [| <term>]...
+unsigned int SpectraSTFilterExpression::parseOr(string::size_type& pos) {
+
+  unsigned int first = parseAnd(pos);
+  
+  skipSpaces(pos);
+  if (pos >= m_criteria.length() || m_criteria[pos] != '|') {
+    return (first);
+  }
+  
+  unsigned int node = addNode(NODE_OR);
+  m_nodes[node].children.push_back(first);
+  
+  while (pos < m_criteria.length() && m_criteria[pos] == '|') {
+    pos++;
+    unsigned int child = parseAnd(pos); // m_nodes can be reallocated in here, so no reference to m_nodes[node] is held
+    m_nodes[node].children.push_back(child);
+    skipSpaces(pos);
+  }
+  
+  return (node);
+}
+
+// parseAnd - parses <factor> [& <factor>]...
+unsigned int SpectraSTFilterExpression::parseAnd(string::size_type& pos) {
+
+  unsigned int first = parseUnary(pos);
+  
+  skipSpaces(pos);
+  if (pos >= m_criteria.length() || m_criteria[pos] != '&') {
+    return (first);
+  }
+  
+  unsigned int node = addNode(NODE_AND);
+  m_nodes[node].children.push_back(first);
+  
+  while (pos < m_criteria.length() && m_criteria[pos] == '&') {
+    pos++;
+    unsigned int child = parseUnary(pos);
+    m_nodes[node].children.push_back(child);
+    skipSpaces(pos);
+  }
+  
+  return (node);
+}
+
+// parseUnary - parses !<factor>, (<expr>) or a predicate. A '!' followed by '=' or '~' is an operator, not a NOT.
+unsigned int SpectraSTFilterExpression::parseUnary(string::size_type& pos) {
+
+  skipSpaces(pos);
+  
+  if (pos < m_criteria.length() && m_criteria[pos] == '!' && 
+      (pos + 1 >= m_criteria.length() || (m_criteria[pos + 1] != '=' && m_criteria[pos + 1] != '~'))) {
+    pos++;
+    unsigned int child = parseUnary(pos);
+    unsigned int node = addNode(NODE_NOT);
+    m_nodes[node].children.push_back(child);
+    return (node);
+  }
+  
+  if (pos < m_criteria.length() && m_criteria[pos] == '(') {
+    pos++;
+    unsigned int node = parseOr(pos);
+    skipSpaces(pos);
+    if (pos < m_criteria.length() && m_criteria[pos] == ')') {
+      pos++;
+    } else {
+      m_wellFormed = false;
+    }
+    return (node);
+  }
+  
+  return (parsePredicate(pos));
+}
+
+// parsePredicate - parses <attr> <op> <value>. The predicate runs until the next &, | or unmatched ')'. 
+// One that cannot be parsed is kept as an invalid predicate, which is neutral, i.e. ignored.
+unsigned int SpectraSTFilterExpression::parsePredicate(string::size_type& pos) {
+
+  string::size_type start = pos;
+  int depth = 0;
+  while (pos < m_criteria.length()) {
+    char c = m_criteria[pos];
+    if (c == '&' || c == '|') break;
+    if (c == '(') {
+      depth++;
+    } else if (c == ')') {
+      if (depth == 0) break;
+      depth--;
+    }
+    pos++;
+  }
+  
+  string criterion = m_criteria.substr(start, pos - start);
+  
+  unsigned int node = addNode(NODE_PREDICATE);
+  
+  string attr("");
+  string value("");
+  string opStr("");
+  string::size_type opPos = 0;
+  if ((opPos = criterion.find("!=", 0)) != string::npos) {
+    attr = crop(criterion.substr(0, opPos));
+    value = crop(criterion.substr(opPos + 2));
+    opStr = "!=";
+  } else if ((opPos = criterion.find(">=", 0)) != string::npos) {
+    attr = crop(criterion.substr(0, opPos));
+    value = crop(criterion.substr(opPos + 2));
+    opStr = ">=";
+  } else if ((opPos = criterion.find("<=", 0)) != string::npos) {
+    attr = crop(criterion.substr(0, opPos));
+    value = crop(criterion.substr(opPos + 2));
+    opStr = "<=";
+  } else if ((opPos = criterion.find("==", 0)) != string::npos) {
+    attr = crop(criterion.substr(0, opPos));
+    value = crop(criterion.substr(opPos + 2));
+    opStr = "==";
+  } else if ((opPos = criterion.find(">", 0)) != string::npos) {
+    attr = crop(criterion.substr(0, opPos));
+    value = crop(criterion.substr(opPos + 1));
+    opStr = ">";
+  } else if ((opPos = criterion.find("<", 0)) != string::npos) {
+    attr = crop(criterion.substr(0, opPos));
+    value = crop(criterion.substr(opPos + 1));
+    opStr = "<";
+  } else if ((opPos = criterion.find("=~", 0)) != string::npos) {
+    attr = crop(criterion.substr(0, opPos));
+    value = crop(criterion.substr(opPos + 2));
+    opStr = "=~";
+  } else if ((opPos = criterion.find("!~", 0)) != string::npos) {
+    attr = crop(criterion.substr(0, opPos));
+    value = crop(criterion.substr(opPos + 2));
+    opStr = "!~";
+  }
+
+  if (opStr.empty() || attr.empty() || value.empty()) {
+    return (node);
+  }
+  
+  FilterNode& pred = m_nodes[node];
+  
+  // Some common ones; for these we know what the type (int, double or string) the value should be
+  if (attr == "Name") {
+    pred.field = FIELD_NAME;
+    pred.predicate = new Predicate(attr, opStr, value);
+  } else if (attr == "MW") {
+    pred.field = FIELD_MW;
+    pred.predicate = new Predicate(attr, opStr, atof(value.c_str()));
+  } else if (attr == "PrecursorMZ") {
+    pred.field = FIELD_PRECURSOR_MZ;
+    pred.predicate = new Predicate(attr, opStr, atof(value.c_str()));
+  } else if (attr == "LibID") {
+    pred.field = FIELD_LIB_ID;
+    pred.predicate = new Predicate(attr, opStr, atoi(value.c_str()));
+  } else if (attr == "Charge") {
+    pred.field = FIELD_CHARGE;
+    pred.predicate = new Predicate(attr, opStr, atoi(value.c_str()));
+  } else if (attr == "Mods") {
+    pred.field = FIELD_MODS;
+    pred.predicate = new Predicate(attr, opStr, value);
+  } else if (attr == "Status") {
+    pred.field = FIELD_STATUS;
+    pred.predicate = new Predicate(attr, opStr, value);
+  } else if (attr == "FullName") {
+    pred.field = FIELD_FULL_NAME;
+    pred.predicate = new Predicate(attr, opStr, value);
+  } else if (attr == "NumPeaks") {
+    pred.field = FIELD_NUM_PEAKS;
+    pred.predicate = new Predicate(attr, opStr, atoi(value.c_str()));
+  } else {
+    // Not the common ones, the type is unknown. Will guess based on the type of the value supplied
+    pred.field = FIELD_COMMENT;
+    if (value.find_first_not_of("0123456789.") == string::npos) { // assume it's a double
+      pred.predicate = new Predicate(attr, opStr, atof(value.c_str()));
+    } else { // assume it's a string
+      pred.predicate = new Predicate(attr, opStr, value);
+    }
+  }
+  
+  return (node);
+}
+
+// addNode - adds a node of the given type, returning its index
+unsigned int SpectraSTFilterExpression::addNode(FilterNodeType type) {
+
+  FilterNode node;
+  node.type = type;
+  node.field = FIELD_INVALID;
+  node.predicate = NULL;
+  m_nodes.push_back(node);
+  return ((unsigned int)(m_nodes.size() - 1));
+}
+
+// skipSpaces - advances pos past any white space
+void SpectraSTFilterExpression::skipSpaces(string::size_type& pos) {
+
+  while (pos < m_criteria.length() && (m_criteria[pos] == ' ' || m_criteria[pos] == '\t')) {
+    pos++;
+  }
+}
+
+// evaluate - evaluates the node, returning the set of values (FILTER_* bits) it can have. If entry is NULL, only the
+// fields in known are known, and the others can have any value.
+int SpectraSTFilterExpression::evaluate(unsigned int node, SpectraSTLibEntry* entry, SpectraSTFilterKnownFields* known) {
+
+  FilterNode& n = m_nodes[node];
+  
+  if (n.type == NODE_PREDICATE) {
+    return (evaluatePredicate(n, entry, known));
+  }
+  
+  if (n.type == NODE_NOT) {
+    return (negate(evaluate(n.children[0], entry, known)));
+  }
+  
+  int values = evaluate(n.children[0], entry, known);
+  for (unsigned int c = 1; c < (unsigned int)(n.children.size()); c++) {
+    if (n.type == NODE_AND) {
+      if (values == FILTER_FALSE) break;
+      values = combineAnd(values, evaluate(n.children[c], entry, known));
+    } else {
+      if (values == FILTER_TRUE) break;
+      values = combineOr(values, evaluate(n.children[c], entry, known));
+    }
+  }
+  return (values);
+}
+
+// evaluatePredicate - evaluates a predicate. A comment field the entry does not have, and a predicate that could not
+// be parsed, are neutral.
+int SpectraSTFilterExpression::evaluatePredicate(FilterNode& node, SpectraSTLibEntry* entry, SpectraSTFilterKnownFields* known) {
+
+  Predicate* filter = node.predicate;
+  
+  if (node.field == FIELD_INVALID || !filter) {
+    return (FILTER_NEUTRAL);
+  }
+  
+  if (!entry) {
+    // only what is in known is known
+    if (node.field == FIELD_CHARGE && known && known->knowsCharge) {
+      return (filter->compRef(known->charge) ? FILTER_TRUE : FILTER_FALSE);
+    } else if (node.field == FIELD_MODS && known && known->knowsMods) {
+      return (filter->compRef(known->mods) ? FILTER_TRUE : FILTER_FALSE);
+    } else if (node.field == FIELD_PRECURSOR_MZ && known && known->knowsPrecursorMzRange) {
+      bool mayBeTrue = true;
+      bool mayBeFalse = true;
+      filter->compRefRange(known->lowPrecursorMz, known->highPrecursorMz, mayBeTrue, mayBeFalse);
+      return ((mayBeTrue ? FILTER_TRUE : 0) | (mayBeFalse ? FILTER_FALSE : 0));
+    } else if (node.field == FIELD_COMMENT) {
+      return (FILTER_TRUE | FILTER_FALSE | FILTER_NEUTRAL);
+    } else {
+      return (FILTER_TRUE | FILTER_FALSE);
+    }
+  }
+  
+  bool result = true;
+  string commentValue("");
+  
+  switch (node.field) {
+  case FIELD_NAME : result = filter->compRef(entry->getName()); break;
+  case FIELD_MW : result = filter->compRef(entry->getMw()); break;
+  case FIELD_PRECURSOR_MZ : result = filter->compRef(entry->getPrecursorMz()); break;
+  case FIELD_LIB_ID : result = filter->compRef((int)(entry->getLibId())); break;
+  case FIELD_CHARGE : result = filter->compRef((int)(entry->getCharge())); break;
+  case FIELD_MODS : result = filter->compRef(entry->getMods()); break;
+  case FIELD_STATUS : result = filter->compRef(entry->getStatus()); break;
+  case FIELD_FULL_NAME : result = filter->compRef(entry->getFullName()); break;
+  case FIELD_NUM_PEAKS : result = filter->compRef((int)(entry->getPeakList()->getNumPeaks())); break;
+  default :
+    if (!(entry->getOneComment(filter->getRefName(), commentValue))) {
+      // can't find it in comments, don't do anything - wait for the other predicates to evaluate
+      return (FILTER_NEUTRAL);
+    }
+    string::size_type pos = 0;
+    if (filter->getType() == 'D') {
+      result = filter->compRef(atof(nextToken(commentValue, pos, pos, "/^\t\r\n").c_str()));
+    } else if (filter->getType() == 'I') {
+      result = filter->compRef(atoi(nextToken(commentValue, pos, pos, "/^\t\r\n").c_str()));
+    } else {
+      result = filter->compRef(commentValue);
+    }
+    break;
+  }
+  
+  return (result ? FILTER_TRUE : FILTER_FALSE);
+}
+
+// canBeTrue - checks if the expression, evaluated to the set of values given, can pass. If it is neutral (all the 
+// predicates were ignored), it passes, unless the expression is an OR at the top.
+bool SpectraSTFilterExpression::canBeTrue(int values) {
+
+  if (values & FILTER_TRUE) {
+    return (true);
+  }
+  if (values & FILTER_NEUTRAL) {
+    return (m_nodes[m_root].type != NODE_OR);
+  }
+  return (false);
+}
+
+// combineAnd - the set of values A & B can have, for A in values1 and B in values2. Neutral is the identity.
+int SpectraSTFilterExpression::combineAnd(int values1, int values2) {
+
+  int combined = 0;
+  for (int v1 = FILTER_TRUE; v1 <= FILTER_NEUTRAL; v1 <<= 1) {
+    if (!(values1 & v1)) continue;
+    for (int v2 = FILTER_TRUE; v2 <= FILTER_NEUTRAL; v2 <<= 1) {
+      if (!(values2 & v2)) continue;
+      if (v1 == FILTER_FALSE || v2 == FILTER_FALSE) {
+        combined |= FILTER_FALSE;
+      } else if (v1 == FILTER_NEUTRAL) {
+        combined |= v2;
+      } else if (v2 == FILTER_NEUTRAL) {
+        combined |= v1;
+      } else {
+        combined |= FILTER_TRUE;
+      }
+    }
+  }
+  return (combined);
+}
+
+// combineOr - the set of values A | B can have, for A in values1 and B in values2. Neutral is the identity.
+int SpectraSTFilterExpression::combineOr(int values1, int values2) {
+
+  int combined = 0;
+  for (int v1 = FILTER_TRUE; v1 <= FILTER_NEUTRAL; v1 <<= 1) {
+    if (!(values1 & v1)) continue;
+    for (int v2 = FILTER_TRUE; v2 <= FILTER_NEUTRAL; v2 <<= 1) {
+      if (!(values2 & v2)) continue;
+      if (v1 == FILTER_TRUE || v2 == FILTER_TRUE) {
+        combined |= FILTER_TRUE;
+      } else if (v1 == FILTER_NEUTRAL) {
+        combined |= v2;
+      } else if (v2 == FILTER_NEUTRAL) {
+        combined |= v1;
+      } else {
+        combined |= FILTER_FALSE;
+      }
+    }
+  }
+  return (combined);
+}
+
+// negate - the set of values !A can have, for A in values. Neutral stays neutral.
+int SpectraSTFilterExpression::negate(int values) {
+
+  return (((values & FILTER_TRUE) ? FILTER_FALSE : 0) | ((values & FILTER_FALSE) ? FILTER_TRUE : 0) | (values & FILTER_NEUTRAL));
+}
@@ -0,0 +1,141 @@
+#ifndef SPECTRASTFILTEREXPRESSION_HPP_
+#define SPECTRASTFILTEREXPRESSION_HPP_
+
+#include "SpectraSTLibEntry.hpp"
+#include "Predicate.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTFilterExpression
+ *
+ * A library filter (-cf) compiled once into a tree of AND, OR and NOT nodes over typed predicates. The 
+ * attribute of each predicate is resolved to the field it reads (or to a comment field) at compile time,
+ * so that checking an entry does no string comparison of attribute names.
+ *
+ * Some fields (charge, mods, precursor m/z) are also known from the library indices before the entry is 
+ * read. The mayBeSatisfiedBy* methods check whether an entry with what the index knows could pass at all,
+ * so that entries that cannot are never read from the .splib.
+ *
+ * As before, a predicate on a comment field that the entry does not have is ignored, i.e. it is neutral
+ * to the AND or OR it is in. If the whole expression is neutral, the entry passes, unless the expression 
+ * is an OR at the top.
+ *
+ */
+
+using namespace std;
+
+// the values a node can evaluate to, as bits. When the fields read are only partly known, a node evaluates
+// to the set of all values it can have.
+#define FILTER_TRUE 1
+#define FILTER_FALSE 2
+#define FILTER_NEUTRAL 4
+
+// what is known about an entry before it is read; the knows* flags tell which of the fields are known
+typedef struct {
+  bool knowsCharge;
+  int charge;
+  bool knowsMods;
+  string mods;
+  bool knowsPrecursorMzRange;
+  double lowPrecursorMz;
+  double highPrecursorMz;
+} SpectraSTFilterKnownFields;
+
+class SpectraSTFilterExpression {
+
+public:
+  SpectraSTFilterExpression(string criteria);
+  ~SpectraSTFilterExpression();
+
+  bool isWellFormed() { return (m_wellFormed); }
+
+  bool isSatisfiedBy(SpectraSTLibEntry* entry);
+  bool mayBeSatisfiedByPeptideIon(string peptide, string subkey);
+  bool mayBeSatisfiedByPrecursorMzRange(double lowMz, double highMz);
+
+private:
+
+  // the fields a predicate can read
+  enum FilterField {
+    FIELD_INVALID,
+    FIELD_NAME,
+    FIELD_MW,
+    FIELD_PRECURSOR_MZ,
+    FIELD_LIB_ID,
+    FIELD_CHARGE,
+    FIELD_MODS,
+    FIELD_STATUS,
+    FIELD_FULL_NAME,
+    FIELD_NUM_PEAKS,
+    FIELD_COMMENT
+  };
+
+  enum FilterNodeType {
+    NODE_AND,
+    NODE_OR,
+    NODE_NOT,
+    NODE_PREDICATE
+  };
+
+  typedef struct {
+    FilterNodeType type;
+    vector<unsigned int> children;
+    FilterField field;
+    Predicate* predicate;
+  } FilterNode;
+
+  string m_criteria;
+  vector<FilterNode> m_nodes;
+  unsigned int m_root;
+  bool m_wellFormed;
+
+  unsigned int parseOr(string::size_type& pos);
+  unsigned int parseAnd(string::size_type& pos);
+  unsigned int parseUnary(string::size_type& pos);
+  unsigned int parsePredicate(string::size_type& pos);
+  unsigned int addNode(FilterNodeType type);
+  void skipSpaces(string::size_type& pos);
+
+  int evaluate(unsigned int node, SpectraSTLibEntry* entry, SpectraSTFilterKnownFields* known);
+  int evaluatePredicate(FilterNode& node, SpectraSTLibEntry* entry, SpectraSTFilterKnownFields* known);
+  bool canBeTrue(int values);
+
+  static int combineAnd(int values1, int values2);
+  static int combineOr(int values1, int values2);
+  static int negate(int values);
+
+};
+
+#endif /*SPECTRASTFILTEREXPRESSION_HPP_*/
@@ -0,0 +1,242 @@
+#include "SpectraSTFragmentIndex.hpp"
+
+#include <algorithm>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTFragmentIndex
+ *
+ * Inverted index from binned fragment m/z to library entries, for open searching. See SpectraSTFragmentIndex.hpp.
+ *
+ */
+
+// constructor
+SpectraSTFragmentIndex::SpectraSTFragmentIndex(int numBinsPerMzUnit) :
+  m_numBinsPerMzUnit(numBinsPerMzUnit > 0 ? numBinsPerMzUnit : 1),
+  m_entryMz(),
+  m_entryCharge(),
+  m_entryLibFileIndex(),
+  m_entryLibId(),
+  m_binOffsets(),
+  m_postings(),
+  m_libIdToEntry(),
+  m_fragments(),
+  m_counts(),
+  m_touched() {
+
+}
+
+// destructor
+SpectraSTFragmentIndex::~SpectraSTFragmentIndex() {
+
+}
+
+// insertEntry - adds an entry. All entries must be inserted before any of their fragments.
+void SpectraSTFragmentIndex::insertEntry(unsigned int libFileIndex, int libId, double precursorMz, int charge) {
+
+  if (libId < 0) return;
+
+  if (libFileIndex >= (unsigned int)(m_libIdToEntry.size())) {
+    m_libIdToEntry.resize(libFileIndex + 1);
+  }
+  vector<unsigned int>& libIdToEntry = m_libIdToEntry[libFileIndex];
+  if ((unsigned int)libId >= (unsigned int)(libIdToEntry.size())) {
+    libIdToEntry.resize(libId + 1, (unsigned int)(-1));
+  }
+  libIdToEntry[libId] = (unsigned int)(m_entryMz.size());
+
+  m_entryMz.push_back(precursorMz);
+  m_entryCharge.push_back(charge);
+  m_entryLibFileIndex.push_back(libFileIndex);
+  m_entryLibId.push_back(libId);
+}
+
+// insertFragment - adds a fragment peak of an entry already inserted. Peaks of unknown entries are ignored.
+void SpectraSTFragmentIndex::insertFragment(unsigned int libFileIndex, int libId, double mz) {
+
+  if (libFileIndex >= (unsigned int)(m_libIdToEntry.size()) || libId < 0 ||
+      (unsigned int)libId >= (unsigned int)(m_libIdToEntry[libFileIndex].size()) || mz < 0.0) {
+    return;
+  }
+  unsigned int entry = m_libIdToEntry[libFileIndex][libId];
+  if (entry == (unsigned int)(-1)) return;
+
+  unsigned int bin = (unsigned int)(mz * (double)m_numBinsPerMzUnit);
+  m_fragments.push_back(pair<unsigned int, unsigned int>(bin, entry));
+}
+
+// finalize - renumbers the entries in order of precursor m/z, and lays out the fragments bin by bin
+void SpectraSTFragmentIndex::finalize() {
+
+  unsigned int numEntries = (unsigned int)(m_entryMz.size());
+
+  // sort by precursor m/z; ties stay in the order inserted
+  vector<pair<double, unsigned int> > order(numEntries);
+  for (unsigned int e = 0; e < numEntries; e++) {
+    order[e] = pair<double, unsigned int>(m_entryMz[e], e);
+  }
+  sort(order.begin(), order.end());
+
+  vector<unsigned int> newEntry(numEntries);
+  vector<double> entryMz(numEntries);
+  vector<int> entryCharge(numEntries);
+  vector<unsigned int> entryLibFileIndex(numEntries);
+  vector<int> entryLibId(numEntries);
+  for (unsigned int e = 0; e < numEntries; e++) {
+    unsigned int old = order[e].second;
+    newEntry[old] = e;
+    entryMz[e] = m_entryMz[old];
+    entryCharge[e] = m_entryCharge[old];
+    entryLibFileIndex[e] = m_entryLibFileIndex[old];
+    entryLibId[e] = m_entryLibId[old];
+  }
+  m_entryMz.swap(entryMz);
+  m_entryCharge.swap(entryCharge);
+  m_entryLibFileIndex.swap(entryLibFileIndex);
+  m_entryLibId.swap(entryLibId);
+
+  // counting sort of the fragments by bin
+  unsigned int numBins = 0;
+  for (vector<pair<unsigned int, unsigned int> >::iterator f = m_fragments.begin(); f != m_fragments.end(); f++) {
+    if (f->first + 1 > numBins) numBins = f->first + 1;
+  }
+
+  m_binOffsets.assign(numBins + 1, 0);
+  for (vector<pair<unsigned int, unsigned int> >::iterator f = m_fragments.begin(); f != m_fragments.end(); f++) {
+    m_binOffsets[f->first + 1]++;
+  }
+  for (unsigned int b = 0; b < numBins; b++) {
+    m_binOffsets[b + 1] += m_binOffsets[b];
+  }
+
+  m_postings.resize(m_fragments.size());
+  vector<unsigned int> next(m_binOffsets.begin(), m_binOffsets.end() - 1);
+  for (vector<pair<unsigned int, unsigned int> >::iterator f = m_fragments.begin(); f != m_fragments.end(); f++) {
+    m_postings[next[f->first]++] = newEntry[f->second];
+  }
+
+  // the building tables are no longer needed
+  vector<pair<unsigned int, unsigned int> >().swap(m_fragments);
+  vector<vector<unsigned int> >().swap(m_libIdToEntry);
+
+  // sort each bin, and count an entry with several peaks in one bin only once
+  unsigned int numKept = 0;
+  for (unsigned int b = 0; b < numBins; b++) {
+    unsigned int begin = m_binOffsets[b];
+    unsigned int end = m_binOffsets[b + 1];
+    sort(m_postings.begin() + begin, m_postings.begin() + end);
+
+    // compacting in place: since numKept <= i, m_postings[i - 1] still holds its sorted value when compared
+    m_binOffsets[b] = numKept;
+    for (unsigned int i = begin; i < end; i++) {
+      if (i == begin || m_postings[i] != m_postings[i - 1]) {
+        m_postings[numKept++] = m_postings[i];
+      }
+    }
+  }
+  m_binOffsets[numBins] = numKept;
+  m_postings.resize(numKept);
+  vector<unsigned int>(m_postings).swap(m_postings);
+
+  m_counts.assign(numEntries, 0);
+  m_touched.clear();
+}
+
+// retrieve - finds the (at most) topK entries with precursor m/z between lowMz and highMz, and of a possible charge,
+// that share at least minSharedPeaks fragment bins with the query. possibleCharges[c] tells if charge c is possible;
+// if empty, all charges are. The hits are ordered by decreasing number of shared bins.
+void SpectraSTFragmentIndex::retrieve(vector<SpectraSTFragmentIndexHit>& hits, SpectraSTPeakList* query, double lowMz, double highMz,
+                                      vector<bool>& possibleCharges, unsigned int topK, unsigned int minSharedPeaks) {
+
+  unsigned int low = (unsigned int)(lower_bound(m_entryMz.begin(), m_entryMz.end(), lowMz) - m_entryMz.begin());
+  unsigned int high = (unsigned int)(upper_bound(m_entryMz.begin(), m_entryMz.end(), highMz) - m_entryMz.begin());
+  if (low >= high || m_binOffsets.empty()) {
+    return;
+  }
+
+  // the distinct bins of the query
+  vector<unsigned int> queryBins;
+  queryBins.reserve(query->getNumPeaks());
+  Peak p;
+  for (unsigned int i = 0; i < query->getNumPeaks(); i++) {
+    query->getPeak(i, p);
+    if (p.mz < 0.0) continue;
+    queryBins.push_back((unsigned int)(p.mz * (double)m_numBinsPerMzUnit));
+  }
+  sort(queryBins.begin(), queryBins.end());
+  queryBins.erase(unique(queryBins.begin(), queryBins.end()), queryBins.end());
+
+  unsigned int numBins = (unsigned int)(m_binOffsets.size()) - 1;
+
+  for (vector<unsigned int>::iterator b = queryBins.begin(); b != queryBins.end() && *b < numBins; b++) {
+    vector<unsigned int>::iterator end = m_postings.begin() + m_binOffsets[*b + 1];
+    for (vector<unsigned int>::iterator e = lower_bound(m_postings.begin() + m_binOffsets[*b], end, low); e != end && *e < high; e++) {
+      if (m_counts[*e]++ == 0) {
+        m_touched.push_back(*e);
+      }
+    }
+  }
+
+  // pick the best, resetting the counters on the way
+  vector<pair<unsigned int, unsigned int> > selected; // (number of shared bins, entry)
+  for (vector<unsigned int>::iterator e = m_touched.begin(); e != m_touched.end(); e++) {
+    int charge = m_entryCharge[*e];
+    if ((unsigned int)(m_counts[*e]) >= minSharedPeaks &&
+        (possibleCharges.empty() || (charge >= 0 && charge < (int)(possibleCharges.size()) && possibleCharges[charge]))) {
+      selected.push_back(pair<unsigned int, unsigned int>(m_counts[*e], *e));
+    }
+    m_counts[*e] = 0;
+  }
+  m_touched.clear();
+
+  if (topK > 0 && (unsigned int)(selected.size()) > topK) {
+    partial_sort(selected.begin(), selected.begin() + topK, selected.end(), SpectraSTFragmentIndex::sortTouchedByCountDesc);
+    selected.resize(topK);
+  } else {
+    sort(selected.begin(), selected.end(), SpectraSTFragmentIndex::sortTouchedByCountDesc);
+  }
+
+  for (vector<pair<unsigned int, unsigned int> >::iterator s = selected.begin(); s != selected.end(); s++) {
+    SpectraSTFragmentIndexHit hit;
+    hit.libFileIndex = m_entryLibFileIndex[s->second];
+    hit.libId = m_entryLibId[s->second];
+    hit.numSharedPeaks = s->first;
+    hits.push_back(hit);
+  }
+}
+
+// sortTouchedByCountDesc - comparison function used by sort() to order (count, entry) pairs by decreasing count,
+// then by increasing entry number (precursor m/z), such that the result does not depend on the order of the query peaks
+bool SpectraSTFragmentIndex::sortTouchedByCountDesc(const pair<unsigned int, unsigned int>& a, const pair<unsigned int, unsigned int>& b) {
+
+  return (a.first > b.first || (a.first == b.first && a.second < b.second));
+}
@@ -0,0 +1,105 @@
+#ifndef SPECTRASTFRAGMENTINDEX_HPP_
+#define SPECTRASTFRAGMENTINDEX_HPP_
+
+#include "SpectraSTPeakList.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTFragmentIndex
+ *
+ * Inverted index from binned fragment m/z to the library entries having a peak in that bin, used to
+ * generate candidates for open (wide precursor tolerance) searching (-s_OPN). The entries are numbered
+ * in order of precursor m/z, so that the entries within the precursor tolerance of a query are a
+ * contiguous range of numbers, and each bin's list of entry numbers is sorted. A query is scored by
+ * counting, in a flat counter array, the number of bins it shares with each entry in that range; only
+ * the entries sharing the most bins are retrieved and scored by the dot product.
+ *
+ * The entries must all be inserted before their fragments; finalize() must be called before retrieve().
+ *
+ */
+
+using namespace std;
+
+// one retrieved entry: which library and LibId it is, and how many fragment bins it shares with the query
+typedef struct {
+  unsigned int libFileIndex;
+  int libId;
+  unsigned int numSharedPeaks;
+} SpectraSTFragmentIndexHit;
+
+class SpectraSTFragmentIndex {
+
+public:
+  SpectraSTFragmentIndex(int numBinsPerMzUnit);
+  ~SpectraSTFragmentIndex();
+
+  void insertEntry(unsigned int libFileIndex, int libId, double precursorMz, int charge);
+  void insertFragment(unsigned int libFileIndex, int libId, double mz);
+  void finalize();
+
+  void retrieve(vector<SpectraSTFragmentIndexHit>& hits, SpectraSTPeakList* query, double lowMz, double highMz,
+                vector<bool>& possibleCharges, unsigned int topK, unsigned int minSharedPeaks);
+
+  unsigned int getNumEntries() { return ((unsigned int)(m_entryMz.size())); }
+  unsigned long long getNumFragments() { return ((unsigned long long)(m_postings.size())); }
+
+private:
+
+  int m_numBinsPerMzUnit;
+
+  // the entries, in order of precursor m/z after finalize()
+  vector<double> m_entryMz;
+  vector<int> m_entryCharge;
+  vector<unsigned int> m_entryLibFileIndex;
+  vector<int> m_entryLibId;
+
+  // m_binOffsets, m_postings - the entry numbers having a peak in bin b are
+  // m_postings[m_binOffsets[b]] ... m_postings[m_binOffsets[b + 1] - 1], in increasing order
+  vector<unsigned int> m_binOffsets;
+  vector<unsigned int> m_postings;
+
+  // only used while building: the entry number of each LibId of each library, and the (bin, entry number) pairs
+  vector<vector<unsigned int> > m_libIdToEntry;
+  vector<pair<unsigned int, unsigned int> > m_fragments;
+
+  // the number of bins each entry shares with the current query, and the entries for which it is non-zero
+  vector<unsigned short> m_counts;
+  vector<unsigned int> m_touched;
+
+  static bool sortTouchedByCountDesc(const pair<unsigned int, unsigned int>& a, const pair<unsigned int, unsigned int>& b);
+
+};
+
+#endif /*SPECTRASTFRAGMENTINDEX_HPP_*/
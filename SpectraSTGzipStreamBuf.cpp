@@ -0,0 +1,91 @@
+#include "SpectraSTGzipStreamBuf.hpp"
+#include <stdio.h>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTGzipStreamBuf
+ *
+ * A stream buffer that gzips everything written to it into a file, on the fly.
+ * See SpectraSTGzipStreamBuf.hpp.
+ *
+ */
+
+// constructor - opens fileName for gzipped output. Check isOpen() afterwards.
+SpectraSTGzipStreamBuf::SpectraSTGzipStreamBuf(string fileName, unsigned int bufferSize) :
+  m_gzFile(NULL),
+  m_buffer(bufferSize > 0 ? bufferSize : 1) {
+
+  m_gzFile = gzopen(fileName.c_str(), "wb");
+  setp(&(m_buffer[0]), &(m_buffer[0]) + m_buffer.size());
+}
+
+// destructor - compresses whatever is left in the buffer and closes the file
+SpectraSTGzipStreamBuf::~SpectraSTGzipStreamBuf() {
+
+  if (m_gzFile) {
+    flushBuffer();
+    gzclose(m_gzFile);
+  }
+}
+
+// overflow - called when the buffer is full. Compresses the buffer, then puts c in the emptied buffer.
+int SpectraSTGzipStreamBuf::overflow(int c) {
+
+  if (!flushBuffer()) {
+    return (EOF);
+  }
+  if (c != EOF) {
+    *pptr() = (char)c;
+    pbump(1);
+  }
+  return (c == EOF ? 0 : c);
+}
+
+// sync - called on flush. Compresses the buffer (but does not force a gzip flush, which would hurt compression).
+int SpectraSTGzipStreamBuf::sync() {
+  return (flushBuffer() ? 0 : -1);
+}
+
+// flushBuffer - hands the buffered bytes to zlib and empties the buffer
+bool SpectraSTGzipStreamBuf::flushBuffer() {
+
+  if (!m_gzFile) {
+    return (false);
+  }
+
+  int len = (int)(pptr() - pbase());
+  if (len > 0 && gzwrite(m_gzFile, pbase(), (unsigned int)len) != len) {
+    return (false);
+  }
+  setp(&(m_buffer[0]), &(m_buffer[0]) + m_buffer.size());
+  return (true);
+}
@@ -0,0 +1,71 @@
+#ifndef SPECTRASTGZIPSTREAMBUF_HPP_
+#define SPECTRASTGZIPSTREAMBUF_HPP_
+
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTGzipStreamBuf
+ *
+ * A stream buffer that gzips everything written to it into a file, on the fly. Put an ostream on top of it
+ * to write a .gz file with the usual << formatting. Output is collected in a large buffer and compressed
+ * a buffer at a time.
+ *
+ */
+
+using namespace std;
+
+class SpectraSTGzipStreamBuf : public streambuf {
+
+public:
+  SpectraSTGzipStreamBuf(string fileName, unsigned int bufferSize = 1048576);
+  virtual ~SpectraSTGzipStreamBuf();
+
+  bool isOpen() { return (m_gzFile != NULL); }
+
+protected:
+  virtual int overflow(int c);
+  virtual int sync();
+
+private:
+
+  gzFile m_gzFile;
+  vector<char> m_buffer;
+
+  bool flushBuffer();
+
+};
+
+#endif /*SPECTRASTGZIPSTREAMBUF_HPP_*/
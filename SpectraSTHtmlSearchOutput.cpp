@@ -57,9 +57,10 @@ SpectraSTHtmlSearchOutput::SpectraSTHtmlSearchOutput(string outputFileName, stri
   makeFullPath(searchFile);
   m_searchFile = searchFile;  
   
-  string libFile(m_searchParams.libraryFile);
-  makeFullPath(libFile);
-  m_libFile = libFile;
+  m_searchParams.getLibraryFiles(m_libFiles);
+  for (vector<string>::iterator l = m_libFiles.begin(); l != m_libFiles.end(); l++) {
+    makeFullPath(*l);
+  }
   
   
 }
@@ -72,30 +73,30 @@ void SpectraSTHtmlSearchOutput::printHeader() {
   if (!m_fout) openFile(); 
   
  // (*m_fout) << "Content-type: text/html\n\n";
-  (*m_fout) << "<HTML>" << endl;
-  (*m_fout) << "  <HEAD>" << endl;
-  (*m_fout) << "    <TITLE>" << "SpectraST Search Results: " << m_searchFile << " against " << m_searchParams.libraryFile << "</TITLE>" << endl;
-  (*m_fout) << "  </HEAD>" << endl;
-  (*m_fout) << endl;
-  (*m_fout) << "<BODY BGCOLOR=\"#EEEEEE\" OnLoad=\"self.focus();\">" << endl;
+  (*m_fout) << "<HTML>" << '\n';
+  (*m_fout) << "  <HEAD>" << '\n';
+  (*m_fout) << "    <TITLE>" << "SpectraST Search Results: " << m_searchFile << " against " << m_searchParams.libraryFile << "</TITLE>" << '\n';
+  (*m_fout) << "  </HEAD>" << '\n';
+  (*m_fout) << '\n';
+  (*m_fout) << "<BODY BGCOLOR=\"#EEEEEE\" OnLoad=\"self.focus();\">" << '\n';
 
   // TODO: Put in some more info
 
-  (*m_fout) << "<TABLE BORDER=0 CELLPADDING=\"2\">" << endl;
+  (*m_fout) << "<TABLE BORDER=0 CELLPADDING=\"2\">" << '\n';
   (*m_fout) << "<TBODY>";
   (*m_fout) << "<TR BGCOLOR=\"" << HEADERCELLCOLOR << "\" ALIGN=\"CENTER\">";
 
-  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Query" << "</TT></TH>" << endl;
-  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "PrecMZ" << "</TT></TH>" << endl;
-  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Rank" << "</TT></TH>" << endl;
-  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "ID" << "</TT></TH>" << endl;
+  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Query" << "</TT></TH>" << '\n';
+  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "PrecMZ" << "</TT></TH>" << '\n';
+  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Rank" << "</TT></TH>" << '\n';
+  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "ID" << "</TT></TH>" << '\n';
   
   SpectraSTSimScores::printHeaderHtml(*m_fout);
   
-  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Status" << "</TT></TH>" << endl;
-  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Protein(s)" << "</TT></TH>" << endl;
+  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Status" << "</TT></TH>" << '\n';
+  (*m_fout) << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Protein(s)" << "</TT></TH>" << '\n';
   
-  (*m_fout) << "</TR>" << endl;
+  (*m_fout) << "</TR>" << '\n';
   
 }
 
@@ -108,11 +109,11 @@ void SpectraSTHtmlSearchOutput::printStartQuery(string query, double precursorMz
   dotpos = query.rfind('.', dotpos - 1);
   string startScan = nextToken(query, dotpos + 1, dotpos, ".");
       
-  (*m_fout) << "<TR BGCOLOR=\"" << NORMALCELLCOLOR << "\" ALIGN=\"LEFT\">" << endl;
+  (*m_fout) << "<TR BGCOLOR=\"" << NORMALCELLCOLOR << "\" ALIGN=\"LEFT\">" << '\n';
 
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << query << "</TT></TD>" << endl;
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << query << "</TT></TD>" << '\n';
   (*m_fout).precision(4);
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << precursorMz << "</TT></TD>" << endl;
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << precursorMz << "</TT></TD>" << '\n';
   
   m_query = query;
   m_queryScanNum = startScan;
@@ -121,9 +122,9 @@ void SpectraSTHtmlSearchOutput::printStartQuery(string query, double precursorMz
 }
 
 void SpectraSTHtmlSearchOutput::printFooter() {
- (*m_fout) << "</TABLE>" << endl;
- (*m_fout) <<"</BODY>" << endl;
- (*m_fout) << "</HTML>" << endl;
+ (*m_fout) << "</TABLE>" << '\n';
+ (*m_fout) <<"</BODY>" << '\n';
+ (*m_fout) << "</HTML>" << '\n';
 }
 
 // printHit - prints the hit
@@ -131,21 +132,21 @@ void SpectraSTHtmlSearchOutput::printHit(string query, unsigned int hitRank, Spe
 
   if (hitRank != 1) {
     // lower hits, print two empty cells to take the place of the query name and precursor m/z
-    (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT></TT></TD>" << endl;
-    (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT></TT></TD>" << endl;
+    (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT></TT></TD>" << '\n';
+    (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT></TT></TD>" << '\n';
   }
   
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << hitRank << "</TT></TD>" << endl;
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << hitRank << "</TT></TD>" << '\n';
   
   if (!entry) {
-    (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << "NO_MATCH" << "</TT></TD>" << endl;
-    (*m_fout) << "</TR>" << endl;
+    (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << "NO_MATCH" << "</TT></TD>" << '\n';
+    (*m_fout) << "</TR>" << '\n';
     return; 
   }	
     
   (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>";
   (*m_fout) << "<A HREF=\"" <<   getCGIPath() << "plotspectrast.cgi";
-  (*m_fout) << "?LibFile=" << m_libFile;
+  (*m_fout) << "?LibFile=" << m_libFiles[entry->getLibFileIndex()];
   (*m_fout) << "&LibFileOffset=" << entry->getLibFileOffset();
   
   if (m_searchFile.substr(m_searchFile.length() - 6) == ".sptxt") {
@@ -154,32 +155,32 @@ void SpectraSTHtmlSearchOutput::printHit(string query, unsigned int hitRank, Spe
     (*m_fout) << "&QueryFile=" << m_searchFile;
   }
   (*m_fout) << "&QueryScanNum=" << m_queryScanNum << "\">";
-  (*m_fout) << entry->getFullName() << "</A></TT></TD>" << endl;
+  (*m_fout) << entry->getFullName() << "</A></TT></TD>" << '\n';
 
   simScores.printHtml((*m_fout));
     
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << entry->getStatus() << "</TT></TD>" << endl;
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << entry->getStatus() << "</TT></TD>" << '\n';
   
   string protein("");
   bool dummy =  entry->getOneComment("Protein", protein);
     
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << protein << "</TT></TD>" << endl;
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << protein << "</TT></TD>" << '\n';
      
-  (*m_fout) << "</TR>" << endl;
+  (*m_fout) << "</TR>" << '\n';
   
 }	
 
 // printAbortedQuery - displays a message for a query that is not searched (used for dta input, for example)
 void SpectraSTHtmlSearchOutput::printAbortedQuery(string query, string message) {
 	
-  (*m_fout) << "<TR BGCOLOR=\"" << NORMALCELLCOLOR << "\" ALIGN=\"LEFT\">" << endl;
+  (*m_fout) << "<TR BGCOLOR=\"" << NORMALCELLCOLOR << "\" ALIGN=\"LEFT\">" << '\n';
 
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << query << "</TT></TD>" << endl;
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << "0.0000" << "</TT></TD>" << endl;
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << "1" << "</TT></TD>" << endl;  
-  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << "NOT_SEARCHED" << "</TT></TD>" << endl;
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << query << "</TT></TD>" << '\n';
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << "0.0000" << "</TT></TD>" << '\n';
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << "1" << "</TT></TD>" << '\n';  
+  (*m_fout) << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << "NOT_SEARCHED" << "</TT></TD>" << '\n';
   
-  (*m_fout) << "</TR>" << endl;
+  (*m_fout) << "</TR>" << '\n';
   
 }
 
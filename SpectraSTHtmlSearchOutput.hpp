@@ -60,7 +60,7 @@ public:
   static string m_plotspectrastCGI;
 
 private:
-  string m_libFile;
+  vector<string> m_libFiles; // full paths of the searched libraries, in the order given to -sL
   string m_searchFile;
   string m_queryScanNum;   
   
@@ -1,15 +1,21 @@
 #include "SpectraSTLib.hpp"
 #include "SpectraSTLibImporter.hpp"
+#include "SpectraSTSearchOutput.hpp"
 #include "SpectraSTLog.hpp"
 #include "SpectraSTConstants.hpp"
+#include "SpectraSTStageStats.hpp"
 
 #include "Peptide.hpp"
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <set>
 
 #include <assert.h>
+#ifndef _MSC_VER
+#include <sys/time.h>
+#endif
 
 /*
 
@@ -58,6 +64,26 @@ extern bool g_verbose;
 extern bool g_quiet;
 extern SpectraSTLog* g_log;
 
+// wallClockTime - returns the current time in seconds, for timing the approximate search
+static double wallClockTime() {
+#ifndef _MSC_VER
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((double)(tv.tv_sec) + (double)(tv.tv_usec) / 1000000.0);
+#else
+  return ((double)(time(NULL)));
+#endif
+}
+
+// sortSketchHitsDesc - comparison function used by sort() to order the sketch index hits of several libraries by
+// decreasing similarity, then by library and LibId
+static bool sortSketchHitsDesc(const pair<unsigned int, SpectraSTSketchIndexHit>& a, const pair<unsigned int, SpectraSTSketchIndexHit>& b) {
+
+  if (a.second.similarity != b.second.similarity) return (a.second.similarity > b.second.similarity);
+  if (a.first != b.first) return (a.first < b.first);
+  return (a.second.libId < b.second.libId);
+}
+
 // Constructor for creation
 SpectraSTLib::SpectraSTLib(vector<string>& impFileNames, SpectraSTCreateParams* createParams) :
   m_libFin(),
@@ -71,6 +97,8 @@ SpectraSTLib::SpectraSTLib(vector<string>& impFileNames, SpectraSTCreateParams*
   m_newLibId(0),
   m_mzIndex(NULL),
   m_pepIndex(NULL),
+  m_fragmentIndex(NULL),
+  m_sketchIndices(),
   m_searchParams(NULL),
   m_createParams(createParams),
   m_count(0),
@@ -93,14 +121,34 @@ SpectraSTLib::SpectraSTLib(string fullFileName, SpectraSTSearchParams* searchPar
   m_newLibId(0),
   m_mzIndex(NULL),
   m_pepIndex(NULL),
+  m_fragmentIndex(NULL),
+  m_sketchIndices(),
   m_searchParams(searchParams),
   m_createParams(NULL),
   m_count(0),
   m_noSptxt(false),
   m_mrmFout(NULL),
-  m_mgfFout(NULL) {
+  m_mgfFout(NULL),
+  m_annNumQueries(0),
+  m_annNumExactHits(0),
+  m_annNumRecalledHits(0),
+  m_annApproxTime(0.0),
+  m_annExactTime(0.0) {
+
+  string::size_type pos = 0;
+  while (pos < m_libFileName.length()) {
+    string libFileName = nextToken(m_libFileName, pos, pos, ",", ",");
+    if (!libFileName.empty()) {
+      m_libFileNames.push_back(libFileName);
+    }
+  }
+
+  if (m_searchParams->trimLibraryComments) {
+    SpectraSTSearchOutput::getLibraryCommentsUsed(*m_searchParams, m_searchCommentsUsed);
+  }
 
   //    initializeLibSearchMode(loadPeptideIndex);
+  SpectraSTStageTimer timer(STAGE_FILE_OPEN);
   initializeDatabase();
   resetCache();
 }
@@ -117,6 +165,12 @@ SpectraSTLib::~SpectraSTLib() {
   if (m_pepIndex) {
       delete m_pepIndex;
     }
+  if (m_fragmentIndex) {
+      delete m_fragmentIndex;
+    }
+  for (vector<SpectraSTSketchIndex*>::iterator si = m_sketchIndices.begin(); si != m_sketchIndices.end(); si++) {
+      delete (*si);
+    }
   if (m_mrmFout) {
       delete m_mrmFout;
     }
@@ -381,7 +435,7 @@ void SpectraSTLib::insertEntry(SpectraSTLibEntry* entry) {
       bfoss << binaryFileOffset;
 
       // write the library in binary format to .splib
-      entry->writeToBinaryFile(m_libFout);
+      entry->writeToBinaryFile(m_libFout, m_createParams->compressPeaks);
 
       if (!m_noSptxt) {
           // note the binary file offset as a comment -- just as a convenience for people examining the .sptxt file to view
@@ -417,6 +471,160 @@ void SpectraSTLib::retrieve(vector<SpectraSTLibEntry*>& entries, double lowMz, d
   //    m_mzIndex->retrieve(entries, lowMz, highMz, true);
 }
 
+// canRetrieveTogether - whether the entries retrieved by any number of calls to retrieve() with m/z ranges within
+// lowMz to highMz all stay valid until the last of these calls. This is the case if the range spans no more blocks
+// than are cached, since the blocks of the range are then always more recently used than any other cached block.
+bool SpectraSTLib::canRetrieveTogether(double lowMz, double highMz) {
+  
+  int idx_low = (int) (lowMz - MIN_MZ) / BLOCK_SIZE;
+  int idx_high = (int) (highMz - MIN_MZ) / BLOCK_SIZE;
+  
+  return (idx_high - idx_low + 1 <= CACHE_SIZE);
+}
+
+// retrieveByFragments - for open searching, retrieves only the library entries within the m/z range that share the most
+// fragment peaks with the query (see SpectraSTFragmentIndex). The entries stay valid until the next call.
+void SpectraSTLib::retrieveByFragments(vector<SpectraSTLibEntry*>& entries, SpectraSTPeakList* query, double lowMz, double highMz, vector<bool>& possibleCharges) {
+
+  // check to make sure we are in the Search mode, and open searching
+  if (!m_searchParams || !m_fragmentIndex) {
+      return;
+    }
+
+  vector<SpectraSTFragmentIndexHit> hits;
+  m_fragmentIndex->retrieve(hits, query, lowMz, highMz, possibleCharges, m_searchParams->openSearchTopK, m_searchParams->openSearchMinSharedPeaks);
+
+  trimEntryCache();
+
+  for (vector<SpectraSTFragmentIndexHit>::iterator h = hits.begin(); h != hits.end(); h++) {
+      SpectraSTLibEntry* entry = retrieveEntryById(h->libFileIndex, h->libId);
+      if (entry) entries.push_back(entry);
+    }
+}
+
+// retrieveBySketch - for approximate searching, retrieves the library entries anywhere in the libraries (regardless of
+// precursor m/z) whose sketches are the most similar to that of the query (see SpectraSTSketchIndex). The entries stay
+// valid until the next call.
+void SpectraSTLib::retrieveBySketch(vector<SpectraSTLibEntry*>& entries, SpectraSTPeakList* query, vector<bool>& possibleCharges) {
+
+  // check to make sure we are in the Search mode, and approximate searching
+  if (!m_searchParams || m_sketchIndices.empty()) {
+      return;
+    }
+
+  double startTime = wallClockTime();
+  vector<pair<unsigned int, SpectraSTSketchIndexHit> > hits;
+  retrieveSketchHits(hits, query, possibleCharges, false);
+  m_annApproxTime += wallClockTime() - startTime;
+
+  if (m_searchParams->annSearchCheckRecall) {
+      // the same search over all sketches; the approximate search is only as good as the fraction of these it finds
+      startTime = wallClockTime();
+      vector<pair<unsigned int, SpectraSTSketchIndexHit> > exactHits;
+      retrieveSketchHits(exactHits, query, possibleCharges, true);
+      m_annExactTime += wallClockTime() - startTime;
+
+      set<pair<unsigned int, int> > found;
+      for (vector<pair<unsigned int, SpectraSTSketchIndexHit> >::iterator h = hits.begin(); h != hits.end(); h++) {
+          found.insert(pair<unsigned int, int>(h->first, h->second.libId));
+        }
+      for (vector<pair<unsigned int, SpectraSTSketchIndexHit> >::iterator h = exactHits.begin(); h != exactHits.end(); h++) {
+          if (found.find(pair<unsigned int, int>(h->first, h->second.libId)) != found.end()) m_annNumRecalledHits++;
+        }
+      m_annNumExactHits += exactHits.size();
+    }
+  m_annNumQueries++;
+
+  trimEntryCache();
+
+  for (vector<pair<unsigned int, SpectraSTSketchIndexHit> >::iterator h = hits.begin(); h != hits.end(); h++) {
+      SpectraSTLibEntry* entry = retrieveEntryById(h->first, h->second.libId);
+      if (entry) entries.push_back(entry);
+    }
+}
+
+// retrieveByIds - retrieves the library entries identified by (library index, LibId), such as the candidates of a query
+// kept in a result cache (see SpectraSTResultCache). hits[k] is the entry of ids[k], or NULL if there is no such entry.
+// The entries stay valid until the next call.
+void SpectraSTLib::retrieveByIds(vector<SpectraSTLibEntry*>& hits, vector<pair<unsigned int, int> >& ids) {
+
+  // check to make sure we are in the Search mode
+  if (!m_searchParams) {
+      return;
+    }
+
+  trimEntryCache();
+
+  for (vector<pair<unsigned int, int> >::iterator i = ids.begin(); i != ids.end(); i++) {
+      if (i->first < (unsigned int)(entry_stmts.size())) {
+          hits.push_back(retrieveEntryById(i->first, i->second));
+        } else {
+          hits.push_back(NULL);
+        }
+    }
+}
+
+// retrieveSketchHits - finds the (at most) annSearchTopK entries of all libraries whose sketches are the most similar to that of
+// the query, as (library index, hit) pairs ordered by decreasing similarity. If exhaustive, all clusters are looked in.
+void SpectraSTLib::retrieveSketchHits(vector<pair<unsigned int, SpectraSTSketchIndexHit> >& hits, SpectraSTPeakList* query,
+                                      vector<bool>& possibleCharges, bool exhaustive) {
+
+  unsigned int topK = m_searchParams->annSearchTopK;
+
+  for (unsigned int k = 0; k < (unsigned int)(m_sketchIndices.size()); k++) {
+      vector<SpectraSTSketchIndexHit> libHits;
+      unsigned int numProbes = exhaustive ? m_sketchIndices[k]->getNumClusters() : m_searchParams->annSearchNumProbes;
+      m_sketchIndices[k]->retrieve(libHits, query, possibleCharges, topK, numProbes);
+      for (vector<SpectraSTSketchIndexHit>::iterator h = libHits.begin(); h != libHits.end(); h++) {
+          hits.push_back(pair<unsigned int, SpectraSTSketchIndexHit>(k, *h));
+        }
+    }
+
+  sort(hits.begin(), hits.end(), sortSketchHitsDesc);
+  if ((unsigned int)(hits.size()) > topK) {
+      hits.resize(topK);
+    }
+}
+
+// trimEntryCache - the entries retrieved by LibId for the previous queries are no longer in use; start over if there are too many
+void SpectraSTLib::trimEntryCache() {
+
+  if (m_entryCache.size() > ENTRY_CACHE_SIZE) {
+      for (map<pair<unsigned int, int>, SpectraSTLibEntry*>::iterator iter = m_entryCache.begin(); iter != m_entryCache.end(); ++iter)
+        delete iter->second;
+      m_entryCache.clear();
+    }
+}
+
+// retrieveEntryById - retrieves one entry of a library by LibId, from the entry cache if retrieved before. NULL if there is none.
+SpectraSTLibEntry* SpectraSTLib::retrieveEntryById(unsigned int libFileIndex, int libId) {
+
+  pair<unsigned int, int> key(libFileIndex, libId);
+  map<pair<unsigned int, int>, SpectraSTLibEntry*>::iterator found = m_entryCache.find(key);
+
+  if (found != m_entryCache.end())
+    {
+      ++hit;
+      SpectraSTStageStats::count(COUNTER_CACHE_HITS);
+      return (found->second);
+    }
+
+  ++miss;
+  SpectraSTStageStats::count(COUNTER_CACHE_MISSES);
+  SpectraSTLibEntry* entry = NULL;
+  sqlite3_stmt* entry_stmt = entry_stmts[libFileIndex];
+  sqlite3_bind_int(entry_stmt, bind_entryLibID_idx, libId);
+  if (sqlite3_step(entry_stmt) == SQLITE_ROW)
+    {
+      entry = readEntrySQL(entry_stmt);
+    }
+  sqlite3_reset(entry_stmt);
+  sqlite3_clear_bindings(entry_stmt);
+
+  m_entryCache[key] = entry;
+  return (entry);
+}
+
 // writePreamble - writes some information about the library to the library file (.sptxt if binary library format is used, .splib otherwise)
 void SpectraSTLib::writePreamble(vector<string>& lines) {
 
@@ -611,16 +819,20 @@ void SpectraSTLib::initializeDatabase() {
 
   sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READONLY, NULL); // in-memory mode
 
-  string db_stmt = "ATTACH DATABASE '";
-  db_stmt = db_stmt + m_libFileName + "' AS db";
+  // all libraries are attached to the same connection, the first one as db, the others as db1, db2, ...
+  string db_stmt("");
+  for (unsigned int k = 0; k < (unsigned int)(m_libFileNames.size()); k++) {
 
-  rc = sqlite3_exec(db, db_stmt.c_str(), NULL, NULL, NULL);
+    db_stmt = "ATTACH DATABASE '" + m_libFileNames[k] + "' AS " + getLibDatabaseName(k);
 
-  if(rc != SQLITE_OK) {
-      sqlite3_close(db);
-      cerr << "Cannot open the given library." << endl;
-      exit(1);
-    }
+    rc = sqlite3_exec(db, db_stmt.c_str(), NULL, NULL, NULL);
+
+    if(rc != SQLITE_OK) {
+        sqlite3_close(db);
+        cerr << "Cannot open the given library \"" << m_libFileNames[k] << "\"." << endl;
+        exit(1);
+      }
+  }
 
   db_stmt = "PRAGMA cache_size = 128000"; /* change the default cache size (# of pages) of SQLite. 128000 PAGES = 128 MB */
   sqlite3_exec(db, db_stmt.c_str(), NULL, NULL, NULL);
@@ -640,13 +852,33 @@ void SpectraSTLib::initializeDatabase() {
 
 
   peptide_stmt = NULL;
-  peaklist_stmt = NULL;
-
-  sqlite3_prepare_v2(db, "SELECT LibId, PeptideName, Charge, PrecursorMz, Comment, NumPeak "
-                     "FROM db.Peptide WHERE PrecursorMz BETWEEN (:lowMz) AND (:highMz);",
-                     -1, &peptide_stmt, NULL);
-  sqlite3_prepare_v2(db, "SELECT Mz, Intensity, Annotation FROM db.Peaklist_50 "
-                          "WHERE LibID = (:LibID)", -1, &peaklist_stmt, NULL);
+  peaklist_stmts.assign(m_libFileNames.size(), (sqlite3_stmt*)NULL);
+
+  // one merged retrieval over all libraries; the first column tells which library the entry is from. The
+  // entries of each library come out in the same order as if that library were searched alone.
+  stringstream peptideSql;
+  for (unsigned int k = 0; k < (unsigned int)(m_libFileNames.size()); k++) {
+    if (k > 0) peptideSql << " UNION ALL ";
+    peptideSql << "SELECT " << k << ", LibId, PeptideName, Charge, PrecursorMz, Comment, NumPeak ";
+    peptideSql << "FROM " << getLibDatabaseName(k) << ".Peptide WHERE PrecursorMz BETWEEN (:lowMz) AND (:highMz)";
+  }
+  peptideSql << ";";
+
+  sqlite3_prepare_v2(db, peptideSql.str().c_str(), -1, &peptide_stmt, NULL);
+
+  for (unsigned int k = 0; k < (unsigned int)(m_libFileNames.size()); k++) {
+    string peaklistSql("SELECT Mz, Intensity, Annotation FROM " + getLibDatabaseName(k) + ".Peaklist_50 WHERE LibID = (:LibID)");
+    sqlite3_prepare_v2(db, peaklistSql.c_str(), -1, &(peaklist_stmts[k]), NULL);
+  }
+
+  // same columns as peptide_stmt, but for one entry given by LibId (for open searching)
+  entry_stmts.assign(m_libFileNames.size(), (sqlite3_stmt*)NULL);
+  for (unsigned int k = 0; k < (unsigned int)(m_libFileNames.size()); k++) {
+    stringstream entrySql;
+    entrySql << "SELECT " << k << ", LibId, PeptideName, Charge, PrecursorMz, Comment, NumPeak ";
+    entrySql << "FROM " << getLibDatabaseName(k) << ".Peptide WHERE LibId = (:LibID);";
+    sqlite3_prepare_v2(db, entrySql.str().c_str(), -1, &(entry_stmts[k]), NULL);
+  }
 
   //    CREATE TABLE Peptide (LibId int, PeptideName text, Charge int, PrecursorMz real, Comment text, NumPeak int);
   //    CREATE TABLE Peaklist (LibID int, Mz real, Intensity real, Annotation text, IntensityRank int);
@@ -654,10 +886,111 @@ void SpectraSTLib::initializeDatabase() {
 
   bind_lowMz_idx = sqlite3_bind_parameter_index(peptide_stmt, ":lowMz");
   bind_highMz_idx = sqlite3_bind_parameter_index(peptide_stmt, ":highMz");
-  bind_LibID_idx = sqlite3_bind_parameter_index(peaklist_stmt, ":LibID");
+  bind_LibID_idx = sqlite3_bind_parameter_index(peaklist_stmts[0], ":LibID"); // same for all libraries
+  bind_entryLibID_idx = sqlite3_bind_parameter_index(entry_stmts[0], ":LibID");
 
   hit = 0;
   miss = 0;
+
+  if (m_searchParams->openSearchTopK > 0) {
+    buildFragmentIndex();
+  }
+  if (m_searchParams->annSearchTopK > 0) {
+    loadSketchIndices();
+  }
+}
+
+// buildFragmentIndex - reads the precursors and the peaks of all entries of all libraries into the fragment index
+void SpectraSTLib::buildFragmentIndex() {
+
+  m_fragmentIndex = new SpectraSTFragmentIndex(m_searchParams->peakBinningNumBinsPerMzUnit);
+
+  sqlite3_stmt* stmt = NULL;
+
+  for (unsigned int k = 0; k < (unsigned int)(m_libFileNames.size()); k++) {
+    string sql("SELECT LibId, PrecursorMz, Charge FROM " + getLibDatabaseName(k) + ".Peptide;");
+    sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        m_fragmentIndex->insertEntry(k, sqlite3_column_int(stmt, 0), sqlite3_column_double(stmt, 1), sqlite3_column_int(stmt, 2));
+      }
+    sqlite3_finalize(stmt);
+  }
+
+  for (unsigned int k = 0; k < (unsigned int)(m_libFileNames.size()); k++) {
+    string sql("SELECT LibID, Mz FROM " + getLibDatabaseName(k) + ".Peaklist_50;");
+    sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        m_fragmentIndex->insertFragment(k, sqlite3_column_int(stmt, 0), sqlite3_column_double(stmt, 1));
+      }
+    sqlite3_finalize(stmt);
+  }
+
+  m_fragmentIndex->finalize();
+
+  if (!g_quiet) {
+    cout << "Fragment index built: " << m_fragmentIndex->getNumEntries() << " entries, ";
+    cout << m_fragmentIndex->getNumFragments() << " fragment bins." << endl;
+  }
+}
+
+// loadSketchIndices - loads the sketch index of each library from its sidecar, or builds it from the library (and saves
+// the sidecar) if there is none or it is out of date
+void SpectraSTLib::loadSketchIndices() {
+
+  for (unsigned int k = 0; k < (unsigned int)(m_libFileNames.size()); k++) {
+
+    SpectraSTSketchIndex* sketchIndex = new SpectraSTSketchIndex(m_libFileNames[k], m_searchParams->peakBinningNumBinsPerMzUnit,
+                                                                 m_searchParams->peakScalingMzPower, m_searchParams->peakScalingIntensityPower);
+    m_sketchIndices.push_back(sketchIndex);
+
+    if (sketchIndex->load()) {
+      continue;
+    }
+
+    if (!g_quiet) {
+      cout << "Building sketch index of \"" << m_libFileNames[k] << "\"..." << endl;
+    }
+
+    sqlite3_stmt* stmt = NULL;
+
+    string sql("SELECT LibId, Charge FROM " + getLibDatabaseName(k) + ".Peptide;");
+    sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        sketchIndex->insertEntry(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+      }
+    sqlite3_finalize(stmt);
+
+    sql = "SELECT LibID, Mz, Intensity FROM " + getLibDatabaseName(k) + ".Peaklist_50;";
+    sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        sketchIndex->insertPeak(sqlite3_column_int(stmt, 0), sqlite3_column_double(stmt, 1), (float)sqlite3_column_double(stmt, 2));
+      }
+    sqlite3_finalize(stmt);
+
+    sketchIndex->build();
+  }
+
+  if (!g_quiet) {
+    for (unsigned int k = 0; k < (unsigned int)(m_sketchIndices.size()); k++) {
+      cout << "Sketch index of \"" << m_libFileNames[k] << "\": " << m_sketchIndices[k]->getNumEntries() << " entries, ";
+      cout << m_sketchIndices[k]->getNumClusters() << " clusters." << endl;
+    }
+  }
+}
+
+// getLibDatabaseName - the name under which the libFileIndex-th library is attached
+string SpectraSTLib::getLibDatabaseName(unsigned int libFileIndex) {
+
+  if (libFileIndex == 0) {
+    return ("db");
+  }
+  stringstream ss;
+  ss << "db" << libFileIndex;
+  return (ss.str());
 }
 
 void SpectraSTLib::retrieveSQL(vector<SpectraSTLibEntry *> &hits, double lowMz, double highMz)
@@ -673,12 +1006,14 @@ void SpectraSTLib::retrieveSQL(vector<SpectraSTLibEntry *> &hits, double lowMz,
           cache_queue.erase(found);
           cache_queue.push_back(idx);
           ++hit;
+          SpectraSTStageStats::count(COUNTER_CACHE_HITS);
         }
       else // this query is a miss, go to sqlite and find it in database
         {
           cache_queue.push_back(idx);
           m_cache[idx];
           ++miss;
+          SpectraSTStageStats::count(COUNTER_CACHE_MISSES);
 
           if(m_cache.size() > CACHE_SIZE)
             {
@@ -696,56 +1031,74 @@ void SpectraSTLib::retrieveSQL(vector<SpectraSTLibEntry *> &hits, double lowMz,
 
           while(sqlite3_step(peptide_stmt) == SQLITE_ROW)
             {
-              int LibID = sqlite3_column_int(peptide_stmt, 0);
+              SpectraSTLibEntry* newLibEntry = readEntrySQL(peptide_stmt);
 
-              const char* raw_name = (const char*) (sqlite3_column_text(peptide_stmt, 1));
-              string name(raw_name);
+              int intMz = static_cast<int> (newLibEntry->getPrecursorMz());
+              m_cache[idx].push_back(Entry(intMz, newLibEntry));
+            }
 
-              int parentCharge = sqlite3_column_int(peptide_stmt, 2);
+          sqlite3_reset(peptide_stmt);
+          sqlite3_clear_bindings(peptide_stmt);
+        }
 
-              double parentMz = sqlite3_column_double(peptide_stmt, 3);
+      for(block::iterator iter = m_cache[idx].begin(); iter != m_cache[idx].end(); ++iter)
+        {
+          if(iter->first <= (int) (highMz) && iter->first >= (int) (lowMz))
+            hits.push_back(iter->second);
+        }
+    }
+}
 
-              const char* raw_comment = (const char*) (sqlite3_column_text(peptide_stmt, 4));
-              string comment(raw_comment);
+// readEntrySQL - creates a library entry from the current row of stmt (library index, LibId, PeptideName, Charge,
+// PrecursorMz, Comment, NumPeak), reading its peaks from that library
+SpectraSTLibEntry* SpectraSTLib::readEntrySQL(sqlite3_stmt* stmt)
+{
+  unsigned int libFileIndex = sqlite3_column_int(stmt, 0);
 
-              unsigned int numPeaks = sqlite3_column_int(peptide_stmt, 5);
+  int LibID = sqlite3_column_int(stmt, 1);
 
-              SpectraSTPeakList* newPeaklist = new SpectraSTPeakList(parentMz,
-                                                                     parentCharge,
-                                                                     numPeaks);
+  const char* raw_name = (const char*) (sqlite3_column_text(stmt, 2));
+  string name(raw_name);
 
-              sqlite3_bind_int(peaklist_stmt, bind_LibID_idx, LibID);
+  int parentCharge = sqlite3_column_int(stmt, 3);
 
-              while(sqlite3_step(peaklist_stmt) == SQLITE_ROW)
-                {
-                  double mz = sqlite3_column_double(peaklist_stmt, 0);
-                  float intensity = static_cast<float> (sqlite3_column_double(peaklist_stmt, 1));
-                  const char* raw_annotation = (const char*) (sqlite3_column_text(peaklist_stmt, 2));
-                  string annotation(raw_annotation);
+  double parentMz = sqlite3_column_double(stmt, 4);
 
-                  newPeaklist->insertForSearch(mz, intensity, annotation);
-                }
+  const char* raw_comment = (const char*) (sqlite3_column_text(stmt, 5));
+  string comment(raw_comment);
 
-              sqlite3_reset(peaklist_stmt);
-              sqlite3_clear_bindings(peaklist_stmt);
+  unsigned int numPeaks = sqlite3_column_int(stmt, 6);
 
-              SpectraSTLibEntry* newLibEntry = new SpectraSTLibEntry(name, parentMz, comment,
-                                                                     "Normal", newPeaklist, string());
+  sqlite3_stmt* peaklist_stmt = peaklist_stmts[libFileIndex];
 
-              int intMz = static_cast<int> (parentMz);
-              m_cache[idx].push_back(Entry(intMz, newLibEntry));
-            }
+  SpectraSTPeakList* newPeaklist = new SpectraSTPeakList(parentMz,
+                                                         parentCharge,
+                                                         numPeaks);
 
-          sqlite3_reset(peptide_stmt);
-          sqlite3_clear_bindings(peptide_stmt);
-        }
+  sqlite3_bind_int(peaklist_stmt, bind_LibID_idx, LibID);
 
-      for(block::iterator iter = m_cache[idx].begin(); iter != m_cache[idx].end(); ++iter)
-        {
-          if(iter->first <= (int) (highMz) && iter->first >= (int) (lowMz))
-            hits.push_back(iter->second);
-        }
+  while(sqlite3_step(peaklist_stmt) == SQLITE_ROW)
+    {
+      double mz = sqlite3_column_double(peaklist_stmt, 0);
+      float intensity = static_cast<float> (sqlite3_column_double(peaklist_stmt, 1));
+      const char* raw_annotation = (const char*) (sqlite3_column_text(peaklist_stmt, 2));
+      string annotation(raw_annotation);
+
+      newPeaklist->insertForSearch(mz, intensity, annotation);
     }
+
+  sqlite3_reset(peaklist_stmt);
+  sqlite3_clear_bindings(peaklist_stmt);
+
+  SpectraSTLibEntry* newLibEntry = new SpectraSTLibEntry(name, parentMz, comment,
+                                                         "Normal", newPeaklist, string());
+  newLibEntry->setLibFileIndex(libFileIndex);
+  newLibEntry->setLibId((unsigned int)LibID);
+  if (!(m_searchCommentsUsed.empty())) {
+    newLibEntry->keepOnlyComments(m_searchCommentsUsed);
+  }
+
+  return (newLibEntry);
 }
 
 void SpectraSTLib::resetCache()
@@ -757,12 +1110,22 @@ void SpectraSTLib::resetCache()
     }
 
   m_cache.clear();
+
+  for(map<pair<unsigned int, int>, SpectraSTLibEntry*>::iterator iter = m_entryCache.begin(); iter != m_entryCache.end(); ++iter)
+    delete iter->second;
+
+  m_entryCache.clear();
 }
 
 void SpectraSTLib::shutdownDatabase()
 {
   sqlite3_finalize(peptide_stmt);
-  sqlite3_finalize(peaklist_stmt);
+  for (vector<sqlite3_stmt*>::iterator st = peaklist_stmts.begin(); st != peaklist_stmts.end(); st++) {
+    sqlite3_finalize(*st);
+  }
+  for (vector<sqlite3_stmt*>::iterator st = entry_stmts.begin(); st != entry_stmts.end(); st++) {
+    sqlite3_finalize(*st);
+  }
 
   sqlite3_close(db);
   sqlite3_shutdown();
@@ -774,4 +1137,12 @@ void SpectraSTLib::shutdownDatabase()
   cout << "Total miss is " << miss << endl;
   cout << "Total hit is " << hit << endl;
   cout << "The hit rate is " << (double) hit / (hit + miss) << endl;
+
+  if (m_searchParams->annSearchCheckRecall && m_annNumQueries > 0) {
+    cout << "Approximate search: " << m_annNumQueries << " queries, recall@" << m_searchParams->annSearchTopK << " is ";
+    cout << (m_annNumExactHits > 0 ? (double)m_annNumRecalledHits / (double)m_annNumExactHits : 1.0) << endl;
+    cout << "Approximate search: " << m_annApproxTime << " s (" << (m_annApproxTime > 0.0 ? (double)m_annNumQueries / m_annApproxTime : 0.0);
+    cout << " queries/s); exhaustive sketch search: " << m_annExactTime << " s (";
+    cout << (m_annExactTime > 0.0 ? (double)m_annNumQueries / m_annExactTime : 0.0) << " queries/s)" << endl;
+  }
 }
@@ -4,6 +4,8 @@
 #include "SpectraSTLibEntry.hpp"
 #include "SpectraSTMzLibIndex.hpp"
 #include "SpectraSTPeptideLibIndex.hpp"
+#include "SpectraSTFragmentIndex.hpp"
+#include "SpectraSTSketchIndex.hpp"
 #include "SpectraSTSearchParams.hpp"
 #include "SpectraSTCreateParams.hpp"
 #include "FileUtils.hpp"
@@ -16,6 +18,7 @@
 
 #define CACHE_SIZE 16
 #define BLOCK_SIZE 1
+#define ENTRY_CACHE_SIZE 20000
 
 /*
 
@@ -70,10 +73,16 @@ public:
     ~SpectraSTLib();
 
     string getLibFileName() { return (m_libFileName); }
+    unsigned int getNumLibFiles() { return ((unsigned int)(m_libFileNames.size())); }
+    string getLibFileName(unsigned int libFileIndex) { return (m_libFileNames[libFileIndex]); }
 
     void insertEntry(SpectraSTLibEntry* entry);
 
     void retrieve(vector<SpectraSTLibEntry*>& hits, double lowMz, double highMz);
+    void retrieveByFragments(vector<SpectraSTLibEntry*>& hits, SpectraSTPeakList* query, double lowMz, double highMz, vector<bool>& possibleCharges);
+    void retrieveBySketch(vector<SpectraSTLibEntry*>& hits, SpectraSTPeakList* query, vector<bool>& possibleCharges);
+    void retrieveByIds(vector<SpectraSTLibEntry*>& hits, vector<pair<unsigned int, int> >& ids);
+    bool canRetrieveTogether(double lowMz, double highMz);
 
     SpectraSTPeptideLibIndex* getPeptideLibIndexPtr() { return (m_pepIndex); }
 
@@ -96,6 +105,14 @@ private:
     // IS the property of SpectraSTLib.
     SpectraSTPeptideLibIndex* m_pepIndex;
 
+    // m_fragmentIndex - points to the fragment index object used for open searching (-s_OPN), NULL if not open searching.
+    // This object is instantiated by SpectraSTLib and IS the property of SpectraSTLib.
+    SpectraSTFragmentIndex* m_fragmentIndex;
+
+    // m_sketchIndices - the sketch index of each library, used for approximate searching (-s_ANN), empty if not
+    // approximate searching. These objects are instantiated by SpectraSTLib and ARE the property of SpectraSTLib.
+    vector<SpectraSTSketchIndex*> m_sketchIndices;
+
     // m_searchParams & m_createParams - points to the params object. The one corresponding to the
     // mode (Search/Create) will be instantiated by SpectraSTMain and passed into here (using the
     // respective constructor); the other will be set to NULL. These pointers are also used to keep track of the
@@ -103,11 +120,16 @@ private:
     SpectraSTSearchParams* m_searchParams;
     SpectraSTCreateParams* m_createParams;
 
+    // m_searchCommentsUsed - the comment fields to keep in the entries retrieved for searching (sorted), if the
+    // other fields are to be dropped to save memory (-s_TCM); empty if all are kept.
+    vector<string> m_searchCommentsUsed;
+
     // m_newLibId - counter used to assign a unique ID to each entry during Create mode
     unsigned int m_newLibId;
 
     // The file names. All these are the full file names that include the path and the extension
     string m_libFileName;   // the .splib file used for searching, or for holding the result of creating
+    vector<string> m_libFileNames; // in search mode, all the libraries searched together (m_libFileName is their comma-separated list)
     string m_txtFileName;   // if the .splib is binary, a separate text file .sptxt is also printed for human readability
     vector<string> m_impFileNames; // files to be imported and create library from
     string m_mzIdxFileName;  // the corresponding .spidx file
@@ -136,16 +158,25 @@ private:
 
     // SQLite database connections methods and pointers
     void initializeDatabase();
+    string getLibDatabaseName(unsigned int libFileIndex);
+    void buildFragmentIndex();
+    void loadSketchIndices();
+    void retrieveSketchHits(vector<pair<unsigned int, SpectraSTSketchIndexHit> >& hits, SpectraSTPeakList* query, vector<bool>& possibleCharges, bool exhaustive);
+    SpectraSTLibEntry* retrieveEntryById(unsigned int libFileIndex, int libId);
+    void trimEntryCache();
     void resetCache();
     void retrieveSQL(vector<SpectraSTLibEntry *> &hits, double lowMz, double highMz);
+    SpectraSTLibEntry* readEntrySQL(sqlite3_stmt* stmt);
     void shutdownDatabase();
 
     sqlite3* db;
-    sqlite3_stmt* peptide_stmt;
-    sqlite3_stmt* peaklist_stmt;
+    sqlite3_stmt* peptide_stmt; // retrieves the entries of all libraries at once, tagged by library
+    vector<sqlite3_stmt*> peaklist_stmts; // one per library
+    vector<sqlite3_stmt*> entry_stmts; // one per library, retrieves one entry by LibId
     int bind_lowMz_idx;
     int bind_highMz_idx;
     int bind_LibID_idx;
+    int bind_entryLibID_idx;
 
     int hit;
     int miss;
@@ -153,6 +184,17 @@ private:
     typedef vector<Entry> block;
     map<int, block> m_cache;
     list<int> cache_queue;
+
+    // the entries retrieved by LibId (by retrieveByFragments(), retrieveBySketch() and retrieveByIds()), keyed by (library index, LibId)
+    map<pair<unsigned int, int>, SpectraSTLibEntry*> m_entryCache;
+
+    // approximate search statistics (-s_ANR): number of queries, of top hits found exhaustively, of those also found
+    // by the approximate search, and the time spent by each
+    unsigned int m_annNumQueries;
+    unsigned long long m_annNumExactHits;
+    unsigned long long m_annNumRecalledHits;
+    double m_annApproxTime;
+    double m_annExactTime;
 };
 
 #endif /*SPECTRALIB_HPP_*/
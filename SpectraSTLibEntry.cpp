@@ -2,8 +2,10 @@
 #include "SpectraSTLog.hpp"
 #include "SpectraSTConstants.hpp"
 #include "FileUtils.hpp"
+#include "SpectraSTMappedFile.hpp"
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 #include <math.h>
 #include <stdlib.h>
 
@@ -52,21 +54,23 @@ extern SpectraSTLog* g_log;
 
 // constructor from arguments
 SpectraSTLibEntry::SpectraSTLibEntry(Peptide* pep, string comments, string status, SpectraSTPeakList* peakList, string fragType) :
-  m_name(""),
   m_pep(pep),
-  m_charge(pep->charge),
+  m_libId(0),
+  m_libFileOffset(0),
+  m_libFileIndex(0),
+  m_name(""),
   m_mw(pep->monoisotopicMH()),
   m_precursorMz(pep->monoisotopicMZ()),
 //  m_mw(pep->averageMH()),
 //  m_precursorMz(pep->averageMZ()),
-  m_commentsStr(comments),
-  m_comments(NULL),
   m_status(status),
   m_fullName(""),
-  m_peakList(peakList),
-  m_libId(0),
-  m_libFileOffset(0),
-  m_fragType(fragType) {
+  m_commentsStr(comments),
+  m_charge(pep->charge),
+  m_fragType(fragType),
+  m_comments(NULL),
+  m_commentsModified(false),
+  m_peakList(peakList) {
 
   // the name is of the format AC[339]DEFGHIK/2	
   m_name = pep->interactStyleWithCharge();
@@ -97,19 +101,21 @@ SpectraSTLibEntry::SpectraSTLibEntry(Peptide* pep, string comments, string statu
 
 // constructor from arguments
 SpectraSTLibEntry::SpectraSTLibEntry(string name, double precursorMz, string comments, string status, SpectraSTPeakList* peakList, string fragType) :
-  m_name(name),
   m_pep(NULL),
-  m_charge(1),
+  m_libId(0),
+  m_libFileOffset(0),
+  m_libFileIndex(0),
+  m_name(name),
   m_mw(precursorMz),
   m_precursorMz(precursorMz),
-  m_commentsStr(comments),
-  m_comments(NULL),
   m_status(status),
   m_fullName(name),
-  m_peakList(peakList),
-  m_libId(0),
-  m_libFileOffset(0),
-  m_fragType(fragType) {
+  m_commentsStr(comments),
+  m_charge(1),
+  m_fragType(fragType),
+  m_comments(NULL),
+  m_commentsModified(false),
+  m_peakList(peakList) {
 
   if (!(m_fragType.empty())) {
     m_fullName += " (" + m_fragType + ")";
@@ -132,31 +138,33 @@ SpectraSTLibEntry::SpectraSTLibEntry(string name, double precursorMz, string com
 
 
 // constructor from library file
-SpectraSTLibEntry::SpectraSTLibEntry(ifstream& libFin, bool binary, bool forSearch) :
+SpectraSTLibEntry::SpectraSTLibEntry(ifstream& libFin, bool binary, bool forSearch, bool headerOnly) :
+  m_pep(NULL),
+  m_libId(0),
+  m_libFileOffset(0),
+  m_libFileIndex(0),
   m_name(""),
-  m_charge(0),
   m_mw(0.0),
   m_precursorMz(0.0),
-  m_commentsStr(""),
-  m_pep(NULL),
-  m_comments(NULL),
   m_status(""),
   m_fullName(""),
-  m_peakList(NULL),
-  m_libId(0),
-  m_libFileOffset(0),
-  m_fragType("") {
+  m_commentsStr(""),
+  m_charge(0),
+  m_fragType(""),
+  m_comments(NULL),
+  m_commentsModified(false),
+  m_peakList(NULL) {
   
   // construct the object by reading from a library file
   if (binary) {
-    readFromBinaryFile(libFin, forSearch);
+    readFromBinaryFile(libFin, forSearch, headerOnly);
   } else {
-    readFromFile(libFin, forSearch);
+    readFromFile(libFin, forSearch, headerOnly);
   }
 }
 
-// readFromFile - reads from a text .splib file.
-void SpectraSTLibEntry::readFromFile(ifstream& libFin, bool forSearch) {
+// readFromFile - reads from a text .splib file. If headerOnly, stops at the NumPeaks line.
+void SpectraSTLibEntry::readFromFile(ifstream& libFin, bool forSearch, bool headerOnly) {
 
   m_libFileOffset = libFin.tellg();
   
@@ -259,6 +267,14 @@ void SpectraSTLibEntry::readFromFile(ifstream& libFin, bool forSearch) {
   
   // line should start with "NumPeaks:" now
   
+  if (headerOnly) {
+    m_peakList = new SpectraSTPeakList(m_precursorMz, m_charge, 0, true, m_fragType);
+    if (m_pep) {
+      m_peakList->setPeptidePtr(m_pep);
+    }
+    return;
+  }
+  
   string::size_type separatorPos = 0;
   string dummy = nextToken(line, 0, separatorPos, ":");
   int numPeaks = atoi(nextToken(line, separatorPos + 1, separatorPos, "\r\n", " \t").c_str());
@@ -269,16 +285,30 @@ void SpectraSTLibEntry::readFromFile(ifstream& libFin, bool forSearch) {
     m_peakList->setPeptidePtr(m_pep);
   }
   // read peak list
+  // (the peak lines are tokenized in place, without copying each token into a string)
   string peakLine;
+  string annotation;
+  string info;
   while (nextLine(libFin, peakLine, "")) {
     
-    string::size_type pos = 0;					
-    double mz = atof((nextToken(peakLine, pos, pos)).c_str());
-    float intensity = atof((nextToken(peakLine, pos, pos)).c_str());
-    string annotation = nextToken(peakLine, pos, pos); 
-    string info = nextToken(peakLine, pos, pos, "\r\n"); // read till end of line
+    const char* p = peakLine.data();
+    const char* lineEnd = p + peakLine.length();
+    
+    p = SpectraSTMappedFile::skipOver(p, lineEnd, " \t\r\n");
+    const char* tokenEnd = SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n");
+    double mz = SpectraSTMappedFile::parseDouble(p, tokenEnd);
+    
+    p = SpectraSTMappedFile::skipOver(tokenEnd, lineEnd, " \t\r\n");
+    tokenEnd = SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n");
+    float intensity = (float)(SpectraSTMappedFile::parseDouble(p, tokenEnd));
+    
+    p = SpectraSTMappedFile::skipOver(tokenEnd, lineEnd, " \t\r\n");
+    tokenEnd = SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n");
+    annotation.assign(p, tokenEnd);
     
     if (!forSearch) {
+      p = SpectraSTMappedFile::skipOver(tokenEnd, lineEnd, " \t\r\n");
+      info.assign(p, SpectraSTMappedFile::findDelim(p, lineEnd, "\r\n")); // read till end of line
       m_peakList->insert(mz, intensity, annotation, info);
     } else {
       m_peakList->insertForSearch(mz, intensity, (annotation.empty() ? "" : annotation.substr(0,1)));   
@@ -295,9 +325,10 @@ void SpectraSTLibEntry::readFromFile(ifstream& libFin, bool forSearch) {
 // <libId (int)> <fullName (\n-terminated string)> <precursorM/Z (double)>
 // <status (\n-terminated string)> <numPeaks (int)>
 // numPeaks times: <m/z (double)> <intensity (double)> <annotation (\n-terminated string)> <info (\n-terminated string)>
+// (or, if numPeaks has COMPRESSED_PEAKS_FLAG set, a compressed peak block -- see SpectraSTPeakList::writeCompressedPeaks)
 // <comment (\n-terminated string)>
 
-void SpectraSTLibEntry::readFromBinaryFile(ifstream& libFin, bool forSearch) {
+void SpectraSTLibEntry::readFromBinaryFile(ifstream& libFin, bool forSearch, bool headerOnly) {
 
   m_libFileOffset = libFin.tellg();
   
@@ -371,12 +402,50 @@ void SpectraSTLibEntry::readFromBinaryFile(ifstream& libFin, bool forSearch) {
   unsigned int numPeaks = 0;
   libFin.read((char*)(&numPeaks), sizeof(unsigned int));
   
+  bool compressedPeaks = ((numPeaks & COMPRESSED_PEAKS_FLAG) != 0);
+  numPeaks &= ~COMPRESSED_PEAKS_FLAG;
+  
+  if (headerOnly) {
+    // the comments come after the peaks, so they are not read either
+    numPeaks = 0;
+  }
+  
   m_peakList = new SpectraSTPeakList(m_precursorMz, m_charge, numPeaks, true, m_fragType);
   
   if (m_pep) {
     m_peakList->setPeptidePtr(m_pep);
   }
     
+  if (headerOnly) {
+    return;
+  }
+  
+  if (compressedPeaks) {
+    // read the whole block at once, then decode it
+    unsigned int blockSize = 0;
+    libFin.read((char*)(&blockSize), sizeof(unsigned int));
+    
+    // check blockSize before allocating for it: the block cannot be empty (it starts with the number of strings),
+    // nor longer than the rest of the file, nor than the longest block of numPeaks peaks
+    ifstream::pos_type blockStart = libFin.tellg();
+    libFin.seekg(0, ios::end);
+    ifstream::pos_type fileEnd = libFin.tellg();
+    libFin.seekg(blockStart);
+    if (!libFin.good() || blockSize == 0 || (unsigned long long)blockSize > (unsigned long long)(fileEnd - blockStart) ||
+        (unsigned long long)blockSize > SpectraSTPeakList::maxCompressedPeaksSize(numPeaks)) {
+      g_log->error("GENERAL", "Corrupt .splib file from which to import entry.");
+      g_log->crash();
+    }
+    
+    vector<char> block(blockSize + 1);
+    libFin.read(&(block[0]), blockSize);
+    if (!libFin.good() || !(m_peakList->readCompressedPeaks(&(block[0]), blockSize, numPeaks, forSearch))) {
+      g_log->error("GENERAL", "Corrupt .splib file from which to import entry.");
+      g_log->crash();
+    }
+    numPeaks = 0;
+  }
+  
   // peaks
   for (unsigned int i = 0; i < numPeaks; i++) {
     double mz = 0.0;
@@ -438,6 +507,7 @@ SpectraSTLibEntry::~SpectraSTLibEntry() {
 SpectraSTLibEntry::SpectraSTLibEntry(SpectraSTLibEntry& other) :
   m_pep(NULL),
   m_comments(NULL),
+  m_commentsModified(false),
   m_peakList(NULL) {
   
   (*this) = other;
@@ -447,6 +517,7 @@ SpectraSTLibEntry::SpectraSTLibEntry(SpectraSTLibEntry& other) :
 SpectraSTLibEntry& SpectraSTLibEntry::operator=(SpectraSTLibEntry& other) {
 	  
   this->m_libId = other.m_libId;
+  this->m_libFileIndex = other.m_libFileIndex;
   this->m_libFileOffset = other.m_libFileOffset;
   this->m_name = other.m_name;
   this->m_mw = other.m_mw;
@@ -468,13 +539,11 @@ SpectraSTLibEntry& SpectraSTLibEntry::operator=(SpectraSTLibEntry& other) {
   // deep copy m_comments
   if (this->m_comments) delete (this->m_comments);
   if (other.m_comments) {
-    this->m_comments = new map<string, string>;
-    for (map<string, string>::iterator c = other.m_comments->begin(); c != other.m_comments->end(); c++) {
-      this->m_comments->insert(*c);
-    }
+    this->m_comments = new vector<pair<string, string> >(*(other.m_comments));
   } else {
     this->m_comments = NULL;
   }
+  this->m_commentsModified = other.m_commentsModified;
   
   // deep copy peakList
   if (this->m_peakList) delete (this->m_peakList);
@@ -562,14 +631,14 @@ void SpectraSTLibEntry::writeToFile(ofstream& libFout){
   
 }
 
-// writeToBinaryFile - write the entry to file in binary format
-void SpectraSTLibEntry::writeToBinaryFile(ofstream& libFout) {
+// writeToBinaryFile - write the entry to file in binary format, with a compressed peak block if compressPeaks
+void SpectraSTLibEntry::writeToBinaryFile(ostream& libFout, bool compressPeaks) {
 	  
   libFout.write((char*)(&m_libId), sizeof(int));
   libFout << m_fullName << endl;
   libFout.write((char*)(&m_precursorMz), sizeof(double));
   libFout << m_status << endl;
-  m_peakList->writeToBinaryFile(libFout);
+  m_peakList->writeToBinaryFile(libFout, compressPeaks);
   libFout << getCommentsStr() << endl;
 
 }
@@ -774,12 +843,17 @@ string SpectraSTLibEntry::getRawSpectra() {
 }
 
 
-// parseCommentsStr - parses the comments string to create the m_comments object
-// this is quite costly, so only do so when it needs to access and modify many comment fields,
-// e.g. during consensus creation
+// sortCommentsByAttr - comparator for keeping the comment table sorted by attribute
+static bool sortCommentsByAttr(const pair<string, string>& a, const pair<string, string>& b) {
+  return (a.first < b.first);
+}
+
+// parseCommentsStr - parses the comments string to create the m_comments table. This is done once, the first time
+// any comment field is accessed; after that, fields are found by binary search.
 void SpectraSTLibEntry::parseCommentsStr() {
 	
-  m_comments = new map<string, string>;
+  m_comments = new vector<pair<string, string> >;
+  m_commentsModified = false;
   
   string::size_type pos = 0;
   string field;
@@ -801,9 +875,7 @@ void SpectraSTLibEntry::parseCommentsStr() {
     string::size_type eqPos = 0;	
     if ((eqPos = field.find('=', 0)) != string::npos) {
       // first equal sign separates the attribute and the value
-      string attr = field.substr(0, eqPos);
-      string value = field.substr(eqPos + 1);
-      (*m_comments)[attr] = value;
+      m_comments->push_back(pair<string, string>(field.substr(0, eqPos), field.substr(eqPos + 1)));
     } else {
       // no equal sign, problem with token. just ignore
     }
@@ -812,18 +884,49 @@ void SpectraSTLibEntry::parseCommentsStr() {
     pos++;
   }
   
+  // sort by attribute; if an attribute is repeated, the last value wins
+  stable_sort(m_comments->begin(), m_comments->end(), sortCommentsByAttr);
+  vector<pair<string, string> >::iterator last = m_comments->begin();
+  for (vector<pair<string, string> >::iterator c = m_comments->begin(); c != m_comments->end(); c++) {
+    if (c != m_comments->begin() && c->first == last->first) {
+      last->second.swap(c->second);
+    } else {
+      if (c != m_comments->begin()) last++;
+      if (last != c) last->swap(*c);
+    }
+  }
+  if (!(m_comments->empty())) {
+    m_comments->erase(last + 1, m_comments->end());
+  }
+  
 }
 
-// getCommentsStr - returns the comments as a string; if m_comments is instantiated, it will
-// prints that object as a string; if not, it will just return m_commentsStr.
-string SpectraSTLibEntry::getCommentsStr() {
+// findComment - returns a pointer to the value of a comment field in the table (parsing m_commentsStr first if needed),
+// or NULL if it is not there. The pointer is only good until the next change to the comments.
+const string* SpectraSTLibEntry::findComment(const string& attr) {
   
   if (!m_comments) {
+    parseCommentsStr();
+  }
+  
+  vector<pair<string, string> >::iterator found = 
+    lower_bound(m_comments->begin(), m_comments->end(), pair<string, string>(attr, ""), sortCommentsByAttr);
+  if (found == m_comments->end() || found->first != attr) {
+    return (NULL);
+  }
+  return (&(found->second));
+}
+
+// getCommentsStr - returns the comments as a string. If any field has been changed, the string is regenerated from 
+// the m_comments table; otherwise, m_commentsStr is returned as is.
+string SpectraSTLibEntry::getCommentsStr() {
+  
+  if (!m_comments || !m_commentsModified) {
     return (m_commentsStr);
   }
   
   stringstream ss;
-  for (map<string, string>::iterator c = m_comments->begin(); c != m_comments->end(); c++) {
+  for (vector<pair<string, string> >::iterator c = m_comments->begin(); c != m_comments->end(); c++) {
     
     if (c != m_comments->begin()) {
       ss << ' ';
@@ -840,93 +943,83 @@ string SpectraSTLibEntry::getCommentsStr() {
   }
   
   m_commentsStr = ss.str();
-  return (ss.str());
+  m_commentsModified = false;
+  return (m_commentsStr);
 }
 
-// getOneComment - get one comment field. If m_comments is not instantiated, just
-// do simple string parsing to find the field.
+// getOneComment - get one comment field. Returns false if it is not found.
 bool SpectraSTLibEntry::getOneComment(string attr, string& value) {
 
-  if (!m_comments) {
-    string::size_type found = m_commentsStr.find(attr + '=', 0);
-
-    if (found == string::npos) {
-      return (false);
-    } else {
-
-      string::size_type vs;
-      if (found == 0) {
-	vs = found + attr.length() + 1;
-      } else {
-	// make sure the attribute we're looking for isn't prefixed with something else
-	found = m_commentsStr.find(' ' + attr + '=', 0);
-	if (found == string::npos) {
-	  return (false);
-	}
-	vs = found + attr.length() + 2;
-      }
-
-      if (vs >= m_commentsStr.length()) {
-        return (false);
-      }
-      if (m_commentsStr[vs] == '\"') {
-        // in quote, get rid of quotes
-        value = nextToken(m_commentsStr, vs, vs, "\"\t\r\n", "\"");
-      } else {
-        value = nextToken(m_commentsStr, vs, vs, " \t\r\n");
-      }
-      return (true);
-    }
-    
-  } else {
-    // already parsed into m_comments. simply find it from the map object
-    map<string, string>::iterator found = m_comments->find(attr);
-    if (found == m_comments->end()) {
-      return (false);
-    } else {
-      value = found->second;
-      return (true);
-    }
+  const string* found = findComment(attr);
+  if (!found) {
+    return (false);
   }
+  value = *found;
+  return (true);
 }
 	
-// setOneComment - set one comment field. This will automatically parse the string into an object
-// for easy insertion or modification. returns true if that comment is found.
+// setOneComment - set one comment field. returns true if that comment is found.
 bool SpectraSTLibEntry::setOneComment(string attr, string value) {
 
   if (!m_comments) {
     parseCommentsStr();
   }
+  m_commentsModified = true;
   
-  map<string, string>::iterator found = m_comments->find(attr);
-  if (found == m_comments->end()) {
-    (*m_comments)[attr] = value;
+  vector<pair<string, string> >::iterator found = 
+    lower_bound(m_comments->begin(), m_comments->end(), pair<string, string>(attr, ""), sortCommentsByAttr);
+  if (found == m_comments->end() || found->first != attr) {
+    m_comments->insert(found, pair<string, string>(attr, value));
     return (false);
   } else {
-    (*m_comments)[attr] = value;
+    found->second = value;
     return (true);
   }
   
 }
 
-// deleteOneComment - delete one comment field. This will automatically parse the string into an object
-// for easy deletion. returns true if that comment is found
+// deleteOneComment - delete one comment field. returns true if that comment is found
 bool SpectraSTLibEntry::deleteOneComment(string attr) {
 	
   if (!m_comments) {
     parseCommentsStr();
   }
   
-  map<string, string>::iterator found = m_comments->find(attr);
-  if (found == m_comments->end()) {
+  vector<pair<string, string> >::iterator found = 
+    lower_bound(m_comments->begin(), m_comments->end(), pair<string, string>(attr, ""), sortCommentsByAttr);
+  if (found == m_comments->end() || found->first != attr) {
     return (false);
   } else {
     m_comments->erase(found);
+    m_commentsModified = true;
     return (true);
   }
   
 }
 
+// keepOnlyComments - drops all comment fields except those in attrs (which must be sorted), and frees the table.
+// Used to save memory when only a few fields will ever be read, e.g. by the search.
+void SpectraSTLibEntry::keepOnlyComments(vector<string>& attrs) {
+
+  if (!m_comments) {
+    parseCommentsStr();
+  }
+  
+  vector<pair<string, string> >::iterator kept = m_comments->begin();
+  for (vector<pair<string, string> >::iterator c = m_comments->begin(); c != m_comments->end(); c++) {
+    if (binary_search(attrs.begin(), attrs.end(), c->first)) {
+      if (kept != c) kept->swap(*c);
+      kept++;
+    }
+  }
+  m_comments->erase(kept, m_comments->end());
+  m_commentsModified = true;
+  
+  getCommentsStr();
+  delete (m_comments);
+  m_comments = NULL;
+}
+
 // setPeakList - setting the peak list.
 void SpectraSTLibEntry::setPeakList(SpectraSTPeakList* peakList) {
 	
@@ -979,27 +1072,26 @@ void SpectraSTLibEntry::synchWithPep() {
 // means that the library is in the old format, that is, average mass is used for m_precursorMz.
 double SpectraSTLibEntry::getAveragePrecursorMz() {
    
-  double mz = m_precursorMz;
-  string mzStr("");
-  if (getOneComment("AvePrecursorMz", mzStr)) {
-    mz = atof(mzStr.c_str());
-  }
-  return (mz);
+  static const string attr("AvePrecursorMz");
+  const string* mzStr = findComment(attr);
+  return (mzStr ? atof(mzStr->c_str()) : m_precursorMz);
 }
 
 // getProb - convenient getter for the probability in the comment
 double SpectraSTLibEntry::getProb(double valueIfNotFound) {
   
+  static const string probAttr("Prob");
+  static const string tfRatioAttr("Tfratio");
+  
   double prob = valueIfNotFound;
   
-  string probStr("");
-  if (getOneComment("Prob", probStr)) {
-    prob = atof(probStr.c_str());
+  const string* probStr = findComment(probAttr);
+  if (probStr) {
+    prob = atof(probStr->c_str());
   } else {
-    string tfRatioStr("");
-    string::size_type tfRatioPos = 0;
-    if (getOneComment("Tfratio", tfRatioStr)) {
-      double tfRatio = atof(tfRatioStr.c_str());
+    const string* tfRatioStr = findComment(tfRatioAttr);
+    if (tfRatioStr) {
+      double tfRatio = atof(tfRatioStr->c_str());
       prob = tfRatio / (1.0 + tfRatio);
     }
   }
@@ -1010,16 +1102,41 @@ double SpectraSTLibEntry::getProb(double valueIfNotFound) {
 // getNrepsUsed - convenient getter for the number of replicates used, i.e. the 'X' in 'Nrep=X/Y' in the comment.
 unsigned int SpectraSTLibEntry::getNrepsUsed(unsigned int valueIfNotFound) {
   
+  static const string attr("Nreps");
+  
   unsigned int numRepsUsed = valueIfNotFound;
-  string nrepsStr("");
-  string::size_type slashPos = 0;
-  if (getOneComment("Nreps", nrepsStr)) {
-    numRepsUsed = atoi(nextToken(nrepsStr, 0, slashPos, "/ \t\r\n").c_str());
+  const string* nrepsStr = findComment(attr);
+  if (nrepsStr) {
+    // atoi stops at the slash
+    numRepsUsed = atoi(nrepsStr->c_str());
   }
   
   return (numRepsUsed);
 }
 
+// getXrea - convenient getter for the Xrea (spectral quality) in the comment
+double SpectraSTLibEntry::getXrea(double valueIfNotFound) {
+  
+  static const string attr("Xrea");
+  
+  const string* xreaStr = findComment(attr);
+  return (xreaStr ? atof(xreaStr->c_str()) : valueIfNotFound);
+}
+
+// isDecoy - returns true if this is a decoy entry, i.e. Spec=Decoy, or a Remark starting with DECOY
+bool SpectraSTLibEntry::isDecoy() {
+  
+  static const string specAttr("Spec");
+  static const string remarkAttr("Remark");
+  
+  const string* spec = findComment(specAttr);
+  if (spec && *spec == "Decoy") {
+    return (true);
+  }
+  const string* remark = findComment(remarkAttr);
+  return (remark && remark->compare(0, 5, "DECOY") == 0);
+}
+
 // getSeqInfo - parses out the Se= field in the comments, 
 // and incorporates the result in the 'seqs' map. Note that if 'seqs' already contains
 // some sequence search information, getSeqInfo will not delete it; instead, it merges
@@ -5,6 +5,7 @@
 #include "Peptide.hpp"
 #include <iostream>
 #include <string>
+#include <vector>
 
 /*
 
@@ -51,10 +52,11 @@ public:
 	
   // only two ways to construct an entry object:
   // 1. by giving all required information as arguments
-  // 2. by giving a ifstream object pointing to the beginning of an entry in a library file
+  // 2. by giving a ifstream object pointing to the beginning of an entry in a library file. With headerOnly,
+  //    reading stops before the peaks: the peak list is left empty, and for a binary library, so are the comments.
   SpectraSTLibEntry(Peptide* pep, string comments, string status, SpectraSTPeakList* peakList, string fragType = "");
   SpectraSTLibEntry(string name, double precursorMz, string comments, string status, SpectraSTPeakList* peakList, string fragType = "");
-  SpectraSTLibEntry(ifstream& libFin, bool binary = false, bool shortAnnotation = false);
+  SpectraSTLibEntry(ifstream& libFin, bool binary = false, bool shortAnnotation = false, bool headerOnly = false);
   
   // copy constructor and assignment operator
   SpectraSTLibEntry(SpectraSTLibEntry& other);
@@ -66,6 +68,7 @@ public:
   // Accessor methods
   unsigned int getLibId() { return m_libId; }
   fstream::off_type getLibFileOffset() { return m_libFileOffset; }
+  unsigned int getLibFileIndex() { return m_libFileIndex; }
   string getName() { return m_name; }
   int getCharge() { return (m_pep ? m_pep->charge : m_charge); }
   string getMods() { return (m_pep ? m_pep->mspMods() : ""); }
@@ -80,6 +83,8 @@ public:
   SpectraSTPeakList* getPeakList() { return m_peakList;}
   double getProb(double valueIfNotFound = 0.0);
   unsigned int getNrepsUsed(unsigned int valueIfNotFound = 1);
+  double getXrea(double valueIfNotFound = 0.0);
+  bool isDecoy();
   string getFragType() { return (m_fragType); }
   int getMassDiffInt();
   
@@ -87,6 +92,7 @@ public:
   void setStatus(string status) { m_status = status; }
   void setLibId(unsigned int libId) { m_libId = libId; }
   void setLibFileOffset(fstream::off_type libFileOffset) { m_libFileOffset = libFileOffset; }
+  void setLibFileIndex(unsigned int libFileIndex) { m_libFileIndex = libFileIndex; }
   void setPeakList(SpectraSTPeakList* peakList);
   void synchWithPep(); // sets m_name, m_fullName, m_mw, m_precursorMz and Mods= in Comments according to the m_pep object
   void setPrecursor(double precursorMz, int charge = 0); // charge = 0 means the charge is unknown
@@ -104,6 +110,7 @@ public:
   bool getOneComment(string attr, string& value);
   bool setOneComment(string attr, string value);
   bool deleteOneComment(string attr);
+  void keepOnlyComments(vector<string>& attrs);
   
   // Accessing specific fields in comment
   string getRawSpectra();
@@ -125,7 +132,7 @@ public:
 
   // File I/O methods
   void writeToFile(ofstream& libFout);
-  void writeToBinaryFile(ofstream& libFout);
+  void writeToBinaryFile(ostream& libFout, bool compressPeaks = false);
   void writeDtaFile(string dtaFileName);
   void writeMRM(ofstream& mrmFout, string format);
   void writeMgfFile(ofstream& mgfFout);
@@ -151,6 +158,7 @@ private:
   Peptide* m_pep; // defines the peptide ion.
   unsigned int m_libId; // just a zero-based unique identifier for each entry
   fstream::off_type m_libFileOffset; // file offset for random access
+  unsigned int m_libFileIndex; // which of the searched libraries (-sL) the entry is from, in the order given
   string m_name; // m_name is an interact-style (with charge) string representing the peptide ion
   double m_mw;
   double m_precursorMz;
@@ -160,20 +168,22 @@ private:
   int m_charge;
   string m_fragType;
   
-  // m_comments is an object representation of the Comment: field.
-  // this is however not used (for efficiency sake) for simple accessing of a comment field
-  // which will be done by string parsing of m_commentsStr instead.
-  map<string, string>* m_comments;
+  // m_comments is a table representation of the Comment: field, (attribute, value) sorted by attribute.
+  // it is created from m_commentsStr the first time any comment field is accessed, and m_commentsStr is
+  // only regenerated from it (by getCommentsStr) if a field has been changed since.
+  vector<pair<string, string> >* m_comments;
+  bool m_commentsModified;
   
   // m_peakList IS the property of SpectraSTLibEntry!
   SpectraSTPeakList* m_peakList;
   
   // parse m_commentsStr to create m_comments
   void parseCommentsStr();
+  const string* findComment(const string& attr);
   
   // reading from files - these are private, so to read from files the constructor has to be called
-  void readFromFile(ifstream& libFin, bool forSearch);
-  void readFromBinaryFile(ifstream& libFin, bool forSearch);
+  void readFromFile(ifstream& libFin, bool forSearch, bool headerOnly);
+  void readFromBinaryFile(ifstream& libFin, bool forSearch, bool headerOnly);
   
 	
 };
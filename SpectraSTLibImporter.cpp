@@ -64,9 +64,9 @@ SpectraSTLibImporter::SpectraSTLibImporter(vector<string>& impFileNames, Spectra
   m_count(0),
   m_preamble(),
   m_outputFileName(""),
-  m_filters(NULL),
+  m_filter(NULL),
   m_filterStr(""),
-  m_filterLogic('\0'),
+  m_filterSkipCount(0),
   m_probTable(NULL),
   m_proteinList(NULL) {
 
@@ -79,7 +79,7 @@ SpectraSTLibImporter::SpectraSTLibImporter(vector<string>& impFileNames, Spectra
       m_outputFileName = params.outputFileName + ".splib";
     }
     
-    // create the Predicate object if filterCriteria is specified
+    // compile the filter expression if filterCriteria is specified
     if (!m_params.filterCriteria.empty()) {
       parseFilterCriteria();
     }
@@ -97,110 +97,20 @@ SpectraSTLibImporter::SpectraSTLibImporter(vector<string>& impFileNames, Spectra
   }
 }
   
-// parseFilterCriteria - parses the filter criterion string.
+// parseFilterCriteria - compiles the filter criterion string into m_filter. 
 // The criterion string is of the form <attr> <op> <value> [<logic> <attr> <op> <value]... where <attr> is any of the
-// field of the entry or any of the fields in the comments. <logic> can be & (and) or | (or), but only one
-// can be used throughout in the criterion. (If there are both & and |, & will be assumed throughout.) 
+// field of the entry or any of the fields in the comments. <logic> can be & (and) or | (or); & binds tighter than |,
+// a criterion can be negated by a leading !, and parentheses can be used for grouping. 
 // <op> can be != (not equal), == (equal), <= (less than or equal), >= (greater than or equal)
 // > (greater than), < (smaller than), =~ (contains as a substring) and !~ (does not contain)
 // <value> can be numerical or string. It will figure out what it should be (hopefully).
+// See SpectraSTFilterExpression for more information.
 void SpectraSTLibImporter::parseFilterCriteria() {
 
-  m_filters = new vector<Predicate*>;
-  
-  string::size_type critStartPos = 0;
-  string::size_type logicPos = 0;
-  
-  while (critStartPos < m_params.filterCriteria.length()) {
-    
-    logicPos = m_params.filterCriteria.find_first_of("&|", critStartPos);
-    if (logicPos != string::npos) {
-      if (m_filterLogic != '\0') {
-        if (m_filterLogic != m_params.filterCriteria[logicPos]) {
-          g_log->error("CREATE", "FILTER: Mixing of AND and OR logics in filter criteria. AND logic is assumed throughout.");
-          m_filterLogic = '&';
-        }
-      } else {
-        m_filterLogic = m_params.filterCriteria[logicPos];
-      }   
-    } else {
-      logicPos = m_params.filterCriteria.length();
-      if (m_filterLogic == '\0') m_filterLogic = '&';
-    }
-      
-    string criterion = m_params.filterCriteria.substr(critStartPos, logicPos - critStartPos);
-    critStartPos = logicPos + 1;
-    
-    string attr("");
-    string value("");
-    string opStr("");
-    string::size_type opPos = 0;
-    if ((opPos = criterion.find("!=", 0)) != string::npos) {
-      attr = crop(criterion.substr(0, opPos));
-      value = crop(criterion.substr(opPos + 2));
-      opStr = "!=";
-    } else if ((opPos = criterion.find(">=", 0)) != string::npos) {
-      attr = crop(criterion.substr(0, opPos));
-      value = crop(criterion.substr(opPos + 2));
-      opStr = ">=";
-    } else if ((opPos = criterion.find("<=", 0)) != string::npos) {
-      attr = crop(criterion.substr(0, opPos));
-      value = crop(criterion.substr(opPos + 2));
-      opStr = "<=";
-    } else if ((opPos = criterion.find("==", 0)) != string::npos) {
-      attr = crop(criterion.substr(0, opPos));
-      value = crop(criterion.substr(opPos + 2));
-      opStr = "==";
-    } else if ((opPos = criterion.find(">", 0)) != string::npos) {
-      attr = crop(criterion.substr(0, opPos));
-      value = crop(criterion.substr(opPos + 1));
-      opStr = ">";
-    } else if ((opPos = criterion.find("<", 0)) != string::npos) {
-      attr = crop(criterion.substr(0, opPos));
-      value = crop(criterion.substr(opPos + 1));
-      opStr = "<";
-    } else if ((opPos = criterion.find("=~", 0)) != string::npos) {
-      attr = crop(criterion.substr(0, opPos));
-      value = crop(criterion.substr(opPos + 2));
-      opStr = "=~";
-    } else if ((opPos = criterion.find("!~", 0)) != string::npos) {
-      attr = crop(criterion.substr(0, opPos));
-      value = crop(criterion.substr(opPos + 2));
-      opStr = "!~";
-    }
-
-    if (opStr.empty() || attr.empty() || value.empty()) {
-      continue;
-    }
-    
-    // Some common ones; for these we know what the type (int, double or string) the value should be
-    if (attr == "Name") {
-      m_filters->push_back(new Predicate(attr, opStr, value));
-    } else if (attr == "MW") {
-      m_filters->push_back(new Predicate(attr, opStr, atof(value.c_str())));
-    } else if (attr == "PrecursorMZ") {
-      m_filters->push_back(new Predicate(attr, opStr, atof(value.c_str())));
-    } else if (attr == "LibID") {
-      m_filters->push_back(new Predicate(attr, opStr, atoi(value.c_str())));
-    } else if (attr == "Charge") {
-      m_filters->push_back(new Predicate(attr, opStr, atoi(value.c_str())));
-    } else if (attr == "Mods") {
-      m_filters->push_back(new Predicate(attr, opStr, value));
-    } else if (attr == "Status") {
-      m_filters->push_back(new Predicate(attr, opStr, value));
-    } else if (attr == "FullName") {
-      m_filters->push_back(new Predicate(attr, opStr, value));
-    } else if (attr == "NumPeaks") {
-      m_filters->push_back(new Predicate(attr, opStr, atoi(value.c_str())));
-    } else {
-      // Not the common ones, the type is unknown. Will guess based on the type of the value supplied
-      if (value.find_first_not_of("0123456789.") == string::npos) { // assume it's a double
-        m_filters->push_back(new Predicate(attr, opStr, atof(value.c_str())));
-      } else { // assume it's a string
-        m_filters->push_back(new Predicate(attr, opStr, value));
-      }
-    }
+  m_filter = new SpectraSTFilterExpression(m_params.filterCriteria);
   
+  if (!(m_filter->isWellFormed())) {
+    g_log->error("CREATE", "FILTER: Unbalanced parentheses in filter criteria. Parsed as far as possible.");
   }
      
   // put together a string to describe what we are filtering for
@@ -219,11 +129,8 @@ void SpectraSTLibImporter::parseFilterCriteria() {
 
 // destructor
 SpectraSTLibImporter::~SpectraSTLibImporter() {
-  if (m_filters) {
-    for (vector<Predicate*>::iterator i = m_filters->begin(); i != m_filters->end(); i++) {
-      delete (*i); 
-    }
-    delete m_filters;
+  if (m_filter) {
+    delete m_filter;
   }
   if (m_probTable) {
     delete m_probTable;
@@ -246,97 +153,40 @@ bool SpectraSTLibImporter::passAllFilters(SpectraSTLibEntry* entry) {
 // the method parseFilterCriteria for more information. 
 bool SpectraSTLibImporter::satisfyFilterCriteria(SpectraSTLibEntry* entry) {
 
-  if (!m_filters) {
+  if (!m_filter) {
     return (true);
   }
 
-  for (vector<Predicate*>::iterator pr = m_filters->begin(); pr != m_filters->end(); pr++) {
+  return (m_filter->isSatisfiedBy(entry));
+}
 
-    Predicate* filter = (*pr);
-    string attr = filter->getRefName();
-    string commentValue("");
-    
-    if (m_filterLogic == '&') {
-
-      if (attr == "Name") {
-        if (!filter->compRef(entry->getName())) return (false);
-      } else if (attr == "MW") {
-        if (!filter->compRef(entry->getMw())) return (false);
-      } else if (attr == "PrecursorMZ") {
-        if (!filter->compRef(entry->getPrecursorMz())) return (false);
-      } else if (attr == "LibID") {
-        if (!filter->compRef((int)(entry->getLibId()))) return (false);
-      } else if (attr == "Charge") {
-        if (!filter->compRef((int)(entry->getCharge()))) return (false);
-      } else if (attr == "Mods") {
-        if (!filter->compRef(entry->getMods())) return (false);
-      } else if (attr == "Status") {
-        if (!filter->compRef(entry->getStatus())) return (false);
-      } else if (attr == "FullName") {
-        if (!filter->compRef(entry->getFullName())) return (false);
-      } else if (attr == "NumPeaks") {
-        if (!filter->compRef((int)(entry->getPeakList()->getNumPeaks()))) return (false);
-      } else if (entry->getOneComment(attr, commentValue)) {
-        string::size_type pos = 0;
-
-        if (filter->getType() == 'D') {
-          if (!filter->compRef(atof(nextToken(commentValue, pos, pos, "/^\t\r\n").c_str()))) return (false);
-        } else if (filter->getType() == 'I') {
-          if (!filter->compRef(atoi(nextToken(commentValue, pos, pos, "/^\t\r\n").c_str()))) return (false);
-        } else {
-          if (!filter->compRef(commentValue)) return (false);
-        }
-     
-      } else {
-        // can't find it in comments, don't do anything - wait for the other predicates to evaluate
-      }
-    
-    } else if (m_filterLogic == '|') {
-      
-      if (attr == "Name") {
-        if (filter->compRef(entry->getName())) return (true);
-      } else if (attr == "MW") {
-        if (filter->compRef(entry->getMw())) return (true);
-      } else if (attr == "PrecursorMZ") {
-        if (filter->compRef(entry->getPrecursorMz())) return (true);
-      } else if (attr == "LibID") {
-        if (filter->compRef((int)(entry->getLibId()))) return (true);
-      } else if (attr == "Charge") {
-        if (filter->compRef((int)(entry->getCharge()))) return (true);
-      } else if (attr == "Mods") {
-        if (filter->compRef(entry->getMods())) return (true);
-      } else if (attr == "Status") {
-        if (filter->compRef(entry->getStatus())) return (true);
-      } else if (attr == "FullName") {
-        if (filter->compRef(entry->getFullName())) return (true);
-      } else if (attr == "NumPeaks") {
-        if (filter->compRef((int)(entry->getPeakList()->getNumPeaks()))) return (true);
-      } else if (entry->getOneComment(attr, commentValue)) {
-        string::size_type pos = 0;
-
-        if (filter->getType() == 'D') {
-          if (filter->compRef(atof(nextToken(commentValue, pos, pos, "/^\t\r\n").c_str()))) return (true);
-        } else if (filter->getType() == 'I') {
-          if (filter->compRef(atoi(nextToken(commentValue, pos, pos, "/^\t\r\n").c_str()))) return (true);
-        } else {
-          if (filter->compRef(commentValue)) return (true);
-        }
-     
-      } else {
-        // can't find it in comments
-      }      
-    }
-  }
-  
-  if (m_filterLogic == '&') {
+// mayPassFilterCriteria - checks, from its peptide index key and subkey alone, if any entry of a peptide ion can satisfy
+// the criteria. Used to avoid reading from the library entries that cannot.
+bool SpectraSTLibImporter::mayPassFilterCriteria(string peptide, string subkey) {
+
+  if (!m_filter) {
     return (true);
-  } else if (m_filterLogic == '|') {
-    return (false);
-  } else {
+  }
+
+  if (m_filter->mayBeSatisfiedByPeptideIon(peptide, subkey)) {
     return (true);
   }
   
-  return (true);
+  m_filterSkipCount++;
+  return (false);
+}
+
+// logFilterSkipCount - logs how many peptide ions (or whatever is counted) were skipped without reading, because 
+// they could not satisfy the filter criteria
+void SpectraSTLibImporter::logFilterSkipCount(string what) {
+
+  if (!m_filter) {
+    return;
+  }
+  
+  stringstream skipss;
+  skipss << "FILTER: Skipped " << m_filterSkipCount << " " << what << " that cannot satisfy the filter criteria without reading them.";
+  g_log->log("CREATE", skipss.str());
 }
 
 // readProbTable - reads a probability table from file. A prob table has lines of the format <peptide ion> <white space> <new prob>, 
@@ -617,7 +467,7 @@ SpectraSTLibImporter* SpectraSTLibImporter::createSpectraSTLibImporter(vector<st
     return (new SpectraSTMs2LibImporter(impFileNames, lib, params));
   } else if (fn.ext == ".tsv" || fn.ext == ".xls") {
     return (new SpectraSTTsvLibImporter(impFileNames, lib, params));
-  } else if (fn.ext == ".mzXML") {
+  } else if (fn.ext == ".mzXML" || fn.ext == ".mzML") {
     return (new SpectraSTMzXMLLibImporter(impFileNames, lib, params));
   } else if (fn.ext == ".sptxt") {
     // treat as .msp unless there is a corresponding .splib in the directory
@@ -4,7 +4,7 @@
 #include "SpectraSTLib.hpp"
 #include "SpectraSTCreateParams.hpp"
 #include "SpectraSTLibEntry.hpp"
-#include "Predicate.hpp"
+#include "SpectraSTFilterExpression.hpp"
 #include <fstream>
 #include <vector>
 #include <string>
@@ -72,6 +72,7 @@ public:
   virtual bool passAllFilters(SpectraSTLibEntry* entry);
   
   bool satisfyFilterCriteria(SpectraSTLibEntry* entry);
+  bool mayPassFilterCriteria(string peptide, string subkey);
   
   bool isInProbTable(SpectraSTLibEntry* entry, bool updateProb = false);
   bool isInProteinList(SpectraSTLibEntry* entry);
@@ -95,10 +96,10 @@ protected:
   // m_lib - pointer to the library object. This is NOT the property of SpectraSTLibImporter!
   SpectraSTLib* m_lib;
   
-  // m_filter - pointer to a Predicate object which stores what we are filtering for 
-  vector<Predicate*>* m_filters;
+  // m_filter - pointer to the compiled expression of what we are filtering for 
+  SpectraSTFilterExpression* m_filter;
   string m_filterStr;
-  char m_filterLogic;
+  unsigned int m_filterSkipCount;
   unsigned int m_count;
   
   // m_probTable - pointer to a hash of (peptide ion) => prob
@@ -110,6 +111,7 @@ protected:
   
   // helper methods
   void parseFilterCriteria();
+  void logFilterSkipCount(string what);
   void readProbTable();
   void readProteinList();
   
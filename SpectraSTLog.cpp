@@ -1,6 +1,9 @@
 #include "SpectraSTLog.hpp"
 #include <iostream>
 #include <stdlib.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
 
 /*
 
@@ -39,6 +42,64 @@ hlam@systemsbiology.org
  * 
  */
 
+#ifndef _MSC_VER
+
+// the deferred-message list of each thread, if it has called beginDeferring(), is reached through a thread-specific key
+static pthread_key_t g_deferredLogKey;
+static pthread_once_t g_deferredLogKeyOnce = PTHREAD_ONCE_INIT;
+
+// createDeferredLogKey - creates the thread-specific key, once
+static void createDeferredLogKey() {
+  
+  pthread_key_create(&g_deferredLogKey, NULL);
+}
+
+// deferredLog - returns the deferred-message list of the calling thread, NULL if it is not deferring
+static vector<string>* deferredLog() {
+  
+  pthread_once(&g_deferredLogKeyOnce, createDeferredLogKey);
+  return ((vector<string>*)pthread_getspecific(g_deferredLogKey));
+}
+
+// setDeferredLog - sets the deferred-message list of the calling thread
+static void setDeferredLog(vector<string>* deferred) {
+  
+  pthread_once(&g_deferredLogKeyOnce, createDeferredLogKey);
+  pthread_setspecific(g_deferredLogKey, deferred);
+}
+
+// the log file, and the errors and warnings recorded, are shared by all threads; they are only touched under this mutex
+static pthread_mutex_t g_logMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void lockLog() {
+  pthread_mutex_lock(&g_logMutex);
+}
+
+static void unlockLog() {
+  pthread_mutex_unlock(&g_logMutex);
+}
+
+#else
+
+// no threads are started under Visual Studio; there is only one deferred-message list
+static vector<string>* g_deferredLog = NULL;
+
+static vector<string>* deferredLog() {
+  return (g_deferredLog);
+}
+
+static void setDeferredLog(vector<string>* deferred) {
+  g_deferredLog = deferred;
+}
+
+static void lockLog() {
+}
+
+static void unlockLog() {
+}
+
+#endif
+
 // Constructor
 SpectraSTLog::SpectraSTLog(string logFileName) :
   m_logFileName(logFileName),
@@ -65,43 +126,84 @@ SpectraSTLog::~SpectraSTLog() {
 
 // log - logs a general message
 void SpectraSTLog::log(string msg) {
-  if (m_good) {
+  vector<string>* deferred = deferredLog();
+  if (deferred) {
+    deferred->push_back(msg);
+  } else if (m_good) {
+    lockLog();
     m_fout << msg << endl;   
+    unlockLog();
   }
 }
 
 // log - logs a message with a tag
 void SpectraSTLog::log(string tag, string msg) {
-  if (m_good) { 
+  vector<string>* deferred = deferredLog();
+  if (deferred) {
+    deferred->push_back(tag + ": " + msg);
+  } else if (m_good) { 
+    lockLog();
     m_fout << tag << ": " << msg << endl;
+    unlockLog();
   }
 }
 
 // log - logs a message with a tag and a stamp (e.g. a time stamp)
 void SpectraSTLog::log(string tag, string msg, string stamp) {
-  if (m_good) {
+  vector<string>* deferred = deferredLog();
+  if (deferred) {
+    deferred->push_back(tag + ": (" + stamp + ") " + msg);
+  } else if (m_good) {
+    lockLog();
     m_fout << tag << ": (" << stamp << ") " << msg << endl; 
+    unlockLog();
+  }
+}
+
+// beginDeferring - from now on, the messages logged by the calling thread are appended to deferred
+void SpectraSTLog::beginDeferring(vector<string>* deferred) {
+  setDeferredLog(deferred);
+}
+
+// endDeferring - from now on, the messages logged by the calling thread are written again
+void SpectraSTLog::endDeferring() {
+  setDeferredLog(NULL);
+}
+
+// writeDeferred - writes the messages deferred by some thread, in the order they were logged
+void SpectraSTLog::writeDeferred(vector<string>& deferred) {
+  if (m_good) {
+    lockLog();
+    for (vector<string>::iterator i = deferred.begin(); i != deferred.end(); i++) {
+      m_fout << (*i) << endl;
+    }
+    unlockLog();
   }
 }
 
 // error - logs an error message. Difference between error() and log() is that 
 // 1. errors will be prefixed with the word "ERROR" in the log entry.
 // 2. errors will be recorded and all error messages can be dumped later on
+// Errors are written right away even by a thread that is deferring its messages, so that crash() can report them.
 void SpectraSTLog::error(string tag, string msg) {
+  lockLog();
   if (m_good) {
     m_fout << "ERROR " << tag << ": " << msg << endl;
   }
   m_errors.push_back(tag + ": " + msg);
   m_numError++;
+  unlockLog();
 }
 
 // warning - logs a warning message.
 void SpectraSTLog::warning(string tag, string msg) {
+  lockLog();
   if (m_good) {
     m_fout << "WARNING " << tag << ": " << msg << endl;
   }
   m_warnings.push_back(tag + ": " + msg);
   m_numWarning++;
+  unlockLog();
 }
 
 // printErrors - dumps all errors to console.
@@ -127,6 +229,8 @@ void SpectraSTLog::printWarnings() {
 // Just a nicer way of crashing.
 void SpectraSTLog::crash() {
   
+  // held until the exit, so that no other thread adds to the errors while they are printed
+  lockLog();
   cerr << "\t==== FATAL ERROR. Exiting immediately. ====" << endl;
   cerr << "\tError trace :" << endl;
   for (vector<string>::iterator i = m_errors.begin(); i != m_errors.end(); i++) {
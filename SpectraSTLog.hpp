@@ -57,6 +57,13 @@ public:
     void warning(string tag, string msg);
     void crash();
     
+    // between beginDeferring() and endDeferring(), the messages a thread logs with log() are appended to
+    // deferred instead of written, so that threads working in parallel can have their messages written
+    // later (by writeDeferred()) in a deterministic order. Errors and warnings are never deferred.
+    void beginDeferring(vector<string>* deferred);
+    void endDeferring();
+    void writeDeferred(vector<string>& deferred);
+    
     unsigned int getNumError() { return (m_numError); }
     unsigned int getNumWarning() { return (m_numWarning); }
     
@@ -0,0 +1,282 @@
+#include "SpectraSTMappedFile.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+
+#ifndef _MSC_VER
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTMappedFile
+ *
+ * A read-only view of a whole text file in memory. See SpectraSTMappedFile.hpp.
+ *
+ */
+
+// constructor - maps the file into memory. Check isOpen() afterwards.
+SpectraSTMappedFile::SpectraSTMappedFile(string fileName) :
+  m_fileName(fileName),
+  m_data(NULL),
+  m_size(0),
+  m_isOpen(false),
+  m_isMapped(false) {
+
+#ifndef _MSC_VER
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return;
+  }
+
+  m_size = (size_t)(st.st_size);
+  if (m_size > 0) {
+    void* addr = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      m_data = (const char*)addr;
+      m_isMapped = true;
+#ifdef MADV_SEQUENTIAL
+      madvise(addr, m_size, MADV_SEQUENTIAL);
+#endif
+    }
+  }
+  close(fd);
+
+  if (m_size == 0 || m_isMapped) {
+    m_isOpen = true;
+    return;
+  }
+  m_size = 0;
+#endif
+
+  // can't map it (or no mmap on this platform), just read the whole thing into memory
+  ifstream fin(fileName.c_str(), ios::binary | ios::in);
+  if (!fin.good()) return;
+
+  fin.seekg(0, ios::end);
+  streamoff len = fin.tellg();
+  fin.seekg(0, ios::beg);
+  if (len < 0) return;
+
+  m_size = (size_t)len;
+  if (m_size > 0) {
+    char* buf = (char*)malloc(m_size);
+    if (!buf) {
+      m_size = 0;
+      return;
+    }
+    fin.read(buf, m_size);
+    m_size = (size_t)(fin.gcount());
+    m_data = buf;
+  }
+  m_isOpen = true;
+}
+
+// destructor
+SpectraSTMappedFile::~SpectraSTMappedFile() {
+
+  if (!m_data) return;
+
+#ifndef _MSC_VER
+  if (m_isMapped) {
+    munmap((void*)m_data, m_size);
+    return;
+  }
+#endif
+  free((void*)m_data);
+}
+
+// splitAtRecords - splits the file into blocks of roughly blockSize bytes. Each block boundary is moved forward to the
+// start of the next line beginning with recordPrefix, so that no record straddles two blocks. boundaries will contain
+// the start of every block, followed by the end of the file.
+void SpectraSTMappedFile::splitAtRecords(size_t blockSize, const char* recordPrefix, vector<const char*>& boundaries) {
+
+  boundaries.clear();
+  boundaries.push_back(begin());
+
+  if (blockSize == 0) blockSize = 1;
+
+  const char* last = begin();
+  while ((size_t)(end() - last) > blockSize) {
+
+    const char* cur = last + blockSize;
+    const char* boundary = end();
+
+    // go to the start of the next line, then look for the next line beginning with the record prefix
+    const char* nl = (const char*)memchr(cur, '\n', end() - cur);
+    cur = (nl ? nl + 1 : end());
+
+    const char* lineBegin = NULL;
+    const char* lineEnd = NULL;
+    const char* lineStart = cur;
+    while (nextLine(cur, end(), lineBegin, lineEnd)) {
+      if (startsWith(lineBegin, lineEnd, recordPrefix)) {
+        boundary = lineStart;
+        break;
+      }
+      lineStart = cur;
+    }
+
+    if (boundary >= end()) break;
+    boundaries.push_back(boundary);
+    last = boundary;
+  }
+
+  boundaries.push_back(end());
+}
+
+// nextLine - gets the next line starting at cur, as [lineBegin, lineEnd) with the newline (and any trailing carriage return)
+// cropped, and moves cur to the start of the following line. Returns false at the end of the data.
+bool SpectraSTMappedFile::nextLine(const char*& cur, const char* end, const char*& lineBegin, const char*& lineEnd) {
+
+  if (cur >= end) return (false);
+
+  lineBegin = cur;
+  const char* nl = (const char*)memchr(cur, '\n', end - cur);
+  if (nl) {
+    lineEnd = nl;
+    cur = nl + 1;
+  } else {
+    lineEnd = end;
+    cur = end;
+  }
+
+  if (lineEnd > lineBegin && *(lineEnd - 1) == '\r') {
+    lineEnd--;
+  }
+  return (true);
+}
+
+// startsWith - returns true if the line begins with prefix
+bool SpectraSTMappedFile::startsWith(const char* lineBegin, const char* lineEnd, const char* prefix) {
+
+  size_t len = strlen(prefix);
+  return ((size_t)(lineEnd - lineBegin) >= len && memcmp(lineBegin, prefix, len) == 0);
+}
+
+// skipOver - returns the first position at or after p that is not one of the characters in skipover (or end)
+const char* SpectraSTMappedFile::skipOver(const char* p, const char* end, const char* skipover) {
+
+  while (p < end && strchr(skipover, *p) && *p != '\0') p++;
+  return (p);
+}
+
+// findDelim - returns the first position at or after p that is one of the characters in delim (or end)
+const char* SpectraSTMappedFile::findDelim(const char* p, const char* end, const char* delim) {
+
+  while (p < end && (*p == '\0' || !strchr(delim, *p))) p++;
+  return (p);
+}
+
+// parseDouble - parses a number at p the way atof does, but without needing a null-terminated copy. Plain decimals
+// of up to 15 significant digits (i.e. all m/z and intensity values in practice) are converted directly, and give the
+// same double as atof since both the digits and the power of ten are exact; anything else is handed to strtod.
+double SpectraSTMappedFile::parseDouble(const char* p, const char* end) {
+
+  p = skipOver(p, end, " \t\r\n\f\v");
+
+  const char* start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  unsigned long long mantissa = 0;
+  int numDigits = 0;
+  int numDecimals = 0;
+  bool seenDigit = false;
+
+  while (p < end && *p >= '0' && *p <= '9') {
+    if (numDigits > 0 || *p != '0') numDigits++;
+    mantissa = mantissa * 10 + (unsigned long long)(*p - '0');
+    seenDigit = true;
+    p++;
+    if (numDigits > 15) break;
+  }
+  if (p < end && *p == '.' && numDigits <= 15) {
+    p++;
+    while (p < end && *p >= '0' && *p <= '9') {
+      if (numDigits > 0 || *p != '0') numDigits++;
+      mantissa = mantissa * 10 + (unsigned long long)(*p - '0');
+      numDecimals++;
+      seenDigit = true;
+      p++;
+      if (numDigits > 15) break;
+    }
+  }
+
+  if (numDigits <= 15 && numDecimals <= 22 && !(p < end && (*p == 'e' || *p == 'E' || (*p >= '0' && *p <= '9')))) {
+    if (!seenDigit) return (0.0);
+
+    static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+					  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    double value = (double)mantissa / powersOfTen[numDecimals];
+    return (negative ? -value : value);
+  }
+
+  // unusual number (exponent, too many digits...), let strtod deal with it
+  const char* tokenEnd = findDelim(start, end, " \t\r\n\f\v\"");
+  size_t len = (size_t)(tokenEnd - start);
+  char buf[64];
+  if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+  memcpy(buf, start, len);
+  buf[len] = '\0';
+  return (strtod(buf, NULL));
+}
+
+// parseInt - parses an integer at p the way atoi does, but without needing a null-terminated copy
+int SpectraSTMappedFile::parseInt(const char* p, const char* end) {
+
+  p = skipOver(p, end, " \t\r\n\f\v");
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  int value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = value * 10 + (*p - '0');
+    p++;
+  }
+  return (negative ? -value : value);
+}
@@ -0,0 +1,80 @@
+#ifndef SPECTRASTMAPPEDFILE_HPP_
+#define SPECTRASTMAPPEDFILE_HPP_
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTMappedFile
+ *
+ * A read-only view of a whole text file in memory (memory-mapped where possible), with helpers
+ * to walk it line by line and parse numbers in place, without copying lines into strings.
+ * Also splits the file into blocks at record boundaries (e.g. "Name: " lines of an .msp), so
+ * that the blocks can be parsed independently.
+ *
+ */
+
+using namespace std;
+
+class SpectraSTMappedFile {
+
+public:
+  SpectraSTMappedFile(string fileName);
+  ~SpectraSTMappedFile();
+
+  bool isOpen() { return (m_isOpen); }
+  const char* begin() { return (m_data); }
+  const char* end() { return (m_data + m_size); }
+  size_t size() { return (m_size); }
+
+  void splitAtRecords(size_t blockSize, const char* recordPrefix, vector<const char*>& boundaries);
+
+  static bool nextLine(const char*& cur, const char* end, const char*& lineBegin, const char*& lineEnd);
+  static bool startsWith(const char* lineBegin, const char* lineEnd, const char* prefix);
+  static const char* skipOver(const char* p, const char* end, const char* skipover);
+  static const char* findDelim(const char* p, const char* end, const char* delim);
+  static double parseDouble(const char* p, const char* end);
+  static int parseInt(const char* p, const char* end);
+
+private:
+
+  string m_fileName;
+  const char* m_data;
+  size_t m_size;
+  bool m_isOpen;
+  bool m_isMapped;
+
+};
+
+#endif /*SPECTRASTMAPPEDFILE_HPP_*/
@@ -3,9 +3,12 @@
 #include "SpectraSTQuery.hpp"
 #include "SpectraSTLog.hpp"
 #include "SpectraSTConstants.hpp"
+#include "SpectraSTStageStats.hpp"
 #include "FileUtils.hpp"
 #include "Peptide.hpp"
 #include "ProgressCount.hpp"
+#include "SpectraSTMappedFile.hpp"
+#include <string.h>
 
 extern bool g_quiet;
 extern bool g_verbose;
@@ -34,89 +37,74 @@ void SpectraSTMgfSearchTask::search() {
 // searchOneFile - search one mgf file
 void SpectraSTMgfSearchTask::searchOneFile(unsigned int fileIndex) {
   
-  string searchFileName(m_searchFileNames[fileIndex]);
-  
-  ifstream fin;
-  if (!myFileOpen(fin, searchFileName)) {
-    g_log->error("SEARCH", "Cannot open MGF file \"" + searchFileName + " for reading query spectra. File Skipped.");
-    return;
-  }
-  
-  m_outputs[fileIndex]->openFile();
-  m_outputs[fileIndex]->printHeader();
+  searchMappedFile(fileIndex, "BEGIN IONS", "MGF");
+}
+
+// parseQueries - parses the mgf records in [begin, end) into queries. Lines are parsed in place in the mapped file.
+bool SpectraSTMgfSearchTask::parseQueries(const char* begin, const char* end, vector<SpectraSTQuery*>& queries) {
   
-  string line("");
-  string::size_type pos = 0;
+  const char* cur = begin;
+  const char* lineBegin = NULL;
+  const char* lineEnd = NULL;
   
-  if (g_verbose) {
-    cout << "Searching query spectra in file \"" << searchFileName << "\" ..." << endl;
-  }
+  // this may run in a parse thread; the stage times go to the stats of that thread
+  SpectraSTStageStats& stageStats = SpectraSTStageStats::local();
   
-  ProgressCount pc(!g_quiet && !g_verbose, 200);
-  string msg("Searching query spectra in file \"");
-  msg += searchFileName + "\"";
-  pc.start(msg);
+  bool hasLine = SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd);
   
-  while (true) {
-    
-    if (line == "_EOF_") {
-      // no more record
-      pc.done();
-      m_outputs[fileIndex]->printFooter();
-      m_outputs[fileIndex]->closeFile();
-      return;
-    }
+  while (hasLine) {
     
-    // skips over all lines until the line with Name: (will stop when it reaches either "Name:" or the end-of-file)
-    if (line.compare(0, 10, "BEGIN IONS") != 0) {
-      while (nextLine(fin, line, "BEGIN IONS", ""));
-      if (line == "_EOF_") {
-	// no more record
-	pc.done();
-	m_outputs[fileIndex]->printFooter();
-	m_outputs[fileIndex]->closeFile();
-	return;
-      }
+    // skips over all lines until the line with BEGIN IONS
+    if (!SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "BEGIN IONS")) {
+      hasLine = SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd);
+      continue;
     }
     
     double precursorMz = 0.0;
     string title("");
     string comments("");
     int charge = 0;
+    bool hasNoPeaks = true;
     
-    
-    // read the rest of the header fields until TITLE:
-    while (nextLine(fin, line, "END IONS", "")) {
-      if (line.find('=') == string::npos) {
-	// no more headers
+    // read the rest of the header fields, until the first peak (or END IONS)
+    while ((hasLine = SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd))) {
+      
+      if (lineBegin == lineEnd) continue;
+      if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "END IONS")) break;
+      
+      if (!memchr(lineBegin, '=', lineEnd - lineBegin)) {
+	// no more headers, line should contain the first peak
+	hasNoPeaks = false;
 	break; 
       }
-
-      if (line.compare(0, 6, "TITLE=") == 0) {
-	title = nextToken(line, 6, pos, " \t\r\n"); 
-      } else if (line.compare(0, 8, "PEPMASS=") == 0) {
-	precursorMz = atof((nextToken(line, 8, pos," \r\n")).c_str());
-	double precursorIntensity = atof((nextToken(line, pos, pos," \r\n")).c_str());
-      } else if (line.compare(0, 7, "CHARGE=") == 0) {
-	charge = atoi((nextToken(line, 7, pos, " \t\r\n", "+")).c_str());
-      } else if (line == "_EOF_" || line.compare(0, 10, "BEGIN IONS") == 0) {
-	cerr << "\nBadly formatted .mgf file! Search task truncated." << endl;
-	m_outputs[fileIndex]->printFooter();
-	m_outputs[fileIndex]->closeFile();
-	return;
-
+      
+      const char* p = NULL;
+      if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "TITLE=")) {
+	p = SpectraSTMappedFile::skipOver(lineBegin + 6, lineEnd, " \t\r\n");
+	title.assign(p, SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n"));
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "PEPMASS=")) {
+	precursorMz = SpectraSTMappedFile::parseDouble(lineBegin + 8, lineEnd);
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "CHARGE=")) {
+	p = SpectraSTMappedFile::skipOver(lineBegin + 7, lineEnd, "+");
+	charge = SpectraSTMappedFile::parseInt(p, SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n"));
       } else {
 	// some other header, put the whole thing in comments
-	comments += nextToken(line, 0, pos, " \t\r\n") + " ";
+	p = SpectraSTMappedFile::skipOver(lineBegin, lineEnd, " \t\r\n");
+	comments.append(p, SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n"));
+	comments += " ";
       }
     }
-
-    bool hasNoPeaks = false;
-    if (line.find("END IONS") != string::npos) {
-      // no peaks?
-      hasNoPeaks = true;
+    
+    if (!hasLine) {
+      // reached the end in the middle of the headers, nothing to search
+      break;
     }
-
+    
+    if (hasNoPeaks) {
+      // line is END IONS, go on to the next record
+      continue;
+    }
+    
     bool selected;
     if (!m_searchAll) {
       selected = isInSelectedList(title);
@@ -126,64 +114,53 @@ void SpectraSTMgfSearchTask::searchOneFile(unsigned int fileIndex) {
     } else {
       selected = true;
     }
-
+    
     if (precursorMz < 0.0001) {
-     // no mass, this can't be searched
+      // no mass, this can't be searched
       selected = false;
-   }
-
-    if (!hasNoPeaks) {
-
-
-      int numPeaks = 0;
+    }
+    
+    if (selected && !m_searchAll && !m_selection.isPrecursorSelected(precursorMz, -1.0)) {
+      // outside the precursor m/z windows of the selected list (the retention time is not known here)
+      selected = false;
+    }
+    
+    SpectraSTPeakList* peakList = new SpectraSTPeakList(precursorMz, charge);
+    peakList->setNoiseFilterThreshold(m_params.filterRemovePeakIntensityThreshold);
+    
+    SpectraSTQuery* query = new SpectraSTQuery(title, precursorMz, charge, comments, peakList);
+    
+    double decodeStartTime = SpectraSTStageStats::now();
+    
+    do { // will stop when it reaches the next "END IONS" or end-of-file
       
-      SpectraSTPeakList* peakList = new SpectraSTPeakList(precursorMz, charge);
-      peakList->setNoiseFilterThreshold(m_params.filterRemovePeakIntensityThreshold);
+      if (lineBegin == lineEnd) continue;
+      if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "END IONS")) break;
       
-      SpectraSTQuery* query = new SpectraSTQuery(title, precursorMz, charge, comments, peakList);
+      // here are the peaks
+      const char* mzStart = SpectraSTMappedFile::skipOver(lineBegin, lineEnd, " \t\r\n");
+      const char* mzEnd = SpectraSTMappedFile::findDelim(mzStart, lineEnd, " \t\r\n");
+      double mz = SpectraSTMappedFile::parseDouble(mzStart, mzEnd);
+      float intensity = (float)(SpectraSTMappedFile::parseDouble(mzEnd, lineEnd));
       
-      // line should contain the first peak
+      peakList->insertForSearch(mz, intensity, "");
       
-      do { // will stop when it reaches the next "END IONS" or end-of-file
-	
-	// here are the peaks
-	double mz = atof((nextToken(line, 0, pos)).c_str());
-	// pos1 now stores the position of the first space after the mz
-	float intensity = atof((nextToken(line, pos, pos)).c_str());
-	// pos2 now stores the position of the first space after the intensity
-	peakList->insertForSearch(mz, intensity, "");
-	
-      } while (nextLine(fin, line, "END IONS", ""));
-    
-      if (!selected || !peakList->passFilter(m_params)) {
-	// not selected to be searched, or bad spectra, ignore
-	delete query;
-      } else {
-	
-	double retained = peakList->simplify(m_params.filterMaxPeaksUsed, m_params.filterMaxDynamicRange);
-    
-	FileName fn;
-	parseFileName(searchFileName, fn);
-	
-	// create the search based on what is read, then search
-	SpectraSTSearch* s = new SpectraSTSearch(query, m_params, m_outputs[fileIndex]);
-	s->search(m_lib);
-	
-	m_searchCount++; // counting searches in all mgf files
-	m_searchTaskStats.processSearch(s);
-	
-	pc.increment();
-
-	// print search result
-	s->print();
-	delete s;
-      }
+    } while ((hasLine = SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd)));
+    
+    double filterStartTime = SpectraSTStageStats::now();
+    stageStats.addTime(STAGE_PEAK_DECODE, filterStartTime - decodeStartTime);
+    
+    if (!selected || !peakList->passFilter(m_params)) {
+      // not selected to be searched, or bad spectra, ignore
+      delete query;
+    } else {
+      
+      double retained = peakList->simplify(m_params.filterMaxPeaksUsed, m_params.filterMaxDynamicRange);
+      queries.push_back(query);
     }
-
+    
+    stageStats.addTime(STAGE_FILTER, SpectraSTStageStats::now() - filterStartTime);
   }
-  m_outputs[fileIndex]->printFooter();
-  m_outputs[fileIndex]->closeFile();
-
+  
+  return (true);
 }
-
-
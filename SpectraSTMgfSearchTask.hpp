@@ -50,6 +50,7 @@ public:
 
 private:
   void searchOneFile(unsigned int fileIndex);
+  virtual bool parseQueries(const char* begin, const char* end, vector<SpectraSTQuery*>& queries);
 
 
 };
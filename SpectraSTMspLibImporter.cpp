@@ -3,9 +3,15 @@
 #include "FileUtils.hpp"
 #include "Peptide.hpp"
 #include "ProgressCount.hpp"
+#include "SpectraSTMappedFile.hpp"
 #include <iostream>
 #include <sstream>
 #include <stdlib.h>
+#include <time.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#include <sys/time.h>
+#endif
 
 
 /*
@@ -82,21 +88,41 @@ void SpectraSTMspLibImporter::import() {
   
 }
 
+// the number of records parsed at a time. With -c_PTH, the next batch is parsed while the current one is inserted.
+#define MSP_IMPORT_BATCH_SIZE 1000
+
+// a batch of records to be parsed, possibly in its own thread
+typedef struct _mspparsearg {
+  const char** cur;
+  const char* end;
+  vector<MspRecord>* records;
+  unsigned int numRecords;
+  bool wellFormed;
+} MspParseArg;
+
+// wallClockTime - returns the current time in seconds, for throughput reporting
+static double wallClockTime() {
+#ifndef _MSC_VER
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((double)(tv.tv_sec) + (double)(tv.tv_usec) / 1000000.0);
+#else
+  return ((double)(time(NULL)));
+#endif
+}
+
 // readFromCurFile - reads one .msp file
 void SpectraSTMspLibImporter::readFromFile(string& impFileName) {
   
-  ifstream fin;
+  SpectraSTMappedFile file(impFileName);
 
-  if (!myFileOpen(fin, impFileName)) {
+  if (!file.isOpen()) {
     g_log->error("MSP IMPORT", "Cannot open " + impFileName + " for reading msp-format (NIST) library");
     return;
   }
   
   g_log->log("MSP IMPORT", "Importing .msp file \"" + impFileName + "\"."); 
   
-  string line("");
-  string::size_type pos = 0;
-  
   if (g_verbose) {
     cout << "\nImporting spectra from .msp library file..." << endl;
   } 
@@ -105,289 +131,396 @@ void SpectraSTMspLibImporter::readFromFile(string& impFileName) {
   ProgressCount pc(!g_quiet && !g_verbose, 1000);
   pc.start("\nImporting spectra from .msp library file");
   
-  while (true) {
+  double startTime = wallClockTime();
+  unsigned int startCount = m_count;
+  
+  const char* cur = file.begin();
+  
+  // two batches: one being inserted, the other being parsed
+  vector<MspRecord> records[2];
+  MspParseArg args[2];
+  for (int b = 0; b < 2; b++) {
+    args[b].cur = &cur;
+    args[b].end = file.end();
+    args[b].records = &(records[b]);
+    args[b].numRecords = 0;
+    args[b].wellFormed = true;
+  }
+  
+  int b = 0;
+  parseRecordsInThread(&(args[b]));
+  
+  bool truncated = false;
+  
+  while (args[b].numRecords > 0 || !(args[b].wellFormed)) {
     
-    if (line.compare(0, 6, "Name: ") != 0) {
-      // first record, skips over all lines until the line with Name: 
-      while (nextLine(fin, line, "Name: ", ""));
-      if (line == "_EOF_") {
-        // empty file
-	break;
-      }
+    int next = 1 - b;
+    bool moreToParse = args[b].wellFormed && cur < file.end();
+    args[next].numRecords = 0;
+    args[next].wellFormed = true;
+    
+#ifndef _MSC_VER
+    pthread_t thread;
+    bool started = false;
+    if (moreToParse && m_params.importParseThread) {
+      started = (pthread_create(&thread, NULL, parseRecordsInThread, &(args[next])) == 0);
     }
+#endif
     
-    // line now starts with "Name: "
-    string name = nextToken(line, 5, pos, "\r\n");
-    double mw = 0.0;
-    double precursorMz = 0.0;
-    string comments;
-    while (nextLine(fin, line, "Num peaks: ", "")) {
-      // here are all the headers
-      if (line.compare(0, 3, "MW:") == 0) {
-        // only used for non-peptides. For peptide this will be calculated based on sequence.
-	mw = atof(nextToken(line, 3, pos, "\r\n").c_str());
-      } else if (line.compare(0, 12, "PrecursorMZ:") == 0) {
-	precursorMz = atof(nextToken(line, 12, pos, "\r\n").c_str());
-      } else if (line.compare(0, 8, "Comment:") == 0) {
-        comments = nextToken(line, 8, pos, "\r\n");
-      } else if (line.compare(0, 9, "NumPeaks:") == 0) {
-	// reach here because this .msp probably is converted from a .sptxt,
-	// hack the line (pad one char) so that the number of peaks will be correctly parsed later
-	line = " " + line;
-	break;	
-      } else if (line == "_EOF_" || line.compare(0, 5, "Name:") == 0) {
-        // reach the end unexpectedly, or see another name field before the Num peaks field. 
-        // ignore this incomplete record, and return
-        g_log->error("MSP IMPORT", "Badly formatted .msp file! Library creation truncated at point of error.");
-        pc.done();
-        return;
-      } else {
-        //        g_log->log("MSP IMPORT", "Unrecognized header field \"" + line + "\" ignored.");
+    for (unsigned int r = 0; r < args[b].numRecords && !truncated; r++) {
+      if (!insertRecord(records[b][r], pc)) {
+	truncated = true;
       }
     }
-    if (line == "_EOF_") {
-      // no "Num peaks:" field. ignore this incomplete record, and return
-      g_log->error("MSP IMPORT", "Badly formatted .msp file. Library creation truncated at point of error.");
+    
+#ifndef _MSC_VER
+    if (started) {
+      pthread_join(thread, NULL);
+    } else if (moreToParse) {
+      parseRecordsInThread(&(args[next]));
+    }
+#else
+    if (moreToParse) {
+      parseRecordsInThread(&(args[next]));
+    }
+#endif
+    
+    if (!truncated && !(args[b].wellFormed)) {
+      // reach the end unexpectedly, or see another name field before the Num peaks field. 
+      truncated = true;
+    }
+    
+    if (truncated) {
+      g_log->error("MSP IMPORT", "Badly formatted .msp file! Library creation truncated at point of error.");
       pc.done();
       return;
     }
     
+    b = next;
+  }
+  
+  stringstream countss1;
+  countss1 << "Total of " << m_count << " spectra imported.";
+  g_log->log("MSP IMPORT", countss1.str());
+  
+  double timeElapsed = wallClockTime() - startTime;
+  if (timeElapsed > 0.0) {
+    stringstream ratess;
+    ratess.precision(1);
+    ratess << fixed << "Read " << (double)(file.size()) / 1048576.0 << " MB in " << timeElapsed << " seconds (";
+    ratess << (double)(file.size()) / 1048576.0 / timeElapsed << " MB/s, " << (double)(m_count - startCount) / timeElapsed << " entries/s).";
+    g_log->log("MSP IMPORT", ratess.str());
+  }
+  
+  pc.done();
+  
+}
+
+// parseRecordsInThread - parses the next batch of records. Touches nothing but its argument and the mapped file.
+void* SpectraSTMspLibImporter::parseRecordsInThread(void* arg) {
+  
+  MspParseArg* a = (MspParseArg*)arg;
+  a->wellFormed = parseRecords(*(a->cur), a->end, *(a->records), a->numRecords);
+  return (NULL);
+}
+
+// parseRecords - parses up to MSP_IMPORT_BATCH_SIZE records starting at cur, into records (which are reused from
+// batch to batch to save on allocations). Moves cur past the records parsed. Returns false if it stops at a badly 
+// formatted record.
+bool SpectraSTMspLibImporter::parseRecords(const char*& cur, const char* end, vector<MspRecord>& records, unsigned int& numRecords) {
+  
+  numRecords = 0;
+  
+  const char* lineBegin = NULL;
+  const char* lineEnd = NULL;
+  const char* lineStart = cur;
+  
+  while (numRecords < MSP_IMPORT_BATCH_SIZE) {
     
+    // skips over all lines until the line with Name: 
+    lineStart = cur;
+    if (!SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd)) {
+      break;
+    }
+    if (!SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Name: ")) {
+      continue;
+    }
     
-    if (g_verbose) {
-      cout << "Importing record #" << m_count << ": " << name << endl;
+    if (records.size() <= numRecords) {
+      records.resize(numRecords + 1);
     }
+    MspRecord& record = records[numRecords];
+    
+    // line now starts with "Name: "
+    const char* p = SpectraSTMappedFile::skipOver(lineBegin + 5, lineEnd, " \t\r\n");
+    record.name.assign(p, SpectraSTMappedFile::findDelim(p, lineEnd, "\r\n"));
+    record.mw = 0.0;
+    record.precursorMz = 0.0;
+    record.comments.clear();
+    record.peaks.clear();
     
-    string mods("");
-    string::size_type modsPos = 0;
-    if ((modsPos = comments.find("Mods=", 0)) != string::npos) {
-      if (modsPos + 5 > comments.length() - 1) {
-        g_log->error("MSP IMPORT", "Badly formatted .msp file. Library creation truncated at point of error.");
-        pc.done();
-        return;
+    // here are all the headers
+    bool hasNumPeaks = false;
+    while (SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd)) {
+      if (lineBegin == lineEnd) {
+	// skip blank lines
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Num peaks: ") || 
+		 SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "NumPeaks:")) {
+	// (NumPeaks: if this .msp probably is converted from a .sptxt)
+	hasNumPeaks = true;
+	break;
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "MW:")) {
+        // only used for non-peptides. For peptide this will be calculated based on sequence.
+	record.mw = SpectraSTMappedFile::parseDouble(lineBegin + 3, lineEnd);
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "PrecursorMZ:")) {
+	record.precursorMz = SpectraSTMappedFile::parseDouble(lineBegin + 12, lineEnd);
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Comment:")) {
+	p = SpectraSTMappedFile::skipOver(lineBegin + 8, lineEnd, " \t\r\n");
+	record.comments.assign(p, SpectraSTMappedFile::findDelim(p, lineEnd, "\r\n"));
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Name:")) {
+        // see another name field before the Num peaks field. 
+	return (false);
       }
-      mods = nextToken(comments, modsPos + 5, modsPos, " \t\r\n");		
+    }
+    if (!hasNumPeaks) {
+      // no "Num peaks:" field. ignore this incomplete record, and return
+      return (false);
     }
     
-    // parse out full name
-    string fullName("");
-    string::size_type fullNamePos = 0;
-    if ((fullNamePos = comments.find("Fullname=", 0)) != string::npos) {
-      if (fullNamePos + 9 > comments.length() - 1) {
-        g_log->error("MSP IMPORT", "Badly formatted .msp file. Library creation truncated at point of error.");
-        pc.done();
-        return;
+    // here are the peaks, until the next "Name: " line
+    while (true) {
+      lineStart = cur;
+      if (!SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd)) {
+	break;
       }
-      fullName = nextToken(comments, fullNamePos + 9, fullNamePos, " \t\r\n");		
-    } else {
-      // can't find it. just use name
-      fullName = name;
+      if (lineBegin == lineEnd) continue;
+      if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Name: ")) {
+	// leave it for the next record
+	cur = lineStart;
+	break;
+      }
+      
+      MspPeak peak;
+      
+      const char* mzEnd = SpectraSTMappedFile::findDelim(SpectraSTMappedFile::skipOver(lineBegin, lineEnd, " \t\r\n"), lineEnd, " \t\r\n");
+      peak.mz = SpectraSTMappedFile::parseDouble(lineBegin, mzEnd);
+      
+      const char* intensityBegin = SpectraSTMappedFile::skipOver(mzEnd, lineEnd, " \t\r\n");
+      const char* intensityEnd = SpectraSTMappedFile::findDelim(intensityBegin, lineEnd, " \t\r\n");
+      peak.intensity = (float)(SpectraSTMappedFile::parseDouble(intensityBegin, intensityEnd));
+      
+      // annotation has quotes around it. The part up to the first space or tab is the real annotation,
+      // the rest is info
+      const char* quoted = SpectraSTMappedFile::skipOver(intensityEnd, lineEnd, "\"\t");
+      const char* quotedEnd = SpectraSTMappedFile::findDelim(quoted, lineEnd, "\"\r\n");
+      peak.annotation = quoted;
+      peak.annotationEnd = SpectraSTMappedFile::findDelim(quoted, quotedEnd, " \t");
+      if (peak.annotationEnd < quotedEnd) {
+	peak.info = SpectraSTMappedFile::skipOver(peak.annotationEnd + 1, quotedEnd, " \t");
+      } else {
+	peak.info = quotedEnd;
+      }
+      peak.infoEnd = quotedEnd;
+      
+      record.peaks.push_back(peak);
     }
     
-    // to avoid trouble, removes the '(O)' piece for methionine oxidation (mods should take care of it anyway)
-    string::size_type openParenPos = fullName.find("(O)");
-    
-    if (openParenPos != string::npos) {
-      string fixedFullName("");
-      do {
-        fixedFullName += fullName.substr(0, openParenPos);
-        fullName = fullName.substr(openParenPos + 3);
-        openParenPos = fullName.find("(O)");
-      } while (openParenPos != string::npos);
-      
-      fullName = fixedFullName + fullName;
+    numRecords++;
+  }
+  
+  return (true);
+}
+
+// insertRecord - makes a library entry out of a parsed record, and inserts it into the library if it passes all filters.
+// Returns false if the record is badly formatted.
+bool SpectraSTMspLibImporter::insertRecord(MspRecord& record, ProgressCount& pc) {
+  
+  string& name = record.name;
+  double mw = record.mw;
+  double precursorMz = record.precursorMz;
+  string& comments = record.comments;
+  
+  if (g_verbose) {
+    cout << "Importing record #" << m_count << ": " << name << endl;
+  }
+  
+  string mods("");
+  string::size_type modsPos = 0;
+  if ((modsPos = comments.find("Mods=", 0)) != string::npos) {
+    if (modsPos + 5 > comments.length() - 1) {
+      return (false);
+    }
+    mods = nextToken(comments, modsPos + 5, modsPos, " \t\r\n");		
+  }
+  
+  // parse out full name
+  string fullName("");
+  string::size_type fullNamePos = 0;
+  if ((fullNamePos = comments.find("Fullname=", 0)) != string::npos) {
+    if (fullNamePos + 9 > comments.length() - 1) {
+      return (false);
     }
+    fullName = nextToken(comments, fullNamePos + 9, fullNamePos, " \t\r\n");		
+  } else {
+    // can't find it. just use name
+    fullName = name;
+  }
+  
+  // to avoid trouble, removes the '(O)' piece for methionine oxidation (mods should take care of it anyway)
+  string::size_type openParenPos = fullName.find("(O)");
+  
+  if (openParenPos != string::npos) {
+    string fixedFullName("");
+    do {
+      fixedFullName += fullName.substr(0, openParenPos);
+      fullName = fullName.substr(openParenPos + 3);
+      openParenPos = fullName.find("(O)");
+    } while (openParenPos != string::npos);
     
-    SpectraSTLibEntry* entry = NULL;
+    fullName = fixedFullName + fullName;
+  }
+  
+  SpectraSTLibEntry* entry = NULL;
+  
+  if (fullName[0] == '_') {
     
-    if (fullName[0] == '_') {
-      
-      if (precursorMz < 0.001) {
-	// no precursor m/z specified,
-        unsigned int charge = 0;
-        string::size_type slashPos = fullName.rfind('/');
-        if (slashPos != string::npos && slashPos < fullName.length() - 1) {
-          charge = atoi(fullName.substr(slashPos + 1).c_str());
-        }
-	// try to calculate from MW and charge
-        if (charge > 0) {
-	  precursorMz = mw / (double)charge;
-	} else {
-	  precursorMz = mw;
-	}
+    if (precursorMz < 0.001) {
+      // no precursor m/z specified,
+      unsigned int charge = 0;
+      string::size_type slashPos = fullName.rfind('/');
+      if (slashPos != string::npos && slashPos < fullName.length() - 1) {
+	charge = atoi(fullName.substr(slashPos + 1).c_str());
       }
-
-      entry = new SpectraSTLibEntry(fullName, precursorMz, comments, "Normal", NULL);
+      // try to calculate from MW and charge
+      if (charge > 0) {
+	precursorMz = mw / (double)charge;
+      } else {
+	precursorMz = mw;
+      }
+    }
     
-    } else {
+    entry = new SpectraSTLibEntry(fullName, precursorMz, comments, "Normal", NULL);
+    
+  } else {
+    
+    Peptide* pep = new Peptide(fullName, 0, mods);
+    
+    // check legality of peptide and mod strings -- will not insert later if illegal (parsing will continue anyway)
+    if (pep->illegalMspModStr) {
+      g_log->error("MSP IMPORT", "Illegal modification string : \"" + mods + "\". Entry skipped.");
+    }
+    if (pep->illegalPeptideStr) {
+      g_log->error("MSP IMPORT", "Illegal peptide ID string: \"" + fullName + "\". Entry skipped.");
+    }
+    
+    // create the entry - without the peak list yet
+    entry = new SpectraSTLibEntry(pep, comments, "Normal", NULL);
+    
+    stringstream nttss;
+    nttss << pep->NTT();
+    entry->setOneComment("NTT", nttss.str());
+    
+    stringstream nmcss;
+    nmcss << pep->NMC();
+    entry->setOneComment("NMC", nmcss.str());
+    
+    stringstream naass;
+    naass << pep->NAA();
+    entry->setOneComment("NAA", naass.str());
+    
+    
+    // NIST's format for the protein string is a mess. Instead of trying to parse it and make sense out of it,
+    // we'll just take the first word as our protein and ignore the rest. To preserve the information however,
+    // we will dump that messy protein string entirely into a new attribute called "NISTProtein"
+    
+    // This has the unfortunate effect that all peptides will appear to map to a single protein, while in reality
+    // it may be multi-mapping. But since NIST doesn't use nonredundant databases, it's impossible anyway to tell whether
+    // a peptide maps to several different proteins, or to the same protein with different names.
+    string proteinStr("");
+    if (entry->getOneComment("Protein", proteinStr)) {
       
-      Peptide* pep = new Peptide(fullName, 0, mods);
-
-      // check legality of peptide and mod strings -- will not insert later if illegal (parsing will continue anyway)
-      if (pep->illegalMspModStr) {
-	g_log->error("MSP IMPORT", "Illegal modification string : \"" + mods + "\". Entry skipped.");
-      }
-      if (pep->illegalPeptideStr) {
-	g_log->error("MSP IMPORT", "Illegal peptide ID string: \"" + fullName + "\". Entry skipped.");
-      }
-
-      // create the entry - without the peak list yet
-      entry = new SpectraSTLibEntry(pep, comments, "Normal", NULL);
-
-      stringstream nttss;
-      nttss << pep->NTT();
-      entry->setOneComment("NTT", nttss.str());
+      entry->setOneComment("NISTProtein", proteinStr);
       
-      stringstream nmcss;
-      nmcss << pep->NMC();
-      entry->setOneComment("NMC", nmcss.str());
-
-      stringstream naass;
-      naass << pep->NAA();
-      entry->setOneComment("NAA", naass.str());
-
-
-      // NIST's format for the protein string is a mess. Instead of trying to parse it and make sense out of it,
-      // we'll just take the first word as our protein and ignore the rest. To preserve the information however,
-      // we will dump that messy protein string entirely into a new attribute called "NISTProtein"
-	  
-      // This has the unfortunate effect that all peptides will appear to map to a single protein, while in reality
-      // it may be multi-mapping. But since NIST doesn't use nonredundant databases, it's impossible anyway to tell whether
-      // a peptide maps to several different proteins, or to the same protein with different names.
-      string proteinStr("");
-      if (entry->getOneComment("Protein", proteinStr)) {
-	
-	entry->setOneComment("NISTProtein", proteinStr);
-
+      string::size_type spacePos = 0;
+      string firstProtein = nextToken(proteinStr, 0, spacePos, " \t\r\n", " ");
+      entry->setOneComment("Protein", "1/" + firstProtein);
+      
+      /*
+      
+      int proCount = 0;
+      string::size_type semiPos = 0;
+      string pro("");
+      string newProtein("");
+      while (!((pro = nextToken(proteinStr, semiPos, semiPos, ";\t\r\n", "; ")).empty())) {
 	string::size_type spacePos = 0;
-	string firstProtein = nextToken(proteinStr, 0, spacePos, " \t\r\n", " ");
-	entry->setOneComment("Protein", "1/" + firstProtein);
-
-	/*
-
-	int proCount = 0;
-	string::size_type semiPos = 0;
-	string pro("");
-	string newProtein("");
-	while (!((pro = nextToken(proteinStr, semiPos, semiPos, ";\t\r\n", "; ")).empty())) {
-	  string::size_type spacePos = 0;
-	  string shortPro = nextToken(pro, 0, spacePos, " \t\r\n", " ");
+	string shortPro = nextToken(pro, 0, spacePos, " \t\r\n", " ");
   //       if (shortPro.find("|sp|") != string::npos) {
-	    newProtein += "/" + shortPro; 
-	    proCount++;
+	  newProtein += "/" + shortPro; 
+	  proCount++;
   //       }
-	}
-	
-	if (proCount > 0) {
-	  stringstream newProteinss;
-	  newProteinss << proCount << newProtein;
-	  entry->setOneComment("Protein", newProteinss.str());
-    //    } else {
-    //      entry->setOneComment("Protein", "UNMAPPED_TO_SP");
-	}
-
-	*/
       }
       
-      string tfRatioStr("");
-      string::size_type tfRatioPos = 0;
-      if ((tfRatioPos = comments.find("Tfratio=", 0)) != string::npos) {
-	if (tfRatioPos + 8 > comments.length() - 1) {
-	  g_log->error("MSP IMPORT", "Badly formatted .msp file. Library creation truncated at point of error.");
-	  pc.done();
-	  return;
-	}
-	tfRatioStr = nextToken(comments, tfRatioPos + 8, tfRatioPos, " \t\r\n");
-	double tfRatio = atof(tfRatioStr.c_str());
-	double prob = tfRatio / (1.0 + tfRatio);
-	stringstream probss;
-	probss.precision(4);
-	probss << fixed << prob;
-	entry->setOneComment("Prob", probss.str());
-	
-      } else {
-	entry->setOneComment("Prob", "1.0000"); // somehow can't find Tfratio. Make it Prob=1.0...
+      if (proCount > 0) {
+	stringstream newProteinss;
+	newProteinss << proCount << newProtein;
+	entry->setOneComment("Protein", newProteinss.str());
+    //    } else {
+    //      entry->setOneComment("Protein", "UNMAPPED_TO_SP");
       }
       
-      entry->getPeakList()->setNoiseFilterThreshold(m_params.rawSpectraNoiseThreshold);    
-      
+      */
     }
     
-    if (!(m_params.setFragmentation.empty())) {
-      entry->setFragType(m_params.setFragmentation);
-    } else {
-      string fragType("CID");
-      entry->setFragType(fragType); // default to CID -- better than leaving it blank!
-    }
-
-    // line now starts with "Num peaks: "
-    int numPeaks = atoi((nextToken(line, 10, pos, "\r\n")).c_str());
-    
-    while (nextLine(fin, line, "Name: ", "")) {
-      if (line == "_EOF_") {
-        if (passAllFilters(entry)) { 
-          pc.increment();
-          m_count++;
-          			
-          entry->annotatePeaks(true);
-          m_lib->insertEntry(entry); 
-            
-        }
-        
+    string tfRatioStr("");
+    string::size_type tfRatioPos = 0;
+    if ((tfRatioPos = comments.find("Tfratio=", 0)) != string::npos) {
+      if (tfRatioPos + 8 > comments.length() - 1) {
 	delete entry;
- 
-        stringstream countss;
-        countss << "Total of " << m_count << " spectra imported.";
-        g_log->log("MSP IMPORT", countss.str());
-        pc.done();
-        return;
-	
+	return (false);
       }
-      // here are the peaks		
-      double mz = atof((nextToken(line, 0, pos)).c_str());
-      // pos1 now stores the position of the first space after the mz
-      float intensity = atof((nextToken(line, pos, pos)).c_str());
-      // pos2 now stores the position of the first space after the intensity
-      
-      // annotation has quotes around it, remove them by adding the quote char to the skipover and delimiter strings passed into nextToken
-      string annotation = nextToken(line, pos, pos, "\"\r\n", "\"\t");
+      tfRatioStr = nextToken(comments, tfRatioPos + 8, tfRatioPos, " \t\r\n");
+      double tfRatio = atof(tfRatioStr.c_str());
+      double prob = tfRatio / (1.0 + tfRatio);
+      stringstream probss;
+      probss.precision(4);
+      probss << fixed << prob;
+      entry->setOneComment("Prob", probss.str());
       
-      // break annotation into real annotation and info
-      string info("");
-      
-      string::size_type spacePos = annotation.find_first_of(" \t", 0);
-      string::size_type dummyPos = 0;
-      if (spacePos != string::npos) {
-        info = nextToken(annotation, spacePos + 1, dummyPos, "\r\n", " \t");
-        annotation = annotation.substr(0, spacePos);
-      }
-      // annotation will get an empty string if there's no annotation
-      entry->getPeakList()->insert(mz, intensity, annotation, info);
-    }	
-    
-    if (passAllFilters(entry)) { 
-
-      pc.increment();
-      m_count++;	
-      		
-      entry->annotatePeaks(true);
-      m_lib->insertEntry(entry); 
+    } else {
+      entry->setOneComment("Prob", "1.0000"); // somehow can't find Tfratio. Make it Prob=1.0...
     }
     
-    delete entry;
-    
+    entry->getPeakList()->setNoiseFilterThreshold(m_params.rawSpectraNoiseThreshold);    
     
   }
   
-  stringstream countss1;
-  countss1 << "Total of " << m_count << " spectra imported.";
-  g_log->log("MSP IMPORT", countss1.str());
+  if (!(m_params.setFragmentation.empty())) {
+    entry->setFragType(m_params.setFragmentation);
+  } else {
+    string fragType("CID");
+    entry->setFragType(fragType); // default to CID -- better than leaving it blank!
+  }
   
-  pc.done();
+  SpectraSTPeakList* peakList = entry->getPeakList();
+  string annotation("");
+  string info("");
+  for (vector<MspPeak>::iterator pk = record.peaks.begin(); pk != record.peaks.end(); pk++) {
+    // annotation will get an empty string if there's no annotation
+    annotation.assign(pk->annotation, pk->annotationEnd);
+    info.assign(pk->info, pk->infoEnd);
+    peakList->insert(pk->mz, pk->intensity, annotation, info);
+  }
+  
+  if (passAllFilters(entry)) { 
+    
+    pc.increment();
+    m_count++;	
+    
+    entry->annotatePeaks(true);
+    m_lib->insertEntry(entry); 
+  }
   
+  delete entry;
+  
+  return (true);
 }
-
-
-
-
-
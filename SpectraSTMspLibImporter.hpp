@@ -2,6 +2,9 @@
 #define SPECTRASTMSPLIBIMPORTER_HPP_
 
 #include "SpectraSTLibImporter.hpp"
+#include "ProgressCount.hpp"
+#include <string>
+#include <vector>
 
 /*
 
@@ -41,6 +44,25 @@ hlam@systemsbiology.org
  */
 
 
+// one peak of an .msp record. The annotation and info are left in the (mapped) file until the entry is made.
+typedef struct {
+  double mz;
+  float intensity;
+  const char* annotation;
+  const char* annotationEnd;
+  const char* info;
+  const char* infoEnd;
+} MspPeak;
+
+// one record of an .msp file, parsed but not yet made into a library entry
+typedef struct {
+  string name;
+  double mw;
+  double precursorMz;
+  string comments;
+  vector<MspPeak> peaks;
+} MspRecord;
+
 class SpectraSTMspLibImporter : public SpectraSTLibImporter { 
 
 public:
@@ -52,6 +74,9 @@ public:
 private:
 
   void readFromFile(string& impFileName);
+  bool insertRecord(MspRecord& record, ProgressCount& pc);
+  static bool parseRecords(const char*& cur, const char* end, vector<MspRecord>& records, unsigned int& numRecords);
+  static void* parseRecordsInThread(void* arg);
   unsigned int m_count;
 
 
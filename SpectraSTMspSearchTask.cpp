@@ -3,9 +3,11 @@
 #include "SpectraSTQuery.hpp"
 #include "SpectraSTLog.hpp"
 #include "SpectraSTConstants.hpp"
+#include "SpectraSTStageStats.hpp"
 #include "FileUtils.hpp"
 #include "Peptide.hpp"
 #include "ProgressCount.hpp"
+#include "SpectraSTMappedFile.hpp"
 
 
 /*
@@ -73,54 +75,32 @@ void SpectraSTMspSearchTask::search() {
 // searchOneFile - search one msp file
 void SpectraSTMspSearchTask::searchOneFile(unsigned int fileIndex) {
   
-  string searchFileName(m_searchFileNames[fileIndex]);
-  
-  ifstream fin;
-  if (!myFileOpen(fin, searchFileName)) {
-    g_log->error("SEARCH", "Cannot open MSP file \"" + searchFileName + " for reading query spectra. File Skipped.");
-    return;
-  }	
+  searchMappedFile(fileIndex, "Name: ", "MSP");
+}
+
+// parseQueries - parses the msp records in [begin, end) into queries. Lines are parsed in place in the mapped file.
+bool SpectraSTMspSearchTask::parseQueries(const char* begin, const char* end, vector<SpectraSTQuery*>& queries) {
   
-  m_outputs[fileIndex]->openFile();
-  m_outputs[fileIndex]->printHeader();
+  const char* cur = begin;
+  const char* lineBegin = NULL;
+  const char* lineEnd = NULL;
   
-  string line("");
-  string::size_type pos = 0;
+  // this may run in a parse thread; the stage times go to the stats of that thread
+  SpectraSTStageStats& stageStats = SpectraSTStageStats::local();
   
-  if (g_verbose) {
-    cout << "Searching query spectra in file \"" << searchFileName << "\" ..." << endl;
-  }
+  bool hasLine = SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd);
   
-  ProgressCount pc(!g_quiet && !g_verbose, 200);
-  string msg("Searching query spectra in file \"");
-  msg += searchFileName + "\"";
-  pc.start(msg);
-  
-  while (true) {
-    
-    if (line == "_EOF_") {
-      // no more record
-      pc.done();
-      m_outputs[fileIndex]->printFooter();
-      m_outputs[fileIndex]->closeFile();
-      return;
-    }
+  while (hasLine) {
     
-    // skips over all lines until the line with Name: (will stop when it reaches either "Name:" or the end-of-file) 
-    if (line.compare(0, 6, "Name: ") != 0) {	
-      while (nextLine(fin, line, "Name: ", ""));
-      if (line == "_EOF_") {
-	// no more record
-	pc.done();
-        m_outputs[fileIndex]->printFooter();
-        m_outputs[fileIndex]->closeFile();
-	return;
-      }
+    // skips over all lines until the line with Name: 
+    if (!SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Name: ")) {
+      hasLine = SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd);
+      continue;
     }
     
-    
-    // line should now start with "Name: "
-    string name = nextToken(line, 5, pos, "\r\n");
+    // line now starts with "Name: "
+    const char* p = SpectraSTMappedFile::skipOver(lineBegin + 5, lineEnd, " \t\r\n");
+    string name(p, SpectraSTMappedFile::findDelim(p, lineEnd, "\r\n"));
     
     bool selected;	
     if (!m_searchAll) {
@@ -132,52 +112,51 @@ void SpectraSTMspSearchTask::searchOneFile(unsigned int fileIndex) {
       selected = true;
     }
     
-    
     double mw = 0.0;
     double precursorMz = 0.0;
     string comments("");
     int charge = 0;
+    const char* numPeaksStr = NULL;
     
     // read the rest of the header fields until Num peaks:
-    while (nextLine(fin, line, "Num peaks: ", "")) {
-      if (line.compare(0, 3, "MW:") == 0) {
-	mw = atof((nextToken(line, 3, pos, "\r\n")).c_str());				
-      } else if (line.compare(0, 8, "Comment:") == 0) {
-	comments = nextToken(line, 8, pos, "\r\n");
-      } else if (line.compare(0, 12, "PrecursorMZ:") == 0) {
-	precursorMz = atof((nextToken(line, 12, pos, "\r\n")).c_str());
-      } else if (line.compare(0, 7, "Charge:") == 0) {
-	charge = atoi((nextToken(line, 7, pos, "\r\n")).c_str());		
-      } else if (line.compare(0, 9, "NumPeaks:") == 0) {
-	// reach here because this .msp probably is converted from a .sptxt,
-	// hack the line (pad one char) so that the number of peaks will be correctly parsed later
-	line = " " + line;
+    while ((hasLine = SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd))) {
+      if (lineBegin == lineEnd) {
+	// skip blank lines
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Num peaks: ")) {
+	numPeaksStr = lineBegin + 10;
+	break;
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "MW:")) {
+	mw = SpectraSTMappedFile::parseDouble(lineBegin + 3, lineEnd);
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Comment:")) {
+	p = SpectraSTMappedFile::skipOver(lineBegin + 8, lineEnd, " \t\r\n");
+	comments.assign(p, SpectraSTMappedFile::findDelim(p, lineEnd, "\r\n"));
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "PrecursorMZ:")) {
+	precursorMz = SpectraSTMappedFile::parseDouble(lineBegin + 12, lineEnd);
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Charge:")) {
+	charge = SpectraSTMappedFile::parseInt(lineBegin + 7, lineEnd);
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "NumPeaks:")) {
+	// reach here because this .msp probably is converted from a .sptxt
+	numPeaksStr = lineBegin + 9;
 	break;		
-      } else if (line.compare(0, 7, "Status:") == 0 || 
-		 line.compare(0, 9, "FullName:") == 0 || 
-		 line.compare(0, 6, "LibID:") == 0) {
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Status:") || 
+		 SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "FullName:") || 
+		 SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "LibID:")) {
 	// reach here because this .msp probably is converted from a .sptxt,
 	// just ignore this line	
-      } else if (line == "_EOF_" || line.compare(0, 5, "Name:") == 0) {
-	// reach the end unexpectedly, or see another name field before the Num peaks field. 
+      } else if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Name:")) {
+	// see another name field before the Num peaks field. 
 	// ignore this incomplete record, and return
-	cerr << "\nBadly formatted .msp file! Library creation truncated." << endl;	
-	return;
+	return (false);
       } else {
 	cerr << "Unrecognized header field. Ignored." << endl;
       }
     }
     
-    if (line == "_EOF_") {
+    if (!hasLine) {
       // no "Num peaks:" field. ignore this incomplete record, and return
-      cerr << "\nBadly formatted .msp file! Library creation truncated." << endl;	
-      m_outputs[fileIndex]->printFooter();
-      m_outputs[fileIndex]->closeFile();
-
-      return;
+      return (false);
     }
     
-    
     if (precursorMz < 0.0001) {
       // Precursor m/z not specified as a header field, try to find it in the comments
       string::size_type parentPos = comments.find("Parent", 0);
@@ -194,8 +173,12 @@ void SpectraSTMspSearchTask::searchOneFile(unsigned int fileIndex) {
       }
     }
     
-    // line now starts with "Num peaks: "
-    int numPeaks = atoi((nextToken(line, 10, pos, "\r\n")).c_str());
+    if (selected && !m_searchAll && !m_selection.isPrecursorSelected(precursorMz, -1.0)) {
+      // outside the precursor m/z windows of the selected list (the retention time is not known here)
+      selected = false;
+    }
+    
+    int numPeaks = SpectraSTMappedFile::parseInt(numPeaksStr, lineEnd);
     
     SpectraSTPeakList* peakList = new SpectraSTPeakList(precursorMz, charge, numPeaks);
     peakList->setNoiseFilterThreshold(m_params.filterRemovePeakIntensityThreshold);
@@ -210,62 +193,49 @@ void SpectraSTMspSearchTask::searchOneFile(unsigned int fileIndex) {
     
     SpectraSTQuery* query = new SpectraSTQuery(name, precursorMz, charge, comments, peakList);
     
-    while (nextLine(fin, line, "Name: ", "")) { // will stop when it reaches the next "Name:" or end-of-file
+    double decodeStartTime = SpectraSTStageStats::now();
+    
+    while ((hasLine = SpectraSTMappedFile::nextLine(cur, end, lineBegin, lineEnd))) { // will stop when it reaches the next "Name:" or end-of-file
+      
+      if (lineBegin == lineEnd) continue;
+      if (SpectraSTMappedFile::startsWith(lineBegin, lineEnd, "Name: ")) break;
       
       // here are the peaks		
-      double mz = atof((nextToken(line, 0, pos)).c_str());
-      // pos1 now stores the position of the first space after the mz
-      float intensity = (float)(atof((nextToken(line, pos, pos)).c_str()));
-      // pos2 now stores the position of the first space after the intensity
+      const char* mzStart = SpectraSTMappedFile::skipOver(lineBegin, lineEnd, " \t\r\n");
+      const char* mzEnd = SpectraSTMappedFile::findDelim(mzStart, lineEnd, " \t\r\n");
+      double mz = SpectraSTMappedFile::parseDouble(mzStart, mzEnd);
       
-      // annotation has quotes around it, remove them by adding the quote char to the skipover and delimiter strings passed into nextToken
-      string annotation = nextToken(line, pos, pos, "\"\r\n", "\"\t");
+      const char* intensityStart = SpectraSTMappedFile::skipOver(mzEnd, lineEnd, " \t\r\n");
+      const char* intensityEnd = SpectraSTMappedFile::findDelim(intensityStart, lineEnd, " \t\r\n");
+      float intensity = (float)(SpectraSTMappedFile::parseDouble(intensityStart, intensityEnd));
       
-      string info("");
+      // annotation has quotes around it, remove them. Only the part before the first space is the annotation,
+      // the rest is info, which is not needed for searching
+      const char* annotationStart = SpectraSTMappedFile::skipOver(intensityEnd, lineEnd, "\"\t");
+      const char* annotationEnd = SpectraSTMappedFile::findDelim(annotationStart, lineEnd, "\"\r\n");
+      annotationEnd = SpectraSTMappedFile::findDelim(annotationStart, annotationEnd, " \t");
       
-      string::size_type spacePos = annotation.find_first_of(" \t", 0);
-      string::size_type dummyPos = 0;
-      if (spacePos != string::npos) {
-	info = nextToken(annotation, spacePos + 1, dummyPos, "\r\n", " \t");
-	annotation = annotation.substr(0, spacePos);
-      }
       // annotation will get an empty string if there's no annotation
-      peakList->insertForSearch(mz, intensity, annotation);
-      
+      peakList->insertForSearch(mz, intensity, string(annotationStart, annotationEnd));
       
     }	
     
+    double filterStartTime = SpectraSTStageStats::now();
+    stageStats.addTime(STAGE_PEAK_DECODE, filterStartTime - decodeStartTime);
+    
     if (!selected || !peakList->passFilter(m_params)) {
       // not selected to be searched, or bad spectra, ignore
       delete query;
     } else {
       
-//      if (m_params.filterMaxPeaksUsed <= 50) {
-//        double retained = peakList->simplify(m_params.filterMaxPeaksUsed, m_params.filterMaxDynamicRange, true, true);
-//      } else {
-        double retained = peakList->simplify(m_params.filterMaxPeaksUsed, m_params.filterMaxDynamicRange);
-//      }
-        
-      FileName fn;
-      parseFileName(searchFileName, fn);
-      
-      // create the search based on what is read, then search
-      SpectraSTSearch* s = new SpectraSTSearch(query, m_params, m_outputs[fileIndex]);
-      s->search(m_lib);
-      
-      m_searchCount++; // counting searches in all msp files
-      m_searchTaskStats.processSearch(s);
-      
-      pc.increment();
-      
-      // print search result
-      s->print();
-      delete s;
+      double retained = peakList->simplify(m_params.filterMaxPeaksUsed, m_params.filterMaxDynamicRange);
+      queries.push_back(query);
     }
     
+    stageStats.addTime(STAGE_FILTER, SpectraSTStageStats::now() - filterStartTime);
+    
   }
-  m_outputs[fileIndex]->printFooter();
-  m_outputs[fileIndex]->closeFile();
-
+  
+  return (true);
 }
 
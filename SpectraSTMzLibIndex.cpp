@@ -67,7 +67,9 @@ SpectraSTMzLibIndex::SpectraSTMzLibIndex(string idxFileName) :
   m_curBin(0),
   m_curOffset(-1),
   m_sortedOffsets(NULL),
-  m_curSortedOffset(-1) {
+  m_curSortedOffset(-1),
+  m_filter(NULL),
+  m_filterSkipCount(0) {
   
   initialize();
   
@@ -85,7 +87,9 @@ SpectraSTMzLibIndex::SpectraSTMzLibIndex(string idxFileName, ifstream* libFinPtr
   m_curBin(0),
   m_curOffset(-1),
   m_sortedOffsets(NULL),
-  m_curSortedOffset(-1) {
+  m_curSortedOffset(-1),
+  m_filter(NULL),
+  m_filterSkipCount(0) {
   
   initialize();
   readFromFile();
@@ -257,16 +261,24 @@ void SpectraSTMzLibIndex::freeCacheBin(unsigned int bin) {
   }
 }
 
-// nextEntry - sequential access of the m/z index. returns NULL if there's no more entry left.
+// nextEntry - sequential access of the m/z index. returns NULL if there's no more entry left. If a filter is set
+// by setPrecursorMzFilter, the bins that cannot have an entry satisfying it are skipped.
 SpectraSTLibEntry* SpectraSTMzLibIndex::nextEntry() {
 
   m_curOffset++;
 
-  while (m_curOffset >= (int)(m_offsets[m_curBin].size())) {
-    m_curBin++;
-    m_curOffset = 0;
-    if (m_curBin >= (unsigned int)m_offsets.size()) {
-      return NULL;
+  while (true) {
+    if (m_curOffset >= (int)(m_offsets[m_curBin].size())) {
+      m_curBin++;
+      m_curOffset = 0;
+      if (m_curBin >= (unsigned int)m_offsets.size()) {
+        return NULL;
+      }
+    } else if (m_curOffset == 0 && m_filter && !binMayPassFilter(m_curBin)) {
+      m_filterSkipCount += (unsigned int)(m_offsets[m_curBin].size());
+      m_curOffset = (int)(m_offsets[m_curBin].size());
+    } else {
+      break;
     }
   }
 
@@ -278,6 +290,32 @@ SpectraSTLibEntry* SpectraSTMzLibIndex::nextEntry() {
 
 }
 
+// retrieveBinHeaders - reads the entries of a bin, in file offset order, without their peaks (or for a binary library,
+// their comments). Unlike retrieve(), the cache is not used, and the returned entries become property of the caller.
+void SpectraSTMzLibIndex::retrieveBinHeaders(unsigned int binNum, vector<SpectraSTLibEntry*>& entries) {
+
+  if (binNum >= (unsigned int)(m_offsets.size())) {
+    return;
+  }
+
+  for (vector<fstream::off_type>::iterator offset = (m_offsets[binNum]).begin(); offset != (m_offsets[binNum]).end(); offset++) {
+    m_libFinPtr->seekg(*offset);
+    SpectraSTLibEntry* newEntry = new SpectraSTLibEntry(*m_libFinPtr, m_binaryLib, false, true);
+    newEntry->setLibFileOffset(*offset);
+    entries.push_back(newEntry);
+  }
+}
+
+// readEntry - reads the entry at the file offset in full. The returned entry becomes property of the caller.
+SpectraSTLibEntry* SpectraSTMzLibIndex::readEntry(fstream::off_type offset) {
+
+  m_libFinPtr->seekg(offset);
+  SpectraSTLibEntry* newEntry = new SpectraSTLibEntry(*m_libFinPtr, m_binaryLib);
+  newEntry->setLibFileOffset(offset);
+
+  return (newEntry);
+}
+
 bool SpectraSTMzLibIndex::nextFileOffset(fstream::off_type& offset) {
   
   m_curOffset++;
@@ -450,6 +488,17 @@ unsigned int SpectraSTMzLibIndex::calcBinMz(unsigned int binNum) {
   return (binNum + MIN_MZ);
 }
 
+// binMayPassFilter - checks if an entry in the bin can satisfy m_filter, from its precursor m/z range alone. The first 
+// and last bins also hold everything below and above the m/z range, and the range is padded a little for the precursor 
+// m/z's being rounded when the .splib is written.
+bool SpectraSTMzLibIndex::binMayPassFilter(unsigned int binNum) {
+
+  double lowMz = (binNum == 0) ? -1.0e30 : (double)(calcBinMz(binNum)) - 0.01;
+  double highMz = (binNum >= (unsigned int)(MAX_MZ - MIN_MZ)) ? 1.0e30 : (double)(calcBinMz(binNum)) + 1.01;
+
+  return (m_filter->mayBeSatisfiedByPrecursorMzRange(lowMz, highMz));
+}
+
 // initialize - simply clear the bins and the cache
 void SpectraSTMzLibIndex::initialize() {
   
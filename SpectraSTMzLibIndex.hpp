@@ -3,6 +3,7 @@
 
 #include "SpectraSTLibEntry.hpp"
 #include "SpectraSTLibIndex.hpp"
+#include "SpectraSTFilterExpression.hpp"
 #include <iostream>
 #include <vector>
 #include <queue>
@@ -82,6 +83,18 @@ public:
   
   void reset();
   
+  // Access by bin, for sweeping several libraries side by side in m/z order. The returned SpectraSTLibEntry objects
+  // become property of caller! retrieveBinHeaders reads the entries of a bin up to (not including) the peaks.
+  unsigned int getNumBins() { return ((unsigned int)(m_offsets.size())); }
+  unsigned int calcBinNumber(double mass);
+  void retrieveBinHeaders(unsigned int binNum, vector<SpectraSTLibEntry*>& entries);
+  SpectraSTLibEntry* readEntry(fstream::off_type offset);
+  
+  // Pushes the precursor m/z predicates of a filter into nextEntry(): bins none of whose entries can satisfy the
+  // filter are skipped without reading. The filter is NOT the property of the index.
+  void setPrecursorMzFilter(SpectraSTFilterExpression* filter) { m_filter = filter; }
+  unsigned int getFilterSkipCount() { return (m_filterSkipCount); }
+  
   // Sequential access methods with sorting - the returned SpectraSTLibEntry object becomes property of caller!
   void sortEntriesByNreps();
   void sortEntriesBySN();
@@ -128,11 +141,15 @@ private:
   // m_curSortedOffset - index into the m_sortedOffets vector. For sequential access using nextSortedEntry()
   int m_curSortedOffset;
   
+  // m_filter - the filter pushed into nextEntry(), and the number of entries skipped because of it
+  SpectraSTFilterExpression* m_filter;
+  unsigned int m_filterSkipCount;
+  
   // Private methods
   void initialize();
   void freeCacheBin(unsigned int bin);
-  unsigned int calcBinNumber(double mass);
   unsigned int calcBinMz(unsigned int binNum);
+  bool binMayPassFilter(unsigned int binNum);
   
   static bool sortEntriesDesc(pair<fstream::off_type, double> a, pair<fstream::off_type, double> b);
   
@@ -1,11 +1,15 @@
 #include "SpectraSTMzXMLLibImporter.hpp"
 #include "SpectraSTReplicates.hpp"
+#include "SpectraSTScanHeaderCache.hpp"
 #include "SpectraSTLog.hpp"
 #include "FileUtils.hpp"
 #include "Peptide.hpp"
 #include "ProgressCount.hpp"
 #include <iostream>
 #include <sstream>
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
 
 
 /*
@@ -54,13 +58,6 @@ extern SpectraSTLog* g_log;
 SpectraSTMzXMLLibImporter::SpectraSTMzXMLLibImporter(vector<string>& impFileNames, SpectraSTLib* lib, SpectraSTCreateParams& params) :
   SpectraSTLibImporter(impFileNames, lib, params),
   m_count(0),
-  m_numScansInFile(0),
-  m_numMissingInFile(0),
-  m_numMS1InFile(0),
-  m_numFailedFilterInFile(0),
-  m_numImportedInFile(0),
-  m_numConsensusInFile(0),
-  m_numBadConsensusInFile(0),
   m_datasetName("") {
   
   
@@ -105,24 +102,174 @@ void SpectraSTMzXMLLibImporter::import() {
   
   m_lib->writePreamble(m_preamble);
   
-  for (vector<string>::iterator i = m_impFileNames.begin(); i != m_impFileNames.end(); i++) {
-    readFromFile(*i);
+  vector<MzXMLRunImport> runs(m_impFileNames.size());
+  for (unsigned int k = 0; k < (unsigned int)(runs.size()); k++) {
+    runs[k].fileName = m_impFileNames[k];
+    runs[k].pool = NULL;
+    runs[k].opened = false;
+    runs[k].done = false;
+  }
+  
+  unsigned int numThreads = m_params.numThreads;
+  if (numThreads > (unsigned int)(runs.size())) {
+    numThreads = (unsigned int)(runs.size());
+  }
+  
+#ifndef _MSC_VER
+  if (numThreads > 1) {
+    importRunsInParallel(runs, numThreads);
+    return;
+  }
+#endif
+  
+  // one at a time, the entries are inserted as they are read
+  for (vector<MzXMLRunImport>::iterator run = runs.begin(); run != runs.end(); run++) {
+    readFromFile(*run, true);
+    mergeRun(*run);
   }
   
 }
 
-// readFromFile - reads one .mzXML file
-void SpectraSTMzXMLLibImporter::readFromFile(string& impFileName) {
+#ifndef _MSC_VER
+
+// the state shared by the threads reading runs: the next run to be read, and the next run to be merged
+typedef struct _mzxmlrunpool {
+  SpectraSTMzXMLLibImporter* importer;
+  vector<MzXMLRunImport>* runs;
+  unsigned int maxAhead;
+  unsigned int nextToRead;
+  unsigned int nextToMerge;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} MzXMLRunPool;
+
+// readRunsInThread - reads runs, in file order, until there is none left. To bound the memory used, a run is
+// not started until the run maxAhead places before it has been merged (and each run holds at most
+// MZXML_MAX_BUFFERED_ENTRIES entries not yet inserted, see addEntry).
+static void* readRunsInThread(void* arg) {
   
-  g_log->log("MZXML IMPORT", "Importing .mzXML file \"" + impFileName + "\"."); 
+  MzXMLRunPool* pool = (MzXMLRunPool*)arg;
   
+  while (true) {
+    pthread_mutex_lock(&(pool->mutex));
+    while (pool->nextToRead < (unsigned int)(pool->runs->size()) && pool->nextToRead >= pool->nextToMerge + pool->maxAhead) {
+      pthread_cond_wait(&(pool->cond), &(pool->mutex));
+    }
+    if (pool->nextToRead >= (unsigned int)(pool->runs->size())) {
+      pthread_mutex_unlock(&(pool->mutex));
+      break;
+    }
+    MzXMLRunImport& run = (*(pool->runs))[pool->nextToRead++];
+    pthread_mutex_unlock(&(pool->mutex));
+    
+    pool->importer->readFromFile(run, false);
+    
+    pthread_mutex_lock(&(pool->mutex));
+    run.done = true;
+    pthread_cond_broadcast(&(pool->cond));
+    pthread_mutex_unlock(&(pool->mutex));
+  }
   
-  // open the file using cRamp
-  cRamp* cramp = new cRamp(impFileName.c_str());
+  return (NULL);
+}
+
+// importRunsInParallel - reads the runs using numThreads threads, each run with its own clustering state, while this
+// thread merges them into the library in file order. The library is the same regardless of the number of threads.
+void SpectraSTMzXMLLibImporter::importRunsInParallel(vector<MzXMLRunImport>& runs, unsigned int numThreads) {
+  
+  // Ramp's list of supported file types is built on first use; build it here before the threads race for it
+  rampListSupportedFileTypes();
+  
+  MzXMLRunPool pool;
+  pool.importer = this;
+  pool.runs = &runs;
+  pool.maxAhead = numThreads * 2;
+  pool.nextToRead = 0;
+  pool.nextToMerge = 0;
+  pthread_mutex_init(&(pool.mutex), NULL);
+  pthread_cond_init(&(pool.cond), NULL);
+  
+  vector<pthread_t> threads(numThreads);
+  vector<bool> started(numThreads, false);
+  for (unsigned int t = 0; t < numThreads; t++) {
+    started[t] = (pthread_create(&(threads[t]), NULL, readRunsInThread, &pool) == 0);
+  }
+  
+  ProgressCount pc(!g_quiet && !g_verbose, 1, (int)(runs.size()));
+  pc.start("\nImporting spectra from .mzXML files");
+  
+  for (unsigned int k = 0; k < (unsigned int)(runs.size()); k++) {
+    runs[k].pool = &pool;
+  }
+  
+  for (unsigned int k = 0; k < (unsigned int)(runs.size()); k++) {
+    
+    pthread_mutex_lock(&(pool.mutex));
+    if (pool.nextToRead == k) {
+      // no thread has picked up this run (yet) -- read it here rather than wait, inserting the entries as they are read
+      pool.nextToRead++;
+      runs[k].pool = NULL;
+      pthread_mutex_unlock(&(pool.mutex));
+      readFromFile(runs[k], false);
+      pthread_mutex_lock(&(pool.mutex));
+      runs[k].done = true;
+    }
+    pthread_mutex_unlock(&(pool.mutex));
+    
+    // inserts the entries of the run while it is being read
+    mergeRun(runs[k]);
+    pc.increment();
+    
+    pthread_mutex_lock(&(pool.mutex));
+    pool.nextToMerge = k + 1;
+    pthread_cond_broadcast(&(pool.cond));
+    pthread_mutex_unlock(&(pool.mutex));
+  }
+  
+  for (unsigned int t = 0; t < numThreads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+  
+  pc.done();
+  
+  pthread_mutex_destroy(&(pool.mutex));
+  pthread_cond_destroy(&(pool.cond));
+}
+
+#endif
+
+// readFromFile - reads one .mzXML file into run, forming the clusters of the run if asked to. Touches nothing 
+// but run (and the log, whose messages are kept in run.logged), so that several runs can be read concurrently.
+void SpectraSTMzXMLLibImporter::readFromFile(MzXMLRunImport& run, bool showProgress) {
+  
+  string& impFileName = run.fileName;
+  
+  run.numScans = 0;
+  run.numMissing = 0;
+  run.numMS1 = 0;
+  run.numFailedFilter = 0;
+  run.numImported = 0;
+  run.numConsensus = 0;
+  run.numBadConsensus = 0;
+  
+  g_log->beginDeferring(&(run.logged));
+  
+  // open the file using cRamp -- through the scan header cache if asked to
+  SpectraSTScanHeaderCache* headerCache = NULL;
+  cRamp* cramp = NULL;
+  if (m_params.cacheScanHeaders) {
+    headerCache = new SpectraSTScanHeaderCache(impFileName);
+    cramp = headerCache->openCRamp();
+  } else {
+    cramp = new cRamp(impFileName.c_str());
+  }
       
   if (!cramp->OK()) {
-    g_log->error("MZXML IMPORT", "Cannot open file \"" + impFileName + "\". File skipped.");
+    g_log->endDeferring();
     delete (cramp);
+    if (headerCache) delete (headerCache);
     return;
   }
       
@@ -131,23 +278,26 @@ void SpectraSTMzXMLLibImporter::readFromFile(string& impFileName) {
       
   if (!runInfo) {
       // probably an empty file...
-    g_log->error("MZXML IMPORT", "Cannot open file \"" + impFileName + "\". File skipped.");
+    g_log->endDeferring();
     delete (cramp);
+    if (headerCache) delete (headerCache);
     return;
   }
       
   //  rampInstrumentInfo* instr = cramp->getInstrumentInfo();
   
+  run.opened = true;
+  
   int numScans = cramp->getLastScan();
   delete (runInfo);
       
     
-  if (g_verbose) {
+  if (g_verbose && showProgress) {
     cout << "\nImporting spectra from \"" << impFileName << "\"" << endl;
   } 
   
   // start the progress count
-  ProgressCount pc(!g_quiet && !g_verbose, 1, numScans);
+  ProgressCount pc(showProgress && !g_quiet && !g_verbose, 1, numScans);
   pc.start("\nImporting spectra from " + impFileName);
       
   // parse out the file name to determine the query prefix. Note that the query string
@@ -155,13 +305,10 @@ void SpectraSTMzXMLLibImporter::readFromFile(string& impFileName) {
   FileName fn;
   parseFileName(impFileName, fn);
         
-  m_numScansInFile = numScans;
-  m_numMissingInFile = 0;
-  m_numMS1InFile = 0;
-  m_numFailedFilterInFile = 0;
-  m_numImportedInFile = 0;
-  m_numConsensusInFile = 0;
-  m_numBadConsensusInFile = 0;
+  run.numScans = numScans;
+  
+  // the clusters are formed within each run
+  map<double, vector<SpectraSTLibEntry*>* > clusters;
       
   for (int k = 1; k <= numScans; k++) {	
 	
@@ -169,53 +316,147 @@ void SpectraSTMzXMLLibImporter::readFromFile(string& impFileName) {
 
     // get the scan header (no peak list) first to check whether it's MS2. 
     // it'd be a waste of time if we read all scans, including MS1
-    rampScanInfo* scanInfo = cramp->getScanHeaderInfo(k);			
+    rampScanInfo* scanInfo = headerCache ? headerCache->getScanHeaderInfo(k) : cramp->getScanHeaderInfo(k);
 
     // check to make sure the scan is good, and is not MS1	
     if (!scanInfo || (scanInfo->m_data.acquisitionNum != k)) {
-      m_numMissingInFile++;          
+      run.numMissing++;          
           
       if (scanInfo) delete (scanInfo);
       continue;
     }
 	
     if (scanInfo->m_data.msLevel == 1) {
-      m_numMS1InFile++;
+      run.numMS1++;
       delete (scanInfo);
       continue;
     }
           
     // now we can import
-    importOne(cramp, scanInfo, fn.name);
+    importOne(cramp, scanInfo, fn.name, run, clusters);
     // done, can delete scanInfo
     delete scanInfo;
 	
   }		
   
   // flush out last remaining clusters
-  for (map<double, vector<SpectraSTLibEntry*>* >::iterator i = m_clusters.begin(); i != m_clusters.end(); i++) {
-    formConsensusEntry(i->second);
+  for (map<double, vector<SpectraSTLibEntry*>* >::iterator i = clusters.begin(); i != clusters.end(); i++) {
+    formConsensusEntry(i->second, run);
     delete (i->second);
   }
   
   pc.done();
       
-  m_clusters.clear();
-    
+  g_log->endDeferring();
+  
+  // we can delete the cRamp object now that we're done with this file.
+  delete (cramp);
+  if (headerCache) delete (headerCache);
+}
+
+// addEntry - passes on an entry (or a consensus entry) read from a run: inserts it right away if the run is read
+// by the thread merging it, or else adds it to the entries waiting for the merge, first waiting for room if the run 
+// already has MZXML_MAX_BUFFERED_ENTRIES of them. 
+void SpectraSTMzXMLLibImporter::addEntry(MzXMLRunImport& run, SpectraSTLibEntry* entry, bool isConsensus) {
+  
+  MzXMLImportedEntry imported;
+  imported.entry = entry;
+  imported.isConsensus = isConsensus;
+  
+#ifndef _MSC_VER
+  if (run.pool) {
+    pthread_mutex_lock(&(run.pool->mutex));
+    while ((unsigned int)(run.entries.size()) >= MZXML_MAX_BUFFERED_ENTRIES) {
+      pthread_cond_wait(&(run.pool->cond), &(run.pool->mutex));
+    }
+    run.entries.push_back(imported);
+    if (run.entries.size() == 1) {
+      // the merging thread may be waiting for it
+      pthread_cond_broadcast(&(run.pool->cond));
+    }
+    pthread_mutex_unlock(&(run.pool->mutex));
+    return;
+  }
+#endif
+  
+  insertImported(run, imported);
+}
+
+// insertImported - filters an entry read from a run and inserts it into the library. Deletes the entry.
+void SpectraSTMzXMLLibImporter::insertImported(MzXMLRunImport& run, MzXMLImportedEntry& imported) {
+  
+  if (!(imported.isConsensus)) {
+    if (passAllFilters(imported.entry)) {
+      m_lib->insertEntry(imported.entry);
+      m_count++;
+    }
+  } else if (passAllFilters(imported.entry)) {
+    if (!(imported.entry->getPeakList()->passFilterUnidentified(m_params))) {
+      // bad one after consensus, likely noise?
+      run.numBadConsensus++;
+    } else {
+      m_lib->insertEntry(imported.entry);
+      m_count++;
+    }
+    run.numConsensus++;
+  }
+  
+  delete (imported.entry);
+}
+
+// mergeRun - inserts the entries of one run into the library, in run order, as they are read (unless they have all
+// been inserted already), then logs the messages of the run. Returns when the run has been read to the end.
+void SpectraSTMzXMLLibImporter::mergeRun(MzXMLRunImport& run) {
+  
+  g_log->log("MZXML IMPORT", "Importing .mzXML file \"" + run.fileName + "\"."); 
+  
+#ifndef _MSC_VER
+  if (run.pool) {
+    vector<MzXMLImportedEntry> entries;
+    pthread_mutex_lock(&(run.pool->mutex));
+    while (true) {
+      while (run.entries.empty() && !(run.done)) {
+        pthread_cond_wait(&(run.pool->cond), &(run.pool->mutex));
+      }
+      if (run.entries.empty()) {
+        break;
+      }
+      // take all the entries waiting, and make room for the reading thread
+      entries.swap(run.entries);
+      pthread_cond_broadcast(&(run.pool->cond));
+      pthread_mutex_unlock(&(run.pool->mutex));
+      
+      for (vector<MzXMLImportedEntry>::iterator en = entries.begin(); en != entries.end(); en++) {
+        insertImported(run, *en);
+      }
+      entries.clear();
+      
+      pthread_mutex_lock(&(run.pool->mutex));
+    }
+    pthread_mutex_unlock(&(run.pool->mutex));
+  }
+#endif
+  
+  g_log->writeDeferred(run.logged);
+  run.logged.clear();
+  
+  if (!run.opened) {
+    g_log->error("MZXML IMPORT", "Cannot open file \"" + run.fileName + "\". File skipped.");
+    return;
+  }
+  
   // log the import of this file
   stringstream importLogss;
-  importLogss << "Imported \"" << impFileName + "\" ";
-  importLogss << "(Max " << m_numScansInFile << " scans; " << m_numImportedInFile << " imported, ";
-  importLogss << m_numFailedFilterInFile << " failed filter; " << m_numMissingInFile << " missing; " << m_numMS1InFile << " MS1)";
-  importLogss << " (" << m_numConsensusInFile << " clusters, " << m_numBadConsensusInFile << " bad)";
+  importLogss << "Imported \"" << run.fileName + "\" ";
+  importLogss << "(Max " << run.numScans << " scans; " << run.numImported << " imported, ";
+  importLogss << run.numFailedFilter << " failed filter; " << run.numMissing << " missing; " << run.numMS1 << " MS1)";
+  importLogss << " (" << run.numConsensus << " clusters, " << run.numBadConsensus << " bad)";
   g_log->log("MZXML IMPORT", importLogss.str());
-           
-  // we can delete the cRamp object now that we're done with this file.
-  delete (cramp);
+  
 }
   
 // import - reads one MS2 spectrum  
-void SpectraSTMzXMLLibImporter::importOne(cRamp* cramp, rampScanInfo* scanInfo, string& prefix) {
+void SpectraSTMzXMLLibImporter::importOne(cRamp* cramp, rampScanInfo* scanInfo, string& prefix, MzXMLRunImport& run, map<double, vector<SpectraSTLibEntry*>* >& clusters) {
   
   unsigned int scanNum = scanInfo->m_data.acquisitionNum;
   
@@ -228,7 +469,7 @@ void SpectraSTMzXMLLibImporter::importOne(cRamp* cramp, rampScanInfo* scanInfo,
   // Go back to the mzXML file and get the peaks using Ramp
   rampPeakList* peaks = cramp->getPeakList(scanNum);
   if (!peaks) {
-    m_numFailedFilterInFile++;
+    run.numFailedFilter++;
     return;
   }
   
@@ -272,7 +513,7 @@ void SpectraSTMzXMLLibImporter::importOne(cRamp* cramp, rampScanInfo* scanInfo,
   }
     
   if (!(peakList->passFilterUnidentified(m_params))) {
-    m_numFailedFilterInFile++;
+    run.numFailedFilter++;
     delete peakList;
     return;
   }
@@ -316,7 +557,7 @@ void SpectraSTMzXMLLibImporter::importOne(cRamp* cramp, rampScanInfo* scanInfo,
   
   SpectraSTLibEntry* entry = new SpectraSTLibEntry(namess.str(), precursorMz, commentss.str(), "Normal", peakList, fragType);
   
-  m_numImportedInFile++;
+  run.numImported++;
   
 
   // clustering
@@ -331,34 +572,35 @@ void SpectraSTMzXMLLibImporter::importOne(cRamp* cramp, rampScanInfo* scanInfo,
   
   if (m_params.unidentifiedClusterIndividualRun) {
   
-    map<double, vector<SpectraSTLibEntry*>* >::iterator lower = m_clusters.upper_bound(precursorMz - 1.0);
-    map<double, vector<SpectraSTLibEntry*>* >::iterator upper = m_clusters.lower_bound(precursorMz + 1.0);
+    map<double, vector<SpectraSTLibEntry*>* >::iterator lower = clusters.upper_bound(precursorMz - 1.0);
+    map<double, vector<SpectraSTLibEntry*>* >::iterator upper = clusters.lower_bound(precursorMz + 1.0);
    
     if (lower == upper) {
       // form own cluster
       //    cerr << "Form cluster: " << namess.str() << " (" << precursorMz << ")" << endl;
       vector<SpectraSTLibEntry*>* cluster = new vector<SpectraSTLibEntry*>;
       cluster->push_back(entry);
-      m_clusters[precursorMz] = cluster;
+      clusters[precursorMz] = cluster;
             
     } else {
       
       bool clustered = false;
-      for (map<double, vector<SpectraSTLibEntry*>* >::iterator i = lower; i != upper; i++) {
-        if (!(i->second) || i->second->empty()) continue; // should not happen
+      for (map<double, vector<SpectraSTLibEntry*>* >::iterator i = lower; i != upper; ) {
+        if (!(i->second) || i->second->empty()) { i++; continue; } // should not happen
         vector<SpectraSTLibEntry*>* cluster = i->second;
         if (!clustered && (*cluster)[cluster->size() - 1]->getPeakList()->compare(peakList) > m_params.unidentifiedClusterMinimumDot) {
 	  // cluster!
 	  // cerr << "Join cluster: " << namess.str() << " (" << precursorMz << ") => " << i->first << endl;
           cluster->push_back(entry);
 	  clustered = true;
+          i++;
         
 	} else {
           // a new scan at same m/z but cannot cluster, this cluster should not carry on any more
 	  // cerr << "Close cluster: " << cluster->size()<< " entries (" << i->first << ")" << endl;
-          formConsensusEntry(cluster);	  
+          formConsensusEntry(cluster, run);	  
 	  delete (cluster);
-	  m_clusters.erase(i);
+	  clusters.erase(i++);
 	}
       }
       if (!clustered) {
@@ -366,44 +608,33 @@ void SpectraSTMzXMLLibImporter::importOne(cRamp* cramp, rampScanInfo* scanInfo,
 	// cerr << "Form cluster: " << namess.str() << " (" << precursorMz << ")" << endl;
 	vector<SpectraSTLibEntry*>* cluster = new vector<SpectraSTLibEntry*>;
 	cluster->push_back(entry);
-	m_clusters[precursorMz] = cluster;
+	clusters[precursorMz] = cluster;
       }
     }
   
   } else {
     // no clustering, just put in library
     
-    if (passAllFilters(entry)) {
-      m_lib->insertEntry(entry);
-      m_count++;
-    } 
-    
-    delete (entry);
+    addEntry(run, entry, false);
   }
 
 }
 
-// formConsensusEntry - uses the consensus creation algorithm to merge all spectra in a cluster, then inserts
-// the merged spectrum into the library. It will also delete all SpectraSTLibEntry's passed in.
-void SpectraSTMzXMLLibImporter::formConsensusEntry(vector<SpectraSTLibEntry*>* cluster) {
+// formConsensusEntry - uses the consensus creation algorithm to merge all spectra in a cluster, then passes
+// the merged spectrum on to be inserted into the library (see addEntry). It will also delete all 
+// SpectraSTLibEntry's passed in, except the one the merged spectrum is held in.
+void SpectraSTMzXMLLibImporter::formConsensusEntry(vector<SpectraSTLibEntry*>* cluster, MzXMLRunImport& run) {
   
   SpectraSTReplicates reps(*cluster, m_params);
   reps.setRecordRawSpectra(true);
   SpectraSTLibEntry* consensus = reps.makeConsensusSpectrum();
-  if (consensus && passAllFilters(consensus)) {
-    if (!(consensus->getPeakList()->passFilterUnidentified(m_params))) {
-      // bad one after consensus, likely noise?
-      m_numBadConsensusInFile++;
-    } else {
-      m_lib->insertEntry(consensus);
-      m_count++;
-    }
-    
-    m_numConsensusInFile++;
-  }
 	  
   for (vector<SpectraSTLibEntry*>::iterator en = cluster->begin(); en != cluster->end(); en++) {
-    delete (*en);
+    if (*en != consensus) delete (*en);
+  }
+  
+  if (consensus) {
+    addEntry(run, consensus, true);
   }
   
   
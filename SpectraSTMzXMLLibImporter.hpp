@@ -47,6 +47,37 @@ hlam@systemsbiology.org
  */
 
 
+// MzXMLImportedEntry - an entry read from a run, waiting to be filtered and inserted into the library
+typedef struct _MzXMLImportedEntry {
+  SpectraSTLibEntry* entry;
+  bool isConsensus;
+} MzXMLImportedEntry;
+
+// the most entries a run being read by another thread may hold before they are inserted into the library
+#define MZXML_MAX_BUFFERED_ENTRIES 1000
+
+struct _mzxmlrunpool;
+
+// MzXMLRunImport - the state of reading one run: the entries read but not yet inserted, its counts and the messages
+// it logged. Runs may be read concurrently, but they are merged into the library one by one, in the order of the files.
+// If pool is NULL, the run is read by the thread merging it, and its entries are inserted as soon as they are read; 
+// otherwise, the entries wait in entries (at most MZXML_MAX_BUFFERED_ENTRIES of them) until the run is merged.
+typedef struct _MzXMLRunImport {
+  string fileName;
+  struct _mzxmlrunpool* pool;
+  bool opened;
+  bool done;
+  vector<MzXMLImportedEntry> entries;
+  vector<string> logged;
+  unsigned int numScans;
+  unsigned int numMissing;
+  unsigned int numMS1;
+  unsigned int numFailedFilter;
+  unsigned int numImported;
+  unsigned int numConsensus;
+  unsigned int numBadConsensus;
+} MzXMLRunImport;
+
 class SpectraSTMzXMLLibImporter : public SpectraSTLibImporter { 
 
 public:
@@ -55,24 +86,20 @@ public:
   virtual ~SpectraSTMzXMLLibImporter();
   virtual void import();
 
+  void readFromFile(MzXMLRunImport& run, bool showProgress);
+
 private:
 
   unsigned int m_count;
-  unsigned int m_numScansInFile;
-  unsigned int m_numMissingInFile;
-  unsigned int m_numMS1InFile;
-  unsigned int m_numFailedFilterInFile;
-  unsigned int m_numImportedInFile;
-  unsigned int m_numConsensusInFile;
-  unsigned int m_numBadConsensusInFile;
 
   string m_datasetName;
    
-  map<double, vector<SpectraSTLibEntry*>* > m_clusters;
-  
-  void readFromFile(string& impFileName);
-  void importOne(cRamp* cramp, rampScanInfo* scanInfo, string& prefix);
-  void formConsensusEntry(vector<SpectraSTLibEntry*>* cluster);
+  void importOne(cRamp* cramp, rampScanInfo* scanInfo, string& prefix, MzXMLRunImport& run, map<double, vector<SpectraSTLibEntry*>* >& clusters);
+  void formConsensusEntry(vector<SpectraSTLibEntry*>* cluster, MzXMLRunImport& run);
+  void addEntry(MzXMLRunImport& run, SpectraSTLibEntry* entry, bool isConsensus);
+  void insertImported(MzXMLRunImport& run, MzXMLImportedEntry& imported);
+  void mergeRun(MzXMLRunImport& run);
+  void importRunsInParallel(vector<MzXMLRunImport>& runs, unsigned int numThreads);
 
 };
 
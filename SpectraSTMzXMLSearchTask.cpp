@@ -2,8 +2,10 @@
 #include "SpectraSTPeakList.hpp"
 #include "SpectraSTQuery.hpp"
 #include "SpectraSTSearch.hpp"
+#include "SpectraSTScanHeaderCache.hpp"
 #include "SpectraSTLog.hpp"
 #include "SpectraSTConstants.hpp"
+#include "SpectraSTStageStats.hpp"
 #include "FileUtils.hpp"
 #include "ProgressCount.hpp"
 
@@ -61,6 +63,8 @@ SpectraSTMzXMLSearchTask::SpectraSTMzXMLSearchTask(vector<string>& searchFileNam
   SpectraSTSearchTask(searchFileNames, params,lib),
   m_files(searchFileNames.size()),
   m_scans(),
+  m_batch(),
+  m_batchLowMz(0.0),
   m_isMzData(false),
   m_numScansInFile(0),
   m_numNotSelectedInFile(0),
@@ -68,7 +72,8 @@ SpectraSTMzXMLSearchTask::SpectraSTMzXMLSearchTask(vector<string>& searchFileNam
   m_numMS1InFile(0),
   m_numFailedFilterInFile(0),
   m_numSearchedInFile(0),
-  m_numLikelyGoodInFile(0) {
+  m_numLikelyGoodInFile(0),
+  m_peakListPool() {
   
   char* rampExt = rampValidFileType(m_searchFileNames[0].c_str());
   if (strstri(rampExt, ".mzdata")) { // accommodates .mzdata.gz
@@ -111,6 +116,8 @@ void SpectraSTMzXMLSearchTask::search() {
     // For each batch, sort all spectra by precursor m/z, open the files, and set the search in motion
     for (unsigned int batch = 0; batch < (unsigned int)m_batchBoundaries.size() - 1; batch++) {
 
+      beginFileStageStats();
+      
       // this will do the sorting. the vector m_scans will be populated with the sorted scans.
       prepareSortedSearch((unsigned int)batch);
       
@@ -118,22 +125,35 @@ void SpectraSTMzXMLSearchTask::search() {
       for (unsigned int n = m_batchBoundaries[batch]; n < m_batchBoundaries[batch + 1]; n++) {
         m_outputs[n]->openFile();
         m_outputs[n]->printHeader();
+        openResultCache(n);
       }
       
       // tracking search progress
       ProgressCount pc(!g_quiet && !g_verbose, 1, (int)(m_scans.size()));
       string msg("Searching");
       pc.start(msg);
+      
+      unsigned long long numAcquiredBefore = m_peakListPool.getNumAcquired();
+      unsigned long long numAllocationsBefore = m_peakListPool.getNumAllocations();
     
+      // queries can be scored in batches if their candidates are retrieved by precursor m/z, and stay valid
+      // while the next queries of the batch are retrieved (see SpectraSTLib::canRetrieveTogether)
+      bool batched = (m_params.searchBatchSize > 1 && m_params.annSearchTopK == 0 && m_params.openSearchTopK == 0);
+      
       // create searches from the m_scans one-by-one, and search them
       for (vector<pair<unsigned int, rampScanInfo*> >::iterator i = m_scans.begin(); i != m_scans.end(); i++) {
       
-        searchOne((*i).first, (*i).second);
+        if (batched) {
+          addToBatch((*i).first, (*i).second);
+        } else {
+          searchOne((*i).first, (*i).second);
+        }
         pc.increment();	
       
         // done. we can delete the rampScanInfo object now.
         delete (*i).second;
       }	
+      searchBatch();
       pc.done();
     
       // log the search of the batch
@@ -145,15 +165,23 @@ void SpectraSTMzXMLSearchTask::search() {
         searchLogss << m_numNotSelectedInFile << " not selected; ";
       }
       searchLogss << m_numFailedFilterInFile << " failed filter; " << m_numMissingInFile << " missing; " << m_numMS1InFile << " MS1)";
+      logPeakListAllocations(searchLogss, numAcquiredBefore, numAllocationsBefore);
       g_log->log("MZXML SEARCH", searchLogss.str());
     
       // done with this batch. close the files so that we can open more files in the next batch
       for (unsigned int n = m_batchBoundaries[batch]; n < m_batchBoundaries[batch + 1]; n++) {
         delete (m_files[n].second); // the cramp objects, which will close the mzXML files
         m_files[n].second = NULL;
+        closeResultCache(n);
         m_outputs[n]->printFooter(); // the output files
         m_outputs[n]->closeFile();
       }
+      
+      string batchLabel(m_searchFileNames[m_batchBoundaries[batch]]);
+      if (m_batchBoundaries[batch + 1] - m_batchBoundaries[batch] > 1) {
+        batchLabel += ".." + m_searchFileNames[m_batchBoundaries[batch + 1] - 1];
+      }
+      endFileStageStats(batchLabel);
     }
     
   } else {
@@ -165,12 +193,23 @@ void SpectraSTMzXMLSearchTask::search() {
     for (unsigned int n = 0; n < (unsigned int)m_searchFileNames.size(); n++) {
       
       
-      // open the file using cRamp
-      cRamp* cramp = new cRamp(m_searchFileNames[n].c_str());
+      beginFileStageStats();
+      double openStartTime = SpectraSTStageStats::now();
+      
+      // open the file using cRamp -- through the scan header cache if asked to
+      SpectraSTScanHeaderCache* headerCache = NULL;
+      cRamp* cramp = NULL;
+      if (m_params.cacheScanHeaders) {
+        headerCache = new SpectraSTScanHeaderCache(m_searchFileNames[n]);
+        cramp = headerCache->openCRamp();
+      } else {
+        cramp = new cRamp(m_searchFileNames[n].c_str());
+      }
       
       if (!cramp->OK()) {
         g_log->error("MZXML SEARCH", "Cannot open file \"" + m_searchFileNames[n] + "\". File skipped.");
         delete (cramp);
+        if (headerCache) delete (headerCache);
         continue;
       }
       
@@ -181,6 +220,7 @@ void SpectraSTMzXMLSearchTask::search() {
         // probably an empty file...
         g_log->error("MZXML SEARCH", "Cannot open file \"" + m_searchFileNames[n] + "\". File skipped.");
         delete (cramp);
+        if (headerCache) delete (headerCache);
         continue;
       }
       
@@ -193,11 +233,14 @@ void SpectraSTMzXMLSearchTask::search() {
       // open the output file
       m_outputs[n]->openFile();
       m_outputs[n]->printHeader();
+      openResultCache(n);
       
       int numScans = cramp->getLastScan();
       
       delete (runInfo);
       
+      SpectraSTStageStats::local().addTime(STAGE_FILE_OPEN, SpectraSTStageStats::now() - openStartTime);
+      
       // parse out the file name to determine the query prefix. Note that the query string
       // has the form <mzXML file name>.<scan num>.<scan num>.0
       FileName fn;
@@ -220,20 +263,25 @@ void SpectraSTMzXMLSearchTask::search() {
       m_numSearchedInFile = 0;
       m_numLikelyGoodInFile = 0;
 
+      unsigned long long numAcquiredBefore = m_peakListPool.getNumAcquired();
+      unsigned long long numAllocationsBefore = m_peakListPool.getNumAllocations();
+      
       
       for (int k = 1; k <= numScans; k++) {	
 	
         pc.increment();
 
         // Filter out all scans not in selected list (in this case,
-	// the selected list contains a list of scan numbers as strings
-	if (!m_searchAll && !isInSelectedList(SpectraSTQuery::constructQueryName(fn.name, k, 0))) {
+	// the selected list contains a list of scan numbers), before the scan header is read
+	if (!m_searchAll && !m_selection.isScanSelected(fn.name, k)) {
           m_numNotSelectedInFile++;
 	  continue;	
 	}
 	// get the scan header (no peak list) first to check whether it's MS2. 
 	// it'd be a waste of time if we read all scans, including MS1
-	rampScanInfo* scanInfo = cramp->getScanHeaderInfo(k);			
+	double headerStartTime = SpectraSTStageStats::now();
+	rampScanInfo* scanInfo = headerCache ? headerCache->getScanHeaderInfo(k) : cramp->getScanHeaderInfo(k);
+	SpectraSTStageStats::local().addTime(STAGE_SCAN_HEADER, SpectraSTStageStats::now() - headerStartTime);
 
 	// check to make sure the scan is good, and is not MS1	
         if (!scanInfo || (!m_isMzData && scanInfo->m_data.acquisitionNum != k)) {
@@ -248,6 +296,13 @@ void SpectraSTMzXMLSearchTask::search() {
           delete (scanInfo);
           continue;
         }
+        
+        // Filter out all scans outside the precursor m/z and retention time windows of the selected list
+        if (!m_searchAll && !m_selection.isPrecursorSelected(scanInfo->m_data.precursorMZ, scanInfo->getRetentionTimeSeconds())) {
+          m_numNotSelectedInFile++;
+          delete (scanInfo);
+          continue;
+        }
           
         // now we can search
         searchOne(n, scanInfo);
@@ -268,6 +323,7 @@ void SpectraSTMzXMLSearchTask::search() {
         searchLogss << m_numNotSelectedInFile << " not selected; ";
       }
       searchLogss << m_numFailedFilterInFile << " failed filter; " << m_numMissingInFile << " missing; " << m_numMS1InFile << " MS1)";
+      logPeakListAllocations(searchLogss, numAcquiredBefore, numAllocationsBefore);
       g_log->log("MZXML SEARCH", searchLogss.str());
            
       // we can delete the cRamp object now that we're done with this file.
@@ -276,9 +332,13 @@ void SpectraSTMzXMLSearchTask::search() {
       // searches
       delete (m_files[n].second);
       m_files[n].second = NULL;
+      if (headerCache) delete (headerCache);
     
+      closeResultCache(n);
       m_outputs[n]->printFooter();
       m_outputs[n]->closeFile(); // just so we won't hit the File Open limit if there are too many files
+      
+      endFileStageStats(m_searchFileNames[n]);
     }	
   }
   
@@ -337,10 +397,20 @@ void SpectraSTMzXMLSearchTask::prepareSortedSearch(unsigned int batch) {
    // open all mzXML files with CRAMP
   for (unsigned int n = m_batchBoundaries[batch]; n < m_batchBoundaries[batch + 1]; n++) {
       
-    cRamp* cramp = new cRamp(m_searchFileNames[n].c_str());
+    double openStartTime = SpectraSTStageStats::now();
+    
+    SpectraSTScanHeaderCache* headerCache = NULL;
+    cRamp* cramp = NULL;
+    if (m_params.cacheScanHeaders) {
+      headerCache = new SpectraSTScanHeaderCache(m_searchFileNames[n]);
+      cramp = headerCache->openCRamp();
+    } else {
+      cramp = new cRamp(m_searchFileNames[n].c_str());
+    }
     if (!cramp->OK()) {
       g_log->error("MZXML SEARCH", "Cannot open file \"" + m_searchFileNames[n] + "\". File skipped.");
       delete (cramp);
+      if (headerCache) delete (headerCache);
       continue;
     }
       
@@ -362,11 +432,14 @@ void SpectraSTMzXMLSearchTask::prepareSortedSearch(unsigned int batch) {
     if (!runInfo) {
         // probably an empty file...
       g_log->error("MZXML SEARCH", "Cannot read run info from \"" + m_searchFileNames[n] + "\". File skipped."); 
+      if (headerCache) delete (headerCache);
       continue;
     }
     
     int numScans = cramp->getLastScan();
     delete (runInfo);
+    
+    SpectraSTStageStats::local().addTime(STAGE_FILE_OPEN, SpectraSTStageStats::now() - openStartTime);
       
     m_numScansInFile += numScans;
       
@@ -374,12 +447,14 @@ void SpectraSTMzXMLSearchTask::prepareSortedSearch(unsigned int batch) {
     for (int k = 1; k <= numScans; k++) {	
 	
       // Filter out all scans not in selected list (in this case,
-      // the selected list contains a list of scan numbers as strings
-      if (!m_searchAll && !isInSelectedList(SpectraSTQuery::constructQueryName(fn.name, k, 0))) {
+      // the selected list contains a list of scan numbers), before the scan header is read
+      if (!m_searchAll && !m_selection.isScanSelected(fn.name, k)) {
         m_numNotSelectedInFile++;
         continue;	
       }
-      rampScanInfo* scanInfo = cramp->getScanHeaderInfo(k);	
+      double headerStartTime = SpectraSTStageStats::now();
+      rampScanInfo* scanInfo = headerCache ? headerCache->getScanHeaderInfo(k) : cramp->getScanHeaderInfo(k);
+      SpectraSTStageStats::local().addTime(STAGE_SCAN_HEADER, SpectraSTStageStats::now() - headerStartTime);
 	
       if (!scanInfo || scanInfo->m_data.acquisitionNum != k) {
         m_numMissingInFile++; 
@@ -394,7 +469,13 @@ void SpectraSTMzXMLSearchTask::prepareSortedSearch(unsigned int batch) {
         delete (scanInfo);
         continue;
       }
-        
+      
+      // Filter out all scans outside the precursor m/z and retention time windows of the selected list
+      if (!m_searchAll && !m_selection.isPrecursorSelected(scanInfo->m_data.precursorMZ, scanInfo->getRetentionTimeSeconds())) {
+        m_numNotSelectedInFile++;
+        delete (scanInfo);
+        continue;
+      }
         
       pair<unsigned int, rampScanInfo*> ms;
       ms.first = n;
@@ -402,6 +483,9 @@ void SpectraSTMzXMLSearchTask::prepareSortedSearch(unsigned int batch) {
       m_scans.push_back(ms);
 	
     }
+    
+    // the headers we keep are copies; the cache itself is no longer needed
+    if (headerCache) delete (headerCache);
   }
     
     // sort all the MS2 scans by precursor m/z
@@ -423,13 +507,32 @@ void SpectraSTMzXMLSearchTask::prepareSortedSearch(unsigned int batch) {
 // and a rampScanInfo object that points to that scan.
 void SpectraSTMzXMLSearchTask::searchOne(unsigned int fileIndex, rampScanInfo* scanInfo) {
   
+  SpectraSTQuery* query = NULL;
+  SpectraSTSearch* s = createSearch(fileIndex, scanInfo, query);
+  if (!s) {
+    return;
+  }
+  
+  s->search(m_lib, m_resultCaches[fileIndex]);
+  
+  finishOne(fileIndex, query, s);
+}
+
+// createSearch - reads the peaks of one spectrum and creates the search for it. Returns NULL (and
+// counts the spectrum as failing the filter) if it cannot be searched.
+SpectraSTSearch* SpectraSTMzXMLSearchTask::createSearch(unsigned int fileIndex, rampScanInfo* scanInfo, SpectraSTQuery*& query) {
+  
   cRamp* cramp = m_files[fileIndex].second;
   
+  SpectraSTStageStats& stageStats = SpectraSTStageStats::local();
+  double decodeStartTime = SpectraSTStageStats::now();
+  
   // Go back to the mzxml file and get the peaks using Ramp
   rampPeakList* peaks = cramp->getPeakList(scanInfo->m_data.acquisitionNum);
   if (!peaks) {
+    stageStats.addTime(STAGE_PEAK_DECODE, SpectraSTStageStats::now() - decodeStartTime);
     m_numFailedFilterInFile++;
-    return;
+    return (NULL);
   }
   
   int peakCount = peaks->getPeakCount();
@@ -440,12 +543,12 @@ void SpectraSTMzXMLSearchTask::searchOne(unsigned int fileIndex, rampScanInfo* s
   string fragType("");
   if (scanInfo->m_data.activationMethod) fragType = scanInfo->m_data.activationMethod;
   
-  // create the peak list and read the peaks one-by-one
-  SpectraSTPeakList* peakList = new SpectraSTPeakList(precursorMz, precursorCharge, peakCount, false, fragType);
+  // create the peak list (reusing the storage of a previous query) and read the peaks one-by-one
+  SpectraSTPeakList* peakList = m_peakListPool.acquire(precursorMz, precursorCharge, peakCount, false, fragType);
   
   // construct the query
   string queryName = SpectraSTQuery::constructQueryName(m_files[fileIndex].first.name, scanInfo->m_data.acquisitionNum, precursorCharge);
-  SpectraSTQuery* query = new SpectraSTQuery(queryName, precursorMz, precursorCharge, "", peakList);
+  query = new SpectraSTQuery(queryName, precursorMz, precursorCharge, "", peakList);
   
   query->setRetentionTime(scanInfo->getRetentionTimeSeconds());
   
@@ -457,12 +560,17 @@ void SpectraSTMzXMLSearchTask::searchOne(unsigned int fileIndex, rampScanInfo* s
   
   delete peaks;
   
+  double filterStartTime = SpectraSTStageStats::now();
+  stageStats.addTime(STAGE_PEAK_DECODE, filterStartTime - decodeStartTime);
   
   // see if peak list passes filter; if not, ignore				
   if (!(peakList->passFilter(m_params))) {
+    stageStats.addTime(STAGE_FILTER, SpectraSTStageStats::now() - filterStartTime);
     m_numFailedFilterInFile++;
+    m_peakListPool.release(query->detachPeakList());
     delete query;
-    return;
+    query = NULL;
+    return (NULL);
   } 
   
   if (m_params.filterMaxPeaksUsed < 50) {
@@ -470,6 +578,8 @@ void SpectraSTMzXMLSearchTask::searchOne(unsigned int fileIndex, rampScanInfo* s
   } else {
     double retained = peakList->simplify(m_params.filterMaxPeaksUsed, m_params.filterMaxDynamicRange);
   }
+  
+  stageStats.addTime(STAGE_FILTER, SpectraSTStageStats::now() - filterStartTime);
     
   int possibleChargeCount = 0;
   int ch = 1;
@@ -481,9 +591,13 @@ void SpectraSTMzXMLSearchTask::searchOne(unsigned int fileIndex, rampScanInfo* s
     ch++;
   }
     
-  // create the Search object and search!  
-  SpectraSTSearch* s = new SpectraSTSearch(query, m_params, m_outputs[fileIndex]);
-  s->search(m_lib);
+  // create the Search object
+  return (new SpectraSTSearch(query, m_params, m_outputs[fileIndex]));
+}
+
+// finishOne - counts and prints one search done, and deletes it
+void SpectraSTMzXMLSearchTask::finishOne(unsigned int fileIndex, SpectraSTQuery* query, SpectraSTSearch* s) {
+  
   m_numSearchedInFile++;
   if (s->isLikelyGood()) {
     m_numLikelyGoodInFile++;
@@ -494,10 +608,85 @@ void SpectraSTMzXMLSearchTask::searchOne(unsigned int fileIndex, rampScanInfo* s
   m_searchTaskStats.processSearch(s);
   
   s->print();
+  m_peakListPool.release(query->detachPeakList());
   delete s;
   
 }
 
+// addToBatch - creates the search for one spectrum and retrieves its candidates, but leaves the scoring until the
+// batch is searched. The batch is searched first if it is full, or if the candidates of this spectrum could push those
+// already retrieved for the batch out of the library cache. Since the spectra come sorted by precursor m/z, the batch
+// holds spectra of similar precursor m/z, which share most of their candidates.
+void SpectraSTMzXMLSearchTask::addToBatch(unsigned int fileIndex, rampScanInfo* scanInfo) {
+  
+  SpectraSTQuery* query = NULL;
+  SpectraSTSearch* s = createSearch(fileIndex, scanInfo, query);
+  if (!s) {
+    return;
+  }
+  
+  double lowMz = 0.0;
+  double highMz = 0.0;
+  s->getRetrievalMzRange(lowMz, highMz);
+  
+  if (!m_batch.empty() && 
+      ((unsigned int)(m_batch.size()) >= m_params.searchBatchSize || !(m_lib->canRetrieveTogether(m_batchLowMz, highMz)))) {
+    searchBatch();
+  }
+  if (m_batch.empty()) {
+    m_batchLowMz = lowMz;
+  }
+  
+  SpectraSTMzXMLSearchBatchItem item;
+  item.fileIndex = fileIndex;
+  item.query = query;
+  item.search = s;
+  item.toScore = s->retrieveCandidates(m_lib, m_resultCaches[fileIndex]);
+  m_batch.push_back(item);
+  
+  if (!item.toScore) {
+    // candidates taken from the result cache are only kept until the next query taken from there; search the batch now
+    searchBatch();
+  }
+}
+
+// searchBatch - scores all the searches of the batch together, then finishes, prints and deletes them in order
+void SpectraSTMzXMLSearchTask::searchBatch() {
+  
+  if (m_batch.empty()) {
+    return;
+  }
+  
+  vector<SpectraSTSearch*> searches;
+  for (vector<SpectraSTMzXMLSearchBatchItem>::iterator i = m_batch.begin(); i != m_batch.end(); i++) {
+    if (i->toScore) searches.push_back(i->search);
+  }
+  
+  SpectraSTSearch::scoreCandidatesTogether(searches);
+  
+  for (vector<SpectraSTMzXMLSearchBatchItem>::iterator i = m_batch.begin(); i != m_batch.end(); i++) {
+    if (i->toScore) {
+      i->search->finishSearch(m_lib, m_resultCaches[i->fileIndex]);
+    }
+    finishOne(i->fileIndex, i->query, i->search);
+  }
+  
+  m_batch.clear();
+}
+
+// logPeakListAllocations - in verbose mode, adds to the search log how many times the query peak lists still had to 
+// allocate storage since the counts given, to show that they are reused
+void SpectraSTMzXMLSearchTask::logPeakListAllocations(stringstream& searchLogss, unsigned long long numAcquiredBefore, unsigned long long numAllocationsBefore) {
+  
+  if (!g_verbose) return;
+  
+  unsigned long long numAcquired = m_peakListPool.getNumAcquired() - numAcquiredBefore;
+  unsigned long long numAllocations = m_peakListPool.getNumAllocations() - numAllocationsBefore;
+  
+  searchLogss << " (" << numAllocations << " peak list allocations for " << numAcquired << " queries, ";
+  searchLogss << (numAcquired > 0 ? (double)numAllocations / (double)numAcquired : 0.0) << " per query)";
+}
+
 // sortRampScanInfoPtrsByPrecursorMzAsc - comparison function used by sort() to sort rampScanInfo pointers
 // by precursor m/z
 bool SpectraSTMzXMLSearchTask::sortRampScanInfoPtrsByPrecursorMzAsc(pair<unsigned int, rampScanInfo*> a, pair<unsigned int, rampScanInfo*> b) {
@@ -4,6 +4,7 @@
 #include "SpectraSTSearchTask.hpp"
 #include "SpectraSTSearchParams.hpp"
 #include "SpectraSTLib.hpp"
+#include "SpectraSTPeakListPool.hpp"
 #include "FileUtils.hpp"
 
 #ifdef STANDALONE_LINUX
@@ -57,6 +58,16 @@ hlam@systemsbiology.org
  * 
  */
  
+class SpectraSTSearch;
+
+// one query of a batch of queries scored together (see SpectraSTMzXMLSearchTask::searchBatch)
+typedef struct {
+  unsigned int fileIndex;
+  SpectraSTQuery* query;
+  SpectraSTSearch* search;
+  bool toScore; // false if the candidates were taken from the result cache, already scored
+} SpectraSTMzXMLSearchBatchItem;
+
 class SpectraSTMzXMLSearchTask : public SpectraSTSearchTask {
   
 public:
@@ -81,8 +92,22 @@ private:
   // private method for sorting queries by precursor m/z before search 
   void prepareSortedSearch(unsigned int batch);
   
-  // private method for searching one query
+  // m_batch - the queries whose candidates have been retrieved, but not yet scored (-s_BAT), and the m/z from
+  // which their candidates were retrieved
+  vector<SpectraSTMzXMLSearchBatchItem> m_batch;
+  double m_batchLowMz;
+  
+  // private methods for searching one query
   void searchOne(unsigned int fileIndex, rampScanInfo* scanInfo);
+  SpectraSTSearch* createSearch(unsigned int fileIndex, rampScanInfo* scanInfo, SpectraSTQuery*& query);
+  void finishOne(unsigned int fileIndex, SpectraSTQuery* query, SpectraSTSearch* s);
+  
+  // private methods for searching queries of similar precursor m/z in batches
+  void addToBatch(unsigned int fileIndex, rampScanInfo* scanInfo);
+  void searchBatch();
+  
+  // private method for logging the peak list allocations since the given counts
+  void logPeakListAllocations(stringstream& searchLogss, unsigned long long numAcquiredBefore, unsigned long long numAllocationsBefore);
   
   // comparator method for sorting
   static bool sortRampScanInfoPtrsByPrecursorMzAsc(pair<unsigned int, rampScanInfo*> a, pair<unsigned int, rampScanInfo*> b);
@@ -98,6 +123,9 @@ private:
   unsigned int m_numSearchedInFile;
   unsigned int m_numLikelyGoodInFile;
   
+  // the query peak lists, reused from one scan to the next
+  SpectraSTPeakListPool m_peakListPool;
+  
   
 };
 
@@ -3,6 +3,7 @@
 #include "SpectraSTLog.hpp"
 #include "SpectraSTDenoiser.hpp"
 #include "SpectraSTConstants.hpp"
+#include "SpectraSTSpectrumPlotter.hpp"
 #include "FileUtils.hpp"
 #include <iostream>
 #include <fstream>
@@ -10,6 +11,10 @@
 #include <vector>
 #include <algorithm>
 #include <math.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
 
 
 /*
@@ -77,6 +82,12 @@ SpectraSTPeakList::SpectraSTPeakList(double parentMz, int parentCharge, unsigned
   m_numAssignedPeaks(0),
   m_bins(NULL),
   m_binIndex(NULL),
+  m_spareBins(NULL),
+  m_spareBinIndex(NULL),
+  m_spareIntensityRanked(NULL),
+  m_sparePeaks(),
+  m_keepSpares(false),
+  m_numAllocations(0),
   m_scaleMzPower(0.0), 
   m_scaleIntensityPower(1.0),
   m_scaleUnassignedFactor(1.0),
@@ -91,7 +102,7 @@ SpectraSTPeakList::SpectraSTPeakList(double parentMz, int parentCharge, unsigned
   m_BYIonCurrent = 0.0;
 
   if (useBinIndex) {
-    m_binIndex = new vector<unsigned int>;
+    allocateBinIndex();
   }
   
 }
@@ -117,6 +128,12 @@ SpectraSTPeakList::SpectraSTPeakList(vector<SpectraSTPeakList*>& pls, Peptide* p
   m_numAssignedPeaks(0),
   m_bins(NULL),
   m_binIndex(NULL),
+  m_spareBins(NULL),
+  m_spareBinIndex(NULL),
+  m_spareIntensityRanked(NULL),
+  m_sparePeaks(),
+  m_keepSpares(false),
+  m_numAllocations(0),
   m_scaleMzPower(0.0), 
   m_scaleIntensityPower(1.0),
   m_scaleUnassignedFactor(1.0),
@@ -162,6 +179,12 @@ SpectraSTPeakList::SpectraSTPeakList(Peptide* pep, string fragType) :
   m_numAssignedPeaks(0),
   m_bins(NULL),
   m_binIndex(NULL),
+  m_spareBins(NULL),
+  m_spareBinIndex(NULL),
+  m_spareIntensityRanked(NULL),
+  m_sparePeaks(),
+  m_keepSpares(false),
+  m_numAllocations(0),
   m_scaleMzPower(0.0), 
   m_scaleIntensityPower(1.0),
   m_scaleUnassignedFactor(1.0),
@@ -179,6 +202,12 @@ SpectraSTPeakList::SpectraSTPeakList(SpectraSTPeakList& other) :
   m_peakMap(NULL),
   m_bins(NULL),
   m_binIndex(NULL),
+  m_spareBins(NULL),
+  m_spareBinIndex(NULL),
+  m_spareIntensityRanked(NULL),
+  m_sparePeaks(),
+  m_keepSpares(false),
+  m_numAllocations(0),
   m_scaleMzPower(0.0), 
   m_scaleIntensityPower(1.0),
   m_scaleUnassignedFactor(1.0) {	
@@ -265,7 +294,151 @@ SpectraSTPeakList::~SpectraSTPeakList() {
   if (m_binIndex) {
     delete (m_binIndex);
   }
+  if (m_spareBins) {
+    delete (m_spareBins);
+  }
+  if (m_spareBinIndex) {
+    delete (m_spareBinIndex);
+  }
+  if (m_spareIntensityRanked) {
+    delete (m_spareIntensityRanked);
+  }
+  
+}
+
+// reset - makes the peak list as if newly constructed with the same arguments (see the general constructor), but keeps
+// the storage already allocated for reuse. From now on, storage that is no longer needed is also kept.
+void SpectraSTPeakList::reset(double parentMz, int parentCharge, unsigned int numPeaks, bool useBinIndex, string fragType) {
+
+  m_keepSpares = true;
+  m_numAllocations = 0;
+  
+  discardBins();
+  discardIntensityRanked();
+  if (m_peakMap) delete (m_peakMap);
+  m_peakMap = NULL;
+  
+  if (useBinIndex) {
+    if (m_binIndex) {
+      m_binIndex->clear();
+    } else {
+      allocateBinIndex();
+    }
+  } else {
+    discardBinIndex();
+  }
+  
+  m_peaks.clear();
+  if (numPeaks > (unsigned int)(m_peaks.capacity())) {
+    m_numAllocations++;
+    m_peaks.reserve(numPeaks);
+  }
+  
+  m_parentMz = parentMz;
+  m_parentCharge = parentCharge;
+  m_pep = NULL;
+  m_isScaled = false;
+  m_isAnnotated = false;
+  m_isSortedByMz = true;
+  m_signalToNoise = -1.0;
+  m_origMaxIntensity = -1.0;
+  m_totalIonCurrent = 0.0;
+  m_precursorIntensity = 0.0;
+  m_noiseFilterThreshold = 0.0;
+  m_weight = 1.0;
+  m_binMagnitude = 1.0;
+  m_numAssignedPeaks = 0;
+  m_scaleMzPower = 0.0;
+  m_scaleIntensityPower = 1.0;
+  m_scaleUnassignedFactor = 1.0;
+  m_fragType = "";
+  m_mzAccuracy = 1.0;
+  m_BYIonCurrent = 0.0;
+  
+  setFragType(fragType);
+}
+
+// allocateBins - sets m_bins to numBins zeros, reusing the spare storage if any
+void SpectraSTPeakList::allocateBins(unsigned int numBins) {
   
+  if (m_spareBins) {
+    m_bins = m_spareBins;
+    m_spareBins = NULL;
+  } else {
+    m_bins = new vector<float>;
+    m_numAllocations++;
+  }
+  if (numBins > (unsigned int)(m_bins->capacity())) {
+    m_numAllocations++;
+  }
+  m_bins->assign(numBins, 0.0);
+}
+
+// allocateBinIndex - sets m_binIndex to an empty index, reusing the spare storage if any
+void SpectraSTPeakList::allocateBinIndex() {
+
+  if (m_spareBinIndex) {
+    m_binIndex = m_spareBinIndex;
+    m_spareBinIndex = NULL;
+  } else {
+    m_binIndex = new vector<unsigned int>;
+    m_numAllocations++;
+  }
+}
+
+// allocateIntensityRanked - sets m_intensityRanked to an empty list with room for all peaks, reusing the spare storage if any
+void SpectraSTPeakList::allocateIntensityRanked() {
+
+  if (m_spareIntensityRanked) {
+    m_intensityRanked = m_spareIntensityRanked;
+    m_spareIntensityRanked = NULL;
+  } else {
+    m_intensityRanked = new vector<Peak*>;
+    m_numAllocations++;
+  }
+  if (m_peaks.size() > m_intensityRanked->capacity()) {
+    m_numAllocations++;
+    m_intensityRanked->reserve(m_peaks.size());
+  }
+}
+
+// discardBins - removes m_bins, keeping its storage as spare if m_keepSpares
+void SpectraSTPeakList::discardBins() {
+
+  if (!m_bins) return;
+  if (m_keepSpares && !m_spareBins) {
+    m_bins->clear();
+    m_spareBins = m_bins;
+  } else {
+    delete (m_bins);
+  }
+  m_bins = NULL;
+}
+
+// discardBinIndex - removes m_binIndex, keeping its storage as spare if m_keepSpares
+void SpectraSTPeakList::discardBinIndex() {
+
+  if (!m_binIndex) return;
+  if (m_keepSpares && !m_spareBinIndex) {
+    m_binIndex->clear();
+    m_spareBinIndex = m_binIndex;
+  } else {
+    delete (m_binIndex);
+  }
+  m_binIndex = NULL;
+}
+
+// discardIntensityRanked - removes m_intensityRanked, keeping its storage as spare if m_keepSpares
+void SpectraSTPeakList::discardIntensityRanked() {
+
+  if (!m_intensityRanked) return;
+  if (m_keepSpares && !m_spareIntensityRanked) {
+    m_intensityRanked->clear();
+    m_spareIntensityRanked = m_intensityRanked;
+  } else {
+    delete (m_intensityRanked);
+  }
+  m_intensityRanked = NULL;
 }
 
 // getNumPeaks - returns the number of peaks
@@ -355,6 +528,9 @@ void SpectraSTPeakList::insertForSearch(double mz, float intensity, string annot
     m_origMaxIntensity = intensity;
   }
   
+  if (m_peaks.size() == m_peaks.capacity()) {
+    m_numAllocations++;
+  }
   m_peaks.push_back(newPeak);
 
 }
@@ -408,8 +584,8 @@ void SpectraSTPeakList::writeToFile(ofstream& libFout) {
 		
 }
 	
-// writeToBinaryFile - just writes to a file in binary.
-void SpectraSTPeakList::writeToBinaryFile(ofstream& libFout) {
+// writeToBinaryFile - just writes to a file in binary. If compress, writes a compressed peak block instead.
+void SpectraSTPeakList::writeToBinaryFile(ostream& libFout, bool compress) {
 
   unsigned int numPeaks = (unsigned int)(m_peaks.size());
   
@@ -418,6 +594,10 @@ void SpectraSTPeakList::writeToBinaryFile(ofstream& libFout) {
     m_isSortedByMz = true;
   }
   
+  if (compress && writeCompressedPeaks(libFout)) {
+    return;
+  }
+  
   libFout.write((char*)(&numPeaks), sizeof(unsigned int));
   
   vector<Peak>::iterator i;
@@ -435,6 +615,151 @@ void SpectraSTPeakList::writeToBinaryFile(ofstream& libFout) {
   }
 }
 	
+// resolution of the m/z values, and of the natural log of the intensities, in a compressed peak block
+#define COMPRESSED_PEAKS_MZ_SCALE 10000.0
+#define COMPRESSED_PEAKS_LOG_INTENSITY_SCALE 1024.0
+#define COMPRESSED_PEAKS_LOG_INTENSITY_OFFSET 16.0
+
+// longest annotation or info string that can go into a compressed peak block; a peak list with a longer one is
+// written uncompressed, so that readers can bound the size of a block by its number of peaks
+#define COMPRESSED_PEAKS_MAX_STRING_LENGTH MAX_LINE
+
+// appendVarint - appends an unsigned number to a compressed peak block, 7 bits per byte, lowest bits first.
+// The high bit of each byte is set if more bytes follow.
+static void appendVarint(string& block, unsigned long long value) {
+  while (value >= 0x80) {
+    block += (char)((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  block += (char)value;
+}
+
+// readVarint - reads an unsigned number written by appendVarint, advancing p. Returns false if the block ends first.
+static bool readVarint(const unsigned char*& p, const unsigned char* end, unsigned long long& value) {
+  value = 0;
+  for (unsigned int shift = 0; p < end && shift < 64; shift += 7) {
+    unsigned char byte = *(p++);
+    value |= ((unsigned long long)(byte & 0x7f)) << shift;
+    if (!(byte & 0x80)) return (true);
+  }
+  return (false);
+}
+
+// writeCompressedPeaks - writes the peaks (sorted by m/z) as a compressed peak block. The format is:
+// <numPeaks | COMPRESSED_PEAKS_FLAG (int)> <blockSize (int)>, then blockSize bytes of
+// <numStrings (varint)> numStrings times: <distinct annotation or info string (\n-terminated string)>
+// numPeaks times: <m/z increase over the previous peak, in units of 1/COMPRESSED_PEAKS_MZ_SCALE (varint)>
+// <quantized log intensity, 0 for zero intensity (2 bytes, lowest first)> <annotation index (varint)> <info index (varint)>
+// Returns false, writing nothing, if a string is longer than COMPRESSED_PEAKS_MAX_STRING_LENGTH.
+bool SpectraSTPeakList::writeCompressedPeaks(ostream& libFout) {
+
+  // most peaks share a handful of annotations and infos (e.g. "?"); store each distinct one once
+  map<string, unsigned int> stringIndex;
+  vector<const string*> strings;
+  for (vector<Peak>::iterator i = m_peaks.begin(); i != m_peaks.end(); i++) {
+    if (i->annotation.length() > COMPRESSED_PEAKS_MAX_STRING_LENGTH || i->info.length() > COMPRESSED_PEAKS_MAX_STRING_LENGTH) {
+      return (false);
+    }
+    if (stringIndex.insert(pair<string, unsigned int>(i->annotation, (unsigned int)(strings.size()))).second) {
+      strings.push_back(&(i->annotation));
+    }
+    if (stringIndex.insert(pair<string, unsigned int>(i->info, (unsigned int)(strings.size()))).second) {
+      strings.push_back(&(i->info));
+    }
+  }
+  
+  string block;
+  block.reserve(m_peaks.size() * 6 + 16);
+  
+  appendVarint(block, strings.size());
+  for (vector<const string*>::iterator s = strings.begin(); s != strings.end(); s++) {
+    block += *(*s);
+    block += '\n';
+  }
+  
+  unsigned long long lastMz = 0;
+  for (vector<Peak>::iterator i = m_peaks.begin(); i != m_peaks.end(); i++) {
+    
+    unsigned long long mz = (i->mz > 0.0 ? (unsigned long long)(i->mz * COMPRESSED_PEAKS_MZ_SCALE + 0.5) : 0);
+    if (mz < lastMz) mz = lastMz; // cannot happen when sorted, except for rounding
+    appendVarint(block, mz - lastMz);
+    lastMz = mz;
+    
+    unsigned int logIntensity = 0;
+    if (i->intensity > 0.0) {
+      double scaled = (log((double)(i->intensity)) + COMPRESSED_PEAKS_LOG_INTENSITY_OFFSET) * COMPRESSED_PEAKS_LOG_INTENSITY_SCALE + 0.5;
+      logIntensity = (scaled < 1.0 ? 1 : (scaled > 65535.0 ? 65535 : (unsigned int)scaled));
+    }
+    block += (char)(logIntensity & 0xff);
+    block += (char)(logIntensity >> 8);
+    
+    appendVarint(block, stringIndex[i->annotation]);
+    appendVarint(block, stringIndex[i->info]);
+  }
+  
+  unsigned int numPeaks = (unsigned int)(m_peaks.size()) | COMPRESSED_PEAKS_FLAG;
+  unsigned int blockSize = (unsigned int)(block.size());
+  libFout.write((char*)(&numPeaks), sizeof(unsigned int));
+  libFout.write((char*)(&blockSize), sizeof(unsigned int));
+  libFout.write(block.data(), blockSize);
+  
+  return (true);
+}
+
+// maxCompressedPeaksSize - the largest compressed peak block that writeCompressedPeaks can write for numPeaks peaks:
+// the number of strings, at most two distinct strings per peak, and per peak the longest m/z increase (10 bytes),
+// the intensity (2 bytes) and two string indices (5 bytes each)
+unsigned long long SpectraSTPeakList::maxCompressedPeaksSize(unsigned int numPeaks) {
+  return (10 + (unsigned long long)numPeaks * (22 + 2 * (COMPRESSED_PEAKS_MAX_STRING_LENGTH + 1)));
+}
+
+// readCompressedPeaks - inserts the peaks of a compressed peak block written by writeCompressedPeaks (the part after
+// blockSize). Returns false if the block is corrupt.
+bool SpectraSTPeakList::readCompressedPeaks(const char* block, unsigned int blockSize, unsigned int numPeaks, bool forSearch) {
+  
+  const unsigned char* p = (const unsigned char*)block;
+  const unsigned char* end = p + blockSize;
+  
+  unsigned long long numStrings = 0;
+  if (!readVarint(p, end, numStrings) || numStrings > blockSize) return (false);
+  
+  vector<string> strings((size_t)numStrings);
+  for (vector<string>::iterator s = strings.begin(); s != strings.end(); s++) {
+    const unsigned char* lineEnd = (const unsigned char*)memchr(p, '\n', end - p);
+    if (!lineEnd) return (false);
+    s->assign((const char*)p, lineEnd - p);
+    p = lineEnd + 1;
+  }
+  
+  unsigned long long mz = 0;
+  for (unsigned int i = 0; i < numPeaks; i++) {
+    
+    unsigned long long mzIncrease = 0;
+    unsigned long long annotation = 0;
+    unsigned long long info = 0;
+    if (!readVarint(p, end, mzIncrease) || end - p < 2) return (false);
+    mz += mzIncrease;
+    unsigned int logIntensity = (unsigned int)(p[0]) | ((unsigned int)(p[1]) << 8);
+    p += 2;
+    if (!readVarint(p, end, annotation) || !readVarint(p, end, info) || annotation >= numStrings || info >= numStrings) {
+      return (false);
+    }
+    
+    float intensity = 0.0;
+    if (logIntensity > 0) {
+      intensity = (float)(exp((double)logIntensity / COMPRESSED_PEAKS_LOG_INTENSITY_SCALE - COMPRESSED_PEAKS_LOG_INTENSITY_OFFSET));
+    }
+    
+    if (!forSearch) {
+      insert((double)mz / COMPRESSED_PEAKS_MZ_SCALE, intensity, strings[(size_t)annotation], strings[(size_t)info]);
+    } else {
+      insertForSearch((double)mz / COMPRESSED_PEAKS_MZ_SCALE, intensity, strings[(size_t)annotation].substr(0, 1));
+    }
+  }
+  
+  return (true);
+}
+
 // writeToDtaFile - similar to writeToFile, except that it won't write
 // the Num peak: header, nor the annotations. (The caller needs to write the MW and 
 // charge before calling this function.)
@@ -476,14 +801,38 @@ double SpectraSTPeakList::compare(SpectraSTPeakList* other) {
   
 }
   
+// getSparseBins - appends the non-empty bins of this (already binned) peak list, in increasing bin number, to
+// binIndex and bins, and returns the bin magnitude. Dotting these sparse bins in bin order gives exactly the same
+// result as calcDot(), since the empty bins contribute nothing to the sums. Returns 0.0 if not binned.
+float SpectraSTPeakList::getSparseBins(vector<unsigned int>& binIndex, vector<float>& bins) {
+
+  if (!m_bins) {
+    return (0.0);
+  }
+
+  if (m_binIndex) {
+    binIndex.insert(binIndex.end(), m_binIndex->begin(), m_binIndex->end());
+    bins.insert(bins.end(), m_bins->begin(), m_bins->end());
+    return (m_binMagnitude);
+  }
+
+  for (unsigned int b = 0; b < (unsigned int)(m_bins->size()); b++) {
+    if ((*m_bins)[b] != 0.0) {
+      binIndex.push_back(b);
+      bins.push_back((*m_bins)[b]);
+    }
+  }
+  return (m_binMagnitude);
+}
+
 void SpectraSTPeakList::setParentCharge(int parentCharge, bool deleteBins) {
 
   if (parentCharge == m_parentCharge) return;
 
   m_parentCharge = parentCharge;
 
-  if (deleteBins && m_bins) {
-    delete (m_bins);
+  if (deleteBins) {
+    discardBins();
   }
 }
  
@@ -508,6 +857,24 @@ double SpectraSTPeakList::compare(SpectraSTPeakList* other, SpectraSTSimScores&
   return (simScores.dot);
 }
 
+// compareBlock - the block version of compare(), for several queries searched together: compares each of the query peak lists
+// queries against each of the library peak lists others. dots[o * queries.size() + q] and dotBiases[o * queries.size() + q] are
+// set to the dot product and dot bias of queries[q] and others[o], exactly as compare() would set them.
+void SpectraSTPeakList::compareBlock(vector<SpectraSTPeakList*>& queries, vector<SpectraSTPeakList*>& others,
+                                     vector<double>& dots, vector<double>& dotBiases, SpectraSTSearchParams& searchParams) {
+
+  for (vector<SpectraSTPeakList*>::iterator q = queries.begin(); q != queries.end(); q++) {
+    (*q)->binPeaks(searchParams.peakScalingMzPower, searchParams.peakScalingIntensityPower, searchParams.peakScalingUnassignedPeaks,
+                   searchParams.peakBinningNumBinsPerMzUnit, searchParams.peakBinningFractionToNeighbor);
+  }
+  for (vector<SpectraSTPeakList*>::iterator o = others.begin(); o != others.end(); o++) {
+    (*o)->binPeaks(searchParams.peakScalingMzPower, searchParams.peakScalingIntensityPower, searchParams.peakScalingUnassignedPeaks,
+                   searchParams.peakBinningNumBinsPerMzUnit, searchParams.peakBinningFractionToNeighbor);
+  }
+
+  calcDotsAndDotBiases(queries, others, dots, dotBiases);
+}
+
 // calcDot - the dot product calculation method, without also calculating dot bias. See
 // calcDotAndDotBias for more documentation.
 double SpectraSTPeakList::calcDot(SpectraSTPeakList* other) {
@@ -684,9 +1051,17 @@ double SpectraSTPeakList::calcDotAndDotBias(SpectraSTPeakList* other, double& do
     }
   }
  
+  return (normalizeDotAndDotBias(dot, sumDotSquares, m_binMagnitude, other->m_binMagnitude, dotBias));
+}
+
+// normalizeDotAndDotBias - turns the sums of the products of the bins of two peak lists (and of their squares), of the given
+// magnitudes, into the dot product and the dot bias. Shared by calcDotAndDotBias() and calcDotsAndDotBiases() so that both
+// give exactly the same results.
+double SpectraSTPeakList::normalizeDotAndDotBias(float dot, float sumDotSquares, float magnitude, float otherMagnitude, double& dotBias) {
+
   // normalize to 1 by dividing by the magnitudes
-  sumDotSquares /= (double)((m_binMagnitude * m_binMagnitude * other->m_binMagnitude * other->m_binMagnitude));
-  dot /= ((double)(m_binMagnitude * other->m_binMagnitude));
+  sumDotSquares /= (double)((magnitude * magnitude * otherMagnitude * otherMagnitude));
+  dot /= ((double)(magnitude * otherMagnitude));
   if (sumDotSquares < 0.0001 || dot < 0.01) {
     dotBias = 0.0;
   } else {
@@ -695,6 +1070,93 @@ double SpectraSTPeakList::calcDotAndDotBias(SpectraSTPeakList* other, double& do
   return (dot);
 }
 
+// calcDotsAndDotBiases - the block version of calcDotAndDotBias(), for several queries searched together: dots each of the
+// (binned) peak lists others against each of the (binned) peak lists queries. dots[o * numQueries + q] and dotBiases[o * numQueries + q]
+// are set to exactly what queries[q]->calcDotAndDotBias(others[o], ...) would give. The bins of the queries are laid out bin
+// by bin, such that each non-empty bin of the other peak list is multiplied with that bin of all the queries in one go, as in
+// a sparse-times-dense matrix product. The bins are still summed in increasing bin number for each pair, and the bins skipped
+// are those with nothing in the other peak list (which contribute nothing to the sums), so the sums are the same.
+void SpectraSTPeakList::calcDotsAndDotBiases(vector<SpectraSTPeakList*>& queries, vector<SpectraSTPeakList*>& others,
+                                             vector<double>& dots, vector<double>& dotBiases) {
+
+  unsigned int numQueries = (unsigned int)(queries.size());
+  dots.assign(others.size() * numQueries, 0.0);
+  dotBiases.assign(others.size() * numQueries, 0.0);
+
+  if (numQueries == 0 || others.empty()) {
+    return;
+  }
+
+  // lay out the bins of the queries bin by bin
+  unsigned int numBins = 0;
+  for (vector<SpectraSTPeakList*>::iterator q = queries.begin(); q != queries.end(); q++) {
+    if (!((*q)->m_bins)) continue;
+    if (!((*q)->m_binIndex)) {
+      if ((unsigned int)((*q)->m_bins->size()) > numBins) numBins = (unsigned int)((*q)->m_bins->size());
+    } else if (!((*q)->m_binIndex->empty()) && (*q)->m_binIndex->back() + 1 > numBins) {
+      numBins = (*q)->m_binIndex->back() + 1;
+    }
+  }
+
+  vector<float> queryBins(numBins * numQueries, 0.0);
+  for (unsigned int q = 0; q < numQueries; q++) {
+    SpectraSTPeakList* query = queries[q];
+    if (!(query->m_bins)) continue;
+    if (!(query->m_binIndex)) {
+      for (unsigned int b = 0; b < (unsigned int)(query->m_bins->size()); b++) {
+        queryBins[b * numQueries + q] = (*(query->m_bins))[b];
+      }
+    } else {
+      for (unsigned int k = 0; k < (unsigned int)(query->m_bins->size()); k++) {
+        queryBins[(*(query->m_binIndex))[k] * numQueries + q] = (*(query->m_bins))[k];
+      }
+    }
+  }
+
+  vector<float> dot(numQueries, 0.0);
+  vector<float> sumDotSquares(numQueries, 0.0);
+  vector<unsigned int> otherBinIndex;
+  vector<float> otherBins;
+
+  for (unsigned int o = 0; o < (unsigned int)(others.size()); o++) {
+
+    SpectraSTPeakList* other = others[o];
+    if (!(other->m_bins) || other->m_binMagnitude < 0.00001) {
+      continue;
+    }
+
+    otherBinIndex.clear();
+    otherBins.clear();
+    other->getSparseBins(otherBinIndex, otherBins);
+
+    dot.assign(numQueries, 0.0);
+    sumDotSquares.assign(numQueries, 0.0);
+
+    for (unsigned int k = 0; k < (unsigned int)(otherBins.size()); k++) {
+
+      unsigned int b = otherBinIndex[k];
+      float v = otherBins[k];
+      if (b >= numBins || v == 0.0) continue;
+
+      const float* row = &(queryBins[b * numQueries]);
+      for (unsigned int q = 0; q < numQueries; q++) {
+        float d = row[q] * v;
+        dot[q] += d;
+        sumDotSquares[q] += d * d;
+      }
+    }
+
+    for (unsigned int q = 0; q < numQueries; q++) {
+      SpectraSTPeakList* query = queries[q];
+      if (!(query->m_bins) || query->m_binMagnitude < 0.00001) {
+        continue;
+      }
+      dots[o * numQueries + q] = normalizeDotAndDotBias(dot[q], sumDotSquares[q], query->m_binMagnitude, other->m_binMagnitude,
+                                                        dotBiases[o * numQueries + q]);
+    }
+  }
+}
+
 // printPeaks - just cout all the peaks, for debugging only.
 void SpectraSTPeakList::printPeaks() {
 
@@ -850,9 +1312,7 @@ void SpectraSTPeakList::binPeaks(double mzPower, double intensityPower, double u
   if (m_bins && !rebin) {
     return;
   }
-  if (m_bins) {
-    delete (m_bins);
-  }
+  discardBins();
   
   m_numBinsPerMzUnit = numBinsPerMzUnit;
   
@@ -861,8 +1321,10 @@ void SpectraSTPeakList::binPeaks(double mzPower, double intensityPower, double u
       
  if (m_binIndex) {
   
-    m_bins = new vector<float>;
+    allocateBins(0);
     m_binIndex->clear();
+    size_t binsCapacity = m_bins->capacity();
+    size_t binIndexCapacity = m_binIndex->capacity();
     
     int curBinNumber = 0;
       
@@ -878,10 +1340,8 @@ void SpectraSTPeakList::binPeaks(double mzPower, double intensityPower, double u
         
       if (shift < 0) {
         // not sorted. bin it the old-fashioned way
-        delete (m_bins);
-        m_bins = NULL;
-        delete (m_binIndex);
-        m_binIndex = NULL;
+        discardBins();
+        discardBinIndex();
         binPeaks(mzPower, intensityPower, unassignedFactor, numBinsPerMzUnit, fractionToNeighbor);
         return;
       }
@@ -915,10 +1375,13 @@ void SpectraSTPeakList::binPeaks(double mzPower, double intensityPower, double u
       
       curBinNumber = binNumber;
     }
+    
+    if (m_bins->capacity() != binsCapacity) m_numAllocations++;
+    if (m_binIndex->capacity() != binIndexCapacity) m_numAllocations++;
      
   } else {
     // no binIndex
-    m_bins = new vector<float>(numBins, 0.0);
+    allocateBins(numBins);
   
     for (vector<Peak>::iterator i = m_peaks.begin(); i != m_peaks.end(); i++) {
       
@@ -1512,27 +1975,16 @@ void SpectraSTPeakList::annotateIsotopicIons(Peak* assignedMonoisotopic, Fragmen
 	
 }
 
-// plot - plot the peak list, for debugging mostly
-void SpectraSTPeakList::plot(string name, string label) {
+// plot - plot the peak list, for debugging mostly. The plot is written to <name>.svg, right away if plotter is NULL,
+// otherwise whenever plotter gets to it. Either way, the plot shows the peaks as they are now.
+void SpectraSTPeakList::plot(string name, string label, SpectraSTSpectrumPlotter* plotter) {
 	
-  string specFileName(name + ".spec");
-  ofstream specFout;
-  if (!myFileOpen(specFout, specFileName)) {
-    g_log->error("CREATE", "Cannot open file \"" + specFileName + "\" for writing spectra file for gnuplot. Plotting skipped.");
-    return;
-  }
-  
-  string plotFileName(name + ".gp");
-  ofstream plotFout;
-  if (!myFileOpen(plotFout, plotFileName)) {
-    g_log->error("CREATE", "Cannot open file \"" + specFileName + "\" for writing gnuplot plot file. Plotting skipped.");
-    return;
-  }
-  
-  string pngFileName(name + ".png");
+  SpectrumPlot* plot = new SpectrumPlot;
+  plot->name = name;
+  plot->label = label;
+  plot->written = false;
   
   float maxIntensity = 0.0;
-  double minMz = getMinMz();
   double maxMz = getMaxMz();
   for (vector<Peak>::iterator i = m_peaks.begin(); i != m_peaks.end(); i++) {
     if (maxIntensity < (*i).intensity) {
@@ -1540,44 +1992,23 @@ void SpectraSTPeakList::plot(string name, string label) {
     }
   }
   
-  minMz = 0.0;
-
   //maxMz = 1200.0;
   maxMz = 100.0 * ((int)(maxMz / 100) + 1); // round up to the next 100 
   
-  for (vector<Peak>::iterator i = m_peaks.begin(); i != m_peaks.end(); i++) {
-    if (!((*i).annotation.empty()) && i->annotation[0] != '?') {
-      specFout << (*i).mz << ' ' << (*i).intensity / maxIntensity << ' ' << 0.0 << ' ' << 0.0 << endl;
-    } else {
-      // don't label
-      specFout << (*i).mz << ' ' << 0.0 << ' ' << (*i).intensity / maxIntensity << ' ' << 0.0 << endl;
-    }		
-    
-  }
-  
-  specFout.close();
-
-  plotFout << "set terminal png" << endl;
-  plotFout << "set output \"" << pngFileName << "\"" << endl;
-  plotFout << "set size " << 1.0 << "," << 1.0 << endl;
-  plotFout << "set nokey" << endl;
-  plotFout << "set border 1" << endl;
-  plotFout << "set xtics border nomirror" << endl;
-  plotFout << "set xzeroaxis linetype -1 linewidth 1.0" << endl;
-  plotFout << "set yzeroaxis linetype -1 linewidth 1.0" << endl;
-  plotFout << "set mxtics" << endl;
-  plotFout << "set noytics" << endl;
-  
-  plotFout << "set origin 0.0,0.0" << endl;
-  plotFout << "set yrange [0.0:1.1]" << endl;
-  
-  plotFout.precision(3);
-  plotFout << "set label \"" << maxIntensity << "\" at " << minMz << ",1.04 front" << endl;	
-  plotFout << "set label \"" << label << "\" at " << maxMz << ",1.04 right front" << endl;
-  
-  plotFout.precision(3);
+  plot->maxIntensity = maxIntensity;
+  plot->maxMz = maxMz;
+  plot->mzs.reserve(m_peaks.size());
+  plot->intensities.reserve(m_peaks.size());
+  plot->annotated.reserve(m_peaks.size());
+  plot->ionLabels.assign(m_peaks.size(), "");
   
-  for (vector<Peak>::iterator i = m_peaks.begin(); i != m_peaks.end(); i++) {
+  unsigned int k = 0;
+  for (vector<Peak>::iterator i = m_peaks.begin(); i != m_peaks.end(); i++, k++) {
+    plot->mzs.push_back((*i).mz);
+    plot->intensities.push_back(maxIntensity > 0.0 ? (*i).intensity / maxIntensity : 0.0f);
+    // don't label the unannotated peaks
+    plot->annotated.push_back(!((*i).annotation.empty()) && i->annotation[0] != '?');
+    
     if (!((*i).annotation.empty()) && i->annotation[0] != '?' && i->annotation[0] != '[') {
       string::size_type commaPos = 0;
       string labelText("");
@@ -1591,31 +2022,17 @@ void SpectraSTPeakList::plot(string name, string label) {
         }
         commaPos++;
       }
-      if (!labelText.empty()) {
-        plotFout << "set label \"" << labelText << "\" at "; 
-        plotFout.precision(3);
-        plotFout << (*i).mz << ",";
-        plotFout.precision(3);
-        plotFout << (*i).intensity / maxIntensity + 0.02 << " left rotate front";
-        plotFout << " font \"Helvetica,2\" tc lt 1" << endl;
-      }		
+      plot->ionLabels[k] = labelText;
     }		
     
   }
   
-  plotFout.precision(3);
-  plotFout << "plot [" << minMz << ":" << maxMz << "] \"" << specFileName << "\" using 1:3 with impulse lc " << 3;
-  plotFout << ", \"" << specFileName << "\" using 1:2 with impulse lc " << 1;
-  plotFout << ", \"" << specFileName << "\" using 1:4 with impulse lc " << -1 << endl;
-  
-  
-  // PLOT!
-  myGnuplot(plotFileName);
-
-  // delete the plot file and spec file
-//  removeFile(plotFileName);
-//  removeFile(specFileName);
-  
+  if (plotter) {
+    plotter->add(plot);
+  } else {
+    SpectraSTSpectrumPlotter::plotNow(*plot);
+    delete (plot);
+  }
 	
 }
 
@@ -1843,11 +2260,8 @@ void SpectraSTPeakList::rankByIntensity(bool redo) {
     return;
   }
   
-  if (m_intensityRanked) {
-    delete (m_intensityRanked);
-  }
-  
-  m_intensityRanked = new vector<Peak*>;
+  discardIntensityRanked();
+  allocateIntensityRanked();
   
   for (vector<Peak>::iterator p = m_peaks.begin(); p != m_peaks.end(); p++) {
     m_intensityRanked->push_back(&(*p));
@@ -1997,6 +2411,52 @@ double SpectraSTPeakList::calcXrea(bool ignorePrecursorRegion) {
   return ((double)(xrea));
 }
 
+// XCorrScratch - the storage used by calcXCorr(), kept for each thread to be reused from one peak list to the next
+struct XCorrScratch {
+  vector<float>* bins; // storage of the specially normalized bins, lent to the peak list being scored
+  vector<double> cumBins;
+};
+
+#ifndef _MSC_VER
+
+static pthread_key_t g_xcorrScratchKey;
+static pthread_once_t g_xcorrScratchKeyOnce = PTHREAD_ONCE_INIT;
+
+// deleteXCorrScratch - destructor of the thread-specific key, called when a thread that has calculated xcorr exits
+static void deleteXCorrScratch(void* arg) {
+  
+  XCorrScratch* scratch = (XCorrScratch*)arg;
+  if (scratch->bins) delete (scratch->bins);
+  delete (scratch);
+}
+
+// createXCorrScratchKey - creates the thread-specific key, once
+static void createXCorrScratchKey() {
+  
+  pthread_key_create(&g_xcorrScratchKey, deleteXCorrScratch);
+}
+
+#endif
+
+// getXCorrScratch - the calcXCorr() storage of the calling thread
+static XCorrScratch* getXCorrScratch() {
+  
+#ifndef _MSC_VER
+  pthread_once(&g_xcorrScratchKeyOnce, createXCorrScratchKey);
+  XCorrScratch* scratch = (XCorrScratch*)pthread_getspecific(g_xcorrScratchKey);
+  if (!scratch) {
+    scratch = new XCorrScratch;
+    scratch->bins = NULL;
+    pthread_setspecific(g_xcorrScratchKey, scratch);
+  }
+  return (scratch);
+#else
+  // no threads are started under Visual Studio
+  static XCorrScratch scratch = { NULL, vector<double>() };
+  return (&scratch);
+#endif
+}
+
 // calcXCorr - calculates the SEQUEST-like cross correlation (not quite the same as SEQUEST)
 // the preprocessing in SEQUEST is slightly different
 double SpectraSTPeakList::calcXCorr() {
@@ -2006,7 +2466,15 @@ double SpectraSTPeakList::calcXCorr() {
   m_parentMz = m_pep->monoisotopicMZ();
   
   // do not use binIndex
-  if (m_binIndex) delete (m_binIndex);
+  discardBinIndex();
+  
+  // bin into the storage of this thread, rather than allocating new bins for every peak list scored
+  XCorrScratch* scratch = getXCorrScratch();
+  discardBins();
+  if (scratch->bins && !m_spareBins) {
+    m_spareBins = scratch->bins;
+    scratch->bins = NULL;
+  }
   
   binPeaks(0.0, 1.0, 1.0, 1, 0.0, true); // force rebinning
   
@@ -2028,6 +2496,9 @@ double SpectraSTPeakList::calcXCorr() {
     }
   }
   
+  // normalize each region, and keep the running sums of the normalized bins for the window sums below
+  vector<double>& cumBins = scratch->cumBins;
+  cumBins.assign(numBins + 1, 0.0);
   for (unsigned int b = 0; b < numBins; b++) {
     unsigned int region = b / regionSize;
     if (!emptyRegion[region]) {
@@ -2035,46 +2506,39 @@ double SpectraSTPeakList::calcXCorr() {
     } else {
       (*m_bins)[b] = 0.0;
     }
+    cumBins[b + 1] = cumBins[b] + (*m_bins)[b];
   }
   
   map<int, float> theoSpec;
   m_pep->SEQUESTTheoreticalSpectrum(theoSpec);
-  vector<float> theoBins;
-  theoBins.assign(numBins, 0.0);
   
-  float theoNormFac = 0.0;
+  // xcorr = dot(tau = 0) - mean of dot(tau) for tau = -75 to 75. Since the dot product is linear, this equals the
+  // dot product of the theoretical spectrum with the experimental bins minus their mean over the 151 bins around
+  // each bin (SEQUEST's trick) -- which only needs to be evaluated at the theoretical peaks.
+  double xcorr = 0.0;
   for (map<int, float>::iterator t = theoSpec.begin(); t != theoSpec.end(); t++) {
-    theoBins[calcBinNumber((double)(t->first))] += t->second;
+    int b = (int)(calcBinNumber((double)(t->first)));
+    int low = (b - 75 < 0 ? 0 : b - 75);
+    int high = (b + 75 >= (int)numBins ? (int)numBins - 1 : b + 75);
+    double windowSum = cumBins[high + 1] - cumBins[low];
+    xcorr += t->second * ((*m_bins)[b] - windowSum / 151.0);
   }
-  
-  float sumDots = 0.0;
-  float xcorr = 0.0;
-  for (int tau = -75; tau <= 75; tau++) {
-    
-    float dot = 0.0;
-    for (unsigned int b = 0; b < numBins; b++) {
-      if (b + tau >= 0 && b + tau < (int)numBins) {
-        dot += (*m_bins)[b] * theoBins[b + tau] / 10000.0;
-      }
-    }
-    
-    sumDots += dot;
-    
-    if (tau == 0) {
-      xcorr = dot;
-    } 
-  }
-  xcorr = xcorr - (sumDots / 151.0);
+  xcorr /= 10000.0;
   
   // for unknown reasons, xcorr calculated this way is smaller than SEQUEST xcorr.
   // empirically, SEQUEST xcorr is about 1.45 times bigger
   xcorr *= 1.45;
   
-  // don't reuse the bins -- they're not binned in the regular way  
-  delete (m_bins);
-  m_bins = NULL;
+  // don't reuse the bins -- they're not binned in the regular way. Their storage goes back to the thread.
+  if (!scratch->bins) {
+    m_bins->clear();
+    scratch->bins = m_bins;
+    m_bins = NULL;
+  } else {
+    discardBins();
+  }
   
-  return ((double)(xcorr));
+  return ((double)((float)xcorr));
 }
 
 
@@ -2214,8 +2678,14 @@ double SpectraSTPeakList::simplify(unsigned int maxNumPeaks, double maxDynamicRa
   double minIntensity = basePeakIntensity / maxDynamicRange;
 
   
-  vector<Peak> newPeaks;
+  // the retained peaks are collected in the spare peak storage, which then changes places with m_peaks
+  vector<Peak>& newPeaks = m_sparePeaks;
   unsigned int numPeaks = (unsigned int)(m_intensityRanked->size());
+  newPeaks.clear();
+  if (numPeaks > (unsigned int)(newPeaks.capacity())) {
+    m_numAllocations++;
+    newPeaks.reserve(numPeaks);
+  }
   
   if (!deisotope) {
     for (unsigned int r = 0; r < maxNumPeaks && r < numPeaks; r++) {
@@ -2280,22 +2750,24 @@ double SpectraSTPeakList::simplify(unsigned int maxNumPeaks, double maxDynamicRa
   }
   
   double retainedScaledIntensity = 0.0;
-  m_peaks.clear();
   for (vector<Peak>::iterator j = newPeaks.begin(); j != newPeaks.end(); j++) {
-    m_peaks.push_back(*j);
     retainedScaledIntensity += sqrt(j->intensity);
   }
+  m_peaks.swap(newPeaks);
+  if (m_keepSpares) {
+    m_sparePeaks.clear();
+  } else {
+    vector<Peak>().swap(m_sparePeaks);
+  }
   
   // peaks are inserted in m/z order
   m_isSortedByMz = true;
   
   m_isScaled = false;
   
-  if (m_bins) delete (m_bins);
-  m_bins = NULL;
+  discardBins();
     
-  delete (m_intensityRanked);
-  m_intensityRanked = NULL;
+  discardIntensityRanked();
 
   if (m_peakMap) delete (m_peakMap);
   m_peakMap = NULL;
@@ -59,6 +59,7 @@ typedef struct _peak {
 } Peak;
 
 class SpectraSTDenoiser;
+class SpectraSTSpectrumPlotter;
 
 class SpectraSTPeakList {
 
@@ -82,6 +83,10 @@ public:
   // destructor
   virtual ~SpectraSTPeakList();
   
+  // reuse - see SpectraSTPeakListPool
+  void reset(double parentMz, int parentCharge, unsigned int numPeaks = 0, bool useBinIndex = false, string fragType = "");
+  unsigned int getNumAllocations() { return (m_numAllocations); }
+  
   // accessors
   unsigned int getNumPeaks();
   double getWeight() { return (m_weight); }
@@ -113,10 +118,16 @@ public:
   // comparing two peak lists by the dot product
   double compare(SpectraSTPeakList* other);
   double compare(SpectraSTPeakList* other, SpectraSTSimScores& simScores, SpectraSTSearchParams& searchParams);
+  static void compareBlock(vector<SpectraSTPeakList*>& queries, vector<SpectraSTPeakList*>& others,
+                           vector<double>& dots, vector<double>& dotBiases, SpectraSTSearchParams& searchParams);
+  float getSparseBins(vector<unsigned int>& binIndex, vector<float>& bins);
   
   // File output methods
   void writeToFile(ofstream& libFout);
-  void writeToBinaryFile(ofstream& libFout);	
+  void writeToBinaryFile(ostream& libFout, bool compress = false);	
+  bool writeCompressedPeaks(ostream& libFout);
+  bool readCompressedPeaks(const char* block, unsigned int blockSize, unsigned int numPeaks, bool forSearch);
+  static unsigned long long maxCompressedPeaksSize(unsigned int numPeaks);
   void writeToDtaFile(ofstream& dtaFout);
   
   // preprocessing methods 
@@ -158,7 +169,7 @@ public:
   // convenient methods for debugging
   void printPeaks();
   void printBins();
-  void plot(string name, string label);
+  void plot(string name, string label, SpectraSTSpectrumPlotter* plotter = NULL);
   void writeMRM(ofstream& fout, string pre, string post, string format);  
 
   void repositionPeaks(bool keepEffectivePeakCountConstant = true);
@@ -196,6 +207,18 @@ private:
   // a peak of specified m/z.  
   map<double, pair<Peak*, double> >* m_peakMap;
   
+  // m_spareBins, m_spareBinIndex, m_spareIntensityRanked, m_sparePeaks - emptied storage kept for reuse instead of
+  // being freed, when the peak list is reused by a SpectraSTPeakListPool (m_keepSpares). NULL (or empty) if none.
+  vector<float>* m_spareBins;
+  vector<unsigned int>* m_spareBinIndex;
+  vector<Peak*>* m_spareIntensityRanked;
+  vector<Peak> m_sparePeaks;
+  bool m_keepSpares;
+  
+  // m_numAllocations - the number of times the storage of this peak list had to be allocated or grown since 
+  // construction or the last reset()
+  unsigned int m_numAllocations;
+  
   // m_pep - points to the Peptide object that is the ID of this peak list (used only when the peak list is
   // a library spectrum, NULL otherwise). NOT the property of this class
   Peptide* m_pep;
@@ -242,10 +265,19 @@ private:
 //  double m_selfDotBias;
   
   // helper methods
+  void allocateBins(unsigned int numBins);
+  void allocateBinIndex();
+  void allocateIntensityRanked();
+  void discardBins();
+  void discardBinIndex();
+  void discardIntensityRanked();
   unsigned int calcBinNumber(double mz);
   double calcBinMz(unsigned int binNum);
   double calcDot(SpectraSTPeakList* other);
   double calcDotAndDotBias(SpectraSTPeakList* other, double& dotBias);	
+  static void calcDotsAndDotBiases(vector<SpectraSTPeakList*>& queries, vector<SpectraSTPeakList*>& others,
+                                   vector<double>& dots, vector<double>& dotBiases);
+  static double normalizeDotAndDotBias(float dot, float sumDotSquares, float magnitude, float otherMagnitude, double& dotBias);
   float scale(Peak& p, double mzPower, double intensityPower, double unassignedFactor, bool removePrecursor = true);
   
   // annotation methods
@@ -0,0 +1,89 @@
+#include "SpectraSTPeakListPool.hpp"
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTPeakListPool
+ *
+ * A pool of query peak lists reused from one query to the next. See SpectraSTPeakListPool.hpp.
+ *
+ */
+
+// constructor
+SpectraSTPeakListPool::SpectraSTPeakListPool(unsigned int maxNumFree) :
+  m_free(),
+  m_maxNumFree(maxNumFree),
+  m_numAcquired(0),
+  m_numAllocations(0) {
+
+  m_free.reserve(m_maxNumFree);
+}
+
+// destructor - deletes the peak lists in the pool. Those acquired and not released are the property of whoever acquired them.
+SpectraSTPeakListPool::~SpectraSTPeakListPool() {
+
+  for (vector<SpectraSTPeakList*>::iterator pl = m_free.begin(); pl != m_free.end(); pl++) {
+    delete (*pl);
+  }
+}
+
+// acquire - returns a peak list as if constructed by SpectraSTPeakList(parentMz, parentCharge, numPeaks, useBinIndex, fragType),
+// reusing one released before if any
+SpectraSTPeakList* SpectraSTPeakListPool::acquire(double parentMz, int parentCharge, unsigned int numPeaks, bool useBinIndex, string fragType) {
+
+  m_numAcquired++;
+
+  SpectraSTPeakList* peakList = NULL;
+  if (m_free.empty()) {
+    peakList = new SpectraSTPeakList(parentMz, parentCharge);
+    m_numAllocations++;
+  } else {
+    peakList = m_free.back();
+    m_free.pop_back();
+  }
+
+  peakList->reset(parentMz, parentCharge, numPeaks, useBinIndex, fragType);
+  return (peakList);
+}
+
+// release - gives back a peak list acquired before, which must no longer be used
+void SpectraSTPeakListPool::release(SpectraSTPeakList* peakList) {
+
+  if (!peakList) return;
+
+  m_numAllocations += peakList->getNumAllocations();
+
+  if ((unsigned int)(m_free.size()) < m_maxNumFree) {
+    m_free.push_back(peakList);
+  } else {
+    delete (peakList);
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef SPECTRASTPEAKLISTPOOL_HPP_
+#define SPECTRASTPEAKLISTPOOL_HPP_
+
+#include "SpectraSTPeakList.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTPeakListPool
+ *
+ * A pool of query peak lists, so that the peak lists (and their bins, intensity rankings, etc.) of the queries
+ * searched one after another reuse the storage of those searched before, instead of allocating it anew for every
+ * query. A peak list is taken with acquire(), which resets it as if newly constructed, and given back with release()
+ * once the query is done. The pool counts how many times storage still had to be allocated (new peak lists, or
+ * storage of a peak list grown); once the pool is warmed up, this should stay at zero.
+ *
+ * Not thread-safe; each thread searching queries should have its own pool.
+ *
+ */
+
+using namespace std;
+
+class SpectraSTPeakListPool {
+
+public:
+  SpectraSTPeakListPool(unsigned int maxNumFree = 16);
+  ~SpectraSTPeakListPool();
+
+  SpectraSTPeakList* acquire(double parentMz, int parentCharge, unsigned int numPeaks = 0, bool useBinIndex = false, string fragType = "");
+  void release(SpectraSTPeakList* peakList);
+
+  unsigned long long getNumAcquired() { return (m_numAcquired); }
+  unsigned long long getNumAllocations() { return (m_numAllocations); }
+
+private:
+
+  // the peak lists released and not yet acquired again; at most m_maxNumFree of them are kept
+  vector<SpectraSTPeakList*> m_free;
+  unsigned int m_maxNumFree;
+
+  // counters: peak lists acquired, and storage allocations made by (or for) those released so far
+  unsigned long long m_numAcquired;
+  unsigned long long m_numAllocations;
+
+};
+
+#endif /*SPECTRASTPEAKLISTPOOL_HPP_*/
@@ -435,6 +435,35 @@ void SpectraSTPeptideLibIndex::retrieve(vector<SpectraSTLibEntry*>& hits, string
   retrieve(hits, peptide, charge, mods, frag);
 }
 
+// retrieveOffsets - similar to retrieve(), but only returns the file offsets of the entries that would be retrieved,
+// without reading them.
+void SpectraSTPeptideLibIndex::retrieveOffsets(vector<fstream::off_type>& offsets, string peptide, string subkey) {
+
+  int charge = 0;
+  string mods("");
+  string frag("");
+  parseSubkey(subkey, charge, mods, frag);
+
+  map<string, map<string, vector<fstream::off_type> > >::iterator foundIndex = m_map.find(peptide);
+  if ((foundIndex == m_map.end())) {
+    // not found
+    return;
+  }
+  
+  for (map<string, vector<fstream::off_type> >::iterator i = (*foundIndex).second.begin(); i != (*foundIndex).second.end(); i++) {
+    
+    string key((*i).first);
+    int subkeyCharge = 0;
+    string subkeyMods("");
+    string subkeyFrag("");
+    parseSubkey(key, subkeyCharge, subkeyMods, subkeyFrag);
+
+    if ((frag == subkeyFrag) && ((charge == 0) || (charge == subkeyCharge)) && (mods.empty() || (mods == subkeyMods))) {
+      offsets.insert(offsets.end(), (*i).second.begin(), (*i).second.end());
+    }
+  }
+}
+
 
 // isInIndex - similar to retrieve(), but only returns whether or not an entry is found, and will not actually retrieve the entry. 
 bool SpectraSTPeptideLibIndex::isInIndex(string peptide, int charge, string mods, string frag) {
@@ -62,6 +62,7 @@ public:
   // Retrieval methods
   void retrieve(vector<SpectraSTLibEntry*>& hits, string peptide, int charge = 0, string mods = "", string frag = "");
   void retrieve(vector<SpectraSTLibEntry*>& hits, string peptide, string subkey);
+  void retrieveOffsets(vector<fstream::off_type>& offsets, string peptide, string subkey);
   bool isInIndex(string peptide, int charge = 0, string mods = "", string frag = "");
   bool isInIndex(string peptide, string subkey);
   
@@ -0,0 +1,131 @@
+#include "SpectraSTPerLibrarySearchOutput.hpp"
+#include "FileUtils.hpp"
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>                                                       
+Date          : 03.06.06 
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St. 
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTPerLibrarySearchOutput
+ * 
+ * Outputter used when several libraries are searched together and their hits are to be ranked separately
+ * (-s_HPL). See SpectraSTPerLibrarySearchOutput.hpp.
+ *  
+ */
+
+// constructor - creates one outputter per library
+SpectraSTPerLibrarySearchOutput::SpectraSTPerLibrarySearchOutput(string searchFileName, vector<string>& libFileNames, SpectraSTSearchParams& searchParams) :
+  SpectraSTSearchOutput("", "", searchParams),
+  m_libOutputs() {
+  
+  string outputFileNames("");
+  for (vector<string>::iterator l = libFileNames.begin(); l != libFileNames.end(); l++) {
+    SpectraSTSearchOutput* output = SpectraSTSearchOutput::createSpectraSTSearchOutput(searchFileName, searchParams, *l);
+    m_libOutputs.push_back(output);
+    
+    if (!outputFileNames.empty()) outputFileNames += ", ";
+    outputFileNames += output->getOutputFileName();
+  }
+  
+  // only for display -- nothing is written by this object itself
+  m_outputFileName = outputFileNames;
+  getPath(m_libOutputs[0]->getOutputFileName(), m_outputPath);
+  
+}
+
+// destructor
+SpectraSTPerLibrarySearchOutput::~SpectraSTPerLibrarySearchOutput() {
+  
+  for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+    delete (*op);
+  }
+}
+
+// setInstrInfo - each outputter gets its own copy, since each deletes it when done
+void SpectraSTPerLibrarySearchOutput::setInstrInfo(rampInstrumentInfo* instrInfo) {
+  
+  for (unsigned int k = 1; k < (unsigned int)(m_libOutputs.size()); k++) {
+    m_libOutputs[k]->setInstrInfo(instrInfo ? new rampInstrumentInfo(*instrInfo) : NULL);
+  }
+  m_libOutputs[0]->setInstrInfo(instrInfo);
+}
+
+void SpectraSTPerLibrarySearchOutput::printHeader() {
+  for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+    (*op)->printHeader();
+  }
+}
+
+void SpectraSTPerLibrarySearchOutput::printStartQuery(string query, double precursorMz, int assumedCharge, double retentionTime) {
+  for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+    (*op)->printStartQuery(query, precursorMz, assumedCharge, retentionTime);
+  }
+}
+
+void SpectraSTPerLibrarySearchOutput::printEndQuery(string query) {
+  for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+    (*op)->printEndQuery(query);
+  }
+}
+
+// printHit - hits are printed to the outputter of their own library
+void SpectraSTPerLibrarySearchOutput::printHit(string query, unsigned int hitRank, SpectraSTLibEntry* entry, SpectraSTSimScores& simScores) {
+  
+  if (entry) {
+    m_libOutputs[entry->getLibFileIndex()]->printHit(query, hitRank, entry, simScores);
+  } else {
+    for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+      (*op)->printHit(query, hitRank, entry, simScores);
+    }
+  }
+}
+
+void SpectraSTPerLibrarySearchOutput::printFooter() {
+  for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+    (*op)->printFooter();
+  }
+}
+
+void SpectraSTPerLibrarySearchOutput::printAbortedQuery(string query, string message) {
+  for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+    (*op)->printAbortedQuery(query, message);
+  }
+}
+
+void SpectraSTPerLibrarySearchOutput::openFile() {
+  for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+    (*op)->openFile();
+  }
+}
+
+void SpectraSTPerLibrarySearchOutput::closeFile() {
+  for (vector<SpectraSTSearchOutput*>::iterator op = m_libOutputs.begin(); op != m_libOutputs.end(); op++) {
+    (*op)->closeFile();
+  }
+}
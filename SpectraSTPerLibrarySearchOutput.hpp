@@ -0,0 +1,78 @@
+#ifndef SPECTRASTPERLIBRARYSEARCHOUTPUT_HPP_
+#define SPECTRASTPERLIBRARYSEARCHOUTPUT_HPP_
+
+#include "SpectraSTSearchOutput.hpp"
+
+#include <vector>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>                                                       
+Date          : 03.06.06 
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St. 
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTPerLibrarySearchOutput
+ * 
+ * Outputter used when several libraries are searched together and their hits are to be ranked separately
+ * (-s_HPL). Holds one outputter (of the usual format) per library, each writing its own result file. 
+ * SpectraSTSearch prints the hits of each library to getLibraryOutput(libFileIndex); everything else 
+ * (headers, footers, aborted queries) goes to all of them.
+ *  
+ */
+
+using namespace std;
+
+class SpectraSTPerLibrarySearchOutput : public SpectraSTSearchOutput {
+
+public:
+  SpectraSTPerLibrarySearchOutput(string searchFileName, vector<string>& libFileNames, SpectraSTSearchParams& searchParams);
+  virtual ~SpectraSTPerLibrarySearchOutput();
+  
+  virtual void setInstrInfo(rampInstrumentInfo* instrInfo);
+  
+  virtual void printHeader();
+  virtual void printStartQuery(string query, double precursorMz, int assumedCharge, double retentionTime);
+  virtual void printEndQuery(string query);
+  virtual void printHit(string query, unsigned int hitRank, SpectraSTLibEntry* entry, SpectraSTSimScores& simScores);
+  virtual void printFooter();
+  
+  virtual void printAbortedQuery(string query, string message);
+  
+  virtual void openFile();
+  virtual void closeFile();
+  
+  virtual SpectraSTSearchOutput* getLibraryOutput(unsigned int libFileIndex) { return (m_libOutputs[libFileIndex]); }
+  
+private:
+  
+  // m_libOutputs - one outputter per library, in the order of the libraries. These ARE properties of this class.
+  vector<SpectraSTSearchOutput*> m_libOutputs;
+  
+};
+
+#endif /*SPECTRASTPERLIBRARYSEARCHOUTPUT_HPP_*/
@@ -137,6 +137,16 @@ SpectraSTPeakList* SpectraSTQuery::getPeakList(int charge) {
   }
 }
 
+// detachPeakList - gives up the ownership of the peak list, which the caller must then delete (or give back to the
+// SpectraSTPeakListPool it came from). The query has no peak list afterwards.
+SpectraSTPeakList* SpectraSTQuery::detachPeakList() {
+  
+  SpectraSTPeakList* peakList = m_defaultPeakList;
+  m_defaultPeakList = NULL;
+  m_peakLists.clear();
+  return (peakList);
+}
+
 void SpectraSTQuery::addPossibleCharge(int charge) {
   
   if (m_defaultCharge == 0) m_defaultCharge = charge;
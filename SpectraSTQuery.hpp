@@ -52,6 +52,7 @@ public:
   int getDefaultCharge() { return m_defaultCharge; }
   string getComments() { return m_comments; }
   SpectraSTPeakList* getPeakList(int charge = 0);
+  SpectraSTPeakList* detachPeakList();
   void setRetentionTime(double rt) { if (rt >= 0.0) m_retentionTime = rt; }
   double getRetentionTime() { return m_retentionTime; }
   
@@ -0,0 +1,299 @@
+#include "SpectraSTQuerySelection.hpp"
+#include "SpectraSTQuery.hpp"
+#include "SpectraSTLog.hpp"
+#include "FileUtils.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTQuerySelection
+ *
+ * The subset of the queries to be searched (-sS). See SpectraSTQuerySelection.hpp.
+ *
+ */
+
+extern bool g_verbose;
+extern bool g_quiet;
+extern SpectraSTLog* g_log;
+
+// constructor - selects nothing until a file is read
+SpectraSTQuerySelection::SpectraSTQuerySelection() :
+  m_nameBuckets(),
+  m_numNames(0),
+  m_scanRanges(),
+  m_nameScanRanges(),
+  m_mzWindows(),
+  m_rtWindows(),
+  m_nameFilterOn(true) {
+
+}
+
+// destructor
+SpectraSTQuerySelection::~SpectraSTQuerySelection() {
+
+}
+
+// readFromFile - reads the selected list file. Returns false if it cannot be opened, in which case nothing is selected.
+bool SpectraSTQuerySelection::readFromFile(string fileName) {
+
+  ifstream fin;
+  if (!myFileOpen(fin, fileName)) {
+    return (false);
+  }
+
+  vector<string> names;
+
+  string line;
+  while (nextLine(fin, line, "", "")) {
+
+    string::size_type pos;
+    string s = nextToken(line, 0, pos);
+    if (s.empty()) continue;
+
+    string::size_type argPos = pos;
+    string arg1 = nextToken(line, argPos, argPos);
+
+    if (s == "SCANS" && !arg1.empty()) {
+      // SCANS <file> <first>[-<last>] ...
+      vector<pair<int, int> >& ranges = m_scanRanges[arg1];
+      string range;
+      while (!((range = nextToken(line, argPos, argPos)).empty())) {
+        string::size_type dash = range.find('-', 1);
+        int first = atoi(range.substr(0, dash).c_str());
+        int last = (dash == string::npos ? first : atoi(range.substr(dash + 1).c_str()));
+        if (first > last) swap(first, last);
+        ranges.push_back(pair<int, int>(first, last));
+        if (g_verbose) {
+          cout << "\tScans selected: " << arg1 << " " << first << "-" << last << endl;
+        }
+      }
+      continue;
+    }
+
+    if ((s == "MZ" || s == "RT") && !arg1.empty()) {
+      // MZ <low> <high> or RT <low> <high>
+      string arg2 = nextToken(line, argPos, argPos);
+      double low = atof(arg1.c_str());
+      double high = (arg2.empty() ? low : atof(arg2.c_str()));
+      if (low > high) swap(low, high);
+      (s == "MZ" ? m_mzWindows : m_rtWindows).push_back(pair<double, double>(low, high));
+      if (g_verbose) {
+        cout << "\t" << (s == "MZ" ? "Precursor m/z" : "Retention time") << " window selected: " << low << "-" << high << endl;
+      }
+      continue;
+    }
+
+    names.push_back(s);
+    if (g_verbose) {
+      cout << "\tQuery selected: " << s << endl;
+    }
+
+    // also keep names like those given to mzXML scans as scan numbers
+    string filePrefix("");
+    int scanNum = 0;
+    int charge = 0;
+    if (parseScanName(s, filePrefix, scanNum, charge) && charge == 0 && SpectraSTQuery::constructQueryName(filePrefix, scanNum, 0) == s) {
+      m_nameScanRanges[filePrefix].push_back(pair<int, int>(scanNum, scanNum));
+    }
+  }
+
+  buildNameTable(names);
+
+  for (map<string, vector<pair<int, int> > >::iterator r = m_scanRanges.begin(); r != m_scanRanges.end(); r++) {
+    mergeRanges(r->second);
+  }
+  for (map<string, vector<pair<int, int> > >::iterator r = m_nameScanRanges.begin(); r != m_nameScanRanges.end(); r++) {
+    mergeRanges(r->second);
+  }
+
+  // a list of windows only restricts the precursors, not the names
+  m_nameFilterOn = (m_numNames > 0 || !(m_scanRanges.empty()) || !hasPrecursorWindows());
+
+  return (true);
+}
+
+// isNameSelected - whether the query of this name is selected by name or scan range (not checking the windows)
+bool SpectraSTQuerySelection::isNameSelected(const string& name) const {
+
+  if (!m_nameFilterOn) {
+    return (true);
+  }
+
+  if (m_numNames > 0) {
+    const vector<string>& bucket = m_nameBuckets[hashName(name) & (unsigned int)(m_nameBuckets.size() - 1)];
+    for (vector<string>::const_iterator n = bucket.begin(); n != bucket.end(); n++) {
+      if (*n == name) {
+        return (true);
+      }
+    }
+  }
+
+  if (!(m_scanRanges.empty())) {
+    string filePrefix("");
+    int scanNum = 0;
+    int charge = 0;
+    if (parseScanName(name, filePrefix, scanNum, charge)) {
+      map<string, vector<pair<int, int> > >::const_iterator found = m_scanRanges.find(filePrefix);
+      if (found != m_scanRanges.end() && isInRanges(found->second, scanNum)) {
+        return (true);
+      }
+    }
+  }
+
+  return (false);
+}
+
+// isScanSelected - whether the scan of the file with this base name is selected by scan range, or by a name of the form
+// <file>.<scan>.<scan>.0 (not checking the windows). Same as isNameSelected(SpectraSTQuery::constructQueryName(filePrefix, scanNum, 0)).
+bool SpectraSTQuerySelection::isScanSelected(const string& filePrefix, int scanNum) const {
+
+  if (!m_nameFilterOn) {
+    return (true);
+  }
+
+  map<string, vector<pair<int, int> > >::const_iterator found = m_scanRanges.find(filePrefix);
+  if (found != m_scanRanges.end() && isInRanges(found->second, scanNum)) {
+    return (true);
+  }
+
+  found = m_nameScanRanges.find(filePrefix);
+  if (found != m_nameScanRanges.end() && isInRanges(found->second, scanNum)) {
+    return (true);
+  }
+
+  return (false);
+}
+
+// isPrecursorSelected - whether the precursor m/z and retention time are in the windows. A negative retentionTime is unknown,
+// and passes the RT windows.
+bool SpectraSTQuerySelection::isPrecursorSelected(double precursorMz, double retentionTime) const {
+
+  if (!(m_mzWindows.empty()) && !isInWindows(m_mzWindows, precursorMz)) {
+    return (false);
+  }
+  if (!(m_rtWindows.empty()) && retentionTime >= 0.0 && !isInWindows(m_rtWindows, retentionTime)) {
+    return (false);
+  }
+  return (true);
+}
+
+// buildNameTable - puts the names in a hash table with (at least) twice as many buckets as names
+void SpectraSTQuerySelection::buildNameTable(vector<string>& names) {
+
+  sort(names.begin(), names.end());
+  names.erase(unique(names.begin(), names.end()), names.end());
+  m_numNames = (unsigned int)(names.size());
+
+  unsigned int numBuckets = 16;
+  while (numBuckets < 2 * m_numNames) numBuckets *= 2;
+
+  m_nameBuckets.assign(numBuckets, vector<string>());
+  for (vector<string>::iterator n = names.begin(); n != names.end(); n++) {
+    m_nameBuckets[hashName(*n) & (numBuckets - 1)].push_back(*n);
+  }
+}
+
+// hashName - FNV-1a hash of a name
+unsigned int SpectraSTQuerySelection::hashName(const string& name) {
+
+  unsigned int h = 2166136261u;
+  for (string::const_iterator c = name.begin(); c != name.end(); c++) {
+    h ^= (unsigned char)(*c);
+    h *= 16777619u;
+  }
+  return (h);
+}
+
+// parseScanName - parses a query name of the form <file>.<scan>.<scan>.<charge>. Returns false if it is not of this form.
+bool SpectraSTQuerySelection::parseScanName(const string& name, string& filePrefix, int& scanNum, int& charge) {
+
+  string::size_type dot3 = name.rfind('.');
+  if (dot3 == string::npos || dot3 == 0) return (false);
+  string::size_type dot2 = name.rfind('.', dot3 - 1);
+  if (dot2 == string::npos || dot2 == 0) return (false);
+  string::size_type dot1 = name.rfind('.', dot2 - 1);
+  if (dot1 == string::npos || dot1 == 0) return (false);
+
+  string firstScan(name, dot1 + 1, dot2 - dot1 - 1);
+  string lastScan(name, dot2 + 1, dot3 - dot2 - 1);
+  string chargeStr(name, dot3 + 1);
+  if (firstScan.empty() || firstScan != lastScan || chargeStr.empty() ||
+      firstScan.find_first_not_of("0123456789") != string::npos || chargeStr.find_first_not_of("0123456789") != string::npos) {
+    return (false);
+  }
+
+  filePrefix = name.substr(0, dot1);
+  scanNum = atoi(firstScan.c_str());
+  charge = atoi(chargeStr.c_str());
+  return (true);
+}
+
+// mergeRanges - sorts the (first, last) ranges, and merges those that overlap or touch
+void SpectraSTQuerySelection::mergeRanges(vector<pair<int, int> >& ranges) {
+
+  sort(ranges.begin(), ranges.end());
+
+  vector<pair<int, int> > merged;
+  for (vector<pair<int, int> >::iterator r = ranges.begin(); r != ranges.end(); r++) {
+    if (!(merged.empty()) && r->first <= merged.back().second + 1) {
+      if (r->second > merged.back().second) merged.back().second = r->second;
+    } else {
+      merged.push_back(*r);
+    }
+  }
+  ranges.swap(merged);
+}
+
+// isInRanges - whether scanNum is in one of the sorted, non-overlapping ranges
+bool SpectraSTQuerySelection::isInRanges(const vector<pair<int, int> >& ranges, int scanNum) {
+
+  // the first range starting after scanNum; the one before it is the only one that can contain scanNum
+  vector<pair<int, int> >::const_iterator r = upper_bound(ranges.begin(), ranges.end(), pair<int, int>(scanNum, 2147483647));
+  if (r == ranges.begin()) return (false);
+  --r;
+  return (scanNum <= r->second);
+}
+
+// isInWindows - whether the value is in any of the (low, high) windows
+bool SpectraSTQuerySelection::isInWindows(const vector<pair<double, double> >& windows, double value) {
+
+  for (vector<pair<double, double> >::const_iterator w = windows.begin(); w != windows.end(); w++) {
+    if (value >= w->first && value <= w->second) {
+      return (true);
+    }
+  }
+  return (false);
+}
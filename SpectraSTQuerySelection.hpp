@@ -0,0 +1,101 @@
+#ifndef SPECTRASTQUERYSELECTION_HPP_
+#define SPECTRASTQUERYSELECTION_HPP_
+
+#include <string>
+#include <vector>
+#include <map>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTQuerySelection
+ *
+ * The subset of the queries to be searched (-sS). The selected list file has one selection per line:
+ *
+ *   <query name>                            - the query with this name
+ *   SCANS <file> <first>[-<last>] ...       - the scans, in the given ranges, of the file with this base name (as in the
+ *                                             query names, without the directory and extension), of any charge
+ *   MZ <low> <high>                         - the queries with precursor m/z in this window
+ *   RT <low> <high>                         - the queries with retention time (in seconds) in this window
+ *
+ * A query is selected if it matches any of the names or scan ranges (or there are none of these, but some windows), and
+ * its precursor m/z is in any of the MZ windows (if any), and its retention time is in any of the RT windows (if any, and
+ * the retention time is known). Names are looked up in a hash table, and scan ranges by binary search, so that neither
+ * depends on the length of the list; names of the form <file>.<scan>.<scan>.0 (as given to the scans of mzXML files) are
+ * also kept as scans, so that the scans of mzXML files can be selected without constructing their names.
+ *
+ */
+
+using namespace std;
+
+class SpectraSTQuerySelection {
+
+public:
+  SpectraSTQuerySelection();
+  ~SpectraSTQuerySelection();
+
+  bool readFromFile(string fileName);
+
+  bool isNameSelected(const string& name) const;
+  bool isScanSelected(const string& filePrefix, int scanNum) const;
+  bool isPrecursorSelected(double precursorMz, double retentionTime) const;
+
+  bool hasPrecursorWindows() const { return (!(m_mzWindows.empty() && m_rtWindows.empty())); }
+
+private:
+
+  // hash table of the names: m_nameBuckets[h & (size - 1)] holds the names with hash h
+  vector<vector<string> > m_nameBuckets;
+  unsigned int m_numNames;
+
+  // the scans selected by SCANS lines (any charge), and by names of the form <file>.<scan>.<scan>.0, of each file, as
+  // sorted, non-overlapping (first, last) ranges
+  map<string, vector<pair<int, int> > > m_scanRanges;
+  map<string, vector<pair<int, int> > > m_nameScanRanges;
+
+  // the (low, high) windows of precursor m/z and retention time
+  vector<pair<double, double> > m_mzWindows;
+  vector<pair<double, double> > m_rtWindows;
+
+  // false if any query name or scan number will do (only windows were given)
+  bool m_nameFilterOn;
+
+  void buildNameTable(vector<string>& names);
+
+  static unsigned int hashName(const string& name);
+  static bool parseScanName(const string& name, string& filePrefix, int& scanNum, int& charge);
+  static void mergeRanges(vector<pair<int, int> >& ranges);
+  static bool isInRanges(const vector<pair<int, int> >& ranges, int scanNum);
+  static bool isInWindows(const vector<pair<double, double> >& windows, double value);
+
+};
+
+#endif /*SPECTRASTQUERYSELECTION_HPP_*/
@@ -29,6 +29,7 @@ SpectraSTReplicates::SpectraSTReplicates(vector<SpectraSTLibEntry*>& entries, Sp
   m_samples(),
   m_instruments(),
   m_missingXCorr(false),
+  m_plotter(NULL),
   m_recordRawSpectra(false),
   m_denoiser(denoiser) {
   
@@ -86,6 +87,8 @@ void SpectraSTReplicates::addEntry(SpectraSTLibEntry* entry) {
   r.sn = 0.0;
   r.xcorr = 0.0;
   r.prob = 0.0;
+  r.numUsed = 1;
+  r.numTotal = 1;
 
   // hijack -- removes anything whose massdiff is not 0
   //string mdStr("");
@@ -515,10 +518,20 @@ bool SpectraSTReplicates::removeDissimilarReplicates() {
 
   vector<SpectraSTLibEntry*> clusters;
   vector<unsigned int> clusterSize;
+  vector<unsigned int> clusterRep; // index into m_reps of the replicate that started each cluster
+  
+  // bin all replicates once up front, rather than comparing their full bin vectors pair by pair
+  vector<SpectraSTPeakList*> pls;
+  pls.reserve(m_reps.size());
+  for (vector<Replicate>::iterator rep = m_reps.begin(); rep != m_reps.end(); rep++) {
+    pls.push_back(rep->entry->getPeakList());
+  }
+  BinnedPeakLists binned;
+  binPeakLists(pls, binned);
     
   for (vector<Replicate>::iterator rep = m_reps.begin(); rep != m_reps.end(); rep++) {
     
-    SpectraSTPeakList* pl = rep->entry->getPeakList();
+    unsigned int repIndex = (unsigned int)(rep - m_reps.begin());
     int mdInt = rep->entry->getMassDiffInt();
     
     for (vector<SpectraSTLibEntry*>::size_type cl = 0; cl < clusters.size(); cl++) {
@@ -530,7 +543,7 @@ bool SpectraSTReplicates::removeDissimilarReplicates() {
       //      }
       // end hijack
       
-      double dot = clusters[cl]->getPeakList()->compare(pl);
+      double dot = calcBinnedDot(binned, clusterRep[cl], binned, repIndex);
       if (dot >= 0.9999) {
         // fishy. probably identical spectra being included twice!
         string query1("");
@@ -555,6 +568,7 @@ bool SpectraSTReplicates::removeDissimilarReplicates() {
       rep->status = -((int)(clusters.size()) + 1);
       clusters.push_back(rep->entry);
       clusterSize.push_back(rep->numUsed);
+      clusterRep.push_back(repIndex);
     }
   }    
 
@@ -622,11 +636,22 @@ void SpectraSTReplicates::aggregateStats(SpectraSTLibEntry* final, SpectraSTPeak
   unsigned int precIntCount = 0;
   unsigned int origMaxIntCount = 0;
   
+  // bin the consensus (entry 0) and the replicates (entries 1 and on) once. The replicates are packed again
+  // here, since their peak lists may have been changed since removeDissimilarReplicates()
+  vector<SpectraSTPeakList*> pls;
+  pls.reserve(usedReps.size() + 1);
+  pls.push_back(pl);
+  for (vector<Replicate*>::iterator r = usedReps.begin(); r != usedReps.end(); r++) {
+    pls.push_back((*r)->entry->getPeakList());
+  }
+  BinnedPeakLists binned;
+  binPeakLists(pls, binned);
+  
   // loop over all replicates for various evaluation data
   for (vector<Replicate*>::iterator r = usedReps.begin(); r != usedReps.end(); r++) {
     
      // check dot product between consensus and each replicate
-    double dot = pl->compare((*r)->entry->getPeakList());
+    double dot = calcBinnedDot(binned, 0, binned, (unsigned int)(r - usedReps.begin()) + 1);
 //    cerr << dot << endl;
     sumDot += dot;
     sumSqDot += dot * dot;
@@ -852,7 +877,7 @@ void SpectraSTReplicates::plotSingle(SpectraSTLibEntry* single) {
   
   fnss << m_plotPath << single->getSafeName() << "_SING";
   
-  single->getPeakList()->plot(fnss.str(), "SINGLE");
+  single->getPeakList()->plot(fnss.str(), "SINGLE", m_plotter);
         
 }
 
@@ -862,7 +887,7 @@ void SpectraSTReplicates::plotConsensus(SpectraSTLibEntry* consensus, SpectraSTP
   stringstream fnss;
     
   fnss << m_plotPath << consensus->getSafeName() << "_CONS";
-  consensusPeakList->plot(fnss.str(), "CONSENSUS");
+  consensusPeakList->plot(fnss.str(), "CONSENSUS", m_plotter);
     
   unsigned int icount = 0;
   for (vector<Replicate*>::iterator rep = usedReps.begin(); rep != usedReps.end(); rep++) {
@@ -876,7 +901,7 @@ void SpectraSTReplicates::plotConsensus(SpectraSTLibEntry* consensus, SpectraSTP
     stringstream rss;
     rss.precision(3);
     rss << (*rep)->entry->getPeakList()->getWeight();
-    (*rep)->entry->getPeakList()->plot(rfnss.str(), rss.str());
+    (*rep)->entry->getPeakList()->plot(rfnss.str(), rss.str(), m_plotter);
   }
     
 	
@@ -887,3 +912,55 @@ bool SpectraSTReplicates::sortReplicatesByWeight(Replicate a, Replicate b) {
   return (a.entry->getPeakList()->getWeight() > b.entry->getPeakList()->getWeight());
 }
 
+// binPeakLists - bins all peak lists in pls (with the same default parameters as SpectraSTPeakList::compare()) and
+// packs their non-empty bins into binned
+void SpectraSTReplicates::binPeakLists(vector<SpectraSTPeakList*>& pls, BinnedPeakLists& binned) {
+
+  binned.offsets.clear();
+  binned.binIndex.clear();
+  binned.bins.clear();
+  binned.magnitudes.clear();
+
+  binned.offsets.reserve(pls.size() + 1);
+  binned.magnitudes.reserve(pls.size());
+
+  for (vector<SpectraSTPeakList*>::iterator pl = pls.begin(); pl != pls.end(); pl++) {
+    binned.offsets.push_back((unsigned int)(binned.bins.size()));
+    (*pl)->binPeaks(0.0, 0.5, 1.0, 1, 0.5);
+    binned.magnitudes.push_back((*pl)->getSparseBins(binned.binIndex, binned.bins));
+  }
+  binned.offsets.push_back((unsigned int)(binned.bins.size()));
+}
+
+// calcBinnedDot - the dot product between peak list k1 of binned1 and peak list k2 of binned2. Gives exactly
+// the same value as SpectraSTPeakList::compare() on the two peak lists.
+double SpectraSTReplicates::calcBinnedDot(BinnedPeakLists& binned1, unsigned int k1, BinnedPeakLists& binned2, unsigned int k2) {
+
+  float mag1 = binned1.magnitudes[k1];
+  float mag2 = binned2.magnitudes[k2];
+  if (mag1 < 0.00001 || mag2 < 0.00001) {
+    return (0.0);
+  }
+
+  unsigned int i = binned1.offsets[k1];
+  unsigned int iEnd = binned1.offsets[k1 + 1];
+  unsigned int j = binned2.offsets[k2];
+  unsigned int jEnd = binned2.offsets[k2 + 1];
+
+  // accumulate in float and in increasing bin order, as calcDot() does
+  float dot = 0.0;
+  while (i < iEnd && j < jEnd) {
+    if (binned1.binIndex[i] == binned2.binIndex[j]) {
+      dot += binned1.bins[i] * binned2.bins[j];
+      i++;
+      j++;
+    } else if (binned1.binIndex[i] < binned2.binIndex[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+
+  return ((double)(dot / (mag1 * mag2)));
+}
+
@@ -61,6 +61,16 @@ typedef struct _replicate {
 	double xcorr;
 } Replicate;
 
+// the binned peak lists of a set of replicates, packed into one contiguous block such that they need to be
+// binned only once for all pairwise comparisons. The bins of peak list k are entries offsets[k] to offsets[k + 1] - 1
+// of binIndex and bins, sorted by bin number.
+typedef struct _binnedPeakLists {
+	vector<unsigned int> offsets;
+	vector<unsigned int> binIndex;
+	vector<float> bins;
+	vector<float> magnitudes;
+} BinnedPeakLists;
+
 class SpectraSTReplicates {
 
 public:
@@ -72,6 +82,7 @@ public:
   SpectraSTLibEntry* findBestReplicate();
 
   void setPlotPath(string plotPath) { m_plotPath = plotPath; }
+  void setPlotter(SpectraSTSpectrumPlotter* plotter) { m_plotter = plotter; }
   void setRecordRawSpectra(bool value) { m_recordRawSpectra = value; }
 
 private:
@@ -86,6 +97,7 @@ private:
   bool m_missingXCorr; // whether some replicates don't have xcorr values
   
   string m_plotPath;
+  SpectraSTSpectrumPlotter* m_plotter; // NOT a property of this class
   
   bool m_recordRawSpectra;
   
@@ -109,6 +121,9 @@ private:
 
   static bool sortReplicatesByWeight(Replicate a, Replicate b);
 
+  static void binPeakLists(vector<SpectraSTPeakList*>& pls, BinnedPeakLists& binned);
+  static double calcBinnedDot(BinnedPeakLists& binned1, unsigned int k1, BinnedPeakLists& binned2, unsigned int k2);
+
 };
 
 #endif /*SPECTRASTREPLICATES_HPP_*/
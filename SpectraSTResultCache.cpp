@@ -0,0 +1,313 @@
+#include "SpectraSTResultCache.hpp"
+#include "SpectraSTLog.hpp"
+#include "FileUtils.hpp"
+
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTResultCache
+ *
+ * Keeps the ranked candidates of every query of a query file in a sidecar file.
+ * See SpectraSTResultCache.hpp.
+ *
+ */
+
+extern bool g_verbose;
+extern bool g_quiet;
+extern SpectraSTLog* g_log;
+
+#define RESULT_CACHE_MAGIC "SPSTRSLT"
+#define RESULT_CACHE_VERSION 1
+
+// constructor - loads the index of the sidecar, if it is current
+SpectraSTResultCache::SpectraSTResultCache(string fileName, SpectraSTSearchParams& params, SpectraSTLib* lib) :
+  m_fileName(fileName),
+  m_cacheFileName(getCacheFileName(fileName)),
+  m_key(),
+  m_offsets(),
+  m_fin(),
+  m_fout(),
+  m_appendOffset(0),
+  m_isCurrent(false),
+  m_failed(false) {
+
+  if (!makeKey(params, lib)) {
+    // cannot tell which version of the file (or libraries) the results would belong to; do not cache
+    m_failed = true;
+    return;
+  }
+
+  m_isCurrent = readIndex();
+
+  if (!m_isCurrent) {
+    m_offsets.clear();
+    if (m_fin.is_open()) m_fin.close();
+  } else if (g_verbose) {
+    cout << "Search results of \"" << m_fileName << "\" loaded from \"" << m_cacheFileName << "\"." << endl;
+  }
+}
+
+// destructor
+SpectraSTResultCache::~SpectraSTResultCache() {
+
+  if (m_fin.is_open()) m_fin.close();
+
+  if (m_fout.is_open()) {
+    // flush first, so that a failure to write out the last buffered records is caught too
+    m_fout.flush();
+    bool ok = m_fout.good();
+    m_fout.close();
+    if (ok) {
+      g_log->log("RESULT CACHE", "Search results of \"" + m_fileName + "\" cached in \"" + m_cacheFileName + "\".");
+    } else if (m_appendOffset > 0 && truncateTo(m_appendOffset)) {
+      // a half-written record would be taken as a stale sidecar next time; drop what was appended, keep the rest
+      g_log->log("RESULT CACHE", "Cannot write result cache \"" + m_cacheFileName + "\". New search results not cached.");
+    } else {
+      // nothing to keep (or cannot cut off the records appended); better not to leave a half-written sidecar
+      g_log->log("RESULT CACHE", "Cannot write result cache \"" + m_cacheFileName + "\". Not cached.");
+      remove(m_cacheFileName.c_str());
+    }
+  }
+}
+
+// getCacheFileName - the name of the sidecar of the file fileName
+string SpectraSTResultCache::getCacheFileName(string fileName) {
+  return (fileName + ".resultcache");
+}
+
+// makeKey - puts together the key of the sidecar. Returns false if the file or one of the libraries cannot be stat'ed.
+bool SpectraSTResultCache::makeKey(SpectraSTSearchParams& params, SpectraSTLib* lib) {
+
+  stringstream ss;
+  struct stat fileStat;
+
+  if (stat(m_fileName.c_str(), &fileStat) != 0) {
+    return (false);
+  }
+  ss << "FILE\t" << (long long)(fileStat.st_size) << '\t' << (long long)(fileStat.st_mtime) << '\t' << m_fileName << '\n';
+
+  for (unsigned int k = 0; k < lib->getNumLibFiles(); k++) {
+    string libFileName(lib->getLibFileName(k));
+    if (stat(libFileName.c_str(), &fileStat) != 0) {
+      return (false);
+    }
+    ss << "LIBRARY\t" << (long long)(fileStat.st_size) << '\t' << (long long)(fileStat.st_mtime) << '\t' << libFileName << '\n';
+  }
+
+  params.printScoringParams(ss);
+
+  m_key = ss.str();
+  return (true);
+}
+
+// readIndex - reads the header of the sidecar and finds where the candidates of each query are. Returns false (and
+// the sidecar will be rewritten) if there is no sidecar, if it does not belong to this version of the file, libraries
+// and options, or if it ends in a partial record.
+bool SpectraSTResultCache::readIndex() {
+
+  if (!myFileOpen(m_fin, m_cacheFileName, true)) {
+    return (false);
+  }
+
+  m_fin.seekg(0, ios::end);
+  long long cacheFileSize = (long long)(m_fin.tellg());
+  m_fin.seekg(0, ios::beg);
+
+  char magic[8];
+  int version = 0;
+  int recordSize = 0;
+  unsigned int keyLength = 0;
+
+  m_fin.read(magic, 8);
+  m_fin.read((char*)(&version), sizeof(int));
+  m_fin.read((char*)(&recordSize), sizeof(int));
+  m_fin.read((char*)(&keyLength), sizeof(unsigned int));
+
+  if (!m_fin.good() || strncmp(magic, RESULT_CACHE_MAGIC, 8) != 0 || version != RESULT_CACHE_VERSION ||
+      recordSize != (int)sizeof(SpectraSTResultCacheRecord) || keyLength != (unsigned int)m_key.length()) {
+    return (false);
+  }
+
+  string key(keyLength, ' ');
+  m_fin.read(&(key[0]), keyLength);
+  if (!m_fin.good() || key != m_key) {
+    return (false);
+  }
+
+  long long pos = (long long)(m_fin.tellg());
+
+  while (pos < cacheFileSize) {
+
+    unsigned int nameLength = 0;
+    m_fin.read((char*)(&nameLength), sizeof(unsigned int));
+    if (!m_fin.good() || pos + (long long)sizeof(unsigned int) + nameLength > cacheFileSize) {
+      return (false);
+    }
+
+    string name(nameLength, ' ');
+    if (nameLength > 0) m_fin.read(&(name[0]), nameLength);
+
+    double precursorMz = 0.0;
+    m_fin.read((char*)(&precursorMz), sizeof(double));
+
+    long long offset = (long long)(m_fin.tellg());
+
+    unsigned int numRecords = 0;
+    m_fin.read((char*)(&numRecords), sizeof(unsigned int));
+    if (!m_fin.good()) {
+      return (false);
+    }
+
+    pos = offset + (long long)sizeof(unsigned int) + (long long)numRecords * (long long)sizeof(SpectraSTResultCacheRecord);
+    if (pos > cacheFileSize) {
+      return (false);
+    }
+
+    m_offsets[name].push_back(pair<double, long long>(precursorMz, offset));
+    m_fin.seekg((fstream::off_type)pos, ios::beg);
+  }
+
+  return (true);
+}
+
+// lookup - gets the candidates of the query, in the order they were ranked. Returns false if the query is not in
+// the sidecar. Each cached query is only served once, so that repeated queries of the same name are served in turn.
+bool SpectraSTResultCache::lookup(string name, double precursorMz, vector<SpectraSTResultCacheRecord>& records) {
+
+  if (!m_isCurrent) {
+    return (false);
+  }
+
+  map<string, vector<pair<double, long long> > >::iterator found = m_offsets.find(name);
+  if (found == m_offsets.end()) {
+    return (false);
+  }
+
+  for (vector<pair<double, long long> >::iterator i = found->second.begin(); i != found->second.end(); i++) {
+
+    if (i->first != precursorMz) continue;
+
+    m_fin.clear();
+    m_fin.seekg((fstream::off_type)(i->second), ios::beg);
+
+    unsigned int numRecords = 0;
+    m_fin.read((char*)(&numRecords), sizeof(unsigned int));
+    records.resize(numRecords);
+    if (numRecords > 0) {
+      m_fin.read((char*)(&(records[0])), numRecords * sizeof(SpectraSTResultCacheRecord));
+    }
+
+    found->second.erase(i);
+
+    if (!m_fin.good()) {
+      records.clear();
+      return (false);
+    }
+    return (true);
+  }
+
+  return (false);
+}
+
+// insert - adds the candidates of a query that had to be searched, in the order they were ranked
+void SpectraSTResultCache::insert(string name, double precursorMz, vector<SpectraSTResultCacheRecord>& records) {
+
+  if (m_failed || (!m_fout.is_open() && !openForAppend())) {
+    return;
+  }
+
+  unsigned int nameLength = (unsigned int)name.length();
+  unsigned int numRecords = (unsigned int)records.size();
+
+  m_fout.write((char*)(&nameLength), sizeof(unsigned int));
+  m_fout.write(name.c_str(), nameLength);
+  m_fout.write((char*)(&precursorMz), sizeof(double));
+  m_fout.write((char*)(&numRecords), sizeof(unsigned int));
+  if (numRecords > 0) {
+    m_fout.write((char*)(&(records[0])), numRecords * sizeof(SpectraSTResultCacheRecord));
+  }
+}
+
+// openForAppend - opens the sidecar for adding queries. A current sidecar is added to; otherwise a new one is started.
+bool SpectraSTResultCache::openForAppend() {
+
+  if (m_isCurrent) {
+    struct stat cacheStat;
+    if (stat(m_cacheFileName.c_str(), &cacheStat) == 0) {
+      m_appendOffset = (long long)(cacheStat.st_size);
+    }
+    m_fout.open(m_cacheFileName.c_str(), ios::out | ios::app | ios::binary);
+    if (!m_fout.good()) {
+      g_log->log("RESULT CACHE", "Cannot write result cache \"" + m_cacheFileName + "\". Not cached.");
+      m_failed = true;
+      return (false);
+    }
+    return (true);
+  }
+
+  if (!myFileOpen(m_fout, m_cacheFileName, true)) {
+    g_log->log("RESULT CACHE", "Cannot write result cache \"" + m_cacheFileName + "\". Not cached.");
+    m_failed = true;
+    return (false);
+  }
+
+  int version = RESULT_CACHE_VERSION;
+  int recordSize = (int)sizeof(SpectraSTResultCacheRecord);
+  unsigned int keyLength = (unsigned int)m_key.length();
+
+  m_fout.write(RESULT_CACHE_MAGIC, 8);
+  m_fout.write((char*)(&version), sizeof(int));
+  m_fout.write((char*)(&recordSize), sizeof(int));
+  m_fout.write((char*)(&keyLength), sizeof(unsigned int));
+  m_fout.write(m_key.c_str(), keyLength);
+
+  return (true);
+}
+
+// truncateTo - cuts the (closed) sidecar back to size bytes, dropping whatever was appended after. Returns false if it
+// cannot be done.
+bool SpectraSTResultCache::truncateTo(long long size) {
+
+#ifndef _MSC_VER
+  return (truncate(m_cacheFileName.c_str(), (off_t)size) == 0);
+#else
+  return (false);
+#endif
+}
@@ -0,0 +1,113 @@
+#ifndef SPECTRASTRESULTCACHE_HPP_
+#define SPECTRASTRESULTCACHE_HPP_
+
+#include "SpectraSTSearchParams.hpp"
+#include "SpectraSTLib.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTResultCache
+ *
+ * Keeps the ranked candidates of every query searched in a query file, with their scores, in a sidecar file
+ * <file>.resultcache, such that repeated searches of the same file need not retrieve and score the candidates
+ * again. Only the options deciding which of the candidates are printed, and how, may differ between the searches.
+ * The sidecar is keyed on the path, size and modification time of the file, those of all libraries, and the
+ * options that can change the candidates or their scores (see SpectraSTSearchParams::printScoringParams); it is
+ * rebuilt whenever any of these changes.
+ *
+ */
+
+using namespace std;
+
+// one candidate of a query, as stored in the sidecar. MUST BE modified together with
+// RESULT_CACHE_VERSION to keep old sidecars from being misread.
+typedef struct {
+  unsigned int libFileIndex;
+  int libId;
+  int libRank; // rank among the candidates of the same library (-s_HPL), -1 if not ranked separately
+  unsigned int hitsNum;
+  unsigned int firstNonHomolog;
+  double sortKey;
+  double dot;
+  double delta;
+  double dotBias;
+  double precursorMzDiff;
+  double hitsMean;
+  double hitsStDev;
+  double fval;
+} SpectraSTResultCacheRecord;
+
+class SpectraSTResultCache {
+
+public:
+  SpectraSTResultCache(string fileName, SpectraSTSearchParams& params, SpectraSTLib* lib);
+  ~SpectraSTResultCache();
+
+  bool lookup(string name, double precursorMz, vector<SpectraSTResultCacheRecord>& records);
+  void insert(string name, double precursorMz, vector<SpectraSTResultCacheRecord>& records);
+
+  static string getCacheFileName(string fileName);
+
+private:
+
+  string m_fileName;
+  string m_cacheFileName;
+
+  // key of the sidecar: everything the results depend on, other than the queries themselves
+  string m_key;
+
+  // m_offsets - where the candidates of each query are in the sidecar, by query name. A query that occurs
+  // more than once in the file is told apart by its precursor m/z, and then by the order of occurrence.
+  map<string, vector<pair<double, long long> > > m_offsets;
+
+  ifstream m_fin;
+  ofstream m_fout;
+
+  // the size of a current sidecar before this run appended to it; it is truncated back to this size if the append fails
+  long long m_appendOffset;
+
+  bool m_isCurrent;
+  bool m_failed;
+
+  bool makeKey(SpectraSTSearchParams& params, SpectraSTLib* lib);
+  bool readIndex();
+  bool openForAppend();
+  bool truncateTo(long long size);
+
+};
+
+#endif /*SPECTRASTRESULTCACHE_HPP_*/
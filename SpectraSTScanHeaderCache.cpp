@@ -0,0 +1,327 @@
+#include "SpectraSTScanHeaderCache.hpp"
+#include "SpectraSTLog.hpp"
+#include "FileUtils.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTScanHeaderCache
+ *
+ * Keeps the scan headers of an mzXML (or other RAMP-readable) file in a sidecar file.
+ * See SpectraSTScanHeaderCache.hpp.
+ *
+ */
+
+extern bool g_verbose;
+extern bool g_quiet;
+extern SpectraSTLog* g_log;
+
+#define SCAN_HEADER_CACHE_MAGIC "SPSTSCAN"
+#define SCAN_HEADER_CACHE_VERSION 1
+
+// constructor
+SpectraSTScanHeaderCache::SpectraSTScanHeaderCache(string fileName) :
+  m_fileName(fileName),
+  m_cacheFileName(getCacheFileName(fileName)),
+  m_fileSize(-1),
+  m_fileModTime(-1),
+  m_records(),
+  m_lastScan(0) {
+
+}
+
+// destructor
+SpectraSTScanHeaderCache::~SpectraSTScanHeaderCache() {
+
+}
+
+// getCacheFileName - the name of the sidecar of the file fileName
+string SpectraSTScanHeaderCache::getCacheFileName(string fileName) {
+  return (fileName + ".scancache");
+}
+
+// openCRamp - opens the file with cRamp. If the sidecar is current, the scan table (and the offsets in it)
+// is taken from there; otherwise all scan headers are read from the file and a new sidecar is written.
+// The cRamp object becomes property of the caller, who must check OK() as usual.
+cRamp* SpectraSTScanHeaderCache::openCRamp() {
+
+  if (statFile() && readFromFile()) {
+
+    // no need for cRamp to read the index -- we have the offsets
+    cRamp* cramp = new cRamp(m_fileName.c_str(), false, true);
+    if (cramp->OK()) {
+      vector<ramp_fileoffset_t> offsets(m_lastScan + 1, -1);
+      for (int k = 1; k <= m_lastScan; k++) {
+        offsets[k] = (ramp_fileoffset_t)(m_records[k].filePosition);
+      }
+      cramp->setScanOffsets(&(offsets[0]), m_lastScan);
+    }
+
+    if (g_verbose) {
+      cout << "Scan headers of \"" << m_fileName << "\" loaded from \"" << m_cacheFileName << "\"." << endl;
+    }
+    return (cramp);
+  }
+
+  cRamp* cramp = new cRamp(m_fileName.c_str());
+  if (!cramp->OK()) {
+    return (cramp);
+  }
+
+  build(cramp);
+  if (m_fileSize >= 0) {
+    writeToFile();
+  }
+  return (cramp);
+}
+
+// getScanHeaderInfo - returns the header of scan scanNum, as cRamp::getScanHeaderInfo() would. The returned
+// rampScanInfo object becomes property of the caller. Returns NULL if there is no such scan.
+rampScanInfo* SpectraSTScanHeaderCache::getScanHeaderInfo(int scanNum) {
+
+  if (scanNum < 1 || scanNum > m_lastScan || m_records[scanNum].scanNum != scanNum) {
+    return (NULL);
+  }
+
+  SpectraSTScanHeaderRecord& r = m_records[scanNum];
+
+  rampScanInfo* scanInfo = new rampScanInfo();
+  scanInfo->m_data.seqNum = scanNum;
+  scanInfo->m_data.acquisitionNum = r.acquisitionNum;
+  scanInfo->m_data.msLevel = r.msLevel;
+  scanInfo->m_data.peaksCount = r.peaksCount;
+  scanInfo->m_data.precursorMZ = r.precursorMz;
+  scanInfo->m_data.precursorCharge = r.precursorCharge;
+  scanInfo->m_data.precursorIntensity = r.precursorIntensity;
+  scanInfo->m_data.totIonCurrent = r.totIonCurrent;
+  scanInfo->m_data.collisionEnergy = r.collisionEnergy;
+  scanInfo->m_data.filePosition = (ramp_fileoffset_t)(r.filePosition);
+  scanInfo->setRetentionTimeSeconds(r.retentionTime);
+  strncpy(scanInfo->m_data.activationMethod, r.activationMethod, sizeof(scanInfo->m_data.activationMethod) - 1);
+  scanInfo->m_data.activationMethod[sizeof(scanInfo->m_data.activationMethod) - 1] = '\0';
+
+  for (int ch = 1; ch < CHARGEARRAY_LENGTH && ch < 32; ch++) {
+    if (r.possibleCharges & (1u << ch)) {
+      int len = (int)strlen(scanInfo->m_data.possibleCharges);
+      sprintf(scanInfo->m_data.possibleCharges + len, "%s%d", len ? "," : "", ch);
+      scanInfo->m_data.possibleChargesArray[ch] = true;
+      scanInfo->m_data.numPossibleCharges++;
+    }
+  }
+
+  return (scanInfo);
+}
+
+// statFile - gets the size and modification time of the file, which together with the path identify
+// the version of the file the sidecar belongs to
+bool SpectraSTScanHeaderCache::statFile() {
+
+  struct stat fileStat;
+  if (stat(m_fileName.c_str(), &fileStat) != 0) {
+    m_fileSize = -1;
+    m_fileModTime = -1;
+    return (false);
+  }
+  m_fileSize = (long long)(fileStat.st_size);
+  m_fileModTime = (long long)(fileStat.st_mtime);
+  return (true);
+}
+
+// build - reads all scan headers through cramp into the scan table
+void SpectraSTScanHeaderCache::build(cRamp* cramp) {
+
+  m_lastScan = cramp->getLastScan();
+
+  SpectraSTScanHeaderRecord empty;
+  memset(&empty, 0, sizeof(SpectraSTScanHeaderRecord));
+  empty.filePosition = -1;
+  m_records.assign(m_lastScan + 1, empty);
+
+  for (int k = 1; k <= m_lastScan; k++) {
+
+    SpectraSTScanHeaderRecord& r = m_records[k];
+    r.filePosition = (long long)(cramp->getScanOffset(k));
+
+    rampScanInfo* scanInfo = cramp->getScanHeaderInfo(k);
+    if (!scanInfo) {
+      continue;
+    }
+
+    r.scanNum = k;
+    r.acquisitionNum = scanInfo->m_data.acquisitionNum;
+    r.msLevel = scanInfo->m_data.msLevel;
+    r.precursorCharge = scanInfo->m_data.precursorCharge;
+    r.peaksCount = scanInfo->m_data.peaksCount;
+    r.precursorMz = scanInfo->m_data.precursorMZ;
+    r.retentionTime = scanInfo->getRetentionTimeSeconds();
+    r.precursorIntensity = scanInfo->m_data.precursorIntensity;
+    r.totIonCurrent = scanInfo->m_data.totIonCurrent;
+    r.collisionEnergy = scanInfo->m_data.collisionEnergy;
+    strncpy(r.activationMethod, scanInfo->m_data.activationMethod, sizeof(r.activationMethod) - 1);
+
+    for (int ch = 1; ch < CHARGEARRAY_LENGTH && ch < 32; ch++) {
+      if (scanInfo->m_data.possibleChargesArray[ch]) {
+        r.possibleCharges |= (1u << ch);
+      }
+    }
+
+    delete (scanInfo);
+  }
+}
+
+// writeToFile - writes the scan table to the sidecar. Only scans that exist are written. MUST BE modified
+// together with readFromFile() to ensure synchronization of the .scancache file format.
+void SpectraSTScanHeaderCache::writeToFile() {
+
+  // write to a temporary file first, so that a concurrent reader never sees half a sidecar
+  string tmpFileName(m_cacheFileName + ".tmp");
+
+  ofstream fout;
+  if (!myFileOpen(fout, tmpFileName, true)) {
+    g_log->log("SCAN HEADER CACHE", "Cannot write scan header cache \"" + m_cacheFileName + "\". Not cached.");
+    return;
+  }
+
+  int version = SCAN_HEADER_CACHE_VERSION;
+  int recordSize = (int)sizeof(SpectraSTScanHeaderRecord);
+  unsigned int pathLength = (unsigned int)m_fileName.length();
+  unsigned int numRecords = 0;
+  for (int k = 1; k <= m_lastScan; k++) {
+    if (m_records[k].scanNum > 0 || m_records[k].filePosition >= 0) numRecords++;
+  }
+
+  fout.write(SCAN_HEADER_CACHE_MAGIC, 8);
+  fout.write((char*)(&version), sizeof(int));
+  fout.write((char*)(&recordSize), sizeof(int));
+  fout.write((char*)(&m_fileSize), sizeof(long long));
+  fout.write((char*)(&m_fileModTime), sizeof(long long));
+  fout.write((char*)(&pathLength), sizeof(unsigned int));
+  fout.write(m_fileName.c_str(), pathLength);
+  fout.write((char*)(&m_lastScan), sizeof(int));
+  fout.write((char*)(&numRecords), sizeof(unsigned int));
+
+  for (int k = 1; k <= m_lastScan; k++) {
+    if (m_records[k].scanNum > 0 || m_records[k].filePosition >= 0) {
+      // scans without a readable header still need their index (scanNum is then 0)
+      SpectraSTScanHeaderRecord r = m_records[k];
+      r.scanNum = k;
+      if (m_records[k].scanNum == 0) r.msLevel = -1; // flag for "header unreadable"
+      fout.write((char*)(&r), sizeof(SpectraSTScanHeaderRecord));
+    }
+  }
+
+  bool ok = fout.good();
+  fout.close();
+
+  if (!ok || rename(tmpFileName.c_str(), m_cacheFileName.c_str()) != 0) {
+    g_log->log("SCAN HEADER CACHE", "Cannot write scan header cache \"" + m_cacheFileName + "\". Not cached.");
+    remove(tmpFileName.c_str());
+    return;
+  }
+
+  g_log->log("SCAN HEADER CACHE", "Scan headers of \"" + m_fileName + "\" cached in \"" + m_cacheFileName + "\".");
+}
+
+// readFromFile - reads the scan table from the sidecar. Returns false (and the caller will rebuild it) if
+// there is no sidecar, or it does not belong to this version of the file.
+bool SpectraSTScanHeaderCache::readFromFile() {
+
+  ifstream fin;
+  if (!myFileOpen(fin, m_cacheFileName, true)) {
+    return (false);
+  }
+
+  char magic[8];
+  int version = 0;
+  int recordSize = 0;
+  long long fileSize = -1;
+  long long fileModTime = -1;
+  unsigned int pathLength = 0;
+
+  fin.read(magic, 8);
+  fin.read((char*)(&version), sizeof(int));
+  fin.read((char*)(&recordSize), sizeof(int));
+  fin.read((char*)(&fileSize), sizeof(long long));
+  fin.read((char*)(&fileModTime), sizeof(long long));
+  fin.read((char*)(&pathLength), sizeof(unsigned int));
+
+  if (!fin.good() || strncmp(magic, SCAN_HEADER_CACHE_MAGIC, 8) != 0 || version != SCAN_HEADER_CACHE_VERSION ||
+      recordSize != (int)sizeof(SpectraSTScanHeaderRecord) || fileSize != m_fileSize || fileModTime != m_fileModTime ||
+      pathLength != (unsigned int)m_fileName.length()) {
+    return (false);
+  }
+
+  string path(pathLength, ' ');
+  fin.read(&(path[0]), pathLength);
+  if (path != m_fileName) {
+    return (false);
+  }
+
+  int lastScan = 0;
+  unsigned int numRecords = 0;
+  fin.read((char*)(&lastScan), sizeof(int));
+  fin.read((char*)(&numRecords), sizeof(unsigned int));
+  if (!fin.good() || lastScan < 0 || numRecords > (unsigned int)lastScan) {
+    return (false);
+  }
+
+  // the whole table in one read
+  vector<SpectraSTScanHeaderRecord> packed(numRecords);
+  if (numRecords > 0) {
+    fin.read((char*)(&(packed[0])), numRecords * sizeof(SpectraSTScanHeaderRecord));
+    if (!fin.good()) {
+      return (false);
+    }
+  }
+
+  SpectraSTScanHeaderRecord empty;
+  memset(&empty, 0, sizeof(SpectraSTScanHeaderRecord));
+  empty.filePosition = -1;
+  m_records.assign(lastScan + 1, empty);
+
+  for (vector<SpectraSTScanHeaderRecord>::iterator i = packed.begin(); i != packed.end(); i++) {
+    if (i->scanNum < 1 || i->scanNum > lastScan) {
+      return (false);
+    }
+    m_records[i->scanNum] = *i;
+    if (i->msLevel == -1) m_records[i->scanNum].scanNum = 0; // header unreadable, only the offset is good
+  }
+  m_lastScan = lastScan;
+
+  return (true);
+}
@@ -0,0 +1,106 @@
+#ifndef SPECTRASTSCANHEADERCACHE_HPP_
+#define SPECTRASTSCANHEADERCACHE_HPP_
+
+#ifdef STANDALONE_LINUX
+#include "SpectraST_cramp.hpp"
+#else
+#include "cramp.hpp"
+#endif
+
+#include <string>
+#include <vector>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTScanHeaderCache
+ *
+ * Keeps the scan headers of an mzXML (or other RAMP-readable) file in a sidecar file
+ * <file>.scancache, such that repeated searches/imports of the same run do not need to
+ * parse the index and every scan header again. The sidecar is keyed on the path, size and
+ * modification time of the file, and is rebuilt whenever any of these changes.
+ *
+ */
+
+using namespace std;
+
+// one packed scan table entry, as stored in the sidecar. MUST BE modified together with
+// SCAN_HEADER_CACHE_VERSION to keep old sidecars from being misread.
+typedef struct {
+  int scanNum; // 0 if there is no (readable) scan of this number
+  int acquisitionNum;
+  int msLevel;
+  int precursorCharge;
+  int peaksCount;
+  unsigned int possibleCharges; // bit c is set if c is a possible charge
+  long long filePosition;
+  double precursorMz;
+  double retentionTime;
+  double precursorIntensity;
+  double totIonCurrent;
+  double collisionEnergy;
+  char activationMethod[16];
+} SpectraSTScanHeaderRecord;
+
+class SpectraSTScanHeaderCache {
+
+public:
+  SpectraSTScanHeaderCache(string fileName);
+  ~SpectraSTScanHeaderCache();
+
+  cRamp* openCRamp();
+
+  rampScanInfo* getScanHeaderInfo(int scanNum);
+  int getLastScan() { return (m_lastScan); }
+
+  static string getCacheFileName(string fileName);
+
+private:
+
+  string m_fileName;
+  string m_cacheFileName;
+
+  // key of the file the scan table was built from
+  long long m_fileSize;
+  long long m_fileModTime;
+
+  // m_records - the scan table, indexed by scan number (entry 0 is unused)
+  vector<SpectraSTScanHeaderRecord> m_records;
+  int m_lastScan;
+
+  bool statFile();
+  bool readFromFile();
+  void writeToFile();
+  void build(cRamp* cramp);
+
+};
+
+#endif /*SPECTRASTSCANHEADERCACHE_HPP_*/
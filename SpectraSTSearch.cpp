@@ -1,9 +1,12 @@
 #include "SpectraSTSearch.hpp"
 #include "SpectraSTLibEntry.hpp"
+#include "SpectraSTStageStats.hpp"
 #include "FileUtils.hpp"
 
 #include <algorithm>
+#include <map>
 #include <math.h>
+#include <string.h>
 
 
 
@@ -55,7 +58,8 @@ SpectraSTSearch::SpectraSTSearch(SpectraSTQuery* query,	SpectraSTSearchParams& p
   m_query(query),
   m_params(params), 
   m_output(output),
-  m_candidates() {
+  m_candidates(),
+  m_libCandidates() {
   
   m_candidates.clear();	
   
@@ -70,8 +74,32 @@ SpectraSTSearch::~SpectraSTSearch() {
   }
 }
 
-// search - main function to perform one search
-void SpectraSTSearch::search(SpectraSTLib* lib) {
+// search - main function to perform one search. If a result cache is given, the ranked candidates are taken from
+// there if the query was searched before, and put there otherwise.
+void SpectraSTSearch::search(SpectraSTLib* lib, SpectraSTResultCache* cache) {
+
+  if (!retrieveCandidates(lib, cache)) {
+    return;
+  }
+  
+  scoreCandidates();
+  
+  finishSearch(lib, cache);
+}
+
+// getRetrievalMzRange - the precursor m/z range within which the library entries are retrieved as candidates
+void SpectraSTSearch::getRetrievalMzRange(double& lowMz, double& highMz) {
+  
+  double precursorMz = m_query->getPrecursorMz();
+  
+  lowMz = precursorMz - m_params.indexRetrievalMzTolerance;
+  if (m_params.indexRetrievalUseAverage) lowMz -= 1.0;
+  highMz = precursorMz + m_params.indexRetrievalMzTolerance;
+}
+
+// retrieveCandidates - the first step of search(): retrieves the candidates of the query from the library. Returns
+// false if they are taken from the result cache instead, already scored and ranked (nothing more to do but print).
+bool SpectraSTSearch::retrieveCandidates(SpectraSTLib* lib, SpectraSTResultCache* cache) {
 
   double precursorMz = m_query->getPrecursorMz();
   
@@ -89,14 +117,46 @@ void SpectraSTSearch::search(SpectraSTLib* lib) {
     cout << ")" << endl;
   }
  
+  if (cache && loadFromCache(lib, cache)) {
+    if (g_verbose) {
+      cout << "\tFound " << m_candidates.size() << " candidate(s) in result cache... ";
+      cout.flush();
+    }
+    return (false);
+  }
+  
   // retrieves all entries from the library within the tolerable m/z range
   vector<SpectraSTLibEntry*> entries;
   
-  double lowMz = precursorMz - m_params.indexRetrievalMzTolerance;
-  if (m_params.indexRetrievalUseAverage) lowMz -= 1.0;
-  double highMz = precursorMz + m_params.indexRetrievalMzTolerance;
+  double lowMz = 0.0;
+  double highMz = 0.0;
+  getRetrievalMzRange(lowMz, highMz);
   
-  lib->retrieve(entries, lowMz, highMz);
+  double retrieveStartTime = SpectraSTStageStats::now();
+  
+  if (m_params.annSearchTopK > 0 || m_params.openSearchTopK > 0) {
+    vector<bool> possibleCharges;
+    if (!m_params.searchAllCharges && m_query->getDefaultCharge() != 0) {
+      possibleCharges.assign(8, false);
+      for (int ch = 0; ch < 8; ch++) {
+        possibleCharges[ch] = m_query->isPossibleCharge(ch);
+      }
+    }
+    if (m_params.annSearchTopK > 0) {
+      // approximate search: the library spectra most similar to the query are retrieved, regardless of precursor m/z
+      lib->retrieveBySketch(entries, m_query->getPeakList(), possibleCharges);
+    } else {
+      // open search: only the library spectra sharing the most fragment peaks with the query are retrieved 
+      lib->retrieveByFragments(entries, m_query->getPeakList(), lowMz, highMz, possibleCharges);
+    }
+  } else {
+    lib->retrieve(entries, lowMz, highMz);
+  }
+  
+  SpectraSTStageStats& stageStats = SpectraSTStageStats::local();
+  stageStats.addTime(STAGE_LIB_RETRIEVE, SpectraSTStageStats::now() - retrieveStartTime);
+  stageStats.addCount(COUNTER_QUERIES, 1);
+  stageStats.addCount(COUNTER_CANDIDATES, (unsigned long long)(entries.size()));
   
   if (g_verbose) {
     cout << "\tFound " << entries.size() << " candidate(s)... " << " Comparing... ";
@@ -124,9 +184,19 @@ void SpectraSTSearch::search(SpectraSTLib* lib) {
     } 
   }
   
+  return (true);
+}
+
+// scoreCandidates - the second step of search(): compares the query to each candidate by calculating the dot product
+void SpectraSTSearch::scoreCandidates() {
+  
+  // the stages are timed per query, not per comparison, to keep the timer calls out of the loop
+  double startTime = SpectraSTStageStats::now();
+  
+  binCandidatePeakLists();
   
+  double binnedTime = SpectraSTStageStats::now();
   
-  // compare query to each candidate by calculating the dot product
   for (vector<SpectraSTCandidate*>::iterator i = m_candidates.begin(); i != m_candidates.end(); i++) {
 
     SpectraSTLibEntry* entry = (*i)->getEntry();
@@ -134,28 +204,155 @@ void SpectraSTSearch::search(SpectraSTLib* lib) {
 
     double dot = m_query->getPeakList(charge)->compare(entry->getPeakList(), (*i)->getSimScoresRef(), m_params);
 
-    if (m_params.indexRetrievalUseAverage) {
-      ((*i)->getSimScoresRef()).precursorMzDiff = precursorMz - entry->getAveragePrecursorMz();          	 
-    } else {
-      ((*i)->getSimScoresRef()).precursorMzDiff = precursorMz - entry->getPrecursorMz();    
+    setPrecursorMzDiffAndSortKey(*i, dot);
+  }
+  
+  SpectraSTStageStats& stageStats = SpectraSTStageStats::local();
+  stageStats.addTime(STAGE_BINNING, binnedTime - startTime);
+  stageStats.addTime(STAGE_DOT_PRODUCT, SpectraSTStageStats::now() - binnedTime);
+}
+
+// binCandidatePeakLists - bins the peak lists of the query and of all the candidates, ahead of the comparisons (which would
+// otherwise bin them the first time each is compared)
+void SpectraSTSearch::binCandidatePeakLists() {
+  
+  for (vector<SpectraSTCandidate*>::iterator i = m_candidates.begin(); i != m_candidates.end(); i++) {
+    
+    SpectraSTLibEntry* entry = (*i)->getEntry();
+    
+    m_query->getPeakList(entry->getCharge())->binPeaks(m_params.peakScalingMzPower, m_params.peakScalingIntensityPower, m_params.peakScalingUnassignedPeaks,
+                                                       m_params.peakBinningNumBinsPerMzUnit, m_params.peakBinningFractionToNeighbor);
+    entry->getPeakList()->binPeaks(m_params.peakScalingMzPower, m_params.peakScalingIntensityPower, m_params.peakScalingUnassignedPeaks,
+                                   m_params.peakBinningNumBinsPerMzUnit, m_params.peakBinningFractionToNeighbor);
+  }
+}
+
+// scoreCandidatesTogether - does the second step of search() for several queries at once (whose candidates have been
+// retrieved, and are all still valid), with the same results as scoreCandidates() for each. Every library entry that
+// is a candidate of any of the queries is compared against all of the queries in one block (see
+// SpectraSTPeakList::compareBlock), so each is gone through once rather than once per query.
+void SpectraSTSearch::scoreCandidatesTogether(vector<SpectraSTSearch*>& searches) {
+  
+  if (searches.empty()) {
+    return;
+  }
+  
+  if (searches.size() == 1) {
+    searches[0]->scoreCandidates();
+    return;
+  }
+  
+  // as in scoreCandidates(), the stages are timed for the whole batch
+  double startTime = SpectraSTStageStats::now();
+  
+  for (vector<SpectraSTSearch*>::iterator s = searches.begin(); s != searches.end(); s++) {
+    (*s)->binCandidatePeakLists();
+  }
+  
+  double binnedTime = SpectraSTStageStats::now();
+  
+  // the query peak lists are the columns of the block, the distinct candidate peak lists its rows
+  vector<SpectraSTPeakList*> queries;
+  map<SpectraSTPeakList*, unsigned int> queryColumns;
+  vector<SpectraSTPeakList*> others;
+  map<SpectraSTPeakList*, unsigned int> otherRows;
+  
+  for (vector<SpectraSTSearch*>::iterator s = searches.begin(); s != searches.end(); s++) {
+    for (vector<SpectraSTCandidate*>::iterator i = (*s)->m_candidates.begin(); i != (*s)->m_candidates.end(); i++) {
+      SpectraSTLibEntry* entry = (*i)->getEntry();
+      SpectraSTPeakList* query = (*s)->m_query->getPeakList(entry->getCharge());
+      if (queryColumns.find(query) == queryColumns.end()) {
+        queryColumns[query] = (unsigned int)(queries.size());
+        queries.push_back(query);
+      }
+      SpectraSTPeakList* other = entry->getPeakList();
+      if (otherRows.find(other) == otherRows.end()) {
+        otherRows[other] = (unsigned int)(others.size());
+        others.push_back(other);
+      }
+    }
+  }
+  
+  vector<double> dots;
+  vector<double> dotBiases;
+  SpectraSTPeakList::compareBlock(queries, others, dots, dotBiases, searches[0]->m_params);
+  
+  unsigned int numQueries = (unsigned int)(queries.size());
+  
+  for (vector<SpectraSTSearch*>::iterator s = searches.begin(); s != searches.end(); s++) {
+    for (vector<SpectraSTCandidate*>::iterator i = (*s)->m_candidates.begin(); i != (*s)->m_candidates.end(); i++) {
+      SpectraSTLibEntry* entry = (*i)->getEntry();
+      unsigned int k = otherRows[entry->getPeakList()] * numQueries + queryColumns[(*s)->m_query->getPeakList(entry->getCharge())];
+      
+      SpectraSTSimScores& simScores = (*i)->getSimScoresRef();
+      simScores.dot = dots[k];
+      simScores.dotBias = dotBiases[k];
+      
+      (*s)->setPrecursorMzDiffAndSortKey(*i, simScores.dot);
+    }
+  }
+  
+  SpectraSTStageStats& stageStats = SpectraSTStageStats::local();
+  stageStats.addTime(STAGE_BINNING, binnedTime - startTime);
+  stageStats.addTime(STAGE_DOT_PRODUCT, SpectraSTStageStats::now() - binnedTime);
+}
+
+// setPrecursorMzDiffAndSortKey - sets the precursor m/z difference of a candidate just compared to the query, and sorts it by its dot product
+void SpectraSTSearch::setPrecursorMzDiffAndSortKey(SpectraSTCandidate* candidate, double dot) {
+  
+  SpectraSTLibEntry* entry = candidate->getEntry();
+  double precursorMz = m_query->getPrecursorMz();
+  
+  if (m_params.indexRetrievalUseAverage) {
+    (candidate->getSimScoresRef()).precursorMzDiff = precursorMz - entry->getAveragePrecursorMz();          	 
+  } else {
+    (candidate->getSimScoresRef()).precursorMzDiff = precursorMz - entry->getPrecursorMz();    
+  }
+  candidate->setSortKey(dot);	
+}
+
+// finishSearch - the last step of search(): ranks the scored candidates, and puts them in the result cache if given
+void SpectraSTSearch::finishSearch(SpectraSTLib* lib, SpectraSTResultCache* cache) {
+
+  if (m_params.hitListPerLibrary && lib->getNumLibFiles() > 1) {
+    // the query is scored once against the candidates of all libraries, but the hits of each library are
+    // ranked (and later printed) on their own, as if that library were searched alone
+    m_libCandidates.assign(lib->getNumLibFiles(), vector<SpectraSTCandidate*>());
+    for (vector<SpectraSTCandidate*>::iterator i = m_candidates.begin(); i != m_candidates.end(); i++) {
+      m_libCandidates[(*i)->getEntry()->getLibFileIndex()].push_back(*i);
+    }
+    for (vector<vector<SpectraSTCandidate*> >::iterator l = m_libCandidates.begin(); l != m_libCandidates.end(); l++) {
+      rankCandidates(*l);
     }
-    (*i)->setSortKey(dot);	
     
+    // m_candidates (used for the search statistics) are ordered by the F values within their own libraries
+    sort(m_candidates.begin(), m_candidates.end(), SpectraSTCandidate::sortPtrsDesc);
+    
+  } else {
+    rankCandidates(m_candidates);
+  }
+
+  if (cache) {
+    saveToCache(cache);
   }
+}
 
+// rankCandidates - sorts the candidates, detects homologs, and calculates the delta dots and F values 
+void SpectraSTSearch::rankCandidates(vector<SpectraSTCandidate*>& candidates) {
+  
   // sort the hits by the sort key 
   // (in this case, the value of "dot" returned by the SpectraSTPeakList::compare function)
-  sort(m_candidates.begin(), m_candidates.end(), SpectraSTCandidate::sortPtrsDesc);
+  sort(candidates.begin(), candidates.end(), SpectraSTCandidate::sortPtrsDesc);
   
   if (m_params.detectHomologs > 1) {
-    detectHomologs();
+    detectHomologs(candidates);
   } else {
-    if (m_candidates.size() > 1) {
-      (m_candidates[0]->getSimScoresRef()).firstNonHomolog = 2;
+    if (candidates.size() > 1) {
+      (candidates[0]->getSimScoresRef()).firstNonHomolog = 2;
     }
   }
  
-  calcHitsStats();
+  calcHitsStats(candidates);
   
   // to save time, we can throw away all except the top N hits
   // this is assuming nothing beyond N will be worth rescuing to the top due to a favorable dot_bias
@@ -166,45 +363,169 @@ void SpectraSTSearch::search(SpectraSTLib* lib) {
   //}
   
   // now that they are sorted, can calculate delta dots.
-  calcDeltaSimpleDots();
+  calcDeltaSimpleDots(candidates);
 	
   // sort again by F value (calculated in calcDeltaSimpleDots)
-  sort(m_candidates.begin(), m_candidates.end(), SpectraSTCandidate::sortPtrsDesc);
+  sort(candidates.begin(), candidates.end(), SpectraSTCandidate::sortPtrsDesc);
+
+}
+
+// loadFromCache - takes the ranked candidates of the query, with their scores, from the result cache. Returns false
+// (and nothing is loaded) if the query is not there, or one of its candidates is no longer in the library.
+bool SpectraSTSearch::loadFromCache(SpectraSTLib* lib, SpectraSTResultCache* cache) {
 
+  double startTime = SpectraSTStageStats::now();
 
+  vector<SpectraSTResultCacheRecord> records;
+  if (!cache->lookup(m_query->getName(), m_query->getPrecursorMz(), records)) {
+    return (false);
+  }
+
+  vector<pair<unsigned int, int> > ids;
+  for (vector<SpectraSTResultCacheRecord>::iterator r = records.begin(); r != records.end(); r++) {
+    ids.push_back(pair<unsigned int, int>(r->libFileIndex, r->libId));
+  }
+
+  vector<SpectraSTLibEntry*> entries;
+  lib->retrieveByIds(entries, ids);
+
+  for (unsigned int k = 0; k < (unsigned int)(records.size()); k++) {
+    if (!entries[k]) {
+      return (false);
+    }
+  }
+
+  bool perLibrary = (m_params.hitListPerLibrary && lib->getNumLibFiles() > 1);
+  if (perLibrary) {
+    m_libCandidates.assign(lib->getNumLibFiles(), vector<SpectraSTCandidate*>());
+    for (vector<SpectraSTResultCacheRecord>::iterator r = records.begin(); r != records.end(); r++) {
+      if (r->libRank < 0 || r->libFileIndex >= lib->getNumLibFiles()) {
+        m_libCandidates.clear();
+        return (false);
+      }
+      vector<SpectraSTCandidate*>& libCandidates = m_libCandidates[r->libFileIndex];
+      if ((unsigned int)(libCandidates.size()) <= (unsigned int)(r->libRank)) {
+        libCandidates.resize(r->libRank + 1, NULL);
+      }
+    }
+  }
+
+  for (unsigned int k = 0; k < (unsigned int)(records.size()); k++) {
+
+    SpectraSTResultCacheRecord& r = records[k];
+
+    SpectraSTCandidate* candidate = new SpectraSTCandidate(entries[k], m_params);
+    SpectraSTSimScores& s = candidate->getSimScoresRef();
+    s.dot = r.dot;
+    s.delta = r.delta;
+    s.dotBias = r.dotBias;
+    s.precursorMzDiff = r.precursorMzDiff;
+    s.hitsNum = r.hitsNum;
+    s.hitsMean = r.hitsMean;
+    s.hitsStDev = r.hitsStDev;
+    s.fval = r.fval;
+    s.firstNonHomolog = r.firstNonHomolog;
+    candidate->setSortKey(r.sortKey);
+
+    m_candidates.push_back(candidate);
+    if (perLibrary) {
+      m_libCandidates[r.libFileIndex][r.libRank] = candidate;
+    }
+  }
+
+  for (vector<vector<SpectraSTCandidate*> >::iterator l = m_libCandidates.begin(); l != m_libCandidates.end(); l++) {
+    if (find(l->begin(), l->end(), (SpectraSTCandidate*)NULL) != l->end()) {
+      // the ranks of a library are not all there, the sidecar must be corrupt. Search as if not cached.
+      for (vector<SpectraSTCandidate*>::iterator i = m_candidates.begin(); i != m_candidates.end(); i++) {
+        delete (*i);
+      }
+      m_candidates.clear();
+      m_libCandidates.clear();
+      return (false);
+    }
+  }
+
+  SpectraSTStageStats& stageStats = SpectraSTStageStats::local();
+  stageStats.addTime(STAGE_LIB_RETRIEVE, SpectraSTStageStats::now() - startTime);
+  stageStats.addCount(COUNTER_QUERIES, 1);
+  stageStats.addCount(COUNTER_RESULT_CACHE_HITS, 1);
+
+  return (true);
+}
+
+// saveToCache - puts the ranked candidates of the query, with their scores, in the result cache
+void SpectraSTSearch::saveToCache(SpectraSTResultCache* cache) {
+
+  map<SpectraSTCandidate*, int> libRanks;
+  for (vector<vector<SpectraSTCandidate*> >::iterator l = m_libCandidates.begin(); l != m_libCandidates.end(); l++) {
+    for (unsigned int rank = 0; rank < (unsigned int)(l->size()); rank++) {
+      libRanks[(*l)[rank]] = (int)rank;
+    }
+  }
+
+  vector<SpectraSTResultCacheRecord> records(m_candidates.size());
+
+  for (unsigned int k = 0; k < (unsigned int)(m_candidates.size()); k++) {
+
+    SpectraSTResultCacheRecord& r = records[k];
+    memset(&r, 0, sizeof(SpectraSTResultCacheRecord));
+
+    SpectraSTLibEntry* entry = m_candidates[k]->getEntry();
+    SpectraSTSimScores& s = m_candidates[k]->getSimScoresRef();
+
+    r.libFileIndex = entry->getLibFileIndex();
+    r.libId = (int)(entry->getLibId());
+    r.libRank = -1;
+    map<SpectraSTCandidate*, int>::iterator found = libRanks.find(m_candidates[k]);
+    if (found != libRanks.end()) {
+      r.libRank = found->second;
+    }
+    r.hitsNum = s.hitsNum;
+    r.firstNonHomolog = s.firstNonHomolog;
+    r.sortKey = m_candidates[k]->getSortKey();
+    r.dot = s.dot;
+    r.delta = s.delta;
+    r.dotBias = s.dotBias;
+    r.precursorMzDiff = s.precursorMzDiff;
+    r.hitsMean = s.hitsMean;
+    r.hitsStDev = s.hitsStDev;
+    r.fval = s.fval;
+  }
+
+  cache->insert(m_query->getName(), m_query->getPrecursorMz(), records);
 }
 
 // calcDeltaSimpleDots - calculates the delta dots
-void SpectraSTSearch::calcDeltaSimpleDots() {
+void SpectraSTSearch::calcDeltaSimpleDots(vector<SpectraSTCandidate*>& candidates) {
 
-  if (m_candidates.empty()) {
+  if (candidates.empty()) {
     return;
   }
   
-  for (unsigned int rank = 0; rank < (unsigned int)(m_candidates.size()); rank++) {
-    SpectraSTSimScores& s = m_candidates[rank]->getSimScoresRef();
+  for (unsigned int rank = 0; rank < (unsigned int)(candidates.size()); rank++) {
+    SpectraSTSimScores& s = candidates[rank]->getSimScoresRef();
     
     if (s.firstNonHomolog > 0) {
       // delta is dot - dot(first non-homologous hit lower than this one)
-      s.delta = s.dot - (m_candidates[s.firstNonHomolog - 1]->getSimScoresRef()).dot;
+      s.delta = s.dot - (candidates[s.firstNonHomolog - 1]->getSimScoresRef()).dot;
     } else {
       s.delta = 0.0;
     }
     
     double fval = s.calcFval(m_params.fvalFractionDelta);
     
-    m_candidates[rank]->setSortKey(fval);
+    candidates[rank]->setSortKey(fval);
   }
 }
 
 // calcHitsStats - calculates such things as the mean and stdev of the dots of all candidates
-void SpectraSTSearch::calcHitsStats() {
+void SpectraSTSearch::calcHitsStats(vector<SpectraSTCandidate*>& candidates) {
   
   unsigned int numHits;
   double mean;
   double stdev;
   
-  if (m_candidates.empty()) {
+  if (candidates.empty()) {
     numHits = 0;
     mean = 0.0;
     stdev = 0.0;
@@ -212,17 +533,17 @@ void SpectraSTSearch::calcHitsStats() {
     
     double totalDot = 0;
     double totalSqDot = 0;
-    for (vector<SpectraSTCandidate*>::iterator i = m_candidates.begin(); i != m_candidates.end(); i++) {
+    for (vector<SpectraSTCandidate*>::iterator i = candidates.begin(); i != candidates.end(); i++) {
       SpectraSTSimScores& s = (*i)->getSimScoresRef();
       totalDot += s.dot;
       totalSqDot += s.dot * s.dot;
     }
-    numHits = (unsigned int)(m_candidates.size());
+    numHits = (unsigned int)(candidates.size());
     mean = totalDot / (double)numHits;
     stdev = totalSqDot / (double)numHits - mean * mean;
     if (stdev > 0.000001) stdev = sqrt(stdev);
   }
-  for (vector<SpectraSTCandidate*>::iterator i = m_candidates.begin(); i != m_candidates.end(); i++) {
+  for (vector<SpectraSTCandidate*>::iterator i = candidates.begin(); i != candidates.end(); i++) {
     SpectraSTSimScores& s = (*i)->getSimScoresRef();
     s.hitsNum = numHits;
     s.hitsMean = mean;
@@ -233,15 +554,15 @@ void SpectraSTSearch::calcHitsStats() {
 }
 
 // detectHomologs - try to see if the lower hits are homologous (or identical) to the first one
-void SpectraSTSearch::detectHomologs() {
+void SpectraSTSearch::detectHomologs(vector<SpectraSTCandidate*>& candidates) {
   
-  if (m_candidates.empty() || m_candidates.size() == 1) return;
+  if (candidates.empty() || candidates.size() == 1) return;
 	
-  Peptide* topHit = m_candidates[0]->getEntry()->getPeptidePtr();
+  Peptide* topHit = candidates[0]->getEntry()->getPeptidePtr();
   
   if (!topHit) {
     // not a peptide. no notion of homology
-    (m_candidates[0]->getSimScoresRef()).firstNonHomolog = 2;  
+    (candidates[0]->getSimScoresRef()).firstNonHomolog = 2;  
     return;
   }
     
@@ -253,7 +574,7 @@ void SpectraSTSearch::detectHomologs() {
     homologFound = false;
     curRank++;
     
-    Peptide* thisHit = m_candidates[curRank]->getEntry()->getPeptidePtr();
+    Peptide* thisHit = candidates[curRank]->getEntry()->getPeptidePtr();
     
     if (!thisHit) {
       // not a peptide. definitely nonhomologous
@@ -273,11 +594,11 @@ void SpectraSTSearch::detectHomologs() {
       
     } 
     
-  } while (homologFound && curRank < m_params.detectHomologs - 1 && curRank < (unsigned int)(m_candidates.size()) - 1);
+  } while (homologFound && curRank < m_params.detectHomologs - 1 && curRank < (unsigned int)(candidates.size()) - 1);
   
   // setting the field firstNonHomolog for all the homologs found
   for (unsigned int rank = 0; rank < curRank; rank++) {
-    (m_candidates[rank]->getSimScoresRef()).firstNonHomolog = curRank + 1;
+    (candidates[rank]->getSimScoresRef()).firstNonHomolog = curRank + 1;
   }
 			
 }
@@ -287,8 +608,23 @@ void SpectraSTSearch::detectHomologs() {
 // print - prints out the search result
 void SpectraSTSearch::print() {
   
+  SpectraSTStageTimer timer(STAGE_OUTPUT);
+  
+  if (!m_libCandidates.empty()) {
+    // hits of each library ranked separately, print them to the output for that library
+    for (unsigned int k = 0; k < (unsigned int)(m_libCandidates.size()); k++) {
+      printCandidates(m_libCandidates[k], m_output->getLibraryOutput(k));
+    }
+  } else {
+    printCandidates(m_candidates, m_output);
+  }
+}
+
+// printCandidates - prints out one ranked list of candidates to output
+void SpectraSTSearch::printCandidates(vector<SpectraSTCandidate*>& candidates, SpectraSTSearchOutput* output) {
+  
 	
-  if (m_candidates.empty() || (!(m_candidates[0]->passTopHitFvalThreshold()))) {
+  if (candidates.empty() || (!(candidates[0]->passTopHitFvalThreshold()))) {
     // no hit (or no hit above threshold
     if (g_verbose) {
       cout << " DONE! Top hit: NO_MATCH";
@@ -302,8 +638,8 @@ void SpectraSTSearch::print() {
   
   // set the assumedCharge to that of the top hit, if any
   int assumedCharge = 0;
-  if (!m_candidates.empty() && m_candidates[0]->passTopHitFvalThreshold()) {
-    assumedCharge = m_candidates[0]->getEntry()->getCharge();
+  if (!candidates.empty() && candidates[0]->passTopHitFvalThreshold()) {
+    assumedCharge = candidates[0]->getEntry()->getCharge();
   }
   
   
@@ -311,43 +647,43 @@ void SpectraSTSearch::print() {
   double precursorMz = m_query->getPrecursorMz();
   double rt = m_query->getRetentionTime();
   // prints all the query information
-  m_output->printStartQuery(name, precursorMz, assumedCharge, rt);
+  output->printStartQuery(name, precursorMz, assumedCharge, rt);
   
   
-  if (m_candidates.empty() || !(m_candidates[0]->passTopHitFvalThreshold())) {
+  if (candidates.empty() || !(candidates[0]->passTopHitFvalThreshold())) {
     // no hit or no hit above threshold
     SpectraSTSimScores emptyScore;
 		
-    m_output->printHit(name, 1, NULL, emptyScore);
+    output->printHit(name, 1, NULL, emptyScore);
 		
   } else {
     // print the top hit!
     if (g_verbose) {
-      cout << " DONE! Top hit: " << m_candidates[0]->getEntry()->getFullName() << " (Dot = " << m_candidates[0]->getSortKey() << ")";
+      cout << " DONE! Top hit: " << candidates[0]->getEntry()->getFullName() << " (Dot = " << candidates[0]->getSortKey() << ")";
       cout.flush();
     }
     
-    m_output->printHit(name, 1, m_candidates[0]->getEntry(), m_candidates[0]->getSimScoresRef());
+    output->printHit(name, 1, candidates[0]->getEntry(), candidates[0]->getSimScoresRef());
 
     /*    
     if (m_params.saveSpectra) {
       // also save the query spectrum and the spectrum for the top hit
-      string querySpectrumFileName(m_output->getOutputPath() + name + ".0.msp");
+      string querySpectrumFileName(output->getOutputPath() + name + ".0.msp");
       m_query->printQuerySpectrum(querySpectrumFileName);
       
-      string topMatchSpectrumFileName(m_output->getOutputPath() + name + ".1.msp");		
-      m_candidates[0]->printSpectrum(topMatchSpectrumFileName);
+      string topMatchSpectrumFileName(output->getOutputPath() + name + ".1.msp");		
+      candidates[0]->printSpectrum(topMatchSpectrumFileName);
     }
     */    
     
     if (!m_params.hitListOnlyTopHit) { 
       // told to print the lower hits too
       
-      unsigned int firstNonHomolog = (m_candidates[0]->getSimScoresRef()).firstNonHomolog;
+      unsigned int firstNonHomolog = (candidates[0]->getSimScoresRef()).firstNonHomolog;
       
-      for (unsigned int rank = 2; rank <= (unsigned int)(m_candidates.size()); rank++) {		
-        if (m_candidates[rank - 1]->passLowerHitsFvalThreshold() || (m_params.hitListShowHomologs && rank < firstNonHomolog)) {
-          m_output->printHit(name, rank, m_candidates[rank - 1]->getEntry(), m_candidates[rank - 1]->getSimScoresRef());
+      for (unsigned int rank = 2; rank <= (unsigned int)(candidates.size()); rank++) {		
+        if (candidates[rank - 1]->passLowerHitsFvalThreshold() || (m_params.hitListShowHomologs && rank < firstNonHomolog)) {
+          output->printHit(name, rank, candidates[rank - 1]->getEntry(), candidates[rank - 1]->getSimScoresRef());
         } else {
           // below threshold now, stop printing
           break;
@@ -358,7 +694,7 @@ void SpectraSTSearch::print() {
   }
   
   // print the closing tags to finish up
-  m_output->printEndQuery(name);
+  output->printEndQuery(name);
   
   
 }
@@ -386,10 +722,7 @@ bool SpectraSTSearch::isLikelyBad() {
 // isDecoy. returns if the hit is a decoy entry
 bool SpectraSTSearch::isDecoy(unsigned int rank) {
   if ((unsigned int)(m_candidates.size()) >= rank) {
-    string spec("");
-    string rem("");
-    return ((m_candidates[rank - 1]->getEntry()->getOneComment("Spec", spec) && spec == "Decoy") ||
-	    (m_candidates[rank - 1]->getEntry()->getOneComment("Remark", rem) && rem.substr(0,5) == "DECOY"));
+    return (m_candidates[rank - 1]->getEntry()->isDecoy());
   } else {
     return (false);
   }
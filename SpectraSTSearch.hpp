@@ -5,6 +5,7 @@
 #include "SpectraSTCandidate.hpp"
 #include "SpectraSTSearchOutput.hpp"
 #include "SpectraSTQuery.hpp"
+#include "SpectraSTResultCache.hpp"
 // #include "SpectraSTSearchTaskStats.hpp"
 
 /*
@@ -53,7 +54,15 @@ public:
   
   virtual ~SpectraSTSearch();
   
-  void search(SpectraSTLib* lib);
+  void search(SpectraSTLib* lib, SpectraSTResultCache* cache = NULL);
+
+  // the steps of search(), for searching several queries together (the candidates of all of them are retrieved, then
+  // scored at once with scoreCandidatesTogether(), then each search is finished)
+  void getRetrievalMzRange(double& lowMz, double& highMz);
+  bool retrieveCandidates(SpectraSTLib* lib, SpectraSTResultCache* cache = NULL);
+  void scoreCandidates();
+  void finishSearch(SpectraSTLib* lib, SpectraSTResultCache* cache = NULL);
+  static void scoreCandidatesTogether(vector<SpectraSTSearch*>& searches);
   void print();
   
   friend class SpectraSTSearchTaskStats;
@@ -76,12 +85,21 @@ private:
   // the candidates
   vector<SpectraSTCandidate*> m_candidates;
   
+  // the candidates of each library, ranked separately (-s_HPL). Not owned; they are all also in m_candidates. 
+  vector<vector<SpectraSTCandidate*> > m_libCandidates;
+  
   // the output object responsible for printing the search results
   SpectraSTSearchOutput* m_output;
   
-  void calcDeltaSimpleDots();
-  void calcHitsStats();
-  void detectHomologs();
+  void binCandidatePeakLists();
+  void setPrecursorMzDiffAndSortKey(SpectraSTCandidate* candidate, double dot);
+  void rankCandidates(vector<SpectraSTCandidate*>& candidates);
+  bool loadFromCache(SpectraSTLib* lib, SpectraSTResultCache* cache);
+  void saveToCache(SpectraSTResultCache* cache);
+  void printCandidates(vector<SpectraSTCandidate*>& candidates, SpectraSTSearchOutput* output);
+  void calcDeltaSimpleDots(vector<SpectraSTCandidate*>& candidates);
+  void calcHitsStats(vector<SpectraSTCandidate*>& candidates);
+  void detectHomologs(vector<SpectraSTCandidate*>& candidates);
 
 };
 
@@ -3,9 +3,12 @@
 #include "SpectraSTXlsSearchOutput.hpp"
 #include "SpectraSTPepXMLSearchOutput.hpp"
 #include "SpectraSTHtmlSearchOutput.hpp"
+#include "SpectraSTPerLibrarySearchOutput.hpp"
 #include "SpectraSTLog.hpp"
 #include "FileUtils.hpp"
 #include <iostream>
+#include <algorithm>
+#include <stdlib.h>
 
 
 
@@ -48,10 +51,22 @@ hlam@systemsbiology.org
 
 extern SpectraSTLog* g_log;
 
+// the outputs with a file open. The output is buffered, so whatever is in the buffers when the program exits without
+// closing them (e.g. through SpectraSTLog::crash()) is written out by flushOpenSearchOutputs(), run at exit.
+static vector<SpectraSTSearchOutput*> g_openSearchOutputs;
+
+static void flushOpenSearchOutputs() {
+  for (vector<SpectraSTSearchOutput*>::iterator i = g_openSearchOutputs.begin(); i != g_openSearchOutputs.end(); i++) {
+    (*i)->flushFile();
+  }
+}
+
 // constructor
 SpectraSTSearchOutput::SpectraSTSearchOutput(string outputFileName, string searchFileExt, SpectraSTSearchParams& searchParams) :
-  m_outputFileName(outputFileName),
   m_fout(NULL),
+  m_gzBuf(NULL),
+  m_foutBuffer(),
+  m_outputFileName(outputFileName),
   m_searchFileExt(searchFileExt),
   m_searchParams(searchParams),
   m_instrInfo(NULL),
@@ -69,21 +84,43 @@ SpectraSTSearchOutput::~SpectraSTSearchOutput() {
   if (m_instrInfo) {
     delete (m_instrInfo);
   }
-  if (m_fout) {
-    delete (m_fout);
-  }
-  
+  closeFile();
   
 }
 
-// openFile - opens the file for output
+// openFile - opens the file for output. The output is collected in a large buffer and written (or gzipped) a buffer
+// at a time; the subclasses should end lines with '\n' rather than endl, which would flush the buffer every line.
 void SpectraSTSearchOutput::openFile() {
 
   if (m_fout) return; // already open
-  m_fout = new ofstream();
-  if (!myFileOpen(*m_fout, m_outputFileName)) {
-    g_log->error("SEARCH", "Cannot open file \"" + m_outputFileName + "\" for writing search results. Exiting.");
-    g_log->crash();
+  
+  static bool flushAtExit = false;
+  if (!flushAtExit) {
+    atexit(flushOpenSearchOutputs);
+    flushAtExit = true;
+  }
+  
+  if (m_searchParams.outputGzip) {
+    
+    m_gzBuf = new SpectraSTGzipStreamBuf(m_outputFileName);
+    if (!m_gzBuf->isOpen()) {
+      g_log->error("SEARCH", "Cannot open file \"" + m_outputFileName + "\" for writing search results. Exiting.");
+      g_log->crash();
+    }
+    m_fout = new ostream(m_gzBuf);
+    g_openSearchOutputs.push_back(this);
+    
+  } else {
+  
+    ofstream* fout = new ofstream();
+    m_foutBuffer.resize(1048576);
+    fout->rdbuf()->pubsetbuf(&(m_foutBuffer[0]), (streamsize)(m_foutBuffer.size())); // must be set before opening
+    m_fout = fout;
+    if (!myFileOpen(*fout, m_outputFileName)) {
+      g_log->error("SEARCH", "Cannot open file \"" + m_outputFileName + "\" for writing search results. Exiting.");
+      g_log->crash();
+    }
+    g_openSearchOutputs.push_back(this);
   }
 
 }
@@ -92,8 +129,23 @@ void SpectraSTSearchOutput::openFile() {
 void SpectraSTSearchOutput::closeFile() {
   
   if (m_fout) {
+    m_fout->flush();
     delete (m_fout);
     m_fout = NULL;
+    g_openSearchOutputs.erase(remove(g_openSearchOutputs.begin(), g_openSearchOutputs.end(), this), g_openSearchOutputs.end());
+  }
+  if (m_gzBuf) {
+    delete (m_gzBuf);
+    m_gzBuf = NULL;
+  }
+}
+
+// flushFile - writes out what is in the output buffer, if the file is open. A gzipped file is only finished when it is
+// closed, so if the program exits with it still open, the end of the output may be missing from it all the same.
+void SpectraSTSearchOutput::flushFile() {
+  
+  if (m_fout) {
+    m_fout->flush();
   }
 }
 
@@ -106,9 +158,17 @@ string SpectraSTSearchOutput::getOutputPath() {
 }
 
 // createSpectraSTSearchOutput - "factory" to create proper output object for different formats. Modify this if you implement
-// a new outputter!
-SpectraSTSearchOutput* SpectraSTSearchOutput::createSpectraSTSearchOutput(string searchFileName, SpectraSTSearchParams& searchParams) {
+// a new outputter! If libFileName is given, the output is for the hits of that library only, and its name says so.
+SpectraSTSearchOutput* SpectraSTSearchOutput::createSpectraSTSearchOutput(string searchFileName, SpectraSTSearchParams& searchParams, string libFileName) {
 	
+  if (libFileName.empty() && searchParams.hitListPerLibrary) {
+    vector<string> libFileNames;
+    searchParams.getLibraryFiles(libFileNames);
+    if (libFileNames.size() > 1) {
+      return (new SpectraSTPerLibrarySearchOutput(searchFileName, libFileNames, searchParams));
+    }
+  }
+  
   FileName fn;
   parseFileName(searchFileName, fn);
 
@@ -122,6 +182,14 @@ SpectraSTSearchOutput* SpectraSTSearchOutput::createSpectraSTSearchOutput(string
   if (ext == "ntxt") ext = "txt";
 
   string outputFileName(outputDirectory + fn.name + "." + ext);
+  if (!libFileName.empty()) {
+    FileName libFn;
+    parseFileName(libFileName, libFn);
+    outputFileName = outputDirectory + fn.name + "." + libFn.name + "." + ext;
+  }
+  if (searchParams.outputGzip) {
+    outputFileName += ".gz";
+  }
 
   /*
   if (searchParams.saveSpectra) {
@@ -149,3 +217,32 @@ SpectraSTSearchOutput* SpectraSTSearchOutput::createSpectraSTSearchOutput(string
 	
   return (new SpectraSTPepXMLSearchOutput(outputFileName, fn.ext, searchParams));	
 }
+
+// getLibraryCommentsUsed - lists (sorted) all the comment fields of the library entries that the search and the outputter
+// for searchParams.outputExtension will ever read. Modify this if you make the search or an outputter read another field!
+void SpectraSTSearchOutput::getLibraryCommentsUsed(SpectraSTSearchParams& searchParams, vector<string>& attrs) {
+
+  attrs.clear();
+
+  // used by the search itself (SpectraSTSearch and SpectraSTLibEntry::isDecoy)
+  attrs.push_back("AvePrecursorMz");
+  attrs.push_back("Nreps");
+  attrs.push_back("Remark");
+  attrs.push_back("Spec");
+
+  // used by the outputters
+  attrs.push_back("Protein");
+  if (searchParams.outputExtension == "txt" || searchParams.outputExtension == "ntxt" ||
+      searchParams.outputExtension == "xls" || searchParams.outputExtension == "nxls") {
+    attrs.push_back("Inst");
+    attrs.push_back("Sample");
+  } else if (searchParams.outputExtension != "html") {
+    // pepXML
+    attrs.push_back("NMC");
+    attrs.push_back("NTT");
+    attrs.push_back("Prob");
+    attrs.push_back("Tfratio");
+  }
+
+  sort(attrs.begin(), attrs.end());
+}
@@ -4,6 +4,7 @@
 #include "SpectraSTSimScores.hpp"
 #include "SpectraSTSearchParams.hpp"
 #include "SpectraSTLibEntry.hpp"
+#include "SpectraSTGzipStreamBuf.hpp"
 
 #ifdef STANDALONE_LINUX
 #include "SpectraST_cramp.hpp"
@@ -74,16 +75,24 @@ public:
 	
 	virtual void printAbortedQuery(string query, string message) = 0;
 
-        void openFile();
-        void closeFile();
+        virtual void openFile();
+        virtual void closeFile();
+        void flushFile();
         string getOutputFileName();
         string getOutputPath();
   
-	static SpectraSTSearchOutput* createSpectraSTSearchOutput(string searchFileName, SpectraSTSearchParams& searchParams);
+	// getLibraryOutput - the outputter to print the separately ranked hits of library libFileIndex to (-s_HPL)
+	virtual SpectraSTSearchOutput* getLibraryOutput(unsigned int libFileIndex) { return (this); }
+  
+	static SpectraSTSearchOutput* createSpectraSTSearchOutput(string searchFileName, SpectraSTSearchParams& searchParams, string libFileName = "");
+	static void getLibraryCommentsUsed(SpectraSTSearchParams& searchParams, vector<string>& attrs);
 	
 protected:
   
-	ofstream* m_fout;
+	// m_fout - the output stream. Either a plain ofstream, or (with -s_GZO) an ostream over m_gzBuf
+	ostream* m_fout;
+	SpectraSTGzipStreamBuf* m_gzBuf;
+	vector<char> m_foutBuffer;
 	string m_outputFileName;
         string m_outputPath;
 	string m_searchFileExt; 
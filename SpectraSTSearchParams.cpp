@@ -3,6 +3,7 @@
 #include "SpectraSTConstants.hpp"
 #include "FileUtils.hpp"
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <stdlib.h>
 
@@ -72,6 +73,11 @@ SpectraSTSearchParams& SpectraSTSearchParams::operator=(SpectraSTSearchParams& s
   this->databaseFile = s.databaseFile;
   this->databaseType = s.databaseType;
   this->indexCacheAll = s.indexCacheAll;
+  this->cacheScanHeaders = s.cacheScanHeaders;
+  this->cacheSearchResults = s.cacheSearchResults;
+  this->queryParseThreads = s.queryParseThreads;
+  this->searchBatchSize = s.searchBatchSize;
+  this->trimLibraryComments = s.trimLibraryComments;
   this->filterSelectedListFileName = s.filterSelectedListFileName; 
 
   this->indexRetrievalMzTolerance = s.indexRetrievalMzTolerance;
@@ -82,13 +88,21 @@ SpectraSTSearchParams& SpectraSTSearchParams::operator=(SpectraSTSearchParams& s
   this->ignoreAbnormalSpectra = s.ignoreAbnormalSpectra;
   this->ignoreSpectraWithUnmodCysteine = s.ignoreSpectraWithUnmodCysteine;
   this->searchAllCharges = s.searchAllCharges;
+  this->openSearchTopK = s.openSearchTopK;
+  this->openSearchMinSharedPeaks = s.openSearchMinSharedPeaks;
+  this->annSearchTopK = s.annSearchTopK;
+  this->annSearchNumProbes = s.annSearchNumProbes;
+  this->annSearchCheckRecall = s.annSearchCheckRecall;
   
   this->outputExtension = s.outputExtension;
   this->outputDirectory = s.outputDirectory;
+  this->outputGzip = s.outputGzip;
+  this->stageStatsFileName = s.stageStatsFileName;
   this->hitListTopHitFvalThreshold = s.hitListTopHitFvalThreshold;
   this->hitListLowerHitsFvalThreshold = s.hitListLowerHitsFvalThreshold;
   this->hitListOnlyTopHit = s.hitListOnlyTopHit;
   this->hitListExcludeNoMatch = s.hitListExcludeNoMatch;
+  this->hitListPerLibrary = s.hitListPerLibrary;
   this->hitListShowHomologs = s.hitListShowHomologs;
   
   //  this->saveSpectra = s.saveSpectra;
@@ -164,8 +178,7 @@ void SpectraSTSearchParams::finalizeOptions() {
     case 'L' :	
       if (!optionValue.empty()) {
 	fixpath(optionValue);
-	getExtension(optionValue, extension);
-    if (extension == ".splib" || extension == ".db") {
+	if (isValidLibraryFile(optionValue)) {
 	  libraryFile = optionValue;
 	  valid = true;					
 	}
@@ -365,6 +378,55 @@ void SpectraSTSearchParams::finalizeAdvancedOption(string option) {
       }
     }
 
+  } else if (optionType == "OPN") {
+
+    if (!optionValue.empty()) {
+      k = atoi(optionValue.c_str());
+      if (k >= 0) {
+	openSearchTopK = (unsigned int)k;
+	valid = true;
+      }
+    }
+
+  } else if (optionType == "OPS") {
+
+    if (!optionValue.empty()) {
+      k = atoi(optionValue.c_str());
+      if (k >= 1) {
+	openSearchMinSharedPeaks = (unsigned int)k;
+	valid = true;
+      }
+    }
+
+  } else if (optionType == "ANN") {
+
+    if (!optionValue.empty()) {
+      k = atoi(optionValue.c_str());
+      if (k >= 0) {
+	annSearchTopK = (unsigned int)k;
+	valid = true;
+      }
+    }
+
+  } else if (optionType == "ANP") {
+
+    if (!optionValue.empty()) {
+      k = atoi(optionValue.c_str());
+      if (k >= 1) {
+	annSearchNumProbes = (unsigned int)k;
+	valid = true;
+      }
+    }
+
+  } else if (optionType == "ANR") {
+    if (optionValue.empty()) {
+      annSearchCheckRecall = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      annSearchCheckRecall = false;
+      valid = true;
+    }
+
   } else if (optionType == "NO1") {
     if (optionValue.empty()) {
       ignoreChargeOneLibSpectra = true;
@@ -374,6 +436,78 @@ void SpectraSTSearchParams::finalizeAdvancedOption(string option) {
       valid = true;
     }
 
+  } else if (optionType == "HDC") {
+    if (optionValue.empty()) {
+      cacheScanHeaders = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      cacheScanHeaders = false;
+      valid = true;
+    }
+
+  } else if (optionType == "RSC") {
+    if (optionValue.empty()) {
+      cacheSearchResults = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      cacheSearchResults = false;
+      valid = true;
+    }
+
+  } else if (optionType == "TCM") {
+    if (optionValue.empty()) {
+      trimLibraryComments = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      trimLibraryComments = false;
+      valid = true;
+    }
+
+  } else if (optionType == "PTH") {
+
+    if (!optionValue.empty()) {
+      k = atoi(optionValue.c_str());
+      if (k >= 1) {
+	queryParseThreads = (unsigned int)k;
+	valid = true;
+      }
+    }
+
+  } else if (optionType == "BAT") {
+
+    if (!optionValue.empty()) {
+      k = atoi(optionValue.c_str());
+      if (k >= 1) {
+	searchBatchSize = (unsigned int)k;
+	valid = true;
+      }
+    }
+
+  } else if (optionType == "HPL") {
+    if (optionValue.empty()) {
+      hitListPerLibrary = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      hitListPerLibrary = false;
+      valid = true;
+    }
+
+  } else if (optionType == "GZO") {
+    if (optionValue.empty()) {
+      outputGzip = true;
+      valid = true;
+    } else if (optionValue == "!") {
+      outputGzip = false;
+      valid = true;
+    }
+
+  } else if (optionType == "PRF") {
+    if (!optionValue.empty()) {
+      fixpath(optionValue);
+      stageStatsFileName = optionValue;
+      valid = true;
+    }
+
   } else if (optionType == "NOS") {
     if (optionValue.empty()) {
       ignoreAbnormalSpectra = true;
@@ -663,6 +797,24 @@ void SpectraSTSearchParams::setDefault() {
   // whether or not to load the entire library in memory (faster but needs lots of RAM)
   indexCacheAll = false;
 
+  // whether or not to keep the scan headers of mzXML query files in a sidecar file, so that repeated searches
+  // of the same files need not parse the headers again
+  cacheScanHeaders = false;
+
+  // whether or not to keep the ranked candidates of every query in a sidecar file next to the query file, so that
+  // repeated searches of the same file against the same libraries (with the same scoring options) need not score them again
+  cacheSearchResults = false;
+
+  // number of threads used to parse .msp and .mgf query files (the searches themselves are still done one at a time)
+  queryParseThreads = 1;
+
+  // max number of queries of similar precursor m/z scored together against their candidates, when the queries of
+  // .mzXML files are searched in order of precursor m/z (1 to score every query on its own)
+  searchBatchSize = 1;
+
+  // whether or not to keep only the comment fields of the library entries that the search and the output will use
+  trimLibraryComments = false;
+
   // CANDIDATE SELECTION AND SCORING
   
   // mass tolerance for index retrieval, i.e. 
@@ -701,6 +853,20 @@ void SpectraSTSearchParams::setDefault() {
   // charge state
   searchAllCharges = false;
   
+  // open searching: if non-zero, the candidates are not all the library spectra within the m/z tolerance, but only
+  // the (at most) openSearchTopK of them sharing the most fragment peaks (at least openSearchMinSharedPeaks) with the
+  // query, found with an inverted index of the library fragments. Meant for very wide m/z tolerances.
+  openSearchTopK = 0;
+  openSearchMinSharedPeaks = 3;
+
+  // approximate nearest-neighbor searching: if non-zero, the candidates are the (at most) annSearchTopK library spectra
+  // anywhere in the library (regardless of precursor m/z) whose sketches are the most similar to that of the query, looking
+  // in the annSearchNumProbes nearest clusters of the sketch index. If annSearchCheckRecall, each query is also searched
+  // exhaustively over all sketches, and the recall and time of both are reported at the end.
+  annSearchTopK = 0;
+  annSearchNumProbes = 8;
+  annSearchCheckRecall = false;
+  
   // OUTPUT DISPLAY
   
   // the type of output
@@ -710,6 +876,13 @@ void SpectraSTSearchParams::setDefault() {
   // if empty, the result file is written to the same directory as its corresponding search file.
   outputDirectory = "";
 
+  // whether or not to gzip the result files on the fly (a .gz is appended to the file names)
+  outputGzip = false;
+
+  // the file to which the time spent in each stage of the search is written as JSON, for the run and per search file.
+  // if empty, the stage times are only written to the log.
+  stageStatsFileName = "";
+
   // threshold of the F value of the top hit, below which the found spectrum will be 
   // removed from the hit list (the value of 0.0 means all top hits will be displayed
   // no matter how good they are)
@@ -728,6 +901,10 @@ void SpectraSTSearchParams::setDefault() {
   
   // exclude all NO_MATCH's - that query will not show up at all in the output file
   hitListExcludeNoMatch = true;
+
+  // when several libraries are searched, whether to rank the hits of each library separately and write them
+  // to one result file per library, instead of ranking the hits of all libraries together in one result file
+  hitListPerLibrary = false;
 	
   // whether or not to save the query and top-matching library spectra for later plotting
   //  saveSpectra = false;
@@ -819,9 +996,7 @@ void SpectraSTSearchParams::readFromFile() {
     if (param == "libraryFile") {
       if (!value.empty()) {
 	fixpath(value);
-	string extension;
-	getExtension(value, extension);
-	if (extension == ".splib") {
+	if (isValidLibraryFile(value)) {
 	  libraryFile = value;	
 	  valid = true;	
 	} 
@@ -845,6 +1020,36 @@ void SpectraSTSearchParams::readFromFile() {
       indexCacheAll = (value == "true");
       valid = true;	
 
+    } else if (param == "cacheScanHeaders") {
+      cacheScanHeaders = (value == "true");
+      valid = true;
+
+    } else if (param == "cacheSearchResults") {
+      cacheSearchResults = (value == "true");
+      valid = true;
+
+    } else if (param == "trimLibraryComments") {
+      trimLibraryComments = (value == "true");
+      valid = true;
+
+    } else if (param == "queryParseThreads") {
+      if (!value.empty()) {
+	k = atoi(value.c_str());
+	if (k >= 1) {
+	  queryParseThreads = (unsigned int)k;
+	  valid = true;
+	}
+      }
+
+    } else if (param == "searchBatchSize") {
+      if (!value.empty()) {
+	k = atoi(value.c_str());
+	if (k >= 1) {
+	  searchBatchSize = (unsigned int)k;
+	  valid = true;
+	}
+      }
+
     } else if (param == "filterSelectedListFileName") {
       if (!value.empty()) {      
 	fixpath(value);
@@ -895,6 +1100,46 @@ void SpectraSTSearchParams::readFromFile() {
       ignoreSpectraWithUnmodCysteine = (value == "true");
       valid = true;	
 
+    } else if (param == "openSearchTopK") {
+      if (!value.empty()) {      
+	k = atoi(value.c_str());
+	if (k >= 0) {
+	  openSearchTopK = (unsigned int)k;
+	  valid = true;	
+	}
+      }
+      
+    } else if (param == "openSearchMinSharedPeaks") {
+      if (!value.empty()) {      
+	k = atoi(value.c_str());
+	if (k >= 1) {
+	  openSearchMinSharedPeaks = (unsigned int)k;
+	  valid = true;	
+	}
+      }
+
+    } else if (param == "annSearchTopK") {
+      if (!value.empty()) {      
+	k = atoi(value.c_str());
+	if (k >= 0) {
+	  annSearchTopK = (unsigned int)k;
+	  valid = true;	
+	}
+      }
+      
+    } else if (param == "annSearchNumProbes") {
+      if (!value.empty()) {      
+	k = atoi(value.c_str());
+	if (k >= 1) {
+	  annSearchNumProbes = (unsigned int)k;
+	  valid = true;	
+	}
+      }
+
+    } else if (param == "annSearchCheckRecall") {				
+      annSearchCheckRecall = (value == "true");
+      valid = true;	
+
  
       
     // OUTPUT DISPLAY
@@ -914,6 +1159,17 @@ void SpectraSTSearchParams::readFromFile() {
       }
 
 
+    } else if (param == "outputGzip") {
+      outputGzip = (value == "true");
+      valid = true;
+
+    } else if (param == "stageStatsFileName") {
+      if (!value.empty()) {
+	fixpath(value);
+	stageStatsFileName = value;
+	valid = true;
+      }
+
     } else if (param == "hitListTopHitFvalThreshold") {
       if (!value.empty()) {
 	f = atof(value.c_str());
@@ -940,6 +1196,10 @@ void SpectraSTSearchParams::readFromFile() {
       hitListShowHomologs = (value == "true");
       valid = true;	
 
+    } else if (param == "hitListPerLibrary") {
+      hitListPerLibrary = (value == "true");
+      valid = true;	
+
       /*      
     } else if (param == "saveSpectra") {				
       saveSpectra = (value == "true");
@@ -1104,42 +1364,139 @@ void SpectraSTSearchParams::readFromFile() {
 }
 
 
-void SpectraSTSearchParams::printPepXMLSearchParams(ofstream& fout) {
+// getLibraryFiles - splits libraryFile, which can be a comma-separated list of libraries to be searched together
+void SpectraSTSearchParams::getLibraryFiles(vector<string>& libFiles) {
+  
+  libFiles.clear();
+  string::size_type pos = 0;
+  while (pos < libraryFile.length()) {
+    string libFile = nextToken(libraryFile, pos, pos, ",", ",");
+    if (!libFile.empty()) {
+      libFiles.push_back(libFile);
+    }
+  }
+}
+
+// isValidLibraryFile - checks that libFile is a library file, or a comma-separated list of them
+bool SpectraSTSearchParams::isValidLibraryFile(string& libFile) {
+  
+  bool valid = false;
+  string::size_type pos = 0;
+  while (pos < libFile.length()) {
+    string oneLibFile = nextToken(libFile, pos, pos, ",", ",");
+    if (oneLibFile.empty()) continue;
+    string extension;
+    getExtension(oneLibFile, extension);
+    if (extension != ".splib" && extension != ".db") {
+      return (false);
+    }
+    valid = true;
+  }
+  return (valid);
+}
+
+void SpectraSTSearchParams::printPepXMLSearchParams(ostream& fout) {
   
-  string fullLibraryFile(libraryFile);
-  makeFullPath(fullLibraryFile);
+  vector<string> libFiles;
+  getLibraryFiles(libFiles);
+  string fullLibraryFile("");
+  for (vector<string>::iterator l = libFiles.begin(); l != libFiles.end(); l++) {
+    string fullLibFile(*l);
+    makeFullPath(fullLibFile);
+    if (!fullLibraryFile.empty()) fullLibraryFile += ",";
+    fullLibraryFile += fullLibFile;
+  }
   
-  fout << "<parameter name=\"spectral_library\" value=\"" << fullLibraryFile << "\"/>" << endl;
-  fout << "<parameter name=\"precursor_mz_tolerance\" value=\"" << indexRetrievalMzTolerance << "\"/>" << endl;
+  fout << "<parameter name=\"spectral_library\" value=\"" << fullLibraryFile << "\"/>" << '\n';
+  fout << "<parameter name=\"precursor_mz_tolerance\" value=\"" << indexRetrievalMzTolerance << "\"/>" << '\n';
   
-  fout << "<parameter name=\"precursor_mz_use_average\" value=\"" << (indexRetrievalUseAverage ? "true" : "false") << "\"/>" << endl;
+  fout << "<parameter name=\"precursor_mz_use_average\" value=\"" << (indexRetrievalUseAverage ? "true" : "false") << "\"/>" << '\n';
 
-  fout << "<parameter name=\"params_file\" value=\"" <<  paramsFileName << "\"/>" << endl;
+  fout << "<parameter name=\"params_file\" value=\"" <<  paramsFileName << "\"/>" << '\n';
   
-  fout << "<parameter name=\"detect_homologs_max_rank\" value=\"" << detectHomologs << "\"/>" << endl;
+  fout << "<parameter name=\"detect_homologs_max_rank\" value=\"" << detectHomologs << "\"/>" << '\n';
   
-  fout << "<parameter name=\"peak_scaling_mz_power\" value=\"" << peakScalingMzPower << "\"/>" << endl;
-  fout << "<parameter name=\"peak_scaling_intensity_power\" value=\"" << peakScalingIntensityPower << "\"/>" << endl;
+  fout << "<parameter name=\"peak_scaling_mz_power\" value=\"" << peakScalingMzPower << "\"/>" << '\n';
+  fout << "<parameter name=\"peak_scaling_intensity_power\" value=\"" << peakScalingIntensityPower << "\"/>" << '\n';
 
-  fout << "<parameter name=\"peak_scaling_unassigned_peaks\" value=\"" << peakScalingUnassignedPeaks << "\"/>" << endl;
+  fout << "<parameter name=\"peak_scaling_unassigned_peaks\" value=\"" << peakScalingUnassignedPeaks << "\"/>" << '\n';
 
-  fout << "<parameter name=\"peak_binning_num_bins_per_mz\" value=\"" << peakBinningNumBinsPerMzUnit << "\"/>" << endl;
+  fout << "<parameter name=\"peak_binning_num_bins_per_mz\" value=\"" << peakBinningNumBinsPerMzUnit << "\"/>" << '\n';
 
-  fout << "<parameter name=\"peak_binning_fraction_to_neighbor\" value=\"" << peakBinningFractionToNeighbor << "\"/>" << endl;
+  fout << "<parameter name=\"peak_binning_fraction_to_neighbor\" value=\"" << peakBinningFractionToNeighbor << "\"/>" << '\n';
 
-  fout << "<parameter name=\"filter_min_peak_count\" value=\"" << filterMinPeakCount << "\"/>" << endl;
+  fout << "<parameter name=\"filter_min_peak_count\" value=\"" << filterMinPeakCount << "\"/>" << '\n';
   
-  fout << "<parameter name=\"filter_all_peaks_below_mz\" value=\"" << filterAllPeaksBelowMz << "\"/>" << endl;
+  fout << "<parameter name=\"filter_all_peaks_below_mz\" value=\"" << filterAllPeaksBelowMz << "\"/>" << '\n';
 
-  fout << "<parameter name=\"filter_max_peaks_used\" value=\"" << filterMaxPeaksUsed << "\"/>" << endl;
+  fout << "<parameter name=\"filter_max_peaks_used\" value=\"" << filterMaxPeaksUsed << "\"/>" << '\n';
 
-  fout << "<parameter name=\"filter_max_dynamic_range\" value=\"" << filterMaxDynamicRange << "\"/>" << endl;
+  fout << "<parameter name=\"filter_max_dynamic_range\" value=\"" << filterMaxDynamicRange << "\"/>" << '\n';
   
-  fout << "<parameter name=\"filter_max_intensity_below\" value=\"" << filterMaxIntensityBelow << "\"/>" << endl;
+  fout << "<parameter name=\"filter_max_intensity_below\" value=\"" << filterMaxIntensityBelow << "\"/>" << '\n';
 
-  fout << "<parameter name=\"filter_lib_max_peaks_used\" value=\"" << filterLibMaxPeaksUsed << "\"/>" << endl;
+  fout << "<parameter name=\"filter_lib_max_peaks_used\" value=\"" << filterLibMaxPeaksUsed << "\"/>" << '\n';
   
-  fout << "<parameter name=\"fval_fraction_delta\" value=\"" << fvalFractionDelta << "\"/>" << endl;  
+  fout << "<parameter name=\"fval_fraction_delta\" value=\"" << fvalFractionDelta << "\"/>" << '\n';  
+}
+
+// the params that cannot change the candidates of a query, or their scores and ranks: they only change which queries
+// and libraries are searched (the result cache keys those separately), how fast, or which results are printed and how.
+// Every other param is printed by printScoringParams; tests/ScoringParamsCheck fails if a param is in neither or both.
+static const char* g_nonScoringParams[] = {
+  "paramsFileName", "libraryFile", "databaseFile", "databaseType", "indexCacheAll", "cacheScanHeaders",
+  "cacheSearchResults", "queryParseThreads", "searchBatchSize", "trimLibraryComments", "filterSelectedListFileName",
+  "annSearchCheckRecall", "outputExtension", "outputDirectory", "outputGzip", "stageStatsFileName",
+  "hitListTopHitFvalThreshold", "hitListLowerHitsFvalThreshold", "hitListOnlyTopHit", "hitListExcludeNoMatch",
+  "hitListShowHomologs", NULL };
+
+// isNonScoringParam - whether the param (named as it is declared) is one that printScoringParams leaves out
+bool SpectraSTSearchParams::isNonScoringParam(string name) {
+  
+  for (const char** p = g_nonScoringParams; *p; p++) {
+    if (name == *p) return (true);
+  }
+  return (false);
+}
+
+// printScoringParams - prints, one per line as "<param> = <value>", all the params that can change the candidates of a 
+// query or their scores and ranks; that is, all but the non-scoring ones above. The result cache (see 
+// SpectraSTResultCache) is keyed on them, so a param missing here would make it serve stale results.
+void SpectraSTSearchParams::printScoringParams(ostream& out) {
+
+  stringstream ss;
+  ss.precision(15);
+
+  ss << "expectedCysteineMod = " << expectedCysteineMod << '\n';
+  ss << "indexRetrievalMzTolerance = " << indexRetrievalMzTolerance << '\n';
+  ss << "indexRetrievalUseAverage = " << (indexRetrievalUseAverage ? "true" : "false") << '\n';
+  ss << "detectHomologs = " << detectHomologs << '\n';
+  ss << "ignoreChargeOneLibSpectra = " << (ignoreChargeOneLibSpectra ? "true" : "false") << '\n';
+  ss << "ignoreAbnormalSpectra = " << (ignoreAbnormalSpectra ? "true" : "false") << '\n';
+  ss << "ignoreSpectraWithUnmodCysteine = " << (ignoreSpectraWithUnmodCysteine ? "true" : "false") << '\n';
+  ss << "searchAllCharges = " << (searchAllCharges ? "true" : "false") << '\n';
+  ss << "openSearchTopK = " << openSearchTopK << '\n';
+  ss << "openSearchMinSharedPeaks = " << openSearchMinSharedPeaks << '\n';
+  ss << "annSearchTopK = " << annSearchTopK << '\n';
+  ss << "annSearchNumProbes = " << annSearchNumProbes << '\n';
+  ss << "hitListPerLibrary = " << (hitListPerLibrary ? "true" : "false") << '\n';
+  ss << "filterAllPeaksBelowMz = " << filterAllPeaksBelowMz << '\n';
+  ss << "filterMinPeakCount = " << filterMinPeakCount << '\n';
+  ss << "filterCountPeakIntensityThreshold = " << filterCountPeakIntensityThreshold << '\n';
+  ss << "filterRemovePeakIntensityThreshold = " << filterRemovePeakIntensityThreshold << '\n';
+  ss << "filterRemoveHuge515Threshold = " << filterRemoveHuge515Threshold << '\n';
+  ss << "filterMaxPeaksUsed = " << filterMaxPeaksUsed << '\n';
+  ss << "filterMaxDynamicRange = " << filterMaxDynamicRange << '\n';
+  ss << "filterMaxIntensityBelow = " << filterMaxIntensityBelow << '\n';
+  ss << "filterLibMaxPeaksUsed = " << filterLibMaxPeaksUsed << '\n';
+  ss << "peakScalingMzPower = " << peakScalingMzPower << '\n';
+  ss << "peakScalingIntensityPower = " << peakScalingIntensityPower << '\n';
+  ss << "peakScalingUnassignedPeaks = " << peakScalingUnassignedPeaks << '\n';
+  ss << "peakBinningNumBinsPerMzUnit = " << peakBinningNumBinsPerMzUnit << '\n';
+  ss << "peakBinningFractionToNeighbor = " << peakBinningFractionToNeighbor << '\n';
+  ss << "fvalFractionDelta = " << fvalFractionDelta << '\n';
+
+  out << ss.str();
 }
 
 void SpectraSTSearchParams::printAdvancedOptions(ostream& out) {
@@ -1150,6 +1507,18 @@ void SpectraSTSearchParams::printAdvancedOptions(ostream& out) {
   out << "SEARCH MODE ADVANCED OPTIONS" << endl;
   out << endl;
   
+  out << "         GENERAL OPTIONS" << endl;
+  out << "         -s_HDC          Cache the scan headers of mzXML query files in <file>.scancache. (Turn off with -s_HDC!)" << endl;
+  out << "                           Speeds up repeated searches of the same files. The cache is rebuilt if the file changes." << endl;
+  out << "         -s_RSC          Cache the ranked hits of every query in <file>.resultcache. (Turn off with -s_RSC!)" << endl;
+  out << "                           Repeated searches of the same file only re-score the queries if the file, the libraries" << endl;
+  out << "                           or the candidate selection, scoring and filtering options change. Output options can differ." << endl;
+  out << "         -s_TCM          Keep only the library comment fields used by the search and the output format. (Turn off with -s_TCM!)" << endl;
+  out << "                           Saves memory when the library entries have long comments. The output is the same." << endl;
+  out << "         -s_PTH<num>     Use <num> threads to parse .msp and .mgf query files. Results do not depend on <num>." << endl;
+  out << "         -s_BAT<num>     Score up to <num> .mzXML queries of similar precursor m/z together. Results do not depend on <num>." << endl;
+  out << endl;
+
   out << "         CANDIDATE SELECTION AND SCORING OPTIONS" << endl;  
   out << "         -s_HOM<rank>    Detect homologous lower hits up to <rank>." << endl;
   out << "                           Looks for lower hits homologous to the first one and adjust delta accordingly." << endl;
@@ -1157,6 +1526,15 @@ void SpectraSTSearchParams::printAdvancedOptions(ostream& out) {
   out << "         -s_NO1          Ignore all +1 spectra in the library. (Turn off with -sNO1!)" << endl; 
   out << "         -s_NOS          Ignore all spectra which have non-Normal status. (Turn off with -s_NOS!)" << endl; 
   out << "         -s_FDL<frac>    Specify fraction of f-value that is delta/dot. (The rest is dot.)" << endl;
+  out << "         -s_OPN<num>     Open search: only score the <num> library spectra sharing the most fragment peaks with the query." << endl;
+  out << "                           Candidates are found with a fragment index built when the library is loaded. For use with" << endl;
+  out << "                           a wide m/z tolerance (-sM). No open search if <num> = 0 (default)." << endl;
+  out << "         -s_OPS<num>     Open search: minimum number of fragment peaks shared with the query. (Default 3)" << endl;
+  out << "         -s_ANN<num>     Approximate search: only score the <num> library spectra most similar to the query anywhere in the" << endl;
+  out << "                           library, regardless of precursor m/z. Candidates are found with a sketch index, kept next to" << endl;
+  out << "                           each library as <library>.spsketch and rebuilt if out of date. No approximate search if <num> = 0 (default)." << endl;
+  out << "         -s_ANP<num>     Approximate search: number of clusters of the sketch index looked in. (Default 8)" << endl;
+  out << "         -s_ANR          Approximate search: also search each query exhaustively, and report the recall and time. (Turn off with -s_ANR!)" << endl;
   out << endl;
 
   out << "         OUTPUT AND DISPLAY OPTIONS" << endl;
@@ -1168,6 +1546,11 @@ void SpectraSTSearchParams::printAdvancedOptions(ostream& out) {
   out << "         -s_SH1          Only display the top hit for each query. (Turn off with -s_SH1!)" << endl;                          
   out << "         -s_SHM          Exclude NO_MATCH's. (Turn off with -s_SHM!)" << endl;
   out << "                           Do not display queries for which there is no match above the dot product threshold." << endl; 
+  out << "         -s_HPL          Rank the hits of each library separately, and write them to one result file per library. (Turn off with -s_HPL!)" << endl;
+  out << "                           Only matters if more than one library is given to -sL. The result files are named <query>.<library>.<ext>." << endl;
+  out << "         -s_GZO          Gzip the result files as they are written (\".gz\" is appended to the file names). (Turn off with -s_GZO!)" << endl;
+  out << "         -s_PRF<file>    Write the time spent in each stage of the search (file opening, peak decoding, retrieval, dot products, etc.)" << endl;
+  out << "                           to <file> as JSON, for the whole run and per search file. (The stage times are always written to the log.)" << endl;
   //  out << "         -s_SAV          Save query and matched library spectra. (Turn off with -s_SAV!)" << endl;
   //  out << "         -s_TGZ          Tgz the saved query and matched library spectra to save space. (Turn off with -s_TGZ!)" << endl;
   out << endl;
@@ -1208,7 +1591,7 @@ void SpectraSTSearchParams::printUsage(ostream& out) {
   out << "(II) SEARCH MODE " << endl;
   out << "Usage: spectrast [ options ] <SearchFileName1> [ <SearchFileName2> ... <SearchFileNameN> ]" << endl;
   out << "where: SearchFileNameX = Name(s) of file containing unknown spectra to be searched." << endl;	
-  out << "                         (Extension specifies format of file. Supports .mzXML, .mzData, .dta and .msp)" << endl;
+  out << "                         (Extension specifies format of file. Supports .mzXML, .mzML, .mzData, .dta and .msp)" << endl;
   
   out << endl;
   out << "Options: GENERAL OPTIONS" << endl;
@@ -1218,6 +1601,7 @@ void SpectraSTSearchParams::printUsage(ostream& out) {
   out << "         -sL<file>    Specify library file." << endl;
   out << "                           <file> must have .splib extension. The existence of the corresponding .spidx file of the same name" << endl; 
   out << "                           in the same directory is assumed." << endl;
+  out << "                           Several libraries can be searched together by separating them with commas, e.g. -sLa.splib,b.splib." << endl;
   out << "         -sD<file>    Specify a sequence database file." << endl;
   out << "                           <file> must be in .fasta format. This will not affect the search in any way," << endl;
   out << "                           but this information will be included in the output for any downstream data processing." << endl;
@@ -1227,6 +1611,8 @@ void SpectraSTSearchParams::printUsage(ostream& out) {
   out << "                           Requires a lot of memory (the library will usually be loaded almost in its entirety), but speeds up search for unsorted queries." << endl;
   out << "         -sS<file>    Only search a subset of the query spectra in the search file." << endl;
   out << "                           Only query spectra with names matching a line of <file> will be searched." << endl; 
+  out << "                           A line can also be \"SCANS <file> <first>-<last> ...\" to select scans of a file (any charge)," << endl;
+  out << "                           or \"MZ <low> <high>\" or \"RT <low> <high>\" (seconds) to select precursor m/z or retention time windows." << endl;
   
   out << endl; 
   
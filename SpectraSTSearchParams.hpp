@@ -68,6 +68,11 @@ public:
 	string databaseFile;
 	string databaseType;
         bool indexCacheAll;
+        bool cacheScanHeaders;
+        bool cacheSearchResults;
+        unsigned int queryParseThreads;
+        unsigned int searchBatchSize;
+        bool trimLibraryComments;
         string filterSelectedListFileName; 
         
         // CANDIDATE SELECTION AND SCORING
@@ -79,15 +84,23 @@ public:
         bool ignoreAbnormalSpectra;
         bool ignoreSpectraWithUnmodCysteine;
 	bool searchAllCharges;
+        unsigned int openSearchTopK;
+        unsigned int openSearchMinSharedPeaks;
+        unsigned int annSearchTopK;
+        unsigned int annSearchNumProbes;
+        bool annSearchCheckRecall;
 	        
         // OUTPUT AND DISPLAY
         string outputExtension;   
         string outputDirectory;
+        bool outputGzip;
+        string stageStatsFileName;
 	double hitListTopHitFvalThreshold;
 	double hitListLowerHitsFvalThreshold;
         bool hitListOnlyTopHit;
         bool hitListExcludeNoMatch;
         bool hitListShowHomologs;
+        bool hitListPerLibrary;
 
   //        bool saveSpectra;
   //      bool tgzSavedSpectra;
@@ -122,7 +135,12 @@ public:
         
 	void readFromFile();
         
-        void printPepXMLSearchParams(ofstream& fout);
+        void getLibraryFiles(vector<string>& libFiles);
+        static bool isValidLibraryFile(string& libFile);
+        
+        void printPepXMLSearchParams(ostream& fout);
+        void printScoringParams(ostream& out);
+        static bool isNonScoringParam(string name);
         
 	static void printUsage(ostream& out);
         static void printAdvancedOptions(ostream& out);
@@ -3,12 +3,18 @@
 #include "SpectraSTMzXMLSearchTask.hpp"
 #include "SpectraSTDtaSearchTask.hpp"
 #include "SpectraSTMgfSearchTask.hpp"
+#include "SpectraSTSearch.hpp"
+#include "SpectraSTMappedFile.hpp"
 #include "SpectraSTLog.hpp"
 #include "FileUtils.hpp"
+#include "ProgressCount.hpp"
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
 
 
 /*
@@ -58,10 +64,13 @@ SpectraSTSearchTask::SpectraSTSearchTask(vector<string>& searchFileNames, Spectr
   m_params(params),
   m_lib(lib),
   m_outputs(),
+  m_resultCaches(),
   m_searchCount(0),
   m_searchTaskStats(),
-  m_selectedList(),
-  m_searchAll(true) {
+  m_selection(),
+  m_searchAll(true),
+  m_fileStageStatsStart(),
+  m_fileStageStats() {
   
   for (vector<string>::iterator f = searchFileNames.begin(); f != searchFileNames.end(); f++) {
     
@@ -70,6 +79,8 @@ SpectraSTSearchTask::SpectraSTSearchTask(vector<string>& searchFileNames, Spectr
     
   }
 
+  m_resultCaches.assign(searchFileNames.size(), (SpectraSTResultCache*)NULL);
+
   // if a selected list is specified (i.e. search only a subset of the queries), read it now.
   if (!(m_params.filterSelectedListFileName.empty())) {
     readSelectedListFile();
@@ -158,6 +169,8 @@ SpectraSTSearchTask::~SpectraSTSearchTask() {
     
   }
   
+  writeStageStats();
+  
   // delete the output objects
   for (vector<SpectraSTSearchOutput*>::iterator op = m_outputs.begin(); op != m_outputs.end(); op++) {
     if (*op) {
@@ -165,6 +178,11 @@ SpectraSTSearchTask::~SpectraSTSearchTask() {
     }
   }
 
+  // and the result caches left open, if any
+  for (unsigned int n = 0; n < (unsigned int)(m_resultCaches.size()); n++) {
+    closeResultCache(n);
+  }
+
 
 }
 
@@ -189,38 +207,229 @@ void SpectraSTSearchTask::readSelectedListFile() {
     cout << "Selected query list file loaded: \"" << m_params.filterSelectedListFileName << "\"." << endl;
   }
   
-  ifstream fin;
-  if (!myFileOpen(fin, m_params.filterSelectedListFileName)) {
+  if (!m_selection.readFromFile(m_params.filterSelectedListFileName)) {
     g_log->error("SEARCH", "Cannot open query list file \"" + m_params.filterSelectedListFileName + "\". No spectrum will be searched.");
     return;
   }
+}
+
+
+// openResultCache - if asked to cache the search results, opens the result cache of the fileIndex-th search file. The
+// queries of the file searched before (with the same libraries and scoring options) will be taken from there.
+void SpectraSTSearchTask::openResultCache(unsigned int fileIndex) {
+
+  if (m_params.cacheSearchResults && !m_resultCaches[fileIndex]) {
+    m_resultCaches[fileIndex] = new SpectraSTResultCache(m_searchFileNames[fileIndex], m_params, m_lib);
+  }
+}
+
+// closeResultCache - closes the result cache of the fileIndex-th search file, writing out the queries added to it
+void SpectraSTSearchTask::closeResultCache(unsigned int fileIndex) {
+
+  if (m_resultCaches[fileIndex]) {
+    delete (m_resultCaches[fileIndex]);
+    m_resultCaches[fileIndex] = NULL;
+  }
+}
+
+// the size of the blocks a mapped query file is cut into for parsing. Each thread parses one block at a time.
+#define QUERY_PARSE_BLOCK_SIZE 8388608
+
+// searchMappedFile - searches all queries in a text query file. The file is mapped into memory and cut into blocks at 
+// the lines starting with recordPrefix; the blocks are parsed into queries by parseQueries() (queryParseThreads blocks
+// at a time, in parallel), and the queries are then searched and printed one by one in file order.
+void SpectraSTSearchTask::searchMappedFile(unsigned int fileIndex, const char* recordPrefix, string fileType) {
+  
+  string searchFileName(m_searchFileNames[fileIndex]);
+  
+  beginFileStageStats();
+  double openStartTime = SpectraSTStageStats::now();
   
-  string line;
-  while (nextLine(fin, line, "", "")) {
-    string::size_type pos;
-    string s = nextToken(line, 0, pos);
-    if (!s.empty()) {
-      m_selectedList.push_back(s);
-      if (g_verbose) {
-        cout << "\tQuery selected: " << s << endl;
+  SpectraSTMappedFile file(searchFileName);
+  if (!file.isOpen()) {
+    g_log->error("SEARCH", "Cannot open " + fileType + " file \"" + searchFileName + " for reading query spectra. File Skipped.");
+    return;
+  }
+  
+  m_outputs[fileIndex]->openFile();
+  m_outputs[fileIndex]->printHeader();
+  openResultCache(fileIndex);
+  
+  if (g_verbose) {
+    cout << "Searching query spectra in file \"" << searchFileName << "\" ..." << endl;
+  }
+  
+  ProgressCount pc(!g_quiet && !g_verbose, 200);
+  string msg("Searching query spectra in file \"");
+  msg += searchFileName + "\"";
+  pc.start(msg);
+  
+  vector<const char*> boundaries;
+  file.splitAtRecords(QUERY_PARSE_BLOCK_SIZE, recordPrefix, boundaries);
+  unsigned int numBlocks = (unsigned int)(boundaries.size()) - 1;
+  
+  SpectraSTStageStats::local().addTime(STAGE_FILE_OPEN, SpectraSTStageStats::now() - openStartTime);
+  
+  unsigned int numThreads = m_params.queryParseThreads;
+  if (numThreads < 1) numThreads = 1;
+  
+  bool wellFormed = true;
+  
+  for (unsigned int firstBlock = 0; firstBlock < numBlocks; firstBlock += numThreads) {
+    
+    unsigned int numJobs = numBlocks - firstBlock;
+    if (numJobs > numThreads) numJobs = numThreads;
+    
+    vector<QueryParseJob> jobs(numJobs);
+    for (unsigned int j = 0; j < numJobs; j++) {
+      jobs[j].task = this;
+      jobs[j].begin = boundaries[firstBlock + j];
+      jobs[j].end = boundaries[firstBlock + j + 1];
+      jobs[j].wellFormed = true;
+    }
+    
+#ifndef _MSC_VER
+    // job 0 is done by this thread; any job a thread cannot be started for is done here as well
+    vector<pthread_t> threads(numJobs);
+    vector<bool> started(numJobs, false);
+    for (unsigned int j = 1; j < numJobs; j++) {
+      started[j] = (pthread_create(&(threads[j]), NULL, parseQueriesInThread, &(jobs[j])) == 0);
+    }
+    parseQueriesInThread(&(jobs[0]));
+    for (unsigned int j = 1; j < numJobs; j++) {
+      if (started[j]) {
+        pthread_join(threads[j], NULL);
+      } else {
+        parseQueriesInThread(&(jobs[j]));
+      }
+    }
+#else
+    for (unsigned int j = 0; j < numJobs; j++) {
+      parseQueriesInThread(&(jobs[j]));
+    }
+#endif
+    
+    for (vector<QueryParseJob>::iterator job = jobs.begin(); job != jobs.end(); job++) {
+      
+      for (vector<SpectraSTQuery*>::iterator q = job->queries.begin(); q != job->queries.end(); q++) {
+	
+	if (!wellFormed) {
+	  // truncated at an earlier block
+	  delete (*q);
+	  continue;
+	}
+	
+	// create the search based on what is read, then search
+	SpectraSTSearch* s = new SpectraSTSearch(*q, m_params, m_outputs[fileIndex]);
+	s->search(m_lib, m_resultCaches[fileIndex]);
+	
+	m_searchCount++; // counting searches in all files
+	m_searchTaskStats.processSearch(s);
+	
+	pc.increment();
+	
+	// print search result
+	s->print();
+	delete s;
+      }
+      
+      if (wellFormed && !job->wellFormed) {
+	cerr << "\nBadly formatted " << fileType << " file! Search task truncated." << endl;
+	wellFormed = false;
       }
     }
-  }	
+    
+    if (!wellFormed) break;
+  }
+  
+  pc.done();
+  closeResultCache(fileIndex);
+  m_outputs[fileIndex]->printFooter();
+  m_outputs[fileIndex]->closeFile();
+  
+  endFileStageStats(searchFileName);
 }
 
-// isInSelectedList - tries to find the query name in the selected list and returns true if found.
-bool SpectraSTSearchTask::isInSelectedList(string name) {
-		
-  vector<string>::iterator i;
-  for (i = m_selectedList.begin(); i != m_selectedList.end(); i++) {
-    
-    if (name == *i) {
-      return (true);
-    }     	
+// beginFileStageStats - called before the search of a file (or a batch of files searched together) begins
+void SpectraSTSearchTask::beginFileStageStats() {
+  
+  SpectraSTStageStats::getTotals(m_fileStageStatsStart);
+}
+
+// endFileStageStats - called after the search of a file (or batch) ends, with the name of the file (or batch). Logs the
+// stage stats of the file, and keeps them for the stage stats file. All threads started for the file must have been joined.
+void SpectraSTSearchTask::endFileStageStats(string label) {
+  
+  SpectraSTStageStats fileStats;
+  SpectraSTStageStats::getTotals(fileStats);
+  fileStats.subtract(m_fileStageStatsStart);
+  
+  fileStats.log("\"" + label + "\"");
+  m_fileStageStats.push_back(pair<string, SpectraSTStageStats>(label, fileStats));
+}
+
+// writeStageStats - logs the stage stats of the whole run, and writes them, together with those of each file, 
+// to the stage stats file if one is specified
+void SpectraSTSearchTask::writeStageStats() {
+  
+  SpectraSTStageStats runStats;
+  SpectraSTStageStats::getTotals(runStats);
+  unsigned int numThreads = SpectraSTStageStats::getNumThreads();
+  
+  stringstream ss;
+  ss << "Run (" << numThreads << " thread(s))";
+  runStats.log(ss.str());
+  
+  if (m_params.stageStatsFileName.empty()) {
+    return;
+  }
+  
+  ofstream fout;
+  if (!myFileOpen(fout, m_params.stageStatsFileName)) {
+    g_log->error("SEARCH", "Cannot open file \"" + m_params.stageStatsFileName + "\" for writing stage stats.");
+    return;
+  }
+  
+  fout << "{" << endl;
+  fout << "  \"threads\": " << numThreads << "," << endl;
+  fout << "  \"run\": ";
+  runStats.writeJSON(fout, "  ");
+  fout << "," << endl;
+  fout << "  \"files\": [" << endl;
+  for (vector<pair<string, SpectraSTStageStats> >::iterator f = m_fileStageStats.begin(); f != m_fileStageStats.end(); f++) {
+    // escape the name for JSON
+    string name("");
+    for (string::size_type i = 0; i < f->first.length(); i++) {
+      if (f->first[i] == '\\' || f->first[i] == '"') name += '\\';
+      name += f->first[i];
+    }
+    fout << "    { \"name\": \"" << name << "\", \"stats\": ";
+    f->second.writeJSON(fout, "    ");
+    fout << " }" << (f + 1 != m_fileStageStats.end() ? "," : "") << endl;
+  }
+  fout << "  ]" << endl;
+  fout << "}" << endl;
+  
+  if (!g_quiet) {
+    cout << "Stage stats written to \"" << m_params.stageStatsFileName << "\"." << endl;
   }
-  return (false);
 }
 
+// parseQueriesInThread - parses one block of a mapped query file. Touches nothing but the job itself.
+void* SpectraSTSearchTask::parseQueriesInThread(void* arg) {
+  
+  QueryParseJob* job = (QueryParseJob*)arg;
+  job->wellFormed = job->task->parseQueries(job->begin, job->end, job->queries);
+  return (NULL);
+}
+
+// parseQueries - parses the text in [begin, end) into queries to be searched, in file order. Subclasses reading their files
+// through searchMappedFile() must implement this; it may be called by several threads at once on different blocks,
+// so it must not modify the task. Returns false if it stops at a badly formatted record.
+bool SpectraSTSearchTask::parseQueries(const char* begin, const char* end, vector<SpectraSTQuery*>& queries) {
+  
+  return (true);
+}
 
 // createSpectraSTSearchTask - factory method to create the proper search task object for different search file formats. Modify
 // if a subclass is implemented!
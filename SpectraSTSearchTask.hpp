@@ -5,6 +5,10 @@
 #include "SpectraSTSearchOutput.hpp"
 #include "SpectraSTSearchParams.hpp"
 #include "SpectraSTSearchTaskStats.hpp"
+#include "SpectraSTQuery.hpp"
+#include "SpectraSTQuerySelection.hpp"
+#include "SpectraSTResultCache.hpp"
+#include "SpectraSTStageStats.hpp"
 #include <vector>
 #include <string>
 
@@ -49,6 +53,17 @@ hlam@systemsbiology.org
 
 using namespace std;
 
+class SpectraSTSearchTask;
+
+// one block of a memory-mapped query file, to be parsed into queries (possibly in its own thread)
+typedef struct {
+  SpectraSTSearchTask* task;
+  const char* begin;
+  const char* end;
+  vector<SpectraSTQuery*> queries; // the queries to be searched, in file order
+  bool wellFormed; // false if parsing stopped at a badly formatted record
+} QueryParseJob;
+
 class SpectraSTSearchTask {
 	
 public:
@@ -81,6 +96,9 @@ protected:
   
   // pointers to the output objects (one per search file) - these ARE properties of this class
   vector<SpectraSTSearchOutput*> m_outputs;
+
+  // pointers to the result caches (one per search file, NULL unless the file is being searched with -s_RSC) - these ARE properties of this class
+  vector<SpectraSTResultCache*> m_resultCaches;
   
   // reference to search params object
   SpectraSTSearchParams& m_params;
@@ -88,17 +106,35 @@ protected:
   // object to manage stats
   SpectraSTSearchTaskStats m_searchTaskStats;
   
-  // a vector of all the selected queries
-  vector<string> m_selectedList;
+  // the selected queries
+  SpectraSTQuerySelection m_selection;
   
   // methods to manage selected lists
   void readSelectedListFile();
-  bool isInSelectedList(string name);
+  bool isInSelectedList(const string& name) { return (m_selection.isNameSelected(name)); }
+  
+  // methods to open and close the result cache of a search file (if caching search results)
+  void openResultCache(unsigned int fileIndex);
+  void closeResultCache(unsigned int fileIndex);
+
+  // methods for text query files read through a SpectraSTMappedFile (.msp, .mgf)
+  void searchMappedFile(unsigned int fileIndex, const char* recordPrefix, string fileType);
+  virtual bool parseQueries(const char* begin, const char* end, vector<SpectraSTQuery*>& queries);
+  static void* parseQueriesInThread(void* arg);
+  
+  // methods to time the stages of the search of each file (or batch of files), and of the whole run
+  void beginFileStageStats();
+  void endFileStageStats(string label);
+  void writeStageStats();
   
   // counters and flags
   bool m_searchAll;
   unsigned int m_searchCount;
 
+  // the stage stats when the search of the current file began, and those of all files searched
+  SpectraSTStageStats m_fileStageStatsStart;
+  vector<pair<string, SpectraSTStageStats> > m_fileStageStats;
+
   
   
 };
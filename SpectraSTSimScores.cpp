@@ -152,7 +152,7 @@ double SpectraSTSimScores::imposeDotBiasPenalty() {
 
 
 // printFixedWidth - prints the scores in fixed width windows on a line. (For .txt outputs)
-void SpectraSTSimScores::printFixedWidth(ofstream& fout) {
+void SpectraSTSimScores::printFixedWidth(ostream& fout) {
   fout.width(10);
   fout.precision(3);		
   fout << left << dot;
@@ -187,7 +187,7 @@ void SpectraSTSimScores::printFixedWidth(ofstream& fout) {
   
 }
 
-void SpectraSTSimScores::printHeaderFixedWidth(ofstream& fout) {
+void SpectraSTSimScores::printHeaderFixedWidth(ostream& fout) {
   
   fout.width(10);
   fout << "Dot";
@@ -211,7 +211,7 @@ void SpectraSTSimScores::printHeaderFixedWidth(ofstream& fout) {
 }
 
 // printTabDelimited - prints the scores, separated by tabs, on a line. (For .xls outputs)
-void SpectraSTSimScores::printTabDelimited(ofstream& fout) {
+void SpectraSTSimScores::printTabDelimited(ostream& fout) {
   
   fout.precision(3);		
   fout << left << dot << '\t';
@@ -235,7 +235,7 @@ void SpectraSTSimScores::printTabDelimited(ofstream& fout) {
   
 }
 
-void SpectraSTSimScores::printHeaderTabDelimited(ofstream& fout) {
+void SpectraSTSimScores::printHeaderTabDelimited(ostream& fout) {
   
   fout << "Dot" << '\t';
   fout << "Delta" << '\t';
@@ -250,53 +250,53 @@ void SpectraSTSimScores::printHeaderTabDelimited(ofstream& fout) {
 }
 
 
-void SpectraSTSimScores::printHtml(ofstream& fout) {
+void SpectraSTSimScores::printHtml(ostream& fout) {
   
   fout.precision(3);
-  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << fval << "</TT></TD>" << endl; 
+  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << fval << "</TT></TD>" << '\n'; 
   fout.precision(3);
-  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << dot << "</TT></TD>" << endl;
+  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << dot << "</TT></TD>" << '\n';
   fout.precision(3);
-  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << delta << "</TT></TD>" << endl;
+  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << delta << "</TT></TD>" << '\n';
   fout.precision(3);
-  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << dotBias << "</TT></TD>" << endl;
+  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << dotBias << "</TT></TD>" << '\n';
   fout.precision(4);
-  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << showpos << precursorMzDiff << noshowpos << "</TT></TD>" << endl;
+  fout << "  <TD BGCOLOR=\"" << NORMALCELLCOLOR << "\"><TT>" << fixed << showpos << precursorMzDiff << noshowpos << "</TT></TD>" << '\n';
   
 }
 
-void SpectraSTSimScores::printHeaderHtml(ofstream& fout) {
+void SpectraSTSimScores::printHeaderHtml(ostream& fout) {
   
-  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Fval" << "</TT></TH>" << endl; 
-  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Dot" << "</TT></TH>" << endl;
-  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Delta" << "</TT></TH>" << endl;
-  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "DBias" << "</TT></TH>" << endl;
-  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "MzDiff" << "</TT></TH>" << endl;
+  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Fval" << "</TT></TH>" << '\n'; 
+  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Dot" << "</TT></TH>" << '\n';
+  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "Delta" << "</TT></TH>" << '\n';
+  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "DBias" << "</TT></TH>" << '\n';
+  fout << "  <TH BGCOLOR=\"" << HEADERCELLCOLOR << "\"><TT>" << "MzDiff" << "</TT></TH>" << '\n';
   
   
 }
 
 // printPepXML - prints the scores as pepXML elements. (For .pepXML outputs)
-void SpectraSTSimScores::printPepXML(ofstream& fout) {
+void SpectraSTSimScores::printPepXML(ostream& fout) {
   
   fout.precision(3);		
-  fout << "<search_score name=\"dot\" value=\"" << dot << "\"/>" << endl;	
+  fout << "<search_score name=\"dot\" value=\"" << dot << "\"/>" << '\n';	
   fout.precision(3);		
-  fout << "<search_score name=\"delta\" value=\"" << delta << "\"/>" << endl;	
+  fout << "<search_score name=\"delta\" value=\"" << delta << "\"/>" << '\n';	
   fout.precision(3);		 
-  fout << "<search_score name=\"dot_bias\" value=\"" << dotBias << "\"/>" << endl;	
+  fout << "<search_score name=\"dot_bias\" value=\"" << dotBias << "\"/>" << '\n';	
   fout.precision(3);		
-  fout << "<search_score name=\"precursor_mz_diff\" value=\"" << precursorMzDiff << "\"/>" << endl;	
+  fout << "<search_score name=\"precursor_mz_diff\" value=\"" << precursorMzDiff << "\"/>" << '\n';	
   fout.precision(3);		
-  fout << "<search_score name=\"hits_num\" value=\"" << hitsNum << "\"/>" << endl;	
+  fout << "<search_score name=\"hits_num\" value=\"" << hitsNum << "\"/>" << '\n';	
   fout.precision(3);		
-  fout << "<search_score name=\"hits_mean\" value=\"" << hitsMean << "\"/>" << endl;	
+  fout << "<search_score name=\"hits_mean\" value=\"" << hitsMean << "\"/>" << '\n';	
   fout.precision(3);		
-  fout << "<search_score name=\"hits_stdev\" value=\"" << hitsStDev << "\"/>" << endl;	
+  fout << "<search_score name=\"hits_stdev\" value=\"" << hitsStDev << "\"/>" << '\n';	
   fout.precision(3);		
-  fout << "<search_score name=\"fval\" value=\"" << fval << "\"/>" << endl;	
+  fout << "<search_score name=\"fval\" value=\"" << fval << "\"/>" << '\n';	
   fout.precision(2);
-  fout << "<search_score name=\"first_non_homolog\" value=\"" << firstNonHomolog << "\"/>" << endl;
+  fout << "<search_score name=\"first_non_homolog\" value=\"" << firstNonHomolog << "\"/>" << '\n';
   
   
 	
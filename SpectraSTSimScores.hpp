@@ -53,14 +53,14 @@ public:
   SpectraSTSimScores& operator=(SpectraSTSimScores& other);
   
   // printing methods for different output types
-  void printFixedWidth(ofstream& fout);
-  void printTabDelimited(ofstream& fout);
-  void printPepXML(ofstream& fout);
-  void printHtml(ofstream& fout);
+  void printFixedWidth(ostream& fout);
+  void printTabDelimited(ostream& fout);
+  void printPepXML(ostream& fout);
+  void printHtml(ostream& fout);
   
-  static void printHeaderTabDelimited(ofstream& fout);
-  static void printHeaderFixedWidth(ofstream& fout);
-  static void printHeaderHtml(ofstream& fout);
+  static void printHeaderTabDelimited(ostream& fout);
+  static void printHeaderFixedWidth(ostream& fout);
+  static void printHeaderHtml(ostream& fout);
   
   // the various scores
   double dot;
@@ -0,0 +1,511 @@
+#include "SpectraSTSketchIndex.hpp"
+#include "SpectraSTLog.hpp"
+#include "FileUtils.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTSketchIndex
+ *
+ * Approximate nearest-neighbor index over the sketches of the spectra of one library.
+ * See SpectraSTSketchIndex.hpp.
+ *
+ */
+
+extern bool g_verbose;
+extern bool g_quiet;
+extern SpectraSTLog* g_log;
+
+#define SKETCH_INDEX_MAGIC "SPSTSKCH"
+#define SKETCH_INDEX_VERSION 1
+
+// clustering: at most this many clusters, trained on about this many sketches per cluster, for this many rounds
+#define SKETCH_INDEX_MAX_CLUSTERS 4096
+#define SKETCH_INDEX_SAMPLE_PER_CLUSTER 32
+#define SKETCH_INDEX_NUM_ROUNDS 10
+
+// hashBin - the hash of a bin number, which decides the dimension (low bits) and the sign (a high bit) a peak
+// in that bin goes to. Fixed, so that sketches built at different times can be compared.
+static unsigned int hashBin(unsigned int bin) {
+  unsigned int h = bin * 2654435761u;
+  h ^= h >> 15;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return (h);
+}
+
+// constructor
+SpectraSTSketchIndex::SpectraSTSketchIndex(string libFileName, int numBinsPerMzUnit, double mzPower, double intensityPower) :
+  m_libFileName(libFileName),
+  m_sketchFileName(getSketchFileName(libFileName)),
+  m_numBinsPerMzUnit(numBinsPerMzUnit > 0 ? numBinsPerMzUnit : 1),
+  m_mzPower(mzPower),
+  m_intensityPower(intensityPower),
+  m_fileSize(-1),
+  m_fileModTime(-1),
+  m_libIds(),
+  m_charges(),
+  m_sketches(),
+  m_centroids(),
+  m_listOffsets(1, 0),
+  m_libIdToEntry() {
+
+}
+
+// destructor
+SpectraSTSketchIndex::~SpectraSTSketchIndex() {
+
+}
+
+// getSketchFileName - the name of the sidecar of the library libFileName
+string SpectraSTSketchIndex::getSketchFileName(string libFileName) {
+  return (libFileName + ".spsketch");
+}
+
+// load - loads the index from the sidecar. Returns false if there is no sidecar, or it is not current; the
+// caller should then insert all entries and peaks, and call build().
+bool SpectraSTSketchIndex::load() {
+
+  if (!statFile() || !readFromFile()) {
+    return (false);
+  }
+  if (g_verbose) {
+    cout << "Sketch index of \"" << m_libFileName << "\" loaded from \"" << m_sketchFileName << "\"." << endl;
+  }
+  return (true);
+}
+
+// insertEntry - adds an entry. All entries must be inserted before any of their peaks.
+void SpectraSTSketchIndex::insertEntry(int libId, int charge) {
+
+  if (libId < 0) return;
+
+  if ((unsigned int)libId >= (unsigned int)(m_libIdToEntry.size())) {
+    m_libIdToEntry.resize(libId + 1, (unsigned int)(-1));
+  }
+  m_libIdToEntry[libId] = (unsigned int)(m_libIds.size());
+
+  m_libIds.push_back(libId);
+  m_charges.push_back(charge);
+  m_sketches.resize(m_sketches.size() + SKETCH_DIM, 0.0);
+}
+
+// insertPeak - adds a peak of an entry already inserted to its sketch. Peaks of unknown entries are ignored.
+void SpectraSTSketchIndex::insertPeak(int libId, double mz, float intensity) {
+
+  if (libId < 0 || (unsigned int)libId >= (unsigned int)(m_libIdToEntry.size())) return;
+  unsigned int entry = m_libIdToEntry[libId];
+  if (entry == (unsigned int)(-1)) return;
+
+  addPeak(&(m_sketches[entry * SKETCH_DIM]), mz, intensity);
+}
+
+// build - finishes the sketches of the inserted entries, clusters them, and writes the sidecar
+void SpectraSTSketchIndex::build() {
+
+  unsigned int numEntries = (unsigned int)(m_libIds.size());
+  for (unsigned int e = 0; e < numEntries; e++) {
+    normalize(&(m_sketches[e * SKETCH_DIM]));
+  }
+  vector<unsigned int>().swap(m_libIdToEntry);
+
+  cluster();
+
+  if (statFile()) {
+    writeToFile();
+  }
+}
+
+// addPeak - adds a peak, binned and scaled as in SpectraSTPeakList::binPeaks, to the sketch
+void SpectraSTSketchIndex::addPeak(float* sketch, double mz, float intensity) {
+
+  if (mz <= 0.0 || intensity <= 0.0) return;
+
+  unsigned int h = hashBin((unsigned int)(mz * (double)m_numBinsPerMzUnit));
+  float value = (float)(pow(mz, m_mzPower) * pow((double)intensity, m_intensityPower));
+
+  if (h & 0x80000000u) {
+    sketch[h % SKETCH_DIM] -= value;
+  } else {
+    sketch[h % SKETCH_DIM] += value;
+  }
+}
+
+// cluster - spherical k-means on a sample of the sketches, then assigns every entry to its nearest cluster and
+// lays the entries out cluster by cluster. Deterministic: the same library gives the same clusters.
+void SpectraSTSketchIndex::cluster() {
+
+  unsigned int numEntries = (unsigned int)(m_libIds.size());
+  if (numEntries == 0) {
+    m_centroids.clear();
+    m_listOffsets.assign(1, 0);
+    return;
+  }
+
+  unsigned int numClusters = (unsigned int)(sqrt((double)numEntries));
+  if (numClusters < 1) numClusters = 1;
+  if (numClusters > SKETCH_INDEX_MAX_CLUSTERS) numClusters = SKETCH_INDEX_MAX_CLUSTERS;
+
+  // an evenly spaced sample to train on
+  unsigned int stride = numEntries / (numClusters * SKETCH_INDEX_SAMPLE_PER_CLUSTER);
+  if (stride < 1) stride = 1;
+  vector<unsigned int> sample;
+  for (unsigned int e = 0; e < numEntries; e += stride) {
+    sample.push_back(e);
+  }
+  unsigned int sampleSize = (unsigned int)(sample.size());
+
+  m_centroids.assign(numClusters * SKETCH_DIM, 0.0);
+  for (unsigned int c = 0; c < numClusters; c++) {
+    unsigned int e = sample[(unsigned int)(((unsigned long long)c * sampleSize) / numClusters)];
+    copy(m_sketches.begin() + e * SKETCH_DIM, m_sketches.begin() + (e + 1) * SKETCH_DIM, m_centroids.begin() + c * SKETCH_DIM);
+  }
+
+  vector<unsigned int> assignment(numEntries, 0);
+
+  for (unsigned int round = 0; round < SKETCH_INDEX_NUM_ROUNDS; round++) {
+
+    vector<float> sums(numClusters * SKETCH_DIM, 0.0);
+    vector<unsigned int> counts(numClusters, 0);
+
+    for (unsigned int s = 0; s < sampleSize; s++) {
+      const float* sketch = &(m_sketches[sample[s] * SKETCH_DIM]);
+      unsigned int best = 0;
+      float bestScore = dot(sketch, &(m_centroids[0]));
+      for (unsigned int c = 1; c < numClusters; c++) {
+        float score = dot(sketch, &(m_centroids[c * SKETCH_DIM]));
+        if (score > bestScore) {
+          bestScore = score;
+          best = c;
+        }
+      }
+      counts[best]++;
+      for (unsigned int d = 0; d < SKETCH_DIM; d++) {
+        sums[best * SKETCH_DIM + d] += sketch[d];
+      }
+    }
+
+    // a cluster left empty keeps its old centroid
+    for (unsigned int c = 0; c < numClusters; c++) {
+      if (counts[c] > 0) {
+        copy(sums.begin() + c * SKETCH_DIM, sums.begin() + (c + 1) * SKETCH_DIM, m_centroids.begin() + c * SKETCH_DIM);
+        normalize(&(m_centroids[c * SKETCH_DIM]));
+      }
+    }
+  }
+
+  // assign all entries, and count the size of each cluster
+  m_listOffsets.assign(numClusters + 1, 0);
+  for (unsigned int e = 0; e < numEntries; e++) {
+    const float* sketch = &(m_sketches[e * SKETCH_DIM]);
+    unsigned int best = 0;
+    float bestScore = dot(sketch, &(m_centroids[0]));
+    for (unsigned int c = 1; c < numClusters; c++) {
+      float score = dot(sketch, &(m_centroids[c * SKETCH_DIM]));
+      if (score > bestScore) {
+        bestScore = score;
+        best = c;
+      }
+    }
+    assignment[e] = best;
+    m_listOffsets[best + 1]++;
+  }
+  for (unsigned int c = 0; c < numClusters; c++) {
+    m_listOffsets[c + 1] += m_listOffsets[c];
+  }
+
+  // lay out the entries cluster by cluster, keeping their order within each cluster
+  vector<int> libIds(numEntries);
+  vector<int> charges(numEntries);
+  vector<float> sketches(m_sketches.size());
+  vector<unsigned int> next(m_listOffsets.begin(), m_listOffsets.end() - 1);
+  for (unsigned int e = 0; e < numEntries; e++) {
+    unsigned int pos = next[assignment[e]]++;
+    libIds[pos] = m_libIds[e];
+    charges[pos] = m_charges[e];
+    copy(m_sketches.begin() + e * SKETCH_DIM, m_sketches.begin() + (e + 1) * SKETCH_DIM, sketches.begin() + pos * SKETCH_DIM);
+  }
+  m_libIds.swap(libIds);
+  m_charges.swap(charges);
+  m_sketches.swap(sketches);
+}
+
+// retrieve - finds the (at most) topK entries, of a possible charge, whose sketches are nearest to that of the query,
+// looking in the numProbes clusters nearest to the query. possibleCharges[c] tells if charge c is possible; if empty,
+// all charges are. If numProbes is at least the number of clusters, the search is exhaustive. The hits are ordered by
+// decreasing similarity.
+void SpectraSTSketchIndex::retrieve(vector<SpectraSTSketchIndexHit>& hits, SpectraSTPeakList* query, vector<bool>& possibleCharges,
+                                    unsigned int topK, unsigned int numProbes) {
+
+  unsigned int numClusters = getNumClusters();
+  if (numClusters == 0 || topK == 0) {
+    return;
+  }
+
+  float querySketch[SKETCH_DIM];
+  for (unsigned int d = 0; d < SKETCH_DIM; d++) {
+    querySketch[d] = 0.0;
+  }
+  Peak p;
+  for (unsigned int i = 0; i < query->getNumPeaks(); i++) {
+    query->getPeak(i, p);
+    addPeak(querySketch, p.mz, p.intensity);
+  }
+  normalize(querySketch);
+
+  // the clusters to look in
+  vector<pair<float, unsigned int> > clusterScores(numClusters);
+  for (unsigned int c = 0; c < numClusters; c++) {
+    clusterScores[c] = pair<float, unsigned int>(dot(querySketch, &(m_centroids[c * SKETCH_DIM])), c);
+  }
+  if (numProbes < 1) numProbes = 1;
+  if (numProbes > numClusters) numProbes = numClusters;
+  partial_sort(clusterScores.begin(), clusterScores.begin() + numProbes, clusterScores.end(), SpectraSTSketchIndex::sortScoresDesc);
+
+  vector<pair<float, unsigned int> > entryScores;
+  for (unsigned int k = 0; k < numProbes; k++) {
+    unsigned int c = clusterScores[k].second;
+    for (unsigned int e = m_listOffsets[c]; e < m_listOffsets[c + 1]; e++) {
+      int charge = m_charges[e];
+      if (!possibleCharges.empty() && (charge < 0 || charge >= (int)(possibleCharges.size()) || !possibleCharges[charge])) {
+        continue;
+      }
+      entryScores.push_back(pair<float, unsigned int>(dot(querySketch, &(m_sketches[e * SKETCH_DIM])), e));
+    }
+  }
+
+  if ((unsigned int)(entryScores.size()) > topK) {
+    partial_sort(entryScores.begin(), entryScores.begin() + topK, entryScores.end(), SpectraSTSketchIndex::sortScoresDesc);
+    entryScores.resize(topK);
+  } else {
+    sort(entryScores.begin(), entryScores.end(), SpectraSTSketchIndex::sortScoresDesc);
+  }
+
+  for (vector<pair<float, unsigned int> >::iterator s = entryScores.begin(); s != entryScores.end(); s++) {
+    SpectraSTSketchIndexHit hit;
+    hit.libId = m_libIds[s->second];
+    hit.charge = m_charges[s->second];
+    hit.similarity = s->first;
+    hits.push_back(hit);
+  }
+}
+
+// statFile - gets the size and modification time of the library file, which together with the path identify
+// the version of the library the sidecar belongs to
+bool SpectraSTSketchIndex::statFile() {
+
+  struct stat fileStat;
+  if (stat(m_libFileName.c_str(), &fileStat) != 0) {
+    m_fileSize = -1;
+    m_fileModTime = -1;
+    return (false);
+  }
+  m_fileSize = (long long)(fileStat.st_size);
+  m_fileModTime = (long long)(fileStat.st_mtime);
+  return (true);
+}
+
+// writeToFile - writes the index to the sidecar. MUST BE modified together with readFromFile() to ensure
+// synchronization of the .spsketch file format.
+void SpectraSTSketchIndex::writeToFile() {
+
+  // write to a temporary file first, so that a concurrent reader never sees half a sidecar
+  string tmpFileName(m_sketchFileName + ".tmp");
+
+  ofstream fout;
+  if (!myFileOpen(fout, tmpFileName, true)) {
+    g_log->log("SKETCH INDEX", "Cannot write sketch index \"" + m_sketchFileName + "\". Not saved.");
+    return;
+  }
+
+  int version = SKETCH_INDEX_VERSION;
+  int dim = SKETCH_DIM;
+  unsigned int pathLength = (unsigned int)m_libFileName.length();
+  unsigned int numEntries = getNumEntries();
+  unsigned int numClusters = getNumClusters();
+
+  fout.write(SKETCH_INDEX_MAGIC, 8);
+  fout.write((char*)(&version), sizeof(int));
+  fout.write((char*)(&dim), sizeof(int));
+  fout.write((char*)(&m_numBinsPerMzUnit), sizeof(int));
+  fout.write((char*)(&m_mzPower), sizeof(double));
+  fout.write((char*)(&m_intensityPower), sizeof(double));
+  fout.write((char*)(&m_fileSize), sizeof(long long));
+  fout.write((char*)(&m_fileModTime), sizeof(long long));
+  fout.write((char*)(&pathLength), sizeof(unsigned int));
+  fout.write(m_libFileName.c_str(), pathLength);
+  fout.write((char*)(&numEntries), sizeof(unsigned int));
+  fout.write((char*)(&numClusters), sizeof(unsigned int));
+
+  if (numClusters > 0) {
+    fout.write((char*)(&(m_centroids[0])), numClusters * SKETCH_DIM * sizeof(float));
+  }
+  fout.write((char*)(&(m_listOffsets[0])), (numClusters + 1) * sizeof(unsigned int));
+  if (numEntries > 0) {
+    fout.write((char*)(&(m_libIds[0])), numEntries * sizeof(int));
+    fout.write((char*)(&(m_charges[0])), numEntries * sizeof(int));
+    fout.write((char*)(&(m_sketches[0])), numEntries * SKETCH_DIM * sizeof(float));
+  }
+
+  bool ok = fout.good();
+  fout.close();
+
+  if (!ok || rename(tmpFileName.c_str(), m_sketchFileName.c_str()) != 0) {
+    g_log->log("SKETCH INDEX", "Cannot write sketch index \"" + m_sketchFileName + "\". Not saved.");
+    remove(tmpFileName.c_str());
+    return;
+  }
+
+  g_log->log("SKETCH INDEX", "Sketch index of \"" + m_libFileName + "\" saved in \"" + m_sketchFileName + "\".");
+}
+
+// readFromFile - reads the index from the sidecar. Returns false if there is no sidecar, or it does not belong to
+// this version of the library or this binning.
+bool SpectraSTSketchIndex::readFromFile() {
+
+  ifstream fin;
+  if (!myFileOpen(fin, m_sketchFileName, true)) {
+    return (false);
+  }
+
+  char magic[8];
+  int version = 0;
+  int dim = 0;
+  int numBinsPerMzUnit = 0;
+  double mzPower = 0.0;
+  double intensityPower = 0.0;
+  long long fileSize = -1;
+  long long fileModTime = -1;
+  unsigned int pathLength = 0;
+
+  fin.read(magic, 8);
+  fin.read((char*)(&version), sizeof(int));
+  fin.read((char*)(&dim), sizeof(int));
+  fin.read((char*)(&numBinsPerMzUnit), sizeof(int));
+  fin.read((char*)(&mzPower), sizeof(double));
+  fin.read((char*)(&intensityPower), sizeof(double));
+  fin.read((char*)(&fileSize), sizeof(long long));
+  fin.read((char*)(&fileModTime), sizeof(long long));
+  fin.read((char*)(&pathLength), sizeof(unsigned int));
+
+  if (!fin.good() || strncmp(magic, SKETCH_INDEX_MAGIC, 8) != 0 || version != SKETCH_INDEX_VERSION || dim != SKETCH_DIM ||
+      numBinsPerMzUnit != m_numBinsPerMzUnit || mzPower != m_mzPower || intensityPower != m_intensityPower ||
+      fileSize != m_fileSize || fileModTime != m_fileModTime || pathLength != (unsigned int)m_libFileName.length()) {
+    return (false);
+  }
+
+  string path(pathLength, ' ');
+  fin.read(&(path[0]), pathLength);
+  if (path != m_libFileName) {
+    return (false);
+  }
+
+  unsigned int numEntries = 0;
+  unsigned int numClusters = 0;
+  fin.read((char*)(&numEntries), sizeof(unsigned int));
+  fin.read((char*)(&numClusters), sizeof(unsigned int));
+  if (!fin.good() || numClusters > SKETCH_INDEX_MAX_CLUSTERS || (numEntries > 0 && numClusters == 0)) {
+    return (false);
+  }
+
+  vector<float> centroids(numClusters * SKETCH_DIM);
+  vector<unsigned int> listOffsets(numClusters + 1);
+  vector<int> libIds(numEntries);
+  vector<int> charges(numEntries);
+  vector<float> sketches((size_t)numEntries * SKETCH_DIM);
+
+  if (numClusters > 0) {
+    fin.read((char*)(&(centroids[0])), numClusters * SKETCH_DIM * sizeof(float));
+  }
+  fin.read((char*)(&(listOffsets[0])), (numClusters + 1) * sizeof(unsigned int));
+  if (numEntries > 0) {
+    fin.read((char*)(&(libIds[0])), numEntries * sizeof(int));
+    fin.read((char*)(&(charges[0])), numEntries * sizeof(int));
+    fin.read((char*)(&(sketches[0])), (size_t)numEntries * SKETCH_DIM * sizeof(float));
+  }
+  if (!fin.good() || listOffsets[0] != 0 || listOffsets[numClusters] != numEntries) {
+    return (false);
+  }
+  for (unsigned int c = 0; c < numClusters; c++) {
+    if (listOffsets[c] > listOffsets[c + 1]) {
+      return (false);
+    }
+  }
+
+  m_centroids.swap(centroids);
+  m_listOffsets.swap(listOffsets);
+  m_libIds.swap(libIds);
+  m_charges.swap(charges);
+  m_sketches.swap(sketches);
+
+  return (true);
+}
+
+// normalize - scales the sketch to unit length (unless it is all zero)
+void SpectraSTSketchIndex::normalize(float* sketch) {
+
+  double sumSq = 0.0;
+  for (unsigned int d = 0; d < SKETCH_DIM; d++) {
+    sumSq += (double)(sketch[d]) * (double)(sketch[d]);
+  }
+  if (sumSq <= 0.0) return;
+
+  float norm = (float)(1.0 / sqrt(sumSq));
+  for (unsigned int d = 0; d < SKETCH_DIM; d++) {
+    sketch[d] *= norm;
+  }
+}
+
+// dot - the inner product of two sketches
+float SpectraSTSketchIndex::dot(const float* a, const float* b) {
+
+  float sum = 0.0;
+  for (unsigned int d = 0; d < SKETCH_DIM; d++) {
+    sum += a[d] * b[d];
+  }
+  return (sum);
+}
+
+// sortScoresDesc - comparison function used by sort() to order (score, number) pairs by decreasing score, then by
+// increasing number, so that the order does not depend on the sort algorithm
+bool SpectraSTSketchIndex::sortScoresDesc(const pair<float, unsigned int>& a, const pair<float, unsigned int>& b) {
+
+  return (a.first > b.first || (a.first == b.first && a.second < b.second));
+}
@@ -0,0 +1,124 @@
+#ifndef SPECTRASTSKETCHINDEX_HPP_
+#define SPECTRASTSKETCHINDEX_HPP_
+
+#include "SpectraSTPeakList.hpp"
+
+#include <string>
+#include <vector>
+
+// the number of dimensions of a sketch. MUST BE modified together with SKETCH_INDEX_VERSION in SpectraSTSketchIndex.cpp.
+#define SKETCH_DIM 64
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTSketchIndex
+ *
+ * Approximate nearest-neighbor index over the spectra of one library, used to find candidates anywhere
+ * in the library regardless of precursor m/z (-s_ANN). Each spectrum is reduced to a sketch of SKETCH_DIM
+ * numbers by hashing its (scaled) binned peaks onto the dimensions with a random sign, and normalizing;
+ * the inner product of two sketches then approximates the dot product of the binned spectra. The sketches
+ * are grouped into clusters (an inverted file, IVF) by spherical k-means, and a query only compares its
+ * sketch with those of the few clusters nearest to it.
+ *
+ * The sketches and clusters are kept in a sidecar file <library>.spsketch, keyed on the path, size and
+ * modification time of the library and on the binning, and rebuilt whenever any of these changes.
+ *
+ */
+
+using namespace std;
+
+// one retrieved entry: its LibId and charge, and the inner product of its sketch with that of the query
+typedef struct {
+  int libId;
+  int charge;
+  float similarity;
+} SpectraSTSketchIndexHit;
+
+class SpectraSTSketchIndex {
+
+public:
+  SpectraSTSketchIndex(string libFileName, int numBinsPerMzUnit, double mzPower, double intensityPower);
+  ~SpectraSTSketchIndex();
+
+  bool load();
+
+  void insertEntry(int libId, int charge);
+  void insertPeak(int libId, double mz, float intensity);
+  void build();
+
+  void retrieve(vector<SpectraSTSketchIndexHit>& hits, SpectraSTPeakList* query, vector<bool>& possibleCharges,
+                unsigned int topK, unsigned int numProbes);
+
+  unsigned int getNumEntries() { return ((unsigned int)(m_libIds.size())); }
+  unsigned int getNumClusters() { return ((unsigned int)(m_listOffsets.size()) - 1); }
+
+  static string getSketchFileName(string libFileName);
+
+private:
+
+  string m_libFileName;
+  string m_sketchFileName;
+
+  // the binning and scaling of the peaks, as in SpectraSTPeakList::binPeaks
+  int m_numBinsPerMzUnit;
+  double m_mzPower;
+  double m_intensityPower;
+
+  // key of the library file the sidecar was built from
+  long long m_fileSize;
+  long long m_fileModTime;
+
+  // the entries, cluster by cluster: the entries of cluster c are m_listOffsets[c] ... m_listOffsets[c + 1] - 1.
+  // The sketch of entry e is m_sketches[e * SKETCH_DIM] ... m_sketches[e * SKETCH_DIM + SKETCH_DIM - 1].
+  vector<int> m_libIds;
+  vector<int> m_charges;
+  vector<float> m_sketches;
+  vector<float> m_centroids;
+  vector<unsigned int> m_listOffsets;
+
+  // only used while building: the entry number of each LibId
+  vector<unsigned int> m_libIdToEntry;
+
+  void addPeak(float* sketch, double mz, float intensity);
+  void cluster();
+
+  bool statFile();
+  bool readFromFile();
+  void writeToFile();
+
+  static void normalize(float* sketch);
+  static float dot(const float* a, const float* b);
+  static bool sortScoresDesc(const pair<float, unsigned int>& a, const pair<float, unsigned int>& b);
+
+};
+
+#endif /*SPECTRASTSKETCHINDEX_HPP_*/
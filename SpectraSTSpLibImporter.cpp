@@ -13,6 +13,8 @@
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 /*
 
@@ -71,26 +73,46 @@ SpectraSTSpLibImporter::SpectraSTSpLibImporter(vector<string>& impFileNames, Spe
   m_splibFins(), 
   m_pepIndices(),
   m_mzIndices(),
-  m_plotPath(""),
-  m_QFSearchParams(NULL),
-  m_QFSearchLib(NULL),
   m_ppMappings(NULL),
+  m_QFSearchLib(NULL),
+  m_QFSearchParams(NULL),
+  m_plotPath(""),
+  m_plotter(NULL),
   m_count(0),
   m_denoiser(NULL),
-  m_singletonPeptideIons() {
+  m_singletonPeptideIons(),
+  m_repIdxFout(NULL),
+  m_updateFin(NULL),
+  m_updatePepIndex(NULL),
+  m_updateSignatures(),
+  m_numCopied(0),
+  m_numRecomputed(0),
+  m_numDiffered(0) {
   
   if (params.outputFileName.empty()) {
     // the constructor of the parent class SpectraSTLibImporter only creates the "default" outputFileName
     // need to overwrite this using our own constructOutputFileName
     m_outputFileName = constructOutputFileName();  
   }
+
+  if (!(params.updateLibrary.empty()) && params.updateLibrary == m_outputFileName) {
+    // the output is opened for writing before the import starts, which would wipe out the library to be updated
+    g_log->error("CREATE", "Cannot write the incrementally updated library over \"" + params.updateLibrary + "\". Specify another output file name with -cN.");
+    g_log->crash();
+  }
     
   // if plotting is required, make a directory for it
   FileName fn;
   parseFileName(m_outputFileName, fn);
   m_plotPath = fn.path + fn.name + "_spplot/";
   if (!m_params.plotSpectra.empty()) {
-    makeDir(m_plotPath);
+    // the plots are rendered in batches, by as many threads as asked for; into one archive if asked to
+    if (m_params.plotArchive) {
+      m_plotter = new SpectraSTSpectrumPlotter(m_params.numThreads, fn.path + fn.name + "_spplot.tar");
+    } else {
+      makeDir(m_plotPath);
+      m_plotter = new SpectraSTSpectrumPlotter(m_params.numThreads);
+    }
   }
   
   if (params.useBayesianDenoiser) {
@@ -143,6 +165,15 @@ SpectraSTSpLibImporter::~SpectraSTSpLibImporter() {
   }
   */
   if (m_denoiser) delete m_denoiser;
+
+  if (m_repIdxFout) delete (m_repIdxFout);
+  if (m_updatePepIndex) delete (m_updatePepIndex);
+  if (m_updateFin) delete (m_updateFin);
+  
+  // renders the plots not yet rendered
+  if (m_plotter) {
+    delete (m_plotter);
+  }
   
 }
 
@@ -182,6 +213,11 @@ void SpectraSTSpLibImporter::import() {
     return;
   }
   
+  if (!(m_params.updateLibrary.empty()) && !canRecordReplicates()) {
+    g_log->error("CREATE", "Incremental update (-c_INC) is only possible for CONSENSUS or BEST_REPLICATE libraries combined by UNION, without the Bayesian denoiser or refresh.");
+    return;
+  }
+  
   string fileListStr = constructFileListStr();
 
   // print starting message to console
@@ -214,6 +250,12 @@ void SpectraSTSpLibImporter::import() {
     refresh();
   }
 
+  openReplicateIndex();
+  
+  if (!(m_params.updateLibrary.empty()) && !openUpdateLibrary()) {
+    return;
+  }
+
   // now go through the peptide indices one by one and load the entries
   // the procedure is a bit counterintuitive, as follows: open the first file, for each peptide ion, add
   // the entries from the first file, then go look for that peptide ion in the rest of the files,
@@ -267,6 +309,29 @@ void SpectraSTSpLibImporter::import() {
 	  }
 	} 
 	
+	if (include && !mayPassFilterCriteria(peptide, *k)) {
+	  // the charge and mods in the subkey alone fail the filter criteria, no need to read the entries
+	  include = false;
+	}
+	
+	if (include && (m_repIdxFout || m_updatePepIndex)) {
+	  string signature = constructReplicateSignature(peptide, *k);
+	  if (m_repIdxFout) {
+	    (*m_repIdxFout) << peptide << '\t' << (*k) << '\t' << signature << endl;
+	  }
+	  if (m_updatePepIndex) {
+	    map<string, string>::iterator found = m_updateSignatures.find(peptide + '\t' + (*k));
+	    if (found != m_updateSignatures.end() && found->second == signature) {
+	      // same replicates as when the existing library was built, no need to recompute
+	      copyUnchangedEntry(peptide, *k);
+	      m_count++;
+	      pc.increment();
+	      continue;
+	    }
+	    m_numRecomputed++;
+	  }
+	}
+	
 	// now actually retrieve the entries
 	vector<SpectraSTLibEntry*> entries;
 	if (include) {
@@ -328,6 +393,21 @@ void SpectraSTSpLibImporter::import() {
 
   pc.done();
 
+  logFilterSkipCount("peptide ions");
+
+  if (m_updatePepIndex) {
+    stringstream updatess;
+    updatess << "Incremental update of \"" << m_params.updateLibrary << "\": " << m_numCopied << " peptide ions copied, ";
+    updatess << m_numRecomputed << " recomputed.";
+    if (m_params.verifyUpdate) {
+      updatess << " " << m_numDiffered << " copied peptide ions differ from a full rebuild (recomputed ones used).";
+    }
+    g_log->log("CREATE", updatess.str());
+    if (!g_quiet) {
+      cout << updatess.str() << endl;
+    }
+  }
+
   if (m_denoiser && (!(m_singletonPeptideIons.empty()))) {
     m_denoiser->generateBayesianModel();
     // re-read the singletons and denoise them before writing to library
@@ -370,68 +450,404 @@ void SpectraSTSpLibImporter::reloadAndProcessSingletons() {
     
 }
 
+// canRecordReplicates - whether each peptide ion of the generated library is built from its replicates alone,
+// such that it can be copied over to an incremental update as long as its replicates are unchanged.
+bool SpectraSTSpLibImporter::canRecordReplicates() {
+  
+  return ((m_params.buildAction == "CONSENSUS" || m_params.buildAction == "BEST_REPLICATE") &&
+	  m_params.combineAction == "UNION" && !m_denoiser && m_params.refreshDatabase.empty());
+}
+
+// openReplicateIndex - opens the .repidx file next to the generated library, and writes its header: the options the
+// entries depend on, and the size and modification time of each imported file. The peptide ions follow as they are built,
+// one line each with the file offsets of their replicates.
+void SpectraSTSpLibImporter::openReplicateIndex() {
+
+  if (!canRecordReplicates()) return;
+  
+  FileName fn;
+  parseFileName(m_lib->getLibFileName(), fn);
+  string repIdxFileName(fn.path + fn.name + ".repidx");
+  
+  m_repIdxFout = new ofstream;
+  if (!myFileOpen(*m_repIdxFout, repIdxFileName)) {
+    g_log->error("CREATE", "Cannot open REPIDX file \"" + repIdxFileName + "\" for writing replicate index. Writing skipped.");
+    delete (m_repIdxFout);
+    m_repIdxFout = NULL;
+    return;
+  }
+  
+  (*m_repIdxFout) << "### SpectraST replicate index" << endl;
+  (*m_repIdxFout) << constructReplicateIndexOptions();
+  
+  for (vector<string>::iterator f = m_impFileNames.begin(); f != m_impFileNames.end(); f++) {
+    struct stat fileStat;
+    long long fileSize = -1;
+    long long fileModTime = -1;
+    if (stat(f->c_str(), &fileStat) == 0) {
+      fileSize = (long long)(fileStat.st_size);
+      fileModTime = (long long)(fileStat.st_mtime);
+    }
+    (*m_repIdxFout) << "FILE\t" << fileSize << '\t' << fileModTime << '\t' << (*f) << endl;
+  }
+  
+}
+
+// openUpdateLibrary - opens the library to be updated incrementally (-c_INC) and its peptide index, and reads
+// its replicate index. Peptide ions whose imported files have since changed are left out, so that they will be 
+// recomputed; if any option the entries depend on has changed, all are. Returns false if the library cannot be opened.
+bool SpectraSTSpLibImporter::openUpdateLibrary() {
+  
+  FileName fn;
+  parseFileName(m_params.updateLibrary, fn);
+  
+  m_updateFin = new ifstream;
+  if (!myFileOpen(*m_updateFin, m_params.updateLibrary, true)) {
+    g_log->error("CREATE", "Cannot open SPLIB file \"" + m_params.updateLibrary + "\" for incremental update. No library creation performed.");
+    return (false);
+  }
+  
+  // peek to see if it's a binary file or not
+  bool binary = true;
+  char firstChar = m_updateFin->peek();
+  if (firstChar == '#' || firstChar == 'N') {
+    binary = false;
+  }
+  
+  m_updatePepIndex = new SpectraSTPeptideLibIndex(fn.path + fn.name + ".pepidx", m_updateFin, binary);
+  
+  string repIdxFileName(fn.path + fn.name + ".repidx");
+  ifstream repIdxFin;
+  if (!myFileOpen(repIdxFin, repIdxFileName)) {
+    g_log->warning("CREATE", "Cannot open REPIDX file \"" + repIdxFileName + "\" for incremental update. All peptide ions will be recomputed.");
+    return (true);
+  }
+  
+  // the files imported then, and where they are among the files imported now (-1 if gone or changed)
+  vector<int> fileMap;
+  
+  // the options the library was built with, checked against those now before the first file
+  string options("");
+  bool optionsChecked = false;
+  
+  string line;
+  while (nextLine(repIdxFin, line)) {
+    
+    if (line.compare(0, 11, "### OPTION ") == 0) {
+      options += line + '\n';
+      continue;
+    }
+    
+    if (line.empty() || line[0] == '#') continue;
+    
+    if (!optionsChecked) {
+      if (options != constructReplicateIndexOptions()) {
+	g_log->warning("CREATE", "Library \"" + m_params.updateLibrary + "\" was built with different options. All peptide ions will be recomputed.");
+	m_updateSignatures.clear();
+	return (true);
+      }
+      optionsChecked = true;
+    }
+    
+    if (line.compare(0, 5, "FILE\t") == 0) {
+      string::size_type sizeEnd = line.find('\t', 5);
+      string::size_type modTimeEnd = (sizeEnd == string::npos ? string::npos : line.find('\t', sizeEnd + 1));
+      int found = -1;
+      string fileName(modTimeEnd != string::npos ? line.substr(modTimeEnd + 1) : "");
+      if (modTimeEnd != string::npos) {
+	long long fileSize = atoll(line.substr(5, sizeEnd - 5).c_str());
+	long long fileModTime = atoll(line.substr(sizeEnd + 1, modTimeEnd - sizeEnd - 1).c_str());
+	for (int f = 0; f < (int)(m_impFileNames.size()); f++) {
+	  struct stat fileStat;
+	  if (m_impFileNames[f] == fileName && m_pepIndices[f] && stat(fileName.c_str(), &fileStat) == 0 &&
+	      (long long)(fileStat.st_size) == fileSize && (long long)(fileStat.st_mtime) == fileModTime) {
+	    found = f;
+	    break;
+	  }
+	}
+      }
+      if (found < 0) {
+	g_log->log("CREATE", "Incremental update: imported file \"" + fileName + "\" changed or not imported again. Its peptide ions will be recomputed.");
+      }
+      fileMap.push_back(found);
+      continue;
+    }
+    
+    // a peptide ion: peptide, subkey, then the replicates as <file>:<offset>, translated to the files imported now
+    string::size_type peptideEnd = line.find('\t');
+    string::size_type subkeyEnd = (peptideEnd == string::npos ? string::npos : line.find('\t', peptideEnd + 1));
+    if (subkeyEnd == string::npos) continue;
+    
+    stringstream signature;
+    bool valid = true;
+    string::size_type tokenEnd = subkeyEnd + 1;
+    string token;
+    while (valid && !((token = nextToken(line, tokenEnd, tokenEnd, " \t\r\n")).empty())) {
+      string::size_type colonPos = token.find(':');
+      int oldFile = atoi(token.substr(0, colonPos).c_str());
+      if (colonPos == string::npos || oldFile < 0 || oldFile >= (int)(fileMap.size()) || fileMap[oldFile] < 0) {
+	valid = false;
+      } else {
+	signature << ' ' << fileMap[oldFile] << token.substr(colonPos);
+      }
+    }
+    
+    if (valid) {
+      m_updateSignatures[line.substr(0, subkeyEnd)] = signature.str();
+    }
+  }
+  
+  return (true);
+}
+
+// constructReplicateIndexOptions - the "### OPTION" lines of the .repidx header: all the options the entries depend on
+// (see SpectraSTCreateParams::printEntryContentParams), and the size and modification time of the probability table
+// and protein list, whose contents they also depend on.
+string SpectraSTSpLibImporter::constructReplicateIndexOptions() {
+  
+  stringstream params;
+  m_params.printEntryContentParams(params);
+  
+  string files[2] = { m_params.useProbTable, m_params.useProteinList };
+  for (int f = 0; f < 2; f++) {
+    struct stat fileStat;
+    if (!(files[f].empty()) && stat(files[f].c_str(), &fileStat) == 0) {
+      params << "file " << files[f] << " = " << (long long)(fileStat.st_size) << '\t' << (long long)(fileStat.st_mtime) << '\n';
+    }
+  }
+  
+  stringstream ss;
+  string line;
+  while (getline(params, line)) {
+    ss << "### OPTION " << line << '\n';
+  }
+  return (ss.str());
+}
+
+// constructReplicateSignature - lists the replicates of a peptide ion in all imported files, in the order
+// they are retrieved, as <file>:<offset>. Two builds from the same signature give the same library entry.
+string SpectraSTSpLibImporter::constructReplicateSignature(string& peptide, string& subkey) {
+  
+  stringstream ss;
+  for (int i = 0; i < (int)(m_pepIndices.size()); i++) {
+    if (m_pepIndices[i]) {
+      vector<fstream::off_type> offsets;
+      m_pepIndices[i]->retrieveOffsets(offsets, peptide, subkey);
+      for (vector<fstream::off_type>::iterator o = offsets.begin(); o != offsets.end(); o++) {
+	ss << ' ' << i << ':' << (*o);
+      }
+    }
+  }
+  return (ss.str());
+}
+
+// copyUnchangedEntry - copies the entry of a peptide ion from the library being updated (if it has one). If
+// verification is asked for (-c_INV), also rebuilds it from the replicates as usual, and uses the rebuilt entry
+// instead, logging it if it differs from the copied one.
+void SpectraSTSpLibImporter::copyUnchangedEntry(string& peptide, string& subkey) {
+  
+  m_numCopied++;
+  
+  vector<SpectraSTLibEntry*> copied;
+  m_updatePepIndex->retrieve(copied, peptide, subkey);
+  SpectraSTLibEntry* entry = (copied.empty() ? NULL : copied[0]);
+  
+  if (!(m_params.verifyUpdate)) {
+    if (entry) {
+      m_lib->insertEntry(entry);
+    }
+    
+  } else {
+    
+    vector<SpectraSTLibEntry*> entries;
+    for (vector<SpectraSTPeptideLibIndex*>::iterator i = m_pepIndices.begin(); i != m_pepIndices.end(); i++) {
+      if (*i) {
+	(*i)->retrieve(entries, peptide, subkey);
+      }
+    }
+    
+    SpectraSTReplicates* replicates = new SpectraSTReplicates(entries, m_params);
+    replicates->setPlotPath(m_plotPath);
+    replicates->setPlotter(m_plotter);
+    
+    SpectraSTLibEntry* rebuilt = NULL;
+    if (m_params.buildAction == "CONSENSUS") {
+      rebuilt = replicates->makeConsensusSpectrum();
+    } else {
+      rebuilt = replicates->findBestReplicate();
+    }
+    if (rebuilt && !passAllFilters(rebuilt)) {
+      rebuilt = NULL;
+    }
+    
+    bool same = (!entry && !rebuilt);
+    if (rebuilt) {
+      processEntry(rebuilt);
+      if (entry) {
+	// compare them as they would be written to the binary library
+	rebuilt->setLibId(entry->getLibId());
+	stringstream copiedss;
+	stringstream rebuiltss;
+	entry->writeToBinaryFile(copiedss, m_params.compressPeaks);
+	rebuilt->writeToBinaryFile(rebuiltss, m_params.compressPeaks);
+	same = (copiedss.str() == rebuiltss.str());
+      }
+      m_lib->insertEntry(rebuilt);
+    }
+    
+    if (!same) {
+      m_numDiffered++;
+      g_log->log("CREATE", "Incremental update: peptide ion " + peptide + "/" + subkey + " in \"" + m_params.updateLibrary + "\" differs from a full rebuild. Recomputed.");
+    }
+    
+    delete (replicates);
+    for (vector<SpectraSTLibEntry*>::iterator den = entries.begin(); den != entries.end(); den++) {
+      delete (*den);
+    }
+  }
+  
+  for (vector<SpectraSTLibEntry*>::iterator c = copied.begin(); c != copied.end(); c++) {
+    delete (*c);
+  }
+  
+}
+
+// the jobs of one batch of SUBTRACT_HOMOLOGS, and the windows of the other libraries to look for their homologs in
+typedef struct _homologbatch {
+  vector<HomologJob>* jobs;
+  vector<HomologWindow>* windows;
+} HomologBatch;
+
+// findHomologs - looks for the first homolog of each job of one share of a HomologBatch (jobs first, first + step,
+// first + 2 * step, ...) in the windows, in the same order as the other libraries would be searched by retrieving 
+// entries within 4.5 Th. Reads the windows and writes only the jobs' own results.
+static void findHomologs(void* context, unsigned int first, unsigned int step) {
+
+  HomologBatch* a = (HomologBatch*)context;
+  for (unsigned int k = first; k < (unsigned int)(a->jobs->size()); k += step) {
+    HomologJob& job = (*(a->jobs))[k];
+    Peptide* pep = job.query.pep;
+    double mz = job.query.precursorMz;
+    job.homolog = NULL;
+    job.identity = 0;
+
+    for (vector<HomologWindow>::iterator w = a->windows->begin(); w != a->windows->end() && !(job.homolog); w++) {
+
+      if (!(w->mzIndex)) continue;
+
+      unsigned int low = w->mzIndex->calcBinNumber(mz - 4.5);
+      unsigned int high = w->mzIndex->calcBinNumber(mz + 4.5);
+
+      for (unsigned int b = low; b <= high && !(job.homolog); b++) {
+        if (b < w->firstBin || b - w->firstBin >= (unsigned int)(w->bins.size())) continue;
+
+        vector<HomologCandidate>& bin = w->bins[b - w->firstBin];
+        for (vector<HomologCandidate>::iterator en = bin.begin(); en != bin.end(); en++) {
+          int identity = 0;
+          if (*pep == *(en->pep) || (job.query.charge == en->charge && pep->isHomolog(*(en->pep), 0.7, identity))) {
+            job.homolog = &(*en);
+            job.identity = identity;
+            break;
+          }
+        }
+      }
+    }
+  }
+}
+
 // doSubtractHomologs - performs the special join action SUBTRACT_HOMOLOGS
 // this will include only those entries in the first .splib files that don't have a homolog in any of the other .splib files
+// All libraries are swept together in m/z order. Of the other libraries, only the peptide ions (no peaks) of the bins 
+// near the current m/z are held in memory; entries of the first library are read in full only if they are to be written.
 void SpectraSTSpLibImporter::doSubtractHomologs() {
   
   openSplibs(true, 13.0, false, false, true);
 
   m_lib->writePreamble(m_preamble);
   
-  string peptide;
-  string mods;
-  
   ProgressCount pc(!g_quiet && !g_verbose, 500, 0);
   pc.start("Importing peptide ions");
 
   SpectraSTMzLibIndex* mzIndex = m_mzIndices[0];
   if (!mzIndex) return;
 
-  // loop through each entries in the m/z index of the first .splib file
-  SpectraSTLibEntry* entry = NULL;
-  while (entry = mzIndex->nextEntry()) {
-  
-    Peptide* pep = entry->getPeptidePtr();
-    
-    if (!pep) continue;
+  vector<HomologWindow> windows(m_mzIndices.size() - 1);
+  for (unsigned int i = 1; i < (unsigned int)(m_mzIndices.size()); i++) {
+    windows[i - 1].mzIndex = m_mzIndices[i];
+    windows[i - 1].firstBin = 0;
+  }
+  
+  // go through the bins of the m/z index of the first .splib file, a batch of peptide ions at a time
+  vector<HomologJob> jobs;
+  unsigned int numBins = mzIndex->getNumBins();
+  for (unsigned int b = 0; b < numBins; b++) {
+    
+    vector<SpectraSTLibEntry*> headers;
+    mzIndex->retrieveBinHeaders(b, headers);
+    
+    for (vector<SpectraSTLibEntry*>::iterator en = headers.begin(); en != headers.end(); en++) {
+      Peptide* pep = (*en)->getPeptidePtr();
+      if (pep) {
+        HomologJob job;
+        job.query.pep = new Peptide(*pep);
+        job.query.precursorMz = (*en)->getPrecursorMz();
+        job.query.charge = (*en)->getCharge();
+        job.query.offset = (*en)->getLibFileOffset();
+        job.homolog = NULL;
+        job.identity = 0;
+        jobs.push_back(job);
+      }
+      delete (*en);
+    }
     
-    double mz = entry->getPrecursorMz();
-    int charge = entry->getCharge();
-    bool include = true;
-	
-    for (vector<SpectraSTMzLibIndex*>::iterator i = m_mzIndices.begin() + 1; i != m_mzIndices.end(); i++) {
+    if (jobs.size() >= 1000 || (b == numBins - 1 && !(jobs.empty()))) {
+      subtractHomologsInBatch(jobs, windows, pc);
+    }
+  }
 
-      if (!(*i)) continue;
+  for (vector<HomologWindow>::iterator w = windows.begin(); w != windows.end(); w++) {
+    slideHomologWindow(*w, numBins, numBins);
+  }
+  
+  pc.done();
+  
+}
 
-      vector<SpectraSTLibEntry*> isobaricEntries;
-      
-      // retrieve all entries within 4.5 Th of this peptide ion from all the other .splib files
-      (*i)->retrieve(isobaricEntries, mz - 4.5, mz + 4.5);
-      
-      for (vector<SpectraSTLibEntry*>::iterator en = isobaricEntries.begin(); en != isobaricEntries.end(); en++) {
-      
-        int identity = 0;
-        Peptide* thisPep = (*en)->getPeptidePtr();
-        if (!thisPep) {
-          continue; 
-        }
+// subtractHomologsInBatch - loads the bins of the other libraries the batch of jobs needs, finds homologs using 
+// numThreads threads, then writes the entries without homologs in job order. Empties jobs.
+void SpectraSTSpLibImporter::subtractHomologsInBatch(vector<HomologJob>& jobs, vector<HomologWindow>& windows, ProgressCount& pc) {
 
-        if (*pep == *thisPep || (charge == (*en)->getCharge() && pep->isHomolog(*thisPep, 0.7, identity))) {
-          stringstream logss;
-          logss << pep->interactStyleWithCharge() << " (m/z = " << mz << ") is homologous (" << identity << ") to ";
-          logss << thisPep->interactStyleWithCharge() << " (m/z = " << (*en)->getPrecursorMz() << "). Removed.";
-          g_log->log("CREATE", logss.str());
-          include = false;
-          break;
-        } 
-      }
-      	
-      if (!include) {
-        break;
-      }
-    }
+  SpectraSTMzLibIndex* mzIndex = m_mzIndices[0];
+  
+  // the bins searched for any of the jobs. Since the batches come in m/z order, the bins below are no longer needed.
+  unsigned int lowBin = mzIndex->getNumBins();
+  unsigned int highBin = 0;
+  for (vector<HomologJob>::iterator job = jobs.begin(); job != jobs.end(); job++) {
+    unsigned int low = mzIndex->calcBinNumber(job->query.precursorMz - 4.5);
+    unsigned int high = mzIndex->calcBinNumber(job->query.precursorMz + 4.5);
+    if (low < lowBin) lowBin = low;
+    if (high > highBin) highBin = high;
+  }
+  for (vector<HomologWindow>::iterator w = windows.begin(); w != windows.end(); w++) {
+    slideHomologWindow(*w, lowBin, highBin);
+  }
+  
+  HomologBatch batch;
+  batch.jobs = &jobs;
+  batch.windows = &windows;
+  runInShares(findHomologs, &batch, (unsigned int)(jobs.size()), m_params.numThreads);
+
+  for (vector<HomologJob>::iterator job = jobs.begin(); job != jobs.end(); job++) {
+    
+    Peptide* pep = job->query.pep;
     
-    if (include) {
+    if (job->homolog) {
+      stringstream logss;
+      logss << pep->interactStyleWithCharge() << " (m/z = " << job->query.precursorMz << ") is homologous (" << job->identity << ") to ";
+      logss << job->homolog->pep->interactStyleWithCharge() << " (m/z = " << job->homolog->precursorMz << "). Removed.";
+      g_log->log("CREATE", logss.str());
+    
+    } else {
     
       m_count++;
       pc.increment();
@@ -440,20 +856,59 @@ void SpectraSTSpLibImporter::doSubtractHomologs() {
         cout << "Importing peptide ion: " << pep->interactStyleWithCharge() << endl;
       }
       
+      SpectraSTLibEntry* entry = mzIndex->readEntry(job->query.offset);
       if (passAllFilters(entry)) {
 	processEntry(entry);
         m_lib->insertEntry(entry);
       }
-      
+      delete (entry);
     } 
     
-    delete (entry);
+    delete (pep);
   }
-
-  pc.done();
-  
   
+  jobs.clear();
+}
+
+// slideHomologWindow - makes the window hold the peptide ions of bins lowBin to highBin (as far as there are bins), 
+// freeing the bins below lowBin. Bins are only ever added above the window, so lowBin must not decrease from call to call.
+void SpectraSTSpLibImporter::slideHomologWindow(HomologWindow& window, unsigned int lowBin, unsigned int highBin) {
+
+  if (!(window.mzIndex)) return;
   
+  while (!(window.bins.empty()) && window.firstBin < lowBin) {
+    for (vector<HomologCandidate>::iterator en = window.bins.front().begin(); en != window.bins.front().end(); en++) {
+      delete (en->pep);
+    }
+    window.bins.pop_front();
+    window.firstBin++;
+  }
+  if (window.bins.empty() && window.firstBin < lowBin) {
+    window.firstBin = lowBin;
+  }
+  
+  unsigned int numBins = window.mzIndex->getNumBins();
+  while (window.firstBin + (unsigned int)(window.bins.size()) <= highBin && 
+         window.firstBin + (unsigned int)(window.bins.size()) < numBins) {
+    
+    vector<SpectraSTLibEntry*> headers;
+    window.mzIndex->retrieveBinHeaders(window.firstBin + (unsigned int)(window.bins.size()), headers);
+    
+    window.bins.push_back(vector<HomologCandidate>());
+    vector<HomologCandidate>& bin = window.bins.back();
+    for (vector<SpectraSTLibEntry*>::iterator en = headers.begin(); en != headers.end(); en++) {
+      Peptide* pep = (*en)->getPeptidePtr();
+      if (pep) {
+        HomologCandidate candidate;
+        candidate.pep = new Peptide(*pep);
+        candidate.precursorMz = (*en)->getPrecursorMz();
+        candidate.charge = (*en)->getCharge();
+        candidate.offset = (*en)->getLibFileOffset();
+        bin.push_back(candidate);
+      }
+      delete (*en);
+    }
+  }
 }
 
 // doBuildAction - performs the build actions BEST_REPLICATE and CONSENSUS
@@ -463,6 +918,7 @@ void SpectraSTSpLibImporter::doBuildAction(vector<SpectraSTLibEntry*>& entries)
 	  
     SpectraSTReplicates* replicates = new SpectraSTReplicates(entries, m_params);
     replicates->setPlotPath(m_plotPath);
+    replicates->setPlotter(m_plotter);
     
     // pick the best replicate and only insert that one into the library
     SpectraSTLibEntry* best = replicates->findBestReplicate();
@@ -475,6 +931,7 @@ void SpectraSTSpLibImporter::doBuildAction(vector<SpectraSTLibEntry*>& entries)
   } else if (m_params.buildAction == "CONSENSUS") {
     SpectraSTReplicates* replicates = new SpectraSTReplicates(entries, m_params, m_denoiser);
     replicates->setPlotPath(m_plotPath);
+    replicates->setPlotter(m_plotter);
     // make a consensus spectrum of replicates and insert that into the library
     SpectraSTLibEntry* consensus = replicates->makeConsensusSpectrum(); 
     
@@ -558,6 +1015,9 @@ void SpectraSTSpLibImporter::doQualityFilter() {
 
   SpectraSTLibEntry* entry = NULL;
 
+  // skip the m/z bins that cannot pass the filter criteria
+  mzIndex->setPrecursorMzFilter(m_filter);
+
   // loop through the library by precursor m/z. entry will get NULL if the end is reached.
   while (entry = mzIndex->nextEntry()) {
 
@@ -575,6 +1035,9 @@ void SpectraSTSpLibImporter::doQualityFilter() {
 
   pc.done();
 
+  m_filterSkipCount += mzIndex->getFilterSkipCount();
+  logFilterSkipCount("entries");
+
   // if we actually go through all 5 levels, and don't remove any, then we have some good statistics
   // output them to the log file for the user to examine
   if (m_params.qualityLevelMark >= 5 && m_params.qualityLevelRemove == 0) {
@@ -1108,7 +1571,7 @@ void SpectraSTSpLibImporter::plot(SpectraSTLibEntry* entry) {
   stringstream fnss;
     
   fnss << m_plotPath << entry->getSafeName();
-  entry->getPeakList()->plot(fnss.str(), entry->getStatus());
+  entry->getPeakList()->plot(fnss.str(), entry->getStatus(), m_plotter);
     
 	
 }
@@ -1154,7 +1617,16 @@ void SpectraSTSpLibImporter::doGenerateDecoy() {
   ProgressCount pc(!g_quiet, 1, count);
   pc.start("Generating decoy spectra");
 
-  srand(time(NULL));
+  // every peptide gets its own random sequence derived from the seed, so the shuffles are the same
+  // given the same seed (and do not depend on how the work is divided among threads)
+  unsigned int seed = m_params.decoyRandomSeed;
+  if (seed == 0) {
+    seed = (unsigned int)(time(NULL));
+  }
+
+  // the entries are finished (annotated, with peaks repositioned) in parallel a batch at a time,
+  // then written in library order
+  vector<DecoyJob> jobs;
 
   // keep track of all sequences in library so that we won't shuffle to one that collides with a sequence already present
   map<int, set<string> > allSequences; // length (NAA) -> set of all peptide sequences of that length
@@ -1175,11 +1647,17 @@ void SpectraSTSpLibImporter::doGenerateDecoy() {
     }
     
     Peptide p(origPeptide, 2, ""); // the stripped peptide
+    unsigned int pepSeed = mySeed(seed, origPeptide);
 
     vector<SpectraSTLibEntry*> entries(subkeys.size(), NULL);
 
     for (unsigned int sk = 0; sk < (unsigned int)(subkeys.size()); sk++) {
 
+      if (!mayPassFilterCriteria(origPeptide, subkeys[sk])) {
+        // cannot pass filter, no need to read it
+        continue;
+      }
+
       vector<SpectraSTLibEntry*> entryHolder;
       pepIndex->retrieve(entryHolder, origPeptide, subkeys[sk]);
 
@@ -1200,7 +1678,12 @@ void SpectraSTSpLibImporter::doGenerateDecoy() {
       processEntry(entries[sk]);
 
       if (m_params.decoyConcatenate) {
-        m_lib->insertEntry(entries[sk]);
+        // the job takes over the entry; it is written (and deleted) after its decoys are made
+        DecoyJob job;
+        job.entry = entries[sk];
+        job.decoyPep = NULL;
+        job.fold = 0;
+        jobs.push_back(job);
       }
 
       // this marks all amino acid that has been observed modified in this stripped peptide
@@ -1217,7 +1700,7 @@ void SpectraSTSpLibImporter::doGenerateDecoy() {
 
     for (int fold = 0; fold < m_params.decoySizeRatio; fold++) {
 
-      Peptide* decoyp = p.shufflePeptideSequence(allSequences);
+      Peptide* decoyp = p.shufflePeptideSequence(allSequences, &pepSeed);
       //  string decoyPeptide = p.reverse();
 
       allSequences[decoyp->NAA()].insert(decoyp->stripped);
@@ -1250,37 +1733,41 @@ void SpectraSTSpLibImporter::doGenerateDecoy() {
         decoyPep->prevAA = origPep->prevAA;
         decoyPep->nextAA = origPep->nextAA;
 
-        SpectraSTLibEntry* decoyEntry = new SpectraSTLibEntry(*(entries[sk]));
-        decoyEntry->makeDecoy(decoyPep, (unsigned int)fold);
-
         stringstream dss;
         dss << "Shuffle " << origPep->interactStyleWithCharge() << " to ";
         dss << decoyPep->interactStyleWithCharge() << " .";
         if (origPep->NAA() != decoyPep->NAA()) {
           dss << " Two AAs added randomly.";
         }
-        g_log->log("DECOY", dss.str());
-
-        if (m_params.plotSpectra == "ALL" || m_params.plotSpectra == "Normal" || m_params.plotSpectra == "Decoy") {
-          plot(decoyEntry);
-        }
-
-        m_lib->insertEntry(decoyEntry);
-        delete (decoyEntry);
-
-        if (fold >= m_params.decoySizeRatio - 1) {
-          delete (entries[sk]);
-        }
 
+        DecoyJob job;
+        job.entry = new SpectraSTLibEntry(*(entries[sk]));
+        job.decoyPep = decoyPep;
+        job.fold = (unsigned int)fold;
+        job.logMsg = dss.str();
+        jobs.push_back(job);
       }
 
       delete (decoyp);
     }
 
+    if (!m_params.decoyConcatenate) {
+      for (unsigned int sk = 0; sk < (unsigned int)(subkeys.size()); sk++) {
+        if (entries[sk]) delete (entries[sk]);
+      }
+    }
+
+    if (jobs.size() >= 1000) {
+      makeAndWriteDecoys(jobs);
+    }
   }
 
+  makeAndWriteDecoys(jobs);
+
   pc.done();
 
+  logFilterSkipCount("peptide ions");
+
 
 
   /*
@@ -1365,6 +1852,43 @@ void SpectraSTSpLibImporter::doGenerateDecoy() {
   
 }
 
+
+// makeDecoys - makes the decoy entries of one share of the jobs (a vector<DecoyJob>): jobs first, first + step, 
+// first + 2 * step, ... Touches nothing but the jobs' own entries.
+static void makeDecoys(void* context, unsigned int first, unsigned int step) {
+
+  vector<DecoyJob>* jobs = (vector<DecoyJob>*)context;
+  for (unsigned int k = first; k < (unsigned int)(jobs->size()); k += step) {
+    DecoyJob& job = (*jobs)[k];
+    if (job.decoyPep) {
+      job.entry->makeDecoy(job.decoyPep, job.fold);
+    }
+  }
+}
+
+// makeAndWriteDecoys - makes the decoy entries of the jobs (using numThreads threads), then writes all
+// entries in job order. The library is the same regardless of the number of threads. Empties jobs.
+void SpectraSTSpLibImporter::makeAndWriteDecoys(vector<DecoyJob>& jobs) {
+
+  runInShares(makeDecoys, &jobs, (unsigned int)(jobs.size()), m_params.numThreads);
+
+  for (vector<DecoyJob>::iterator job = jobs.begin(); job != jobs.end(); job++) {
+
+    if (job->decoyPep) {
+      g_log->log("DECOY", job->logMsg);
+
+      if (m_params.plotSpectra == "ALL" || m_params.plotSpectra == "Normal" || m_params.plotSpectra == "Decoy") {
+        plot(job->entry);
+      }
+    }
+
+    m_lib->insertEntry(job->entry);
+    delete (job->entry);
+  }
+
+  jobs.clear();
+}
+
 // doSortByNreps - performs the build action SORT_BY_NREPS. Uses the mzIndex object to sort entries by Nreps and spit
 // them up in descending order of Nreps.
 void SpectraSTSpLibImporter::doSortByNreps() {
@@ -1987,11 +2511,8 @@ void SpectraSTSpLibImporter::doSimilarityClustering() {
     if (cluster->size() == 1) {
       // singleton, just copy this entry and be done with it
             
-      string xreaStr("");
-      double xrea = 0.0;
-      if (entry->getOneComment("Xrea", xreaStr)) {
-	xrea = atof(xreaStr.c_str());
-      } else {
+      double xrea = entry->getXrea(-1.0);
+      if (xrea < 0.0) {
 	xrea = entry->getPeakList()->calcXrea(true);
 	stringstream xreass;
 	xreass.precision(3);
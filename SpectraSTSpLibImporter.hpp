@@ -3,8 +3,11 @@
 
 #include "SpectraSTLibImporter.hpp"
 #include "SpectraSTDenoiser.hpp"
+#include "SpectraSTSpectrumPlotter.hpp"
+#include "ProgressCount.hpp"
 #include <map>
 #include <set>
+#include <deque>
 
 /*
 
@@ -48,6 +51,8 @@ hlam@systemsbiology.org
  * - Union (based on peptide) multiple libraries
  * - Intersect (based on peptide) multiple libraries
  * - Subtract one library from another (based on peptide)
+ * - Incrementally update a consensus or best-replicate library with new files, copying the peptide ions whose
+ *   replicates are unchanged (as recorded in its .repidx file)
  * 
  * Some others -- still under MAJOR CONSTRUCTION!
  * 
@@ -64,6 +69,37 @@ typedef struct _qfstats {
   unsigned int Q1Q2Q3Q4Q5;
 } QFStats;
 
+// one library entry of decoy generation, waiting to be finished and written out in library order
+typedef struct _decoyjob {
+  SpectraSTLibEntry* entry; // the real entry to concatenate, or the copy of it to be made into a decoy
+  Peptide* decoyPep; // the shuffled peptide ion, NULL for a real entry. Becomes property of entry in makeDecoy()
+  unsigned int fold;
+  string logMsg;
+} DecoyJob;
+
+// a peptide ion of a library swept for SUBTRACT_HOMOLOGS: only what the homology check needs, no peaks
+typedef struct _homologcandidate {
+  Peptide* pep;
+  double precursorMz;
+  int charge;
+  fstream::off_type offset;
+} HomologCandidate;
+
+// the bins of the m/z index of one of the other libraries held in memory during SUBTRACT_HOMOLOGS: 
+// bins[k] holds the peptide ions of bin firstBin + k
+typedef struct _homologwindow {
+  SpectraSTMzLibIndex* mzIndex;
+  unsigned int firstBin;
+  deque<vector<HomologCandidate> > bins;
+} HomologWindow;
+
+// a peptide ion of the first library to be checked for homologs, and the first homolog found (NULL if none)
+typedef struct _homologjob {
+  HomologCandidate query;
+  HomologCandidate* homolog;
+  int identity;
+} HomologJob;
+
 
 class SpectraSTSpLibImporter : public SpectraSTLibImporter { 
 
@@ -104,16 +140,31 @@ private:
   SpectraSTSearchParams* m_QFSearchParams;
   
   string m_plotPath;
+  SpectraSTSpectrumPlotter* m_plotter;
   unsigned int m_count;
   
   SpectraSTDenoiser* m_denoiser;
   vector<pair<string, string> > m_singletonPeptideIons;
 
+  // the replicate index written alongside the generated library: the replicates of each peptide ion (.repidx)
+  ofstream* m_repIdxFout;
+
+  // for incremental update (-c_INC): the existing library, and the replicates its peptide ions were built from,
+  // keyed by peptide and subkey. These are properties of this class
+  ifstream* m_updateFin;
+  SpectraSTPeptideLibIndex* m_updatePepIndex;
+  map<string, string> m_updateSignatures;
+  unsigned int m_numCopied;
+  unsigned int m_numRecomputed;
+  unsigned int m_numDiffered;
+
   // method to parse preambles of the imported .splib files
   void parsePreamble(ifstream& splibFin, bool binary);
 
   // join methods  
   void doSubtractHomologs();
+  void subtractHomologsInBatch(vector<HomologJob>& jobs, vector<HomologWindow>& windows, ProgressCount& pc);
+  void slideHomologWindow(HomologWindow& window, unsigned int lowBin, unsigned int highBin);
   
   // uniquify methods
   void doBuildAction(vector<SpectraSTLibEntry*>& entries);
@@ -138,6 +189,7 @@ private:
   
   // decoy generation methods
   void doGenerateDecoy();
+  void makeAndWriteDecoys(vector<DecoyJob>& jobs);
     
   // sort by number of replicates
   void doSortByNreps();
@@ -156,6 +208,14 @@ private:
   void refresh();
   
   void reloadAndProcessSingletons();
+
+  // incremental update
+  bool canRecordReplicates();
+  void openReplicateIndex();
+  bool openUpdateLibrary();
+  string constructReplicateSignature(string& peptide, string& subkey);
+  string constructReplicateIndexOptions();
+  void copyUnchangedEntry(string& peptide, string& subkey);
   
    bool hackDeamidation(SpectraSTLibEntry* entry);
 
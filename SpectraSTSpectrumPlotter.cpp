@@ -0,0 +1,321 @@
+#include "SpectraSTSpectrumPlotter.hpp"
+#include "SpectraSTLog.hpp"
+#include "FileUtils.hpp"
+
+#include <sstream>
+#include <string.h>
+#include <time.h>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTSpectrumPlotter
+ *
+ * Renders spectrum plots as SVG files, in batches and in parallel. See SpectraSTSpectrumPlotter.hpp.
+ *
+ */
+
+extern SpectraSTLog* g_log;
+
+// the layout of a plot, in pixels: the size of the picture and the corners of the plotting area
+static const double PLOT_WIDTH = 640.0;
+static const double PLOT_HEIGHT = 480.0;
+static const double PLOT_LEFT = 40.0;
+static const double PLOT_RIGHT = 620.0;
+static const double PLOT_TOP = 30.0;
+static const double PLOT_BOTTOM = 440.0;
+
+// the y axis goes up to 1.1 times the tallest peak, leaving room for the labels
+static const double PLOT_MAX_Y = 1.1;
+
+// constructor - if archiveFileName is not empty, the plots are packed into a tar archive of that name
+SpectraSTSpectrumPlotter::SpectraSTSpectrumPlotter(unsigned int numThreads, string archiveFileName, unsigned int batchSize) :
+  m_numThreads(numThreads < 1 ? 1 : numThreads),
+  m_batchSize(batchSize < 1 ? 1 : batchSize),
+  m_pending(),
+  m_numPlotted(0),
+  m_archiveFileName(archiveFileName),
+  m_archive(),
+  m_archiveOpen(false) {
+
+  if (!m_archiveFileName.empty()) {
+    if (myFileOpen(m_archive, m_archiveFileName, true)) {
+      m_archiveOpen = true;
+    } else {
+      g_log->error("CREATE", "Cannot open file \"" + m_archiveFileName + "\" for writing spectrum plots. Plotting skipped.");
+    }
+  }
+}
+
+// destructor - renders the plots not yet rendered, and finishes the archive
+SpectraSTSpectrumPlotter::~SpectraSTSpectrumPlotter() {
+
+  flush();
+
+  if (m_archiveOpen) {
+    // a tar archive ends with two empty blocks
+    char block[1024];
+    memset(block, 0, 1024);
+    m_archive.write(block, 1024);
+    m_archive.close();
+  }
+}
+
+// add - adds a plot to be rendered. Takes ownership of plot.
+void SpectraSTSpectrumPlotter::add(SpectrumPlot* plot) {
+
+  m_pending.push_back(plot);
+  if ((unsigned int)(m_pending.size()) >= m_batchSize) {
+    flush();
+  }
+}
+
+// the plots of one batch, and whether to write them to their own files
+typedef struct _plotbatch {
+  vector<SpectrumPlot*>* plots;
+  bool toFiles;
+} PlotBatch;
+
+// renderPlots - renders one share of the plots of a PlotBatch (and writes them to their own files if asked to):
+// plots first, first + step, first + 2 * step, ... Touches nothing but the plots.
+static void renderPlots(void* context, unsigned int first, unsigned int step) {
+
+  PlotBatch* b = (PlotBatch*)context;
+  for (unsigned int k = first; k < (unsigned int)(b->plots->size()); k += step) {
+    SpectrumPlot& plot = *((*(b->plots))[k]);
+    SpectraSTSpectrumPlotter::render(plot);
+    if (b->toFiles) {
+      SpectraSTSpectrumPlotter::writeFile(plot);
+    }
+  }
+}
+
+// flush - renders the plots added so far (using m_numThreads threads), then writes them out in the order they were added
+void SpectraSTSpectrumPlotter::flush() {
+
+  if (m_pending.empty()) {
+    return;
+  }
+
+  if (!m_archiveFileName.empty() && !m_archiveOpen) {
+    // could not open the archive; nowhere to write
+    for (vector<SpectrumPlot*>::iterator p = m_pending.begin(); p != m_pending.end(); p++) {
+      delete (*p);
+    }
+    m_pending.clear();
+    return;
+  }
+
+  PlotBatch batch;
+  batch.plots = &m_pending;
+  batch.toFiles = !m_archiveOpen;
+  runInShares(renderPlots, &batch, (unsigned int)(m_pending.size()), m_numThreads);
+
+  for (vector<SpectrumPlot*>::iterator p = m_pending.begin(); p != m_pending.end(); p++) {
+    if (m_archiveOpen) {
+      // the members are named after the files, without the directory
+      string::size_type slashPos = (*p)->name.rfind('/');
+      string memberName(slashPos == string::npos ? (*p)->name : (*p)->name.substr(slashPos + 1));
+      writeToArchive(memberName + ".svg", (*p)->rendered);
+      m_numPlotted++;
+    } else if ((*p)->written) {
+      m_numPlotted++;
+    } else {
+      g_log->error("CREATE", "Cannot open file \"" + (*p)->name + ".svg\" for writing spectrum plot. Plotting skipped.");
+    }
+    delete (*p);
+  }
+  m_pending.clear();
+}
+
+// plotNow - renders one plot and writes it to its own file, right away
+void SpectraSTSpectrumPlotter::plotNow(SpectrumPlot& plot) {
+
+  render(plot);
+  if (!writeFile(plot)) {
+    g_log->error("CREATE", "Cannot open file \"" + plot.name + ".svg\" for writing spectrum plot. Plotting skipped.");
+  }
+}
+
+// writeFile - writes a rendered plot to <name>.svg. Returns false if the file cannot be opened.
+bool SpectraSTSpectrumPlotter::writeFile(SpectrumPlot& plot) {
+
+  string svgFileName(plot.name + ".svg");
+  ofstream svgFout;
+  if (!myFileOpen(svgFout, svgFileName)) {
+    plot.written = false;
+    return (false);
+  }
+  svgFout << plot.rendered;
+  svgFout.close();
+  plot.written = true;
+  return (true);
+}
+
+// escapeXml - escapes the characters that cannot appear as is in SVG text
+static string escapeXml(const string& text) {
+
+  string escaped("");
+  for (string::size_type i = 0; i < text.length(); i++) {
+    switch (text[i]) {
+      case '&': escaped += "&amp;"; break;
+      case '<': escaped += "&lt;"; break;
+      case '>': escaped += "&gt;"; break;
+      case '"': escaped += "&quot;"; break;
+      default: escaped += text[i];
+    }
+  }
+  return (escaped);
+}
+
+// render - draws the plot as SVG into plot.rendered: the peaks as impulses (annotated ones in red, the others in blue),
+// the ion labels rotated above the annotated peaks, and the m/z axis. Same layout as the gnuplot plots before.
+void SpectraSTSpectrumPlotter::render(SpectrumPlot& plot) {
+
+  double maxMz = plot.maxMz > 0.0 ? plot.maxMz : 100.0;
+  double xScale = (PLOT_RIGHT - PLOT_LEFT) / maxMz;
+  double yScale = (PLOT_BOTTOM - PLOT_TOP) / PLOT_MAX_Y;
+
+  stringstream svg;
+  svg << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << endl;
+  svg << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << PLOT_WIDTH << "\" height=\"" << PLOT_HEIGHT << "\" ";
+  svg << "viewBox=\"0 0 " << PLOT_WIDTH << ' ' << PLOT_HEIGHT << "\" font-family=\"Helvetica,Arial,sans-serif\">" << endl;
+  svg << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>" << endl;
+
+  svg.setf(ios::fixed);
+  svg.precision(1);
+
+  // the peaks: unannotated ones first, so that the annotated ones are drawn on top
+  for (int pass = 0; pass < 2; pass++) {
+    bool annotated = (pass == 1);
+    svg << "<g stroke=\"" << (annotated ? "#ff0000" : "#0000ff") << "\" stroke-width=\"1\">" << endl;
+    for (unsigned int k = 0; k < (unsigned int)(plot.mzs.size()); k++) {
+      if (plot.annotated[k] != annotated || plot.mzs[k] < 0.0 || plot.mzs[k] > maxMz) continue;
+      double x = PLOT_LEFT + plot.mzs[k] * xScale;
+      double y = PLOT_BOTTOM - plot.intensities[k] * yScale;
+      svg << "<line x1=\"" << x << "\" y1=\"" << PLOT_BOTTOM << "\" x2=\"" << x << "\" y2=\"" << y << "\"/>" << endl;
+    }
+    svg << "</g>" << endl;
+  }
+
+  // the ion labels
+  svg << "<g font-size=\"6\" fill=\"#ff0000\">" << endl;
+  for (unsigned int k = 0; k < (unsigned int)(plot.ionLabels.size()); k++) {
+    if (plot.ionLabels[k].empty() || plot.mzs[k] < 0.0 || plot.mzs[k] > maxMz) continue;
+    double x = PLOT_LEFT + plot.mzs[k] * xScale;
+    double y = PLOT_BOTTOM - (plot.intensities[k] + 0.02) * yScale;
+    svg << "<text x=\"" << x << "\" y=\"" << y << "\" transform=\"rotate(-90 " << x << ' ' << y << ")\" dominant-baseline=\"middle\">";
+    svg << escapeXml(plot.ionLabels[k]) << "</text>" << endl;
+  }
+  svg << "</g>" << endl;
+
+  // the m/z axis, with a tick every 50, 100, 200, 250, 500, ... such that there are at most 10 of them
+  double tickSteps[] = { 50.0, 100.0, 200.0, 250.0, 500.0, 1000.0, 2000.0, 2500.0, 5000.0 };
+  double tickStep = 10000.0;
+  for (unsigned int s = 0; s < 9; s++) {
+    if (maxMz / tickSteps[s] <= 10.0) {
+      tickStep = tickSteps[s];
+      break;
+    }
+  }
+  svg << "<g stroke=\"black\" stroke-width=\"1\">" << endl;
+  svg << "<line x1=\"" << PLOT_LEFT << "\" y1=\"" << PLOT_BOTTOM << "\" x2=\"" << PLOT_RIGHT << "\" y2=\"" << PLOT_BOTTOM << "\"/>" << endl;
+  for (double tick = 0.0; tick <= maxMz + 0.001; tick += tickStep) {
+    double x = PLOT_LEFT + tick * xScale;
+    svg << "<line x1=\"" << x << "\" y1=\"" << PLOT_BOTTOM << "\" x2=\"" << x << "\" y2=\"" << PLOT_BOTTOM + 5.0 << "\"/>" << endl;
+  }
+  svg << "</g>" << endl;
+  svg << "<g font-size=\"10\" text-anchor=\"middle\">" << endl;
+  for (double tick = 0.0; tick <= maxMz + 0.001; tick += tickStep) {
+    double x = PLOT_LEFT + tick * xScale;
+    svg << "<text x=\"" << x << "\" y=\"" << PLOT_BOTTOM + 18.0 << "\">" << (int)(tick + 0.5) << "</text>" << endl;
+  }
+  svg << "</g>" << endl;
+
+  // the intensity of the tallest peak at the top left, the label at the top right
+  double labelY = PLOT_BOTTOM - 1.04 * yScale;
+  stringstream maxss;
+  maxss.precision(3);
+  maxss << plot.maxIntensity;
+  svg << "<text x=\"" << PLOT_LEFT << "\" y=\"" << labelY << "\" font-size=\"10\">" << maxss.str() << "</text>" << endl;
+  svg << "<text x=\"" << PLOT_RIGHT << "\" y=\"" << labelY << "\" font-size=\"10\" text-anchor=\"end\">" << escapeXml(plot.label) << "</text>" << endl;
+
+  svg << "</svg>" << endl;
+
+  plot.rendered = svg.str();
+}
+
+// writeToArchive - appends a file to the tar archive
+void SpectraSTSpectrumPlotter::writeToArchive(string name, string& content) {
+
+  if (name.length() >= 100) {
+    // too long for the header; precede it by a GNU long name entry
+    writeArchiveHeader("././@LongLink", (unsigned long long)(name.length() + 1), 'L');
+    m_archive.write(name.c_str(), name.length() + 1);
+    unsigned int padding = (512 - (unsigned int)((name.length() + 1) % 512)) % 512;
+    char zeros[512];
+    memset(zeros, 0, 512);
+    m_archive.write(zeros, padding);
+  }
+
+  writeArchiveHeader(name.substr(0, 99), (unsigned long long)(content.length()), '0');
+  m_archive.write(content.data(), content.length());
+  unsigned int padding = (512 - (unsigned int)(content.length() % 512)) % 512;
+  char zeros[512];
+  memset(zeros, 0, 512);
+  m_archive.write(zeros, padding);
+}
+
+// writeArchiveHeader - writes the 512-byte tar header of a member
+void SpectraSTSpectrumPlotter::writeArchiveHeader(string name, unsigned long long size, char type) {
+
+  char header[512];
+  memset(header, 0, 512);
+
+  strncpy(header, name.c_str(), 99);
+  strcpy(header + 100, "0000644"); // mode
+  strcpy(header + 108, "0000000"); // uid
+  strcpy(header + 116, "0000000"); // gid
+  sprintf(header + 124, "%011llo", size);
+  sprintf(header + 136, "%011llo", (unsigned long long)time(NULL));
+  memset(header + 148, ' ', 8); // the checksum counts itself as spaces
+  header[156] = type;
+  memcpy(header + 257, "ustar  ", 8); // GNU magic and version
+
+  unsigned int checksum = 0;
+  for (unsigned int i = 0; i < 512; i++) {
+    checksum += (unsigned char)(header[i]);
+  }
+  sprintf(header + 148, "%06o", checksum);
+  header[155] = ' ';
+
+  m_archive.write(header, 512);
+}
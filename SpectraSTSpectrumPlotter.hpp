@@ -0,0 +1,98 @@
+#ifndef SPECTRASTSPECTRUMPLOTTER_HPP_
+#define SPECTRASTSPECTRUMPLOTTER_HPP_
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTSpectrumPlotter
+ *
+ * Renders spectrum plots as SVG files, without calling out to gnuplot. Plots are added with add() and rendered in
+ * batches, by as many threads as asked for; each batch is written out in the order the plots were added, either as
+ * one .svg file per plot, or as the members of a single (uncompressed) tar archive. The remaining plots are rendered
+ * by flush(), which the destructor also calls.
+ *
+ * Not thread-safe; plots should be added by one thread.
+ *
+ */
+
+using namespace std;
+
+// SpectrumPlot - what is drawn for one spectrum: the peaks, with intensities relative to the tallest one, and their labels
+typedef struct _spectrumPlot {
+  string name; // the file name, without the .svg extension
+  string label; // printed at the top right
+  float maxIntensity; // printed at the top left
+  double maxMz; // end of the m/z axis
+  vector<double> mzs;
+  vector<float> intensities;
+  vector<bool> annotated;
+  vector<string> ionLabels; // printed above the peaks; empty if none
+  string rendered; // the SVG, once rendered
+  bool written;
+} SpectrumPlot;
+
+class SpectraSTSpectrumPlotter {
+
+public:
+  SpectraSTSpectrumPlotter(unsigned int numThreads = 1, string archiveFileName = "", unsigned int batchSize = 1000);
+  ~SpectraSTSpectrumPlotter();
+
+  void add(SpectrumPlot* plot);
+  void flush();
+
+  unsigned int getNumPlotted() { return (m_numPlotted); }
+
+  static void render(SpectrumPlot& plot);
+  static bool writeFile(SpectrumPlot& plot);
+  static void plotNow(SpectrumPlot& plot);
+
+private:
+
+  unsigned int m_numThreads;
+  unsigned int m_batchSize;
+  vector<SpectrumPlot*> m_pending;
+  unsigned int m_numPlotted;
+
+  // the tar archive, if the plots are packed into one
+  string m_archiveFileName;
+  ofstream m_archive;
+  bool m_archiveOpen;
+
+  void writeToArchive(string name, string& content);
+  void writeArchiveHeader(string name, unsigned long long size, char type);
+
+};
+
+#endif /*SPECTRASTSPECTRUMPLOTTER_HPP_*/
@@ -0,0 +1,263 @@
+#include "SpectraSTStageStats.hpp"
+#include "SpectraSTLog.hpp"
+
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTStageStats
+ *
+ * Per-thread stage timers and event counters. See SpectraSTStageStats.hpp.
+ *
+ */
+
+extern SpectraSTLog* g_log;
+
+#ifndef _MSC_VER
+
+// the stats of each live thread are reached through a thread-specific key; the registry lists them all, and
+// the stats of the threads that have exited are folded into g_retiredStageStats
+static pthread_key_t g_stageStatsKey;
+static pthread_once_t g_stageStatsKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_stageStatsMutex = PTHREAD_MUTEX_INITIALIZER;
+static vector<SpectraSTStageStats*> g_liveStageStats;
+static SpectraSTStageStats g_retiredStageStats;
+static unsigned int g_numStageStatsThreads = 0;
+
+// retireStageStats - destructor of the thread-specific key, called when a thread that has recorded stats exits
+static void retireStageStats(void* arg) {
+
+  SpectraSTStageStats* stats = (SpectraSTStageStats*)arg;
+
+  pthread_mutex_lock(&g_stageStatsMutex);
+  g_retiredStageStats.add(*stats);
+  vector<SpectraSTStageStats*>::iterator found = find(g_liveStageStats.begin(), g_liveStageStats.end(), stats);
+  if (found != g_liveStageStats.end()) g_liveStageStats.erase(found);
+  pthread_mutex_unlock(&g_stageStatsMutex);
+
+  delete (stats);
+}
+
+// createStageStatsKey - creates the thread-specific key, once
+static void createStageStatsKey() {
+
+  pthread_key_create(&g_stageStatsKey, retireStageStats);
+}
+
+#else
+
+// no threads are started under Visual Studio; all stats are recorded into one object
+static SpectraSTStageStats g_retiredStageStats;
+
+#endif
+
+// constructor
+SpectraSTStageStats::SpectraSTStageStats() {
+
+  clear();
+}
+
+// destructor
+SpectraSTStageStats::~SpectraSTStageStats() {
+
+}
+
+// clear - zeroes all times and counts
+void SpectraSTStageStats::clear() {
+
+  for (int s = 0; s < NUM_STAGES; s++) {
+    m_times[s] = 0.0;
+    m_calls[s] = 0;
+  }
+  for (int c = 0; c < NUM_COUNTERS; c++) {
+    m_counts[c] = 0;
+  }
+}
+
+// add - adds the times and counts of other to these
+void SpectraSTStageStats::add(const SpectraSTStageStats& other) {
+
+  for (int s = 0; s < NUM_STAGES; s++) {
+    m_times[s] += other.m_times[s];
+    m_calls[s] += other.m_calls[s];
+  }
+  for (int c = 0; c < NUM_COUNTERS; c++) {
+    m_counts[c] += other.m_counts[c];
+  }
+}
+
+// subtract - subtracts the times and counts of other (an earlier snapshot of these) from these
+void SpectraSTStageStats::subtract(const SpectraSTStageStats& other) {
+
+  for (int s = 0; s < NUM_STAGES; s++) {
+    m_times[s] -= other.m_times[s];
+    m_calls[s] -= other.m_calls[s];
+  }
+  for (int c = 0; c < NUM_COUNTERS; c++) {
+    m_counts[c] -= other.m_counts[c];
+  }
+}
+
+// log - writes the times and counts to the log, one line per stage and one for the counters
+void SpectraSTStageStats::log(string label) {
+
+  for (int s = 0; s < NUM_STAGES; s++) {
+    stringstream ss;
+    ss << label << ": " << getStageName(s) << " " << fixed << setprecision(3) << m_times[s] << " s in " << m_calls[s] << " call(s)";
+    g_log->log("STAGE", ss.str());
+  }
+
+  stringstream ss;
+  ss << label << ":";
+  for (int c = 0; c < NUM_COUNTERS; c++) {
+    ss << " " << getCounterName(c) << " = " << m_counts[c] << ";";
+  }
+  g_log->log("STAGE", ss.str());
+}
+
+// writeJSON - writes the times and counts as a JSON object. Lines after the first are prefixed by indent.
+void SpectraSTStageStats::writeJSON(ostream& out, string indent) {
+
+  out << "{" << endl;
+  out << indent << "  \"stages\": {" << endl;
+  for (int s = 0; s < NUM_STAGES; s++) {
+    out << indent << "    \"" << getStageName(s) << "\": { \"seconds\": " << fixed << setprecision(6) << m_times[s];
+    out << ", \"calls\": " << m_calls[s] << " }" << (s < NUM_STAGES - 1 ? "," : "") << endl;
+  }
+  out << indent << "  }," << endl;
+  out << indent << "  \"counters\": {" << endl;
+  for (int c = 0; c < NUM_COUNTERS; c++) {
+    out << indent << "    \"" << getCounterName(c) << "\": " << m_counts[c] << (c < NUM_COUNTERS - 1 ? "," : "") << endl;
+  }
+  out << indent << "  }" << endl;
+  out << indent << "}";
+}
+
+// local - returns the stats of the calling thread, creating them on its first call
+SpectraSTStageStats& SpectraSTStageStats::local() {
+
+#ifndef _MSC_VER
+  pthread_once(&g_stageStatsKeyOnce, createStageStatsKey);
+
+  SpectraSTStageStats* stats = (SpectraSTStageStats*)pthread_getspecific(g_stageStatsKey);
+  if (!stats) {
+    stats = new SpectraSTStageStats();
+    pthread_setspecific(g_stageStatsKey, stats);
+
+    pthread_mutex_lock(&g_stageStatsMutex);
+    g_liveStageStats.push_back(stats);
+    g_numStageStatsThreads++;
+    pthread_mutex_unlock(&g_stageStatsMutex);
+  }
+  return (*stats);
+#else
+  return (g_retiredStageStats);
+#endif
+}
+
+// getTotals - sums the stats of all threads into totals. The live threads other than the caller should be
+// idle (e.g. joined) for the result to be exact.
+void SpectraSTStageStats::getTotals(SpectraSTStageStats& totals) {
+
+#ifndef _MSC_VER
+  pthread_mutex_lock(&g_stageStatsMutex);
+  totals = g_retiredStageStats;
+  for (vector<SpectraSTStageStats*>::iterator s = g_liveStageStats.begin(); s != g_liveStageStats.end(); s++) {
+    totals.add(**s);
+  }
+  pthread_mutex_unlock(&g_stageStatsMutex);
+#else
+  totals = g_retiredStageStats;
+#endif
+}
+
+// getNumThreads - returns the number of threads that have recorded any stats so far
+unsigned int SpectraSTStageStats::getNumThreads() {
+
+#ifndef _MSC_VER
+  pthread_mutex_lock(&g_stageStatsMutex);
+  unsigned int numThreads = g_numStageStatsThreads;
+  pthread_mutex_unlock(&g_stageStatsMutex);
+  return (numThreads);
+#else
+  return (1);
+#endif
+}
+
+// now - returns the current time in seconds
+double SpectraSTStageStats::now() {
+
+#ifndef _MSC_VER
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((double)(tv.tv_sec) + (double)(tv.tv_usec) / 1000000.0);
+#else
+  return ((double)(clock()) / (double)CLOCKS_PER_SEC);
+#endif
+}
+
+// getStageName - returns the name of a stage, as written to the log and the JSON file
+string SpectraSTStageStats::getStageName(int stage) {
+
+  switch (stage) {
+  case STAGE_FILE_OPEN : return ("file_open");
+  case STAGE_SCAN_HEADER : return ("scan_header");
+  case STAGE_PEAK_DECODE : return ("peak_decode");
+  case STAGE_FILTER : return ("filter");
+  case STAGE_LIB_RETRIEVE : return ("lib_retrieve");
+  case STAGE_BINNING : return ("binning");
+  case STAGE_DOT_PRODUCT : return ("dot_product");
+  case STAGE_OUTPUT : return ("output");
+  default : return ("unknown");
+  }
+}
+
+// getCounterName - returns the name of a counter, as written to the log and the JSON file
+string SpectraSTStageStats::getCounterName(int counter) {
+
+  switch (counter) {
+  case COUNTER_QUERIES : return ("queries");
+  case COUNTER_CANDIDATES : return ("candidates");
+  case COUNTER_CACHE_HITS : return ("lib_cache_hits");
+  case COUNTER_CACHE_MISSES : return ("lib_cache_misses");
+  case COUNTER_RESULT_CACHE_HITS : return ("result_cache_hits");
+  default : return ("unknown");
+  }
+}
@@ -0,0 +1,125 @@
+#ifndef SPECTRASTSTAGESTATS_HPP_
+#define SPECTRASTSTAGESTATS_HPP_
+
+#include <string>
+#include <iostream>
+
+// the timed stages of a search run. MUST BE modified together with the names in SpectraSTStageStats::getStageName.
+#define STAGE_FILE_OPEN 0
+#define STAGE_SCAN_HEADER 1
+#define STAGE_PEAK_DECODE 2
+#define STAGE_FILTER 3
+#define STAGE_LIB_RETRIEVE 4
+#define STAGE_BINNING 5
+#define STAGE_DOT_PRODUCT 6
+#define STAGE_OUTPUT 7
+#define NUM_STAGES 8
+
+// the counted events. MUST BE modified together with the names in SpectraSTStageStats::getCounterName.
+#define COUNTER_QUERIES 0
+#define COUNTER_CANDIDATES 1
+#define COUNTER_CACHE_HITS 2
+#define COUNTER_CACHE_MISSES 3
+#define COUNTER_RESULT_CACHE_HITS 4
+#define NUM_COUNTERS 5
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Class: SpectraSTStageStats
+ *
+ * Time spent in, and number of calls to, each stage of a search run, plus a few event counters. Every thread
+ * records into its own object (local()), so that the timers need no locking; getTotals() sums the objects
+ * of all threads, including those that have already exited. A stage is timed by putting a SpectraSTStageTimer
+ * on the stack for the duration of the stage. Stages may nest, in which case the time of the inner
+ * stage is counted in both.
+ *
+ */
+
+using namespace std;
+
+class SpectraSTStageStats {
+
+public:
+  SpectraSTStageStats();
+  ~SpectraSTStageStats();
+
+  void clear();
+  void add(const SpectraSTStageStats& other);
+  void subtract(const SpectraSTStageStats& other);
+
+  void addTime(int stage, double seconds) { m_times[stage] += seconds; m_calls[stage]++; }
+  void addCount(int counter, unsigned long long n) { m_counts[counter] += n; }
+
+  double getTime(int stage) const { return (m_times[stage]); }
+  unsigned long long getNumCalls(int stage) const { return (m_calls[stage]); }
+  unsigned long long getCount(int counter) const { return (m_counts[counter]); }
+
+  void log(string label);
+  void writeJSON(ostream& out, string indent);
+
+  static SpectraSTStageStats& local();
+  static void getTotals(SpectraSTStageStats& totals);
+  static unsigned int getNumThreads();
+
+  static void count(int counter, unsigned long long n = 1) { local().addCount(counter, n); }
+  static double now();
+
+  static string getStageName(int stage);
+  static string getCounterName(int counter);
+
+private:
+
+  double m_times[NUM_STAGES];
+  unsigned long long m_calls[NUM_STAGES];
+  unsigned long long m_counts[NUM_COUNTERS];
+
+};
+
+/* Class: SpectraSTStageTimer
+ *
+ * Times one stage from construction to destruction, into the stats of the calling thread.
+ *
+ */
+
+class SpectraSTStageTimer {
+
+public:
+  SpectraSTStageTimer(int stage) : m_stage(stage), m_startTime(SpectraSTStageStats::now()) { }
+  ~SpectraSTStageTimer() { SpectraSTStageStats::local().addTime(m_stage, SpectraSTStageStats::now() - m_startTime); }
+
+private:
+  int m_stage;
+  double m_startTime;
+
+};
+
+#endif /*SPECTRASTSTAGESTATS_HPP_*/
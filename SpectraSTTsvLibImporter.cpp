@@ -3,9 +3,15 @@
 #include "SpectraSTConstants.hpp"
 #include "FileUtils.hpp"
 #include "ProgressCount.hpp"
+#include "SpectraSTMappedFile.hpp"
 #include "XMLWalker.hpp"
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <string.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
 
 
 /*
@@ -81,6 +87,55 @@ SpectraSTTsvLibImporter::~SpectraSTTsvLibImporter() {
   
 }
 
+// the number of spectra read at a time from a run
+#define TSV_SPECTRUM_BATCH_SIZE 2000
+
+// a batch of jobs: jobs first to last - 1, all of which read their spectra from the same run
+typedef struct _tsvRunSegment {
+  unsigned int first;
+  unsigned int last;
+} TsvRunSegment;
+
+#ifndef _MSC_VER
+
+// the state shared with the thread reading the spectra: how many batches have been read, and how many processed
+typedef struct _tsvSpectrumReader {
+  SpectraSTTsvLibImporter* importer;
+  vector<TsvSpectrumJob>* jobs;
+  vector<TsvRunSegment>* segments;
+  unsigned int maxAhead;
+  unsigned int numRead;
+  unsigned int numProcessed;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} TsvSpectrumReader;
+
+// readSpectraInThread - reads the spectra of the batches one by one, staying at most maxAhead batches ahead of the processing
+static void* readSpectraInThread(void* arg) {
+  
+  TsvSpectrumReader* r = (TsvSpectrumReader*)arg;
+  
+  for (unsigned int s = 0; s < (unsigned int)(r->segments->size()); s++) {
+    
+    pthread_mutex_lock(&(r->mutex));
+    while (s >= r->numProcessed + r->maxAhead) {
+      pthread_cond_wait(&(r->cond), &(r->mutex));
+    }
+    pthread_mutex_unlock(&(r->mutex));
+    
+    r->importer->loadSpectra(*(r->jobs), (*(r->segments))[s].first, (*(r->segments))[s].last);
+    
+    pthread_mutex_lock(&(r->mutex));
+    r->numRead = s + 1;
+    pthread_cond_broadcast(&(r->cond));
+    pthread_mutex_unlock(&(r->mutex));
+  }
+  
+  return (NULL);
+}
+
+#endif
+
 // import - imports all the pepXML files
 void SpectraSTTsvLibImporter::import() {
   
@@ -92,69 +147,110 @@ void SpectraSTTsvLibImporter::import() {
   // by now we have all entries to be imported in memory
   m_lib->writePreamble(m_preamble);
   
-  ProgressCount pc(!g_quiet, 1, (int)(m_queries.size()));
-  pc.start("Importing spectra");	
-  
-  // for efficiency, the entries don't have the spectra yet. Now we load the spectra.	
-  for (map<string, pair<vector<string>, SpectraSTLibEntry*> >::iterator q = m_queries.begin(); q != m_queries.end(); q++) {
+  // for efficiency, the entries don't have the spectra yet. Now we load the spectra. The entries are inserted
+  // in the order of their query names, which keeps the queries of each run together; the spectra are read
+  // in batches from one run, in the order of their scan numbers.
+  vector<TsvSpectrumJob> jobs(m_queries.size());
+  vector<TsvRunSegment> segments;
+  unsigned int k = 0;
+  for (map<string, pair<vector<string>, SpectraSTLibEntry*> >::iterator q = m_queries.begin(); q != m_queries.end(); q++, k++) {
     
-    pc.increment();
+    TsvSpectrumJob& job = jobs[k];
+    job.query = q->first;
+    job.path = (q->second.first.size() > 0 ? q->second.first[0] : "");
+    job.altPath = (q->second.first.size() > 1 ? q->second.first[1] : "");
+    job.entry = q->second.second;
+    job.scanNum = 0;
+    job.loaded = false;
     
-    string query = q->first;
-    string path = (q->second.first.size() > 0 ? q->second.first[0] : "");
-    string altPath = (q->second.first.size() > 1 ? q->second.first[1] : "");
-    SpectraSTLibEntry* entry = q->second.second;
-    SpectraSTPeakList* peakList = entry->getPeakList();
-
-    if (!(loadSpectrum(query, path, entry, altPath))) {
-      // can't load spectrum
-      m_numSkipped++;
-      delete (entry);
-      continue;
+    string::size_type lastDotPos = job.query.rfind('.');   // .<lastScanNum>  (<charge> has been taken off already)
+    string::size_type secondLastDotPos = (lastDotPos == string::npos || lastDotPos == 0 ? string::npos : job.query.rfind('.', lastDotPos - 1));  // .<firstScanNum>.<lastScanNum>
+    if (secondLastDotPos == string::npos) {
+      job.errorTag = "TSV IMPORT";
+      job.errorMsg = "Illegal query name \"" + job.query + "\". Scan not imported.";
+    } else {
+      job.scanNum = atoi((job.query.substr(secondLastDotPos + 1, lastDotPos - secondLastDotPos - 1)).c_str());
+      job.baseName = job.query.substr(0, secondLastDotPos);
+      // even though the scans may not be in fullFileName, still use this as the key to the run
+      job.fullFileName = job.path + job.baseName + ".mzXML";  
     }
     
-    if (m_params.centroidPeaks) {
-      // check instrument? doesn't seem to matter much, so just assume it's TOF for now
-      peakList->centroid("TOF");
-    }
-
-    if (peakList->getNumPeaks() < m_params.minimumNumPeaksToInclude) {
-      g_log->log("PEPXML IMPORT", "Too few peaks in spectrum. Skipped query \"" + query + "\"."); 
-      m_numSkipped++;
-      delete (entry);
-      continue;
-    }
-      
-    if (entry->getMods().find("iTRAQ") != string::npos) {
-      peakList->removeITRAQPeaks();
+    if (segments.empty() || job.fullFileName != jobs[segments.back().first].fullFileName || 
+        segments.back().last - segments.back().first >= TSV_SPECTRUM_BATCH_SIZE) {
+      TsvRunSegment segment;
+      segment.first = k;
+      segment.last = k + 1;
+      segments.push_back(segment);
+    } else {
+      segments.back().last = k + 1;
     }
+  }
+  m_queries.clear();
+  
+  ProgressCount pc(!g_quiet, 1, (int)(jobs.size()));
+  pc.start("Importing spectra");	
+  
+  bool readInThread = false;
+  
+#ifndef _MSC_VER
+  if (m_params.importParseThread && segments.size() > 1) {
     
-    stringstream maxss;
-    maxss.precision(2);
-    maxss << peakList->getOrigMaxIntensity();
-    entry->setOneComment("OrigMaxIntensity", maxss.str());
+    // read the spectra of the next batch in another thread while the entries of this batch are processed
     
-    // normalize the spectra	
-    if (!(m_params.keepRawIntensities)) {
-      peakList->normalizeTo(10000.0, m_params.rawSpectraMaxDynamicRange);
-    }
+    // Ramp's list of supported file types is built on first use; build it here before the other thread does
+    rampListSupportedFileTypes();
+    
+    TsvSpectrumReader reader;
+    reader.importer = this;
+    reader.jobs = &jobs;
+    reader.segments = &segments;
+    reader.maxAhead = 2;
+    reader.numRead = 0;
+    reader.numProcessed = 0;
+    pthread_mutex_init(&(reader.mutex), NULL);
+    pthread_cond_init(&(reader.cond), NULL);
+    
+    pthread_t thread;
+    readInThread = (pthread_create(&thread, NULL, readSpectraInThread, &reader) == 0);
+    
+    // if the thread cannot be started, the batches are read below, in turn with their processing
+    for (unsigned int s = 0; readInThread && s < (unsigned int)(segments.size()); s++) {
+      
+      pthread_mutex_lock(&(reader.mutex));
+      while (reader.numRead <= s) {
+        pthread_cond_wait(&(reader.cond), &(reader.mutex));
+      }
+      pthread_mutex_unlock(&(reader.mutex));
       
-    if (!(m_params.skipRawAnnotation)) {
-      // annotate the spectra
-      entry->annotatePeaks();
+      for (unsigned int j = segments[s].first; j < segments[s].last; j++) {
+        pc.increment();
+        processSpectrum(jobs[j]);
+      }
+      
+      pthread_mutex_lock(&(reader.mutex));
+      reader.numProcessed = s + 1;
+      pthread_cond_broadcast(&(reader.cond));
+      pthread_mutex_unlock(&(reader.mutex));
     }
-       
-    // insert the entry into the library
-    if (passAllFilters(entry)) {
-      m_numImported++; 
-      m_lib->insertEntry(entry);
-    } else {
-      m_numSkipped++;
+    
+    if (readInThread) {
+      pthread_join(thread, NULL);
     }
-
-    delete (entry);
+    pthread_mutex_destroy(&(reader.mutex));
+    pthread_cond_destroy(&(reader.cond));
     
   }
+#endif
+  
+  if (!readInThread) {
+    for (vector<TsvRunSegment>::iterator s = segments.begin(); s != segments.end(); s++) {
+      loadSpectra(jobs, s->first, s->last);
+      for (unsigned int j = s->first; j < s->last; j++) {
+        pc.increment();
+        processSpectrum(jobs[j]);
+      }
+    }
+  }
   
   stringstream countss;
   countss << "Total of " << m_numImported << " spectra imported, ";
@@ -165,6 +261,67 @@ void SpectraSTTsvLibImporter::import() {
   
 }
 
+// processSpectrum - processes an entry whose spectrum has been read, and inserts it into the library. Deletes the entry.
+void SpectraSTTsvLibImporter::processSpectrum(TsvSpectrumJob& job) {
+  
+  string& query = job.query;
+  SpectraSTLibEntry* entry = job.entry;
+  SpectraSTPeakList* peakList = entry->getPeakList();
+  
+  if (!(job.errorMsg.empty())) {
+    g_log->error(job.errorTag, job.errorMsg);
+  }
+  
+  if (!(job.loaded)) {
+    // can't load spectrum
+    m_numSkipped++;
+    delete (entry);
+    return;
+  }
+    
+  if (m_params.centroidPeaks) {
+    // check instrument? doesn't seem to matter much, so just assume it's TOF for now
+    peakList->centroid("TOF");
+  }
+
+  if (peakList->getNumPeaks() < m_params.minimumNumPeaksToInclude) {
+    g_log->log("PEPXML IMPORT", "Too few peaks in spectrum. Skipped query \"" + query + "\"."); 
+    m_numSkipped++;
+    delete (entry);
+    return;
+  }
+      
+  if (entry->getMods().find("iTRAQ") != string::npos) {
+    peakList->removeITRAQPeaks();
+  }
+    
+  stringstream maxss;
+  maxss.precision(2);
+  maxss << peakList->getOrigMaxIntensity();
+  entry->setOneComment("OrigMaxIntensity", maxss.str());
+    
+  // normalize the spectra	
+  if (!(m_params.keepRawIntensities)) {
+    peakList->normalizeTo(10000.0, m_params.rawSpectraMaxDynamicRange);
+  }
+      
+  if (!(m_params.skipRawAnnotation)) {
+    // annotate the spectra
+    entry->annotatePeaks();
+  }
+       
+  // insert the entry into the library
+  if (passAllFilters(entry)) {
+    m_numImported++; 
+    m_lib->insertEntry(entry);
+  } else {
+    m_numSkipped++;
+  }
+
+  delete (entry);
+    
+}
+
 // readFromCurFile - reads one pepXML file
 void SpectraSTTsvLibImporter::readFromFile(string& impFileName) {
 
@@ -200,41 +357,53 @@ void SpectraSTTsvLibImporter::readFromFile(string& impFileName) {
   string databaseType("AA");
   string instrumentType("UNKNOWN");
 
-  ifstream fin;
-  if (!myFileOpen(fin, impFileName)) {
+  // the columns are parsed in place from the file mapped into memory, without copying the lines
+  SpectraSTMappedFile tsv(impFileName);
+  if (!tsv.isOpen()) {
     g_log->error("CREATE", "Cannot open TSV file \"" + impFileName + " for reading IDs. File Skipped.");
     return;
   }
 
-  string line("");
-
   ProgressCount pc(!g_quiet, 500, 0);
   string message("Processing \"");
   message += impFileName + "\"";
   pc.start(message);
 
-  while (nextLine(fin, line)) {
-    string::size_type pos = 0;
-    pos = line.find('#');
-    if (pos != string::npos) {
-      line = line.substr(0, pos);
+  const char* cur = tsv.begin();
+  const char* lineBegin = NULL;
+  const char* lineEnd = NULL;
+  while (SpectraSTMappedFile::nextLine(cur, tsv.end(), lineBegin, lineEnd)) {
+    const char* hash = (const char*)memchr(lineBegin, '#', lineEnd - lineBegin);
+    if (hash) {
+      lineEnd = hash;
     }
-    string mzXMLFile = nextToken(line, 0, pos, " \t\r\n", " \t");
-    if (mzXMLFile.empty()) {
+    
+    const char* p = SpectraSTMappedFile::skipOver(lineBegin, lineEnd, " \t");
+    const char* tokenEnd = SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n");
+    if (tokenEnd == p) {
       continue;
     }
-    string scanNumStr = nextToken(line, pos, pos, " \t\r\n", " \t");
-    int scanNum = atoi(scanNumStr.c_str());
+    string mzXMLFile(p, tokenEnd);
+    
+    p = SpectraSTMappedFile::skipOver(tokenEnd, lineEnd, " \t");
+    tokenEnd = SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n");
+    int scanNum = SpectraSTMappedFile::parseInt(p, tokenEnd);
     if (scanNum <= 0) {
       m_numSkipped++;
       continue;
     }
-    string id = nextToken(line, pos, pos, " \t\r\n", " \t");
     
-    string probStr = nextToken(line, pos, pos, " \t\r\n", " \t");
-    double prob = atof(probStr.c_str());
+    p = SpectraSTMappedFile::skipOver(tokenEnd, lineEnd, " \t");
+    tokenEnd = SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n");
+    string id(p, tokenEnd);
+    
+    p = SpectraSTMappedFile::skipOver(tokenEnd, lineEnd, " \t");
+    tokenEnd = SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n");
+    double prob = SpectraSTMappedFile::parseDouble(p, tokenEnd);
     
-    string scores = nextToken(line, pos, pos, " \t\r\n", " \t");
+    p = SpectraSTMappedFile::skipOver(tokenEnd, lineEnd, " \t");
+    tokenEnd = SpectraSTMappedFile::findDelim(p, lineEnd, " \t\r\n");
+    string scores(p, tokenEnd);
       
     if (processSearchHit(mzXMLFile, scanNum, id, searchEngine, instrumentType, fn.path, prob, scores)) {
       pc.increment();
@@ -482,29 +651,44 @@ bool SpectraSTTsvLibImporter::processSearchHit(string& mzXMLFile, int scanNum, s
 
 
 
-// loadSpectrum - go to the mzXML file to load the spectrum
-bool SpectraSTTsvLibImporter::loadSpectrum(string query, string path, SpectraSTLibEntry* entry, string altPath) {
-
-  SpectraSTPeakList* peakList = entry->getPeakList();
+// loadSpectra - reads the spectra of jobs first to last - 1, which are all from the same run, in the order of their 
+// scan numbers. Touches nothing but the jobs and the open runs (and does not log), so that it can be done in another thread.
+void SpectraSTTsvLibImporter::loadSpectra(vector<TsvSpectrumJob>& jobs, unsigned int first, unsigned int last) {
   
-  string::size_type lastDotPos = query.rfind('.');   // .<lastScanNum>  (<charge> has been taken off already)
-  if (lastDotPos == string::npos) {
-    g_log->error("TSV IMPORT", "Illegal query name \"" + query + "\". Scan not imported.");
-    return (false);
+  if (first >= last || jobs[first].fullFileName.empty()) {
+    // cannot tell the run
+    return;
   }
-  string::size_type secondLastDotPos = query.rfind('.', lastDotPos - 1);  // .<firstScanNum>.<lastScanNum>
-  if (secondLastDotPos == string::npos) {
-    g_log->error("TSV IMPORT", "Illegal query name \"" + query + "\". Scan not imported.");
-    return (false);
+  
+  // the first job (by query name) is the one to report if the run cannot be opened, as it is the first to be processed.
+  // (if it is not the first batch from this run, openRun knows the run already and reports nothing.)
+  cRamp* cramp = openRun(jobs[first]);
+  if (!cramp) {
+    return;
   }
+  
+  vector<pair<int, unsigned int> > order;
+  order.reserve(last - first);
+  for (unsigned int k = first; k < last; k++) {
+    order.push_back(pair<int, unsigned int>(jobs[k].scanNum, k));
+  }
+  sort(order.begin(), order.end());
+  
+  for (vector<pair<int, unsigned int> >::iterator o = order.begin(); o != order.end(); o++) {
+    jobs[o->second].loaded = loadSpectrum(jobs[o->second], cramp);
+  }
+  
+}
 
-  int scanNum = atoi((query.substr(secondLastDotPos + 1, lastDotPos - secondLastDotPos - 1)).c_str());
-
-  string baseName = query.substr(0, secondLastDotPos);
-
-  // even though the scans may not be in fullFileName, still use this as the key in the map
-  string fullFileName = path + baseName + ".mzXML";  
-
+// openRun - finds the run the spectrum of job is in, opening it if it is not open already. Returns NULL if the 
+// run cannot be opened, noting the error in the job if this is the first attempt.
+cRamp* SpectraSTTsvLibImporter::openRun(TsvSpectrumJob& job) {
+  
+  string& fullFileName = job.fullFileName;
+  string& path = job.path;
+  string& altPath = job.altPath;
+  string& baseName = job.baseName;
+  
   // try to see if the file is already opened	  
   map<string, cRamp*>::iterator found = m_mzXMLFiles.find(fullFileName);
   cRamp* cramp = NULL;
@@ -513,14 +697,16 @@ bool SpectraSTTsvLibImporter::loadSpectrum(string query, string path, SpectraSTL
     if (m_numMzXMLOpen >= MAX_NUM_OPEN_FILES) {
       // already at max number of open files... need to close one
       // pick the first file in m_mzXMLFiles to close -- note that this will not cause
-      // incessant opening and closing of that first file, because m_queries is sorted
-      // by query name (i.e. <mzXMLFileName>.<scanNum>.<scanNum>), and this loadSpectrum
-      // is called in the order of query name. Therefore, it should be done with the first
-      // file before it starts on the second, and so forth.
+      // incessant opening and closing of that first file, because the spectra are read
+      // run by run. Therefore, it should be done with the first file before it starts 
+      // on the second, and so forth.
       map<string, cRamp*>::iterator dead = m_mzXMLFiles.begin();
-      delete (dead->second);
-      m_mzXMLFiles.erase(dead);
-      m_numMzXMLOpen--;
+      while (dead != m_mzXMLFiles.end() && !(dead->second)) dead++; // skip those failed to open, which are not open
+      if (dead != m_mzXMLFiles.end()) {
+        delete (dead->second);
+        m_mzXMLFiles.erase(dead);
+        m_numMzXMLOpen--;
+      }
     }
 
     string triedFileNames(fullFileName);
@@ -553,30 +739,39 @@ bool SpectraSTTsvLibImporter::loadSpectrum(string query, string path, SpectraSTL
     }
 
     if (!cramp->OK()) {
-      g_log->error("TSV IMPORT", "Cannot open file \"" + triedFileNames + "\". No scan from this file will be imported.");
+      job.errorTag = "TSV IMPORT";
+      job.errorMsg = "Cannot open file \"" + triedFileNames + "\". No scan from this file will be imported.";
       delete (cramp);
       m_mzXMLFiles[fullFileName] = NULL; // note this so that future attempts to read scan from this file will die silently
-      return (false);          
+      return (NULL);          
     } else {
       m_numMzXMLOpen++;
       m_mzXMLFiles[fullFileName] = cramp;
     }
       
   } else {
-    if (found->second) {
-      cramp = found->second;
-    } else {
-      // tried to open this file previously and failed
-      return (false);
-    }
+    // if NULL, tried to open this file previously and failed
+    cramp = found->second;
   }
   
+  return (cramp);
+}
+
+// loadSpectrum - go to the mzXML file to load the spectrum
+bool SpectraSTTsvLibImporter::loadSpectrum(TsvSpectrumJob& job, cRamp* cramp) {
+
+  SpectraSTLibEntry* entry = job.entry;
+  SpectraSTPeakList* peakList = entry->getPeakList();
+  int scanNum = job.scanNum;
+  string& fullFileName = job.fullFileName;
+  
   rampScanInfo* scanInfo = cramp->getScanHeaderInfo(scanNum);
   if (!scanInfo || scanInfo->m_data.acquisitionNum != scanNum || scanInfo->m_data.msLevel == 1) {
     // bad. not found!
     stringstream errss;
     errss << "Cannot find MS2+ scan #" << scanNum << " in file \"" << fullFileName << "\". Scan not imported.";
-    g_log->error("PEPXML IMPORT", errss.str());
+    job.errorTag = "PEPXML IMPORT";
+    job.errorMsg = errss.str();
     
     if (scanInfo) delete (scanInfo);
     return (false);
@@ -588,7 +783,9 @@ bool SpectraSTTsvLibImporter::loadSpectrum(string query, string path, SpectraSTL
   if (!peaks) {
     stringstream errss;
     errss << "Cannot read peaks for scan #" << scanNum << " in file \"" << fullFileName << "\". Scan not imported.";
-    g_log->error("PEPXML IMPORT", errss.str());
+    job.errorTag = "PEPXML IMPORT";
+    job.errorMsg = errss.str();
+    delete (scanInfo);
     return (false);
   }
   
@@ -597,6 +794,7 @@ bool SpectraSTTsvLibImporter::loadSpectrum(string query, string path, SpectraSTL
   int precursorCharge = scanInfo->m_data.precursorCharge;
   if (precursorCharge < 1) precursorCharge = 0;
   string fragType(scanInfo->m_data.activationMethod);
+  delete (scanInfo);
   
   if (!(fragType.empty()) && entry->getFragType().empty()) {
     entry->setFragType(fragType);
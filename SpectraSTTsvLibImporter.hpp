@@ -65,6 +65,21 @@ hlam@systemsbiology.org
 
 using namespace std;
 
+// TsvSpectrumJob - a query whose spectrum is to be read from its run. The jobs are made in the order the entries are 
+// inserted into the library (by query name); the spectra of a run are read in the order of their scan numbers.
+typedef struct _TsvSpectrumJob {
+  string query;
+  string path;
+  string altPath;
+  SpectraSTLibEntry* entry;
+  string fullFileName; // the run, with its path (and .mzXML); empty if the query name cannot be parsed
+  string baseName;
+  int scanNum;
+  bool loaded;
+  string errorTag; // the error met reading the spectrum, logged when the entry is processed
+  string errorMsg;
+} TsvSpectrumJob;
+
 class SpectraSTTsvLibImporter : public SpectraSTLibImporter { 
 
 public:
@@ -74,6 +89,7 @@ public:
   
   virtual void import();
 
+  void loadSpectra(vector<TsvSpectrumJob>& jobs, unsigned int first, unsigned int last);
   
   
 private:
@@ -96,7 +112,9 @@ private:
   
   void readFromFile(string& impFileName);
   
-  bool loadSpectrum(string query, string path, SpectraSTLibEntry* entry, string altPath = "");
+  cRamp* openRun(TsvSpectrumJob& job);
+  bool loadSpectrum(TsvSpectrumJob& job, cRamp* cramp);
+  void processSpectrum(TsvSpectrumJob& job);
   
   bool processSearchHit(string& mzXMLFile, int scanNum, string& peptide, string& searchEngine, 
       string& instrumentType, string& path, double& prob, string& scores);
@@ -78,7 +78,7 @@ void SpectraSTTxtSearchOutput::printHeader() {
     (*m_fout).width(MAX_NAME_LEN);
     (*m_fout) << left << "Proteins";
     
-    (*m_fout) << endl;
+    (*m_fout) << '\n';
   }
   
 }
@@ -102,7 +102,7 @@ void SpectraSTTxtSearchOutput::printHit(string query, unsigned int hitRank, Spec
     (*m_fout) << "0";
     (*m_fout).width(MAX_NAME_LEN);
     (*m_fout) << left << "NO_MATCH";
-    (*m_fout) << endl;
+    (*m_fout) << '\n';
     
     return; 
   }
@@ -180,7 +180,7 @@ void SpectraSTTxtSearchOutput::printHit(string query, unsigned int hitRank, Spec
     
   (*m_fout) << proteinss.str();
   
-  (*m_fout) << endl;
+  (*m_fout) << '\n';
   	
 }
 
@@ -191,5 +191,5 @@ void SpectraSTTxtSearchOutput::printAbortedQuery(string query, string message) {
   (*m_fout) << left << query;	
   (*m_fout).width(MAX_NAME_LEN);
   (*m_fout) << left << message;
-  (*m_fout) << endl;
+  (*m_fout) << '\n';
 }
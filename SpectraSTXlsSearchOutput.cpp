@@ -66,7 +66,7 @@ void SpectraSTXlsSearchOutput::printHeader() {
     (*m_fout) << "Spec" << '\t';
     (*m_fout) << "#Pr" << '\t';
     (*m_fout) << "Proteins" << '\t';
-    (*m_fout) << "LibFileOffset" << endl;
+    (*m_fout) << "LibFileOffset" << '\n';
   }
 }
 
@@ -149,13 +149,13 @@ void SpectraSTXlsSearchOutput::printHit(string query, unsigned int hitRank, Spec
     
     (*m_fout) << entry->getLibFileOffset();
   }
-  (*m_fout) << endl;
+  (*m_fout) << '\n';
   
 }	
 
 // printAbortedQuery - displays a message for a query that is not searched (used for dta input, for example)
 void SpectraSTXlsSearchOutput::printAbortedQuery(string query, string message) {
 	
-  (*m_fout) << query << '\t' << message << endl;	
+  (*m_fout) << query << '\t' << message << '\n';	
 }
 
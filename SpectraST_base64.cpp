@@ -23,6 +23,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "stdlib.h"
 #include "string.h"
 #include "SpectraST_base64.h"
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
 
 static const unsigned int lookup[] = { // basic base64 charset table
 0, //  NUL
@@ -171,7 +174,7 @@ static void b64_cleanup(void) {
    free(lookup12);
 }
 
-static void b64_init() {
+static void b64_build_tables() {
    if (!lookup1) { // first time?
 
       // init tables for faster base64 decode
@@ -216,6 +219,19 @@ static void b64_init() {
    }
 }
 
+// the tables are built once, even when several threads start decoding at the same time
+#ifndef _MSC_VER
+static pthread_once_t b64_once = PTHREAD_ONCE_INIT;
+
+static void b64_init() {
+   pthread_once(&b64_once, b64_build_tables);
+}
+#else
+static void b64_init() {
+   b64_build_tables();
+}
+#endif
+
 void b64_decode ( char *out,  const char *in , int outlen)
 {
    unsigned char *dest = (unsigned char *)out;
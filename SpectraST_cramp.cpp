@@ -56,7 +56,7 @@ cramp.hpp
 
 
 
-cRamp::cRamp( const char* fileName,bool declaredScansOnly ) : 
+cRamp::cRamp( const char* fileName,bool declaredScansOnly,bool deferIndex ) : 
   m_filename(fileName), m_declaredScansOnly(declaredScansOnly), m_runInfo()
 {
    m_handle = rampOpenFile(fileName);
@@ -71,6 +71,10 @@ cRamp::cRamp( const char* fileName,bool declaredScansOnly ) :
 
       m_runInfo = getRunInfo();
 
+      if (deferIndex) {
+         return; // index will be read on first use, or supplied by setScanOffsets
+      }
+
       // HENRY -- always read index to set scan count, since scan count
       // declared at the top of the mzXML file is unreliable now that
       // there are missing scans.
@@ -85,6 +89,23 @@ cRamp::cRamp( const char* fileName,bool declaredScansOnly ) :
    }
 }
 
+// use a saved scan offset table instead of reading the index from the file
+void cRamp::setScanOffsets(const ramp_fileoffset_t* offsets, int lastScan) {
+   free(m_scanOffsets);
+   m_scanOffsets = (ramp_fileoffset_t *)malloc((lastScan+2)*sizeof(ramp_fileoffset_t));
+   if (!m_scanOffsets) {
+      m_lastScan = 0;
+      return;
+   }
+   memmove(m_scanOffsets,offsets,(lastScan+1)*sizeof(ramp_fileoffset_t));
+   m_scanOffsets[0] = -1;
+   m_scanOffsets[lastScan+1] = -1;
+   if (m_runInfo && lastScan >= m_runInfo->m_data.scanCount) {
+      m_runInfo->m_data.scanCount = lastScan; // as if we had read the index ourselves
+   }
+   m_lastScan = lastScan;
+}
+
 cRamp::~cRamp() {
    rampCloseFile(m_handle);
    
@@ -54,9 +54,10 @@ public:
     * constructor
     * @param fileName: Name of the msxml file
     * @param declaredScansOnly: suppress RAMP's behavior of creating sparse tables to accomodate unlisted scans
+    * @param deferIndex: don't read the scan index at open time (e.g. because the caller will supply it with setScanOffsets)
     *
     */
-      cRamp( const char* fileName, bool declaredScansOnly=false );
+      cRamp( const char* fileName, bool declaredScansOnly=false, bool deferIndex=false );
       virtual ~cRamp();
 
    /**
@@ -135,6 +136,14 @@ public:
 	ramp_fileoffset_t getScanOffset(size_t n) const {
 		return m_scanOffsets[n];
 	}
+
+   /**
+    * Use a previously saved scan offset table instead of reading the index from the file.
+    *
+    * @param offsets: offsets of scans 1..lastScan (indexed from 1, -1 for missing scans); copied
+    * @param lastScan: number of the last scan
+    */
+    void setScanOffsets(const ramp_fileoffset_t* offsets, int lastScan);
     
 private:
    std::string m_filename;
@@ -232,6 +241,11 @@ public:
    //
    rampScanInfo(RAMPFILE *m_handle, ramp_fileoffset_t index, int seqNum); // populate from file at this position, assign this sequence number
 
+   rampScanInfo() { // empty, for the caller to populate (e.g. from a saved scan table)
+      memset(&m_data,0,sizeof(m_data));
+      init();
+   }
+
    rampScanInfo(rampScanInfo &rhs) { // copy constructor - note this moves a pointer from rhs to *this
       memmove(this,&rhs,sizeof(rhs));
    };
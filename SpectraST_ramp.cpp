@@ -4,7 +4,7 @@
 
 Non sequential parser for mzXML files
 and mzData files, too!
-and mzML, if you have the ProteoWizard pwiz library from Spielberg Family Proteomics Center
+and mzML, natively (indexedmzML) or with the ProteoWizard pwiz library from Spielberg Family Proteomics Center
 and gzipped versions of all of these if you have pwiz
 
                              -------------------
@@ -161,6 +161,14 @@ static void getIsLittleEndian(const char *buf, int *result) {
    // leave *result alone if we don't see anything!
 }
 
+// native mzML reader (used when we don't have pwiz) - see below
+static void mzMLReadParamGroups(RAMPFILE *pFI);
+static ramp_fileoffset_t *mzMLReadIndex(RAMPFILE *pFI, ramp_fileoffset_t indexOffset, int *iLastScan);
+static void mzMLReadHeader(RAMPFILE *pFI, ramp_fileoffset_t lScanIndex, struct ScanHeaderStruct *scanHeader);
+static RAMPREAL *mzMLReadPeaks(RAMPFILE *pFI, ramp_fileoffset_t lScanIndex);
+static void mzMLReadMSRun(RAMPFILE *pFI, struct RunHeaderStruct *runHeader);
+static int mzMLReadInstrument(RAMPFILE *pFI, InstrumentStruct *output);
+
 /**************************************************
 * open and close files *
 **************************************************/
@@ -206,6 +214,13 @@ RAMPFILE *rampOpenFile(const char *filename) {
 			  bRecognizedFormat = 1;
 			  break;
 		   }
+#ifndef HAVE_PWIZ_MZML_LIB  // no pwiz, read mzML ourselves
+		   else if (strstr(buf,"<mzML") || strstr(buf,"<indexedmzML")) {
+              result->bIsMzML = 1;
+			  bRecognizedFormat = 1;
+			  break;
+		   }
+#endif
 #ifdef HAVE_PWIZ_MZML_LIB
            if ((bRecognizedFormat && !strchr(buf,'\n')) || // mzXML without newlines
 			   strstr(buf,"<mzML") || strstr(buf,"<indexedmzML")
@@ -258,6 +273,9 @@ RAMPFILE *rampOpenFile(const char *filename) {
 	 	if (!result->mzML) 
 #endif
 		{
+		if (result->bIsMzML) {
+		   mzMLReadParamGroups(result);
+		}
         ramp_fseek(result,0,SEEK_SET); // rewind
 		}
      }
@@ -281,6 +299,7 @@ void rampCloseFile(RAMPFILE *pFI) {
 #else
       fclose(pFI->fileHandle);
 #endif
+      free(pFI->mzMLParamGroups);
       free(pFI);
    }
 }
@@ -337,10 +356,11 @@ ramp_fileoffset_t getIndexOffset(RAMPFILE *pFI)
       return -1; // no index in mzData
    }
 
-   for (indexOffsetOffset = -120;  indexOffsetOffset++ < 0 ;)
+   // indexedmzML has a checksum after the offset, so look further back
+   for (indexOffsetOffset = pFI->bIsMzML?-400:-120;  indexOffsetOffset++ < 0 ;)
    {
       char seekbuf[SIZE_BUF+1];
-      const char *target = "<indexOffset>";
+      const char *target = pFI->bIsMzML?"<indexListOffset>":"<indexOffset>";
 	  int tlen = (int)strlen(target);
       int  nread;
 
@@ -401,6 +421,9 @@ ramp_fileoffset_t *readIndex(RAMPFILE *pFI,
    ramp_fileoffset_t *pScanIndex=NULL;
    int retryLoop;
    char* s;
+   if (pFI->bIsMzML) {
+      return mzMLReadIndex(pFI, indexOffset, iLastScan);
+   }
 #ifdef HAVE_PWIZ_MZML_LIB
    if (pFI->mzML) {
       // we're really building a table of scan numbers vs scan ids, not vs file offsets
@@ -699,6 +722,8 @@ static const char *findMzDataTagValue(const char *pStr, const char *tag) {
 }
 
 #include <time.h>
+#include <math.h>
+#include <zlib.h>
 /*
  * Reads a time string, returns time in seconds.
  */
@@ -786,6 +811,962 @@ static char *ramp_nextTag(char *buf, int buflen, RAMPFILE *pFI) {
 }
 
 
+/****************************************************************
+ * Native mzML support, for when we don't have the pwiz lib.   *
+ * Spectra are located through the indexedmzML offset list     *
+ * (or by inspection if that's missing or broken), and the      *
+ * binaryDataArrays are decoded directly, including zlib and    *
+ * MS-Numpress compression.                                     *
+ ***************************************************************/
+
+#define LOWMZ_UNINIT 1.111E6
+#define MZML_READ_CHUNK 16384
+
+/*
+ * read the file from offset until stopTag (or altStopTag, if given) is seen,
+ * and on through the '>' that closes that tag. Returns a malloc'ed, null
+ * terminated buffer that becomes property of the caller, or NULL.
+ */
+static char *mzMLReadElement(RAMPFILE *pFI, ramp_fileoffset_t offset,
+                             const char *stopTag, const char *altStopTag) {
+   size_t cap = MZML_READ_CHUNK;
+   size_t len = 0;
+   size_t overlap = strlen(stopTag);
+   long stopAt = -1;
+   char *elem = (char *)malloc(cap+1);
+   if (!elem) {
+      printf("Cannot allocate memory\n");
+      return NULL;
+   }
+   if (altStopTag && strlen(altStopTag) > overlap) {
+      overlap = strlen(altStopTag);
+   }
+   ramp_fseek(pFI, offset, SEEK_SET);
+   for (;;) {
+      if (len + MZML_READ_CHUNK > cap) {
+         char *grown = (char *)realloc(elem, 2*cap+1);
+         if (!grown) {
+            printf("Cannot allocate memory\n");
+            free(elem);
+            return NULL;
+         }
+         elem = grown;
+         cap *= 2;
+      }
+      size_t searchFrom = (len > overlap) ? len - overlap : 0;
+      size_t nread = ramp_fread(elem+len, MZML_READ_CHUNK, pFI);
+      len += nread;
+      elem[len] = 0;
+      if (stopAt < 0) {
+         char *stop = strstr(elem+searchFrom, stopTag);
+         if (altStopTag) {
+            char *alt = strstr(elem+searchFrom, altStopTag);
+            if (alt && (!stop || alt < stop)) {
+               stop = alt;
+            }
+         }
+         if (stop) {
+            stopAt = (long)(stop-elem);
+         }
+      }
+      if (stopAt >= 0) {
+         char *close = strchr(elem+stopAt, '>');
+         if (close) {
+            *(close+1) = 0;
+            return elem;
+         }
+      }
+      if (!nread) {
+         break; // EOF
+      }
+   }
+   if (len) {
+      return elem; // unterminated element at EOF, caller makes the best of it
+   }
+   free(elem);
+   return NULL;
+}
+
+/*
+ * copy the value of attribute attr of the tag starting at tag into out.
+ * returns out, or NULL if the tag doesn't have that attribute.
+ */
+static char *mzMLGetAttr(const char *tag, const char *attr, char *out, int outlen) {
+   const char *tagEnd = strchr(tag, '>');
+   int alen = (int)strlen(attr);
+   const char *look;
+   for (look = tag; (look = strstr(look+1, attr)) && (!tagEnd || look < tagEnd);) {
+      const char *val = look+alen;
+      if (!isspace(*(look-1))) {
+         continue; // just the tail end of some other attribute name
+      }
+      while (isspace(*val)) {
+         val++;
+      }
+      if ('=' != *val++) {
+         continue;
+      }
+      while (isspace(*val)) {
+         val++;
+      }
+      if (!isquot(*val)) {
+         continue;
+      }
+      const char *endq = strchr(val+1, *val);
+      if (!endq) {
+         return NULL;
+      }
+      int n = (int)(endq-(val+1));
+      if (n >= outlen) {
+         n = outlen-1;
+      }
+      memcpy(out, val+1, n);
+      out[n] = 0;
+      return out;
+   }
+   return NULL;
+}
+
+static int mzMLIsTag(const char *tag, const char *name) { // matches <name>, <name ...> and <name/>
+   int len = (int)strlen(name);
+   return (!strncmp(tag, name, len) && (isspace(tag[len]) || '>'==tag[len] || '/'==tag[len]));
+}
+
+/*
+ * derive a scan number from a nativeID such as "controllerType=0 controllerNumber=1 scan=42".
+ * ids with no scan number in them fall back to the (1-based) position of the spectrum in the file
+ */
+static int mzMLScanNumFromId(const char *id, int ordinal) {
+   static const char *keys[] = { "scan=", "scanId=", "spectrum=", "index=", NULL };
+   for (int k = 0; keys[k]; k++) {
+      const char *p = strstr(id, keys[k]);
+      if (p && (p==id || isspace(*(p-1))) && isdigit(p[strlen(keys[k])])) {
+         int num = atoi(p+strlen(keys[k]));
+         return strcmp(keys[k],"index=") ? num : num+1; // index= is 0-based
+      }
+   }
+   return ordinal;
+}
+
+typedef struct {
+   char accession[32];
+   char name[SIZE_BUF];
+   char value[SIZE_BUF];
+   char unitAccession[32];
+   char unitName[32];
+} mzMLCvParam;
+
+static int mzMLParseCvParam(const char *tag, mzMLCvParam *cv) {
+   if (!mzMLIsTag(tag, "<cvParam")) {
+      return 0;
+   }
+   if (!mzMLGetAttr(tag, "accession", cv->accession, sizeof(cv->accession))) {
+      return 0;
+   }
+   if (!mzMLGetAttr(tag, "name", cv->name, sizeof(cv->name))) {
+      cv->name[0] = 0;
+   }
+   if (!mzMLGetAttr(tag, "value", cv->value, sizeof(cv->value))) {
+      cv->value[0] = 0;
+   }
+   if (!mzMLGetAttr(tag, "unitAccession", cv->unitAccession, sizeof(cv->unitAccession))) {
+      cv->unitAccession[0] = 0;
+   }
+   if (!mzMLGetAttr(tag, "unitName", cv->unitName, sizeof(cv->unitName))) {
+      cv->unitName[0] = 0;
+   }
+   return 1;
+}
+
+/*
+ * remember the referenceableParamGroupList so that group refs can be
+ * resolved without going back to the head of the file
+ */
+static void mzMLReadParamGroups(RAMPFILE *pFI) {
+   char *head = mzMLReadElement(pFI, 0, "<run", "<spectrumList");
+   if (head) {
+      const char *begin = strstr(head, "<referenceableParamGroupList");
+      const char *end = begin?strstr(begin, "</referenceableParamGroupList>"):NULL;
+      if (end) {
+         int len = (int)(end-begin);
+         if ((pFI->mzMLParamGroups = (char *)malloc(len+1))) {
+            memcpy(pFI->mzMLParamGroups, begin, len);
+            pFI->mzMLParamGroups[len] = 0;
+         }
+      }
+      free(head);
+   }
+}
+
+/*
+ * call handler for each tag in [begin,end) - or until the terminating null if end is NULL.
+ * referenceableParamGroupRefs are replaced by the contents of the group they refer to.
+ */
+typedef void (*mzMLTagHandler)(const char *tag, void *context);
+
+static void mzMLWalkTags(RAMPFILE *pFI, const char *begin, const char *end,
+                         mzMLTagHandler handler, void *context) {
+   const char *tag;
+   for (tag = begin; (tag = strchr(tag, '<')) && (!end || tag < end); tag++) {
+      if (mzMLIsTag(tag, "<referenceableParamGroupRef")) {
+         char ref[SIZE_BUF];
+         char id[SIZE_BUF+8];
+         const char *group;
+         if (!pFI->mzMLParamGroups || !mzMLGetAttr(tag, "ref", ref, sizeof(ref))) {
+            continue;
+         }
+         snprintf(id, sizeof(id), "id=\"%s\"", ref);
+         if ((group = strstr(pFI->mzMLParamGroups, id)) && (group = strchr(group, '>'))) {
+            mzMLWalkTags(pFI, group, strstr(group, "</referenceableParamGroup>"), handler, context);
+         }
+      } else {
+         handler(tag, context);
+      }
+   }
+}
+
+/*
+ * scan header
+ */
+typedef struct {
+   struct ScanHeaderStruct *scanHeader;
+   int inPrecursor;
+   int gotSelectedIon;
+} mzMLHeaderContext;
+
+static void mzMLHeaderTag(const char *tag, void *context) {
+   mzMLHeaderContext *ctx = (mzMLHeaderContext *)context;
+   struct ScanHeaderStruct *scanHeader = ctx->scanHeader;
+   char attr[SIZE_BUF];
+   mzMLCvParam cv;
+
+   if (mzMLIsTag(tag, "<spectrum")) {
+      int index = -1;
+      if (mzMLGetAttr(tag, "index", attr, sizeof(attr))) {
+         index = atoi(attr);
+      }
+      if (mzMLGetAttr(tag, "id", attr, sizeof(attr))) {
+         scanHeader->acquisitionNum = mzMLScanNumFromId(attr, index+1);
+      } else if (index >= 0) {
+         scanHeader->acquisitionNum = index+1;
+      }
+      if (mzMLGetAttr(tag, "defaultArrayLength", attr, sizeof(attr))) {
+         scanHeader->peaksCount = atoi(attr);
+      }
+   } else if (mzMLIsTag(tag, "<precursor")) {
+      ctx->inPrecursor = 1;
+      if (mzMLGetAttr(tag, "spectrumRef", attr, sizeof(attr))) {
+         int precursorScanNum = mzMLScanNumFromId(attr, -1);
+         if (precursorScanNum > 0) {
+            scanHeader->precursorScanNum = precursorScanNum;
+         }
+      }
+   } else if (!strncmp(tag, "</precursor>", 12)) {
+      ctx->inPrecursor = 0;
+   } else if (mzMLParseCvParam(tag, &cv)) {
+      double val = atof(cv.value);
+      const char *activation = NULL;
+      if (!ctx->inPrecursor) {
+         if (!strcmp(cv.accession, "MS:1000511")) { // ms level
+            scanHeader->msLevel = atoi(cv.value);
+         } else if (!strcmp(cv.accession, "MS:1000016")) { // scan start time
+            if (!strcmp(cv.unitAccession, "UO:0000031") || !strcmp(cv.unitName, "minute")) {
+               val *= 60.0;
+            }
+            scanHeader->retentionTime = val;
+         } else if (!strcmp(cv.accession, "MS:1000504")) { // base peak m/z
+            scanHeader->basePeakMZ = val;
+         } else if (!strcmp(cv.accession, "MS:1000505")) { // base peak intensity
+            scanHeader->basePeakIntensity = val;
+         } else if (!strcmp(cv.accession, "MS:1000285")) { // total ion current
+            scanHeader->totIonCurrent = val;
+         } else if (!strcmp(cv.accession, "MS:1000528")) { // lowest observed m/z
+            scanHeader->lowMZ = val;
+         } else if (!strcmp(cv.accession, "MS:1000527")) { // highest observed m/z
+            scanHeader->highMZ = val;
+         } else if (!strcmp(cv.accession, "MS:1000501")) { // scan window lower limit
+            if (LOWMZ_UNINIT == scanHeader->lowMZ) {
+               scanHeader->lowMZ = val;
+            }
+         } else if (!strcmp(cv.accession, "MS:1000500")) { // scan window upper limit
+            if (!scanHeader->highMZ) {
+               scanHeader->highMZ = val;
+            }
+         } else if (!strcmp(cv.accession, "MS:1000579") || !strcmp(cv.accession, "MS:1000580")) { // MS1 or MSn spectrum
+            strcpy(scanHeader->scanType, "Full");
+         } else if (!strcmp(cv.accession, "MS:1000582")) {
+            strcpy(scanHeader->scanType, "SIM");
+         } else if (!strcmp(cv.accession, "MS:1000583")) {
+            strcpy(scanHeader->scanType, "SRM");
+         }
+      } else {
+         if (!strcmp(cv.accession, "MS:1000744")) { // selected ion m/z
+            if (!ctx->gotSelectedIon) {
+               scanHeader->precursorMZ = val;
+               ctx->gotSelectedIon = 1;
+            }
+         } else if (!strcmp(cv.accession, "MS:1000827")) { // isolation window target m/z
+            if (!ctx->gotSelectedIon) {
+               scanHeader->precursorMZ = val; // selected ion m/z will override if given
+            }
+         } else if (!strcmp(cv.accession, "MS:1000041")) { // charge state
+            if (!scanHeader->precursorCharge) {
+               scanHeader->precursorCharge = atoi(cv.value);
+            }
+         } else if (!strcmp(cv.accession, "MS:1000633")) { // possible charge state
+            int charge = atoi(cv.value);
+            if (charge > 0 && charge < CHARGEARRAY_LENGTH && !scanHeader->possibleChargesArray[charge]) {
+               int len = (int)strlen(scanHeader->possibleCharges);
+               if (len + 5 < SCANTYPE_LENGTH) {
+                  sprintf(scanHeader->possibleCharges+len, "%s%d", len?",":"", charge);
+               }
+               scanHeader->possibleChargesArray[charge] = true;
+               scanHeader->numPossibleCharges++;
+            }
+         } else if (!strcmp(cv.accession, "MS:1000042")) { // peak intensity
+            scanHeader->precursorIntensity = val;
+         } else if (!strcmp(cv.accession, "MS:1000045")) { // collision energy
+            scanHeader->collisionEnergy = val;
+         } else if (!strcmp(cv.accession, "MS:1000133")) {
+            activation = "CID";
+         } else if (!strcmp(cv.accession, "MS:1000422")) {
+            activation = "HCD";
+         } else if (!strcmp(cv.accession, "MS:1000598")) {
+            activation = "ETD";
+         } else if (!strcmp(cv.accession, "MS:1000250")) {
+            activation = "ECD";
+         } else if (!strcmp(cv.accession, "MS:1000599")) {
+            activation = "PQD";
+         }
+         if (activation && !scanHeader->activationMethod[0]) {
+            strcpy(scanHeader->activationMethod, activation);
+         }
+      }
+   }
+}
+
+static void mzMLReadHeader(RAMPFILE *pFI, ramp_fileoffset_t lScanIndex, struct ScanHeaderStruct *scanHeader) {
+   // no need to read the peaks just to get the header
+   char *elem = mzMLReadElement(pFI, lScanIndex, "<binaryDataArrayList", "</spectrum>");
+   if (!elem) {
+      return;
+   }
+   if (mzMLIsTag(elem, "<spectrum")) { // else offset is bogus, leave acquisitionNum at -1
+      mzMLHeaderContext ctx;
+      memset(&ctx, 0, sizeof(ctx));
+      ctx.scanHeader = scanHeader;
+      mzMLWalkTags(pFI, elem, NULL, mzMLHeaderTag, &ctx);
+   }
+   free(elem);
+}
+
+/*
+ * scan index
+ */
+static ramp_fileoffset_t *mzMLAddIndexEntry(ramp_fileoffset_t *pScanIndex, int *reallocSize,
+                                            int scanNum, ramp_fileoffset_t offset, int *iLastScan) {
+   if (scanNum < 1) {
+      return pScanIndex; // ramp is 1-based
+   }
+   if (scanNum + 1 >= *reallocSize) {
+      int oldSize = *reallocSize;
+      ramp_fileoffset_t *pTmp;
+      *reallocSize = scanNum + 500;
+      pTmp = (ramp_fileoffset_t *)realloc(pScanIndex, (*reallocSize) * sizeof(ramp_fileoffset_t));
+      if (!pTmp) {
+         printf("Cannot allocate memory\n");
+         free(pScanIndex);
+         return NULL;
+      }
+      pScanIndex = pTmp;
+      for (int k = oldSize; k < *reallocSize; k++) {
+         pScanIndex[k] = -1; // meaning "there is no scan k"
+      }
+   }
+   pScanIndex[scanNum] = offset;
+   if (scanNum > *iLastScan) {
+      *iLastScan = scanNum;
+   }
+   return pScanIndex;
+}
+
+static ramp_fileoffset_t *mzMLReadIndex(RAMPFILE *pFI, ramp_fileoffset_t indexOffset, int *iLastScan) {
+   int reallocSize = 8000;
+   ramp_fileoffset_t *pScanIndex = (ramp_fileoffset_t *)malloc(reallocSize * sizeof(ramp_fileoffset_t));
+   int indexOK = 0;
+   char attr[SIZE_BUF];
+   if (!pScanIndex) {
+      printf("Cannot allocate memory\n");
+      return NULL;
+   }
+   for (int k = 0; k < reallocSize; k++) {
+      pScanIndex[k] = -1;
+   }
+   *iLastScan = 0;
+
+   if (indexOffset >= 0) { // read the offset list out of the file (then check it!)
+      char *indexList = mzMLReadElement(pFI, indexOffset, "</indexList>", NULL);
+      const char *spectrumIndex = NULL;
+      const char *look;
+      for (look = indexList; look && (look = strstr(look, "<index ")); look++) {
+         if (mzMLGetAttr(look, "name", attr, sizeof(attr)) && !strcmp(attr, "spectrum")) {
+            spectrumIndex = look;
+            break;
+         }
+      }
+      if (spectrumIndex) {
+         const char *end = strstr(spectrumIndex, "</index>");
+         int ordinal = 0;
+         for (look = spectrumIndex; pScanIndex && (look = strstr(look+1, "<offset")) && (!end || look < end);) {
+            const char *offsetStr = strchr(look, '>');
+            if (!offsetStr) {
+               break;
+            }
+            ordinal++;
+            if (!mzMLGetAttr(look, "idRef", attr, sizeof(attr))) {
+               attr[0] = 0;
+            }
+            pScanIndex = mzMLAddIndexEntry(pScanIndex, &reallocSize, mzMLScanNumFromId(attr, ordinal),
+                                           atoll(offsetStr+1), iLastScan);
+         }
+      }
+      free(indexList);
+      if (!pScanIndex) {
+         return NULL;
+      }
+
+      // check the first listed scan actually points at itself
+      int testIndex = 1;
+      while (testIndex <= *iLastScan && pScanIndex[testIndex] <= 0) testIndex++;
+      if (testIndex <= *iLastScan) {
+         struct ScanHeaderStruct scanHeader;
+         readHeader(pFI, pScanIndex[testIndex], &scanHeader);
+         indexOK = (scanHeader.acquisitionNum == testIndex);
+      }
+   }
+
+   if (!indexOK) { // no index found, or it's broken - derive it by inspection
+      const char *scantag = "<spectrum ";
+      int taglen = (int)strlen(scantag);
+      char *chunk = (char *)malloc(2*MZML_READ_CHUNK+1);
+      ramp_fileoffset_t chunkStart = 0;
+      int carry = 0;
+      int ordinal = 0;
+      if (!chunk) {
+         printf("Cannot allocate memory\n");
+         free(pScanIndex);
+         return NULL;
+      }
+      for (int k = 0; k < reallocSize; k++) {
+         pScanIndex[k] = -1;
+      }
+      *iLastScan = 0;
+      ramp_fseek(pFI, 0, SEEK_SET);
+      for (;;) {
+         int nread = (int)ramp_fread(chunk+carry, MZML_READ_CHUNK, pFI);
+         int len = carry+nread;
+         char *look = chunk;
+         char *find;
+         chunk[len] = 0;
+         carry = 0;
+         while ((find = strstr(look, scantag))) {
+            if (!strchr(find, '>')) { // tag overhangs the end of the chunk
+               if (nread) {
+                  carry = len-(int)(find-chunk);
+               }
+               break;
+            }
+            ordinal++;
+            int index = mzMLGetAttr(find, "index", attr, sizeof(attr)) ? atoi(attr)+1 : ordinal;
+            int scanNum = mzMLGetAttr(find, "id", attr, sizeof(attr)) ? mzMLScanNumFromId(attr, index) : index;
+            if (!(pScanIndex = mzMLAddIndexEntry(pScanIndex, &reallocSize, scanNum,
+                                                 chunkStart+(find-chunk), iLastScan))) {
+               free(chunk);
+               return NULL;
+            }
+            look = find+taglen;
+         }
+         if (!nread) {
+            break;
+         }
+         if (!carry && len > taglen) { // possible that next scantag overhangs end of chunk
+            carry = taglen-1;
+         }
+         memmove(chunk, chunk+len-carry, carry);
+         chunkStart += len-carry;
+      }
+      free(chunk);
+   }
+
+   // make sure there's room for the -1 after the last scan
+   if (!(pScanIndex = mzMLAddIndexEntry(pScanIndex, &reallocSize, *iLastScan+1, -1, iLastScan))) {
+      return NULL;
+   }
+   (*iLastScan)--;
+   return pScanIndex;
+}
+
+/*
+ * MS-Numpress decoding (Teleman et al., Mol Cell Proteomics 2014)
+ * Each decoder returns the number of values decoded, or -1 on corrupt data.
+ */
+static double mzMLNumpressFixedPoint(const unsigned char *data) {
+   // the scaling factor is an 8-byte double; take whichever byte order yields a sane
+   // (normal, positive) scaling factor, as writers haven't all agreed on that
+   U64 le, be;
+   le.u64 = be.u64 = 0;
+   for (int i = 0; i < 8; i++) {
+      le.u64 |= ((uint64_t)data[i]) << (8*i);
+      be.u64 = (be.u64 << 8) | data[i];
+   }
+   if (le.dbl > 1.0E-10 && le.dbl < 1.0E30) {
+      return le.dbl;
+   }
+   return be.dbl;
+}
+
+// read one integer encoded as a count of leading 0 (or f) half-bytes plus the remaining half-bytes
+static int mzMLNumpressDecodeInt(const unsigned char *data, size_t *di, size_t dataSize, int *half, unsigned int *res) {
+   unsigned int head;
+   int n;
+   if (*di >= dataSize) {
+      return 0;
+   }
+   if (!*half) {
+      head = data[*di] >> 4;
+   } else {
+      head = data[(*di)++] & 0xf;
+   }
+   *half = 1-*half;
+   *res = 0;
+   if (head <= 8) {
+      n = (int)head;
+   } else { // leading ones, fill n half bytes in res
+      n = (int)head-8;
+      for (int i = 0; i < n; i++) {
+         *res |= 0xf0000000U >> (4*i);
+      }
+   }
+   if (8 == n) {
+      return 1;
+   }
+   if ((dataSize-*di)*2 - *half < (size_t)(8-n)) {
+      return 0; // not enough half bytes left
+   }
+   for (int i = n; i < 8; i++) {
+      unsigned int hb;
+      if (!*half) {
+         hb = data[*di] >> 4;
+      } else {
+         hb = data[(*di)++] & 0xf;
+      }
+      *res |= hb << ((i-n)*4);
+      *half = 1-*half;
+   }
+   return 1;
+}
+
+static int mzMLNumpressDecodeLinear(const unsigned char *data, size_t dataSize, double *result, int maxResult) {
+   long long ints[3];
+   unsigned int init;
+   double fixedPoint;
+   size_t di;
+   int half = 0;
+   int ri;
+   if (dataSize == 8) {
+      return 0;
+   }
+   if (dataSize < 12) {
+      return -1;
+   }
+   fixedPoint = mzMLNumpressFixedPoint(data);
+   init = 0;
+   for (int i = 0; i < 4; i++) {
+      init |= ((unsigned int)data[8+i]) << (i*8);
+   }
+   ints[1] = init;
+   if (maxResult < 1) {
+      return -1;
+   }
+   result[0] = ints[1] / fixedPoint;
+   if (dataSize == 12) {
+      return 1;
+   }
+   if (dataSize < 16 || maxResult < 2) {
+      return -1;
+   }
+   init = 0;
+   for (int i = 0; i < 4; i++) {
+      init |= ((unsigned int)data[12+i]) << (i*8);
+   }
+   ints[2] = init;
+   result[1] = ints[2] / fixedPoint;
+
+   ri = 2;
+   di = 16;
+   while (di < dataSize) {
+      unsigned int buff;
+      if (di == dataSize-1 && half && !(data[di] & 0xf)) {
+         break; // padding half byte
+      }
+      if (ri >= maxResult || !mzMLNumpressDecodeInt(data, &di, dataSize, &half, &buff)) {
+         return -1;
+      }
+      ints[0] = ints[1];
+      ints[1] = ints[2];
+      long long y = ints[1] + (ints[1]-ints[0]) + (int)buff; // extrapolation plus residual
+      result[ri++] = y / fixedPoint;
+      ints[2] = y;
+   }
+   return ri;
+}
+
+static int mzMLNumpressDecodePic(const unsigned char *data, size_t dataSize, double *result, int maxResult) {
+   size_t di = 0;
+   int half = 0;
+   int ri = 0;
+   while (di < dataSize) {
+      unsigned int count;
+      if (di == dataSize-1 && half && !(data[di] & 0xf)) {
+         break; // padding half byte
+      }
+      if (ri >= maxResult || !mzMLNumpressDecodeInt(data, &di, dataSize, &half, &count)) {
+         return -1;
+      }
+      result[ri++] = count;
+   }
+   return ri;
+}
+
+static int mzMLNumpressDecodeSlof(const unsigned char *data, size_t dataSize, double *result, int maxResult) {
+   double fixedPoint;
+   int ri = 0;
+   if (dataSize < 8) {
+      return -1;
+   }
+   fixedPoint = mzMLNumpressFixedPoint(data);
+   for (size_t i = 8; i+1 < dataSize; i += 2) {
+      unsigned int x = data[i] | (((unsigned int)data[i+1]) << 8);
+      if (ri >= maxResult) {
+         return -1;
+      }
+      result[ri++] = exp(x / fixedPoint) - 1;
+   }
+   return ri;
+}
+
+/*
+ * peak list
+ */
+enum { MZML_NUMPRESS_NONE = 0, MZML_NUMPRESS_LINEAR, MZML_NUMPRESS_PIC, MZML_NUMPRESS_SLOF };
+enum { MZML_ARRAY_OTHER = 0, MZML_ARRAY_MZ, MZML_ARRAY_INTENSITY };
+
+typedef struct {
+   int precision; // 32 or 64
+   int isInteger;
+   int isZlib;
+   int numpress;
+   int arrayType;
+} mzMLArrayContext;
+
+static void mzMLArrayTag(const char *tag, void *context) {
+   mzMLArrayContext *ctx = (mzMLArrayContext *)context;
+   mzMLCvParam cv;
+   if (!mzMLParseCvParam(tag, &cv)) {
+      return;
+   }
+   if (!strcmp(cv.accession, "MS:1000521")) { // 32-bit float
+      ctx->precision = 32;
+      ctx->isInteger = 0;
+   } else if (!strcmp(cv.accession, "MS:1000523")) { // 64-bit float
+      ctx->precision = 64;
+      ctx->isInteger = 0;
+   } else if (!strcmp(cv.accession, "MS:1000519")) { // 32-bit integer
+      ctx->precision = 32;
+      ctx->isInteger = 1;
+   } else if (!strcmp(cv.accession, "MS:1000522")) { // 64-bit integer
+      ctx->precision = 64;
+      ctx->isInteger = 1;
+   } else if (!strcmp(cv.accession, "MS:1000574")) { // zlib compression
+      ctx->isZlib = 1;
+   } else if (!strcmp(cv.accession, "MS:1002312")) {
+      ctx->numpress = MZML_NUMPRESS_LINEAR;
+   } else if (!strcmp(cv.accession, "MS:1002313")) {
+      ctx->numpress = MZML_NUMPRESS_PIC;
+   } else if (!strcmp(cv.accession, "MS:1002314")) {
+      ctx->numpress = MZML_NUMPRESS_SLOF;
+   } else if (!strcmp(cv.accession, "MS:1002746")) { // numpress linear followed by zlib
+      ctx->numpress = MZML_NUMPRESS_LINEAR;
+      ctx->isZlib = 1;
+   } else if (!strcmp(cv.accession, "MS:1002747")) {
+      ctx->numpress = MZML_NUMPRESS_PIC;
+      ctx->isZlib = 1;
+   } else if (!strcmp(cv.accession, "MS:1002748")) {
+      ctx->numpress = MZML_NUMPRESS_SLOF;
+      ctx->isZlib = 1;
+   } else if (!strcmp(cv.accession, "MS:1000514")) {
+      ctx->arrayType = MZML_ARRAY_MZ;
+   } else if (!strcmp(cv.accession, "MS:1000515")) {
+      ctx->arrayType = MZML_ARRAY_INTENSITY;
+   }
+}
+
+/*
+ * decode the base64 text of one binaryDataArray into count values, written to
+ * result[0], result[stride], ... returns 0 on failure
+ */
+static int mzMLDecodeArray(const char *base64, const char *base64End, const mzMLArrayContext *ctx,
+                           int count, RAMPREAL *result, int stride) {
+   int  endtest = 1;
+   int  weAreLittleEndian = *((char *)&endtest);
+   int bytesPerValue = ctx->precision/8;
+   int encodedLen = 0;
+   int decodedLen;
+   char *encoded = (char *)malloc(base64End-base64+1);
+   unsigned char *decoded = NULL;
+   unsigned char *data; // after decompression
+   size_t dataLen;
+   int ok = 0;
+   if (!encoded) {
+      printf("Cannot allocate memory\n");
+      return 0;
+   }
+   // whitespace may be present in base64 char stream
+   for (const char *cp = base64; cp < base64End; cp++) {
+      if (!isspace(*cp)) {
+         encoded[encodedLen++] = *cp;
+      }
+   }
+   encoded[encodedLen] = 0;
+   decodedLen = (encodedLen/4)*3;
+   if (encodedLen && '=' == encoded[encodedLen-1]) decodedLen--;
+   if (encodedLen > 1 && '=' == encoded[encodedLen-2]) decodedLen--;
+   if ((decoded = (unsigned char *)malloc(decodedLen+4)) == NULL) {
+      printf("Cannot allocate memory\n");
+      free(encoded);
+      return 0;
+   }
+   b64_decode((char *)decoded, encoded, decodedLen);
+   free(encoded);
+   data = decoded;
+   dataLen = decodedLen;
+
+   if (ctx->isZlib) {
+      // numpress output size isn't known in advance; grow until it fits
+      uLongf uncomprLen = (uLongf)count*(ctx->numpress?5:bytesPerValue) + 64;
+      int err;
+      unsigned char *pUncompr = NULL;
+      for (;;) {
+         unsigned char *grown = (unsigned char *)realloc(pUncompr, uncomprLen);
+         uLongf destLen = uncomprLen;
+         if (!grown) {
+            printf("Cannot allocate memory\n");
+            break;
+         }
+         pUncompr = grown;
+         err = uncompress(pUncompr, &destLen, decoded, decodedLen);
+         if (Z_BUF_ERROR == err) {
+            uncomprLen *= 2;
+            continue;
+         }
+         if (Z_OK == err) {
+            dataLen = destLen;
+         }
+         break;
+      }
+      free(decoded);
+      decoded = pUncompr;
+      data = pUncompr;
+      if (!data || Z_OK != err) {
+         free(decoded);
+         return 0;
+      }
+   }
+
+   if (ctx->numpress) {
+      double *values = (double *)malloc((count+1)*sizeof(double));
+      int nvalues = -1;
+      if (values) {
+         if (MZML_NUMPRESS_LINEAR == ctx->numpress) {
+            nvalues = mzMLNumpressDecodeLinear(data, dataLen, values, count);
+         } else if (MZML_NUMPRESS_PIC == ctx->numpress) {
+            nvalues = mzMLNumpressDecodePic(data, dataLen, values, count);
+         } else {
+            nvalues = mzMLNumpressDecodeSlof(data, dataLen, values, count);
+         }
+      }
+      if (nvalues == count) {
+         for (int n = 0; n < count; n++) {
+            result[n*stride] = (RAMPREAL)values[n];
+         }
+         ok = 1;
+      } else {
+         fprintf(stderr, "corrupt MS-Numpress data in mzML binaryDataArray\n");
+      }
+      free(values);
+   } else if (dataLen >= (size_t)count*bytesPerValue) {
+      // mzML binary data is always little endian
+      for (int n = 0; n < count; n++) {
+         const unsigned char *v = data + n*bytesPerValue;
+         if (32 == ctx->precision) {
+            U32 tmp;
+            memcpy(&tmp.u32, v, 4);
+            if (!weAreLittleEndian) tmp.u32 = swapbytes(tmp.u32);
+            result[n*stride] = ctx->isInteger ? (RAMPREAL)(int32_t)tmp.u32 : (RAMPREAL)tmp.flt;
+         } else {
+            U64 tmp;
+            memcpy(&tmp.u64, v, 8);
+            if (!weAreLittleEndian) tmp.u64 = swapbytes64(tmp.u64);
+            result[n*stride] = ctx->isInteger ? (RAMPREAL)(int64_t)tmp.u64 : (RAMPREAL)tmp.dbl;
+         }
+      }
+      ok = 1;
+   }
+   free(decoded);
+   return ok;
+}
+
+static RAMPREAL *mzMLReadPeaks(RAMPFILE *pFI, ramp_fileoffset_t lScanIndex) {
+   RAMPREAL *pPeaks = NULL;
+   char attr[SIZE_BUF];
+   int peaksCount = 0;
+   int gotMZ = 0;
+   int gotIntensity = 0;
+   const char *look;
+   char *elem = mzMLReadElement(pFI, lScanIndex, "</spectrum>", NULL);
+   if (!elem) {
+      return NULL;
+   }
+   if (mzMLIsTag(elem, "<spectrum") && mzMLGetAttr(elem, "defaultArrayLength", attr, sizeof(attr))) {
+      peaksCount = atoi(attr);
+   }
+   if (peaksCount <= 0) { // No peaks in this scan!!
+      free(elem);
+      return NULL;
+   }
+   if ((pPeaks = (RAMPREAL *) calloc((peaksCount+1) * 2 * sizeof(RAMPREAL) + 1, 1)) == NULL) {
+      printf("Cannot allocate memory\n");
+      free(elem);
+      return NULL;
+   }
+
+   for (look = elem; (look = strstr(look+1, "<binaryDataArray")) && !(gotMZ && gotIntensity);) {
+      const char *end;
+      const char *binary;
+      const char *binaryEnd;
+      mzMLArrayContext ctx;
+      int count = peaksCount;
+      if (!mzMLIsTag(look, "<binaryDataArray")) {
+         continue; // <binaryDataArrayList
+      }
+      if (!(end = strstr(look, "</binaryDataArray>"))) {
+         break;
+      }
+      memset(&ctx, 0, sizeof(ctx));
+      ctx.precision = 64;
+      if (mzMLGetAttr(look, "arrayLength", attr, sizeof(attr))) {
+         count = atoi(attr);
+      }
+      for (binary = look; (binary = strstr(binary+1, "<binary")) && !mzMLIsTag(binary, "<binary");) {
+         ; // skip past <binaryDataArray...
+      }
+      if (!binary || binary > end || !(binary = strchr(binary, '>'))) {
+         continue;
+      }
+      binary++;
+      binaryEnd = ('/' == *(binary-2)) ? binary : strstr(binary, "</binary>"); // <binary/> is empty
+      mzMLWalkTags(pFI, look+1, binary, mzMLArrayTag, &ctx);
+      if (MZML_ARRAY_OTHER == ctx.arrayType || count != peaksCount || !binaryEnd) {
+         continue;
+      }
+      int isInten = (MZML_ARRAY_INTENSITY == ctx.arrayType);
+      if (mzMLDecodeArray(binary, binaryEnd, &ctx, count, pPeaks+isInten, 2)) {
+         if (isInten) {
+            gotIntensity = 1;
+         } else {
+            gotMZ = 1;
+         }
+      }
+   }
+   free(elem);
+   if (!gotMZ) {
+      free(pPeaks);
+      return NULL;
+   }
+   pPeaks[peaksCount*2] = -1; // some callers want a terminator
+   pPeaks[peaksCount*2+1] = -1;
+   return pPeaks; // caller must free this pointer
+}
+
+/*
+ * run info
+ */
+static void mzMLReadMSRun(RAMPFILE *pFI, struct RunHeaderStruct *runHeader) {
+   char attr[SIZE_BUF];
+   char *head = mzMLReadElement(pFI, 0, "<spectrumList", "<chromatogramList");
+   const char *spectrumList;
+   if (!head) {
+      return;
+   }
+   if ((spectrumList = strstr(head, "<spectrumList")) &&
+       mzMLGetAttr(spectrumList, "count", attr, sizeof(attr))) {
+      runHeader->scanCount = atoi(attr);
+   }
+   free(head);
+}
+
+/*
+ * instrument info, from the first instrumentConfiguration
+ */
+typedef struct {
+   InstrumentStruct *output;
+   char *current; // what the next cvParam describes
+   int found;
+} mzMLInstrumentContext;
+
+static void mzMLInstrumentTag(const char *tag, void *context) {
+   mzMLInstrumentContext *ctx = (mzMLInstrumentContext *)context;
+   mzMLCvParam cv;
+   if (mzMLIsTag(tag, "<source")) {
+      ctx->current = ctx->output->ionisation;
+   } else if (mzMLIsTag(tag, "<analyzer")) {
+      ctx->current = ctx->output->analyzer;
+   } else if (mzMLIsTag(tag, "<detector")) {
+      ctx->current = ctx->output->detector;
+   } else if (!strncmp(tag, "</source>", 9) || !strncmp(tag, "</analyzer>", 11) || !strncmp(tag, "</detector>", 11)) {
+      ctx->current = NULL;
+   } else if (mzMLParseCvParam(tag, &cv) && ctx->current && cv.name[0] && strcmp(cv.accession, "MS:1000529")) {
+      // first named term in each section; skip the instrument serial number
+      strncpy(ctx->current, cv.name, INSTRUMENT_LENGTH-1);
+      ctx->current[INSTRUMENT_LENGTH-1] = 0;
+      ctx->current = NULL;
+      ctx->found = 1;
+   }
+}
+
+static int mzMLReadInstrument(RAMPFILE *pFI, InstrumentStruct *output) {
+   mzMLInstrumentContext ctx;
+   char *head = mzMLReadElement(pFI, 0, "<run", "<spectrumList");
+   const char *config;
+   memset(&ctx, 0, sizeof(ctx));
+   ctx.output = output;
+   if (head && (config = strstr(head, "<instrumentConfiguration "))) {
+      const char *end = strstr(config, "</instrumentConfiguration>");
+      const char *components = strstr(config, "<componentList");
+      if (components && end && components < end) {
+         ctx.current = output->model; // the model term comes before the components
+         mzMLWalkTags(pFI, config+1, components, mzMLInstrumentTag, &ctx);
+         ctx.current = NULL;
+         mzMLWalkTags(pFI, components, end, mzMLInstrumentTag, &ctx);
+      } else {
+         ctx.current = output->model;
+         mzMLWalkTags(pFI, config+1, end, mzMLInstrumentTag, &ctx);
+      }
+   }
+   free(head);
+   return ctx.found;
+}
+
 /*
  * Reads scan header information.
  * !! THE STREAM IS NOT RESET AT THE INITIAL POSITION BEFORE
@@ -802,7 +1783,6 @@ void readHeader(RAMPFILE *pFI,
     * initialize defaults
     */
    memset(scanHeader,0,sizeof(struct ScanHeaderStruct)); // mostly we want 0's
-#define LOWMZ_UNINIT 1.111E6
    scanHeader->lowMZ =  LOWMZ_UNINIT;
    scanHeader->acquisitionNum = -1;
    scanHeader->seqNum = -1;
@@ -829,7 +1809,9 @@ void readHeader(RAMPFILE *pFI,
 
 
 
-   if (pFI->bIsMzData) {
+   if (pFI->bIsMzML) {
+      mzMLReadHeader(pFI, lScanIndex, scanHeader);
+   } else if (pFI->bIsMzData) {
       int bHasPrecursor = 0;
       while (ramp_nextTag(stringBuf, SIZE_BUF, pFI))
       {
@@ -1198,6 +2180,11 @@ int readMsLevel(RAMPFILE *pFI,
 	   return(scanHeader.msLevel);
    }
 #endif
+   if (pFI->bIsMzML) {
+      struct ScanHeaderStruct scanHeader;
+      readHeader(pFI, lScanIndex, &scanHeader);
+      return(scanHeader.msLevel);
+   }
    ramp_fseek(pFI, lScanIndex, SEEK_SET);
 
    char *fgot=ramp_fgets(stringBuf, SIZE_BUF, pFI);
@@ -1246,6 +2233,11 @@ double readStartMz(RAMPFILE *pFI,
 	   return(scanHeader.lowMZ);
    }
 #endif
+  if (pFI->bIsMzML) {
+    struct ScanHeaderStruct scanHeader;
+    readHeader(pFI, lScanIndex, &scanHeader);
+    return(scanHeader.lowMZ);
+  }
   ramp_fseek(pFI, lScanIndex, SEEK_SET);
    
   while (ramp_fgets(stringBuf, SIZE_BUF, pFI))
@@ -1290,6 +2282,11 @@ double readEndMz(RAMPFILE *pFI,
 	   return(scanHeader.highMZ);
    }
 #endif
+  if (pFI->bIsMzML) {
+    struct ScanHeaderStruct scanHeader;
+    readHeader(pFI, lScanIndex, &scanHeader);
+    return(scanHeader.highMZ);
+  }
   ramp_fseek(pFI, lScanIndex, SEEK_SET);
    
   while (ramp_fgets(stringBuf, SIZE_BUF, pFI))
@@ -1312,9 +2309,7 @@ const char **rampListSupportedFileTypes() {
 	if (!data_Ext.size()) { // needs init
 		data_Ext.push_back(".mzXML");
 		data_Ext.push_back(".mzData");
-#ifdef HAVE_PWIZ_MZML_LIB
-		data_Ext.push_back(".mzML");
-#endif
+		data_Ext.push_back(".mzML"); // natively, or via pwiz
 #ifdef RAMP_HAVE_GZ_INPUT
 		// add these filetypes again, gzipped
 		int n=(int)data_Ext.size();
@@ -1531,6 +2526,11 @@ int readPeaksCount(RAMPFILE *pFI,
    if (lScanIndex <= 0) {
      return (0);
    }
+   if (pFI->bIsMzML) {
+     struct ScanHeaderStruct scanHeader;
+     readHeader(pFI, lScanIndex, &scanHeader);
+     return scanHeader.peaksCount;
+   }
    char *stringBuf=(char *)malloc(SIZE_BUF+1);
    char *beginPeaksCount, *peaks;
    int result = 0;
@@ -1623,6 +2623,10 @@ RAMPREAL *readPeaks(RAMPFILE *pFI,
      return (NULL);
    }
 
+   if (pFI->bIsMzML) {
+      return mzMLReadPeaks(pFI, lScanIndex); // caller must free this pointer
+   }
+
    if (pFI->bIsMzData) {
       // intensity and mz are written in two different arrays
       int bGotInten = 0;
@@ -2067,6 +3071,10 @@ void readMSRun(RAMPFILE *pFI,
 	   return;
    }
 #endif
+   if (pFI->bIsMzML) {
+      mzMLReadMSRun(pFI, runHeader);
+      return;
+   }
    char stringBuf[SIZE_BUF+1];
    ramp_fseek(pFI, 0 , SEEK_SET); // rewind
    char *fgot=ramp_fgets(stringBuf, SIZE_BUF, pFI);
@@ -2227,7 +3235,9 @@ InstrumentStruct* getInstrumentStruct(RAMPFILE *pFI)
 
    char *fgot=ramp_fgets(stringBuf, SIZE_BUF, pFI);
 
-   if (pFI->bIsMzData) {  // TODO
+   if (pFI->bIsMzML) {
+      found[0] = mzMLReadInstrument(pFI, output);
+   } else if (pFI->bIsMzData) {  // TODO
    } else {
       int isAncient=0;
       while( !strstr( stringBuf , "<msInstrument" ) && 
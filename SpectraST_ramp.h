@@ -4,7 +4,8 @@
 
 Non sequential parser for mzXML files
 and mzData files, too!
-and mzML, if you have the PWIZ library from Spielberg Family Proteomics Center
+and mzML, natively (via the indexedmzML offset list) or through
+the PWIZ library from Spielberg Family Proteomics Center
 
                              -------------------
     begin                : Wed Oct 10
@@ -103,6 +104,8 @@ typedef struct {
    pwiz::msdata::RAMPAdapter *mzML; // if nonNULL, then we're reading mzML 
 #endif
    int bIsMzData; // if not mzML, then is it mzXML or mzData?
+   int bIsMzML; // mzML read natively (no pwiz), spectra located via the indexedmzML offset list
+   char *mzMLParamGroups; // native mzML only: the referenceableParamGroupList, for resolving group refs
 } RAMPFILE;
 
 #ifdef RAMP_HAVE_GZ_INPUT
@@ -0,0 +1,255 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../Peptide.hpp"
+#include "../SpectraSTLog.hpp"
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Program: HomologCheck
+ *
+ * Checks Peptide::isHomolog() against the original implementation, which compared the interactStyleAA strings of the
+ * residues in two full (m + 1) x (n + 1) tables allocated row by row. The identity and the verdict must be exactly the
+ * same: for all pairs of peptides of up to 3 residues built from residues that exercise the I/L and K/Q equivalences and
+ * the mod tokens, for some peptides with terminal mods, and for random pairs of peptides of up to 95 residues (so as to
+ * go past HOMOLOG_STACK_LENGTH). Then times both implementations on unmodified and on modified tryptic-length peptides.
+ *
+ * Usage: HomologCheck
+ *
+ */
+
+using namespace std;
+
+bool g_verbose = false;
+bool g_quiet = true;
+SpectraSTLog* g_log = NULL;
+
+// oldIsHomolog - the original isHomolog()
+static bool oldIsHomolog(Peptide& self, Peptide& other, double threshold, int& identity) {
+
+  unsigned int m = (unsigned int)(self.stripped.length());
+  unsigned int n = (unsigned int)(other.stripped.length());
+
+  vector<string> aa1(m + 1);
+  vector<string> aa2(n + 1);
+
+  string::size_type shorter = m;
+  if (m > n) shorter = n;
+
+  double minIdentity = threshold * (shorter * 2 - 1);
+
+  int** alignedLength = new int*[m + 1];
+  int** identical = new int*[m + 1];
+  unsigned int i = 0;
+  unsigned int j = 0;
+
+  for (i = 0; i <= m; i++) {
+    alignedLength[i] = new int[n + 1];
+    identical[i] = new int[n + 1];
+    alignedLength[i][0] = 0;
+    if (i > 0) aa1[i] = self.interactStyleAA(i - 1);
+    for (j = 0; j <= n; j++) {
+      identical[i][j] = 0;
+    }
+  }
+  for (j = 0; j <= n; j++) {
+    alignedLength[0][j] = 0;
+    if (j > 0) aa2[j] = other.interactStyleAA(j - 1);
+  }
+
+  for (i = 1; i <= m; i++) {
+    for (j = 1; j <= n; j++) {
+      if (aa1[i] == aa2[j] || (aa1[i] == "L" && aa2[j] == "I") || (aa1[i] == "I" && aa2[j] == "L") ||
+          (aa1[i] == "K" && aa2[j] == "Q") || (aa1[i] == "Q" && aa2[j] == "K")) {
+        alignedLength[i][j] = alignedLength[i - 1][j - 1] + 1 + identical[i - 1][j - 1];
+        identical[i][j] = 1;
+      } else if (alignedLength[i - 1][j] > alignedLength[i][j - 1]) {
+        alignedLength[i][j] = alignedLength[i - 1][j];
+      } else {
+        alignedLength[i][j] = alignedLength[i][j - 1];
+      }
+    }
+  }
+
+  identity = alignedLength[m][n];
+  bool result = ((double)(alignedLength[m][n]) >= minIdentity);
+
+  for (unsigned int r = 0; r <= m; r++) {
+    delete[] alignedLength[r];
+    delete[] identical[r];
+  }
+  delete[] alignedLength;
+  delete[] identical;
+
+  return (result);
+}
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((double)(tv.tv_sec) + (double)(tv.tv_usec) / 1000000.0);
+}
+
+// checkPair - compares the two implementations on one pair, and reports the first few mismatches
+static void checkPair(Peptide* a, Peptide* b, double threshold, unsigned long long& numChecked, unsigned long long& numBad) {
+
+  int oldIdentity = 0;
+  int newIdentity = 0;
+  bool oldResult = oldIsHomolog(*a, *b, threshold, oldIdentity);
+  bool newResult = a->isHomolog(*b, threshold, newIdentity);
+
+  numChecked++;
+  if (oldResult != newResult || oldIdentity != newIdentity) {
+    if (numBad++ < 10) {
+      cout << "MISMATCH " << a->interactStyle() << " " << b->interactStyle() << " old " << oldIdentity << " new " << newIdentity << endl;
+    }
+  }
+}
+
+// randomPeptides - numPeptides random peptides of minLength to maxLength residues, each one of the tokens given
+static void randomPeptides(vector<Peptide*>& peptides, unsigned int numPeptides, int minLength, int maxLength, const char** tokens, int numTokens) {
+
+  for (unsigned int r = 0; r < numPeptides; r++) {
+    int length = minLength + rand() % (maxLength - minLength + 1);
+    string seq;
+    for (int k = 0; k < length; k++) {
+      seq += tokens[rand() % numTokens];
+    }
+    peptides.push_back(new Peptide(seq, 2));
+  }
+}
+
+// timeBoth - times the two implementations on the pairs of each peptide with the next 50, in ns per call
+static void timeBoth(vector<Peptide*>& peptides, string label) {
+
+  int identity = 0;
+  unsigned long long numCalls = 0;
+
+  double t0 = now();
+  for (int rep = 0; rep < 5; rep++) {
+    for (size_t a = 0; a < peptides.size(); a++) {
+      for (size_t b = 0; b < 50; b++) {
+        oldIsHomolog(*(peptides[a]), *(peptides[(a + b) % peptides.size()]), 0.7, identity);
+        numCalls++;
+      }
+    }
+  }
+  double t1 = now();
+  for (int rep = 0; rep < 5; rep++) {
+    for (size_t a = 0; a < peptides.size(); a++) {
+      for (size_t b = 0; b < 50; b++) {
+        peptides[a]->isHomolog(*(peptides[(a + b) % peptides.size()]), 0.7, identity);
+      }
+    }
+  }
+  double t2 = now();
+
+  cout << label << ": old " << (t1 - t0) / (double)numCalls * 1.0e9 << " ns/call, new " << (t2 - t1) / (double)numCalls * 1.0e9 << " ns/call" << endl;
+}
+
+int main() {
+
+  Peptide::defaultTables();
+  srand(7);
+
+  static const char* tokens[] = { "I", "L", "K", "Q", "A", "M", "M[147]", "C[160]", "S[167]" };
+  int numTokens = 9;
+
+  vector<Peptide*> peptides;
+
+  // all peptides of up to 3 of the tokens
+  int numCombinations = 1;
+  for (int length = 1; length <= 3; length++) {
+    numCombinations *= numTokens;
+    for (int c = 0; c < numCombinations; c++) {
+      string seq;
+      int x = c;
+      for (int k = 0; k < length; k++) {
+        seq += tokens[x % numTokens];
+        x /= numTokens;
+      }
+      peptides.push_back(new Peptide(seq, 2));
+    }
+  }
+
+  // terminal mods are not part of any residue
+  peptides.push_back(new Peptide("n[43]AKL", 2));
+  peptides.push_back(new Peptide("AKL", 2));
+  peptides.push_back(new Peptide("n[43]M[147]KI", 2));
+
+  unsigned long long numChecked = 0;
+  unsigned long long numBad = 0;
+
+  for (size_t a = 0; a < peptides.size(); a++) {
+    for (size_t b = 0; b < peptides.size(); b++) {
+      checkPair(peptides[a], peptides[b], 0.7, numChecked, numBad);
+    }
+  }
+
+  // random ones, one in ten longer than HOMOLOG_STACK_LENGTH can be
+  vector<Peptide*> randomOnes;
+  for (unsigned int r = 0; r < 300; r++) {
+    randomPeptides(randomOnes, 9, 5, 29, tokens, numTokens);
+    randomPeptides(randomOnes, 1, 5, 94, tokens, numTokens);
+  }
+  for (size_t a = 0; a < randomOnes.size(); a++) {
+    for (size_t b = a; b < a + 20 && b < randomOnes.size(); b++) {
+      checkPair(randomOnes[a], randomOnes[b], 0.6, numChecked, numBad);
+    }
+  }
+
+  cout << numChecked << " pairs checked, " << numBad << " mismatches" << endl;
+
+  // timings on tryptic-length peptides, unmodified, and with the modified tokens mixed in
+  static const char* aas[] = { "A", "C", "D", "E", "F", "G", "H", "I", "K", "L", "M", "N", "P", "Q", "R", "S", "T", "V", "W", "Y" };
+  static const char* modAas[] = { "A", "C[160]", "D", "E", "F", "G", "H", "I", "K", "L", "M", "M[147]", "N", "P", "Q", "R", "S", "S[167]", "T", "V" };
+
+  vector<Peptide*> unmodified;
+  randomPeptides(unmodified, 2000, 8, 22, aas, 20);
+  timeBoth(unmodified, "unmodified");
+
+  vector<Peptide*> modified;
+  randomPeptides(modified, 2000, 8, 22, modAas, 20);
+  timeBoth(modified, "modified");
+
+  vector<Peptide*>* all[] = { &peptides, &randomOnes, &unmodified, &modified };
+  for (int v = 0; v < 4; v++) {
+    for (vector<Peptide*>::iterator p = all[v]->begin(); p != all[v]->end(); p++) {
+      delete (*p);
+    }
+  }
+
+  return (numBad == 0 ? 0 : 1);
+}
@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+# IncrementalConsensusCheck - checks that an incremental update of a consensus library (-c_INC) is the same as
+# the library built from scratch: after some of the imported files have changed or been added, and after each
+# of the options that change the entries has been changed since the library to be updated was built.
+#
+# Usage: IncrementalConsensusCheck.sh <spectrast executable>
+#
+
+if [ $# -ne 1 ] || [ ! -x "$1" ]; then
+  echo "Usage: $0 <spectrast executable>"
+  exit 2
+fi
+
+case "$1" in
+  /*) SPECTRAST="$1" ;;
+  *) SPECTRAST="`pwd`/$1" ;;
+esac
+
+WORKDIR=`mktemp -d /tmp/IncrementalConsensusCheck.XXXXXX` || exit 2
+trap 'rm -rf "$WORKDIR"' 0
+cd "$WORKDIR" || exit 2
+
+# genMsp <seed> <file> - writes the replicates of the same 200 peptide ions: each one is in the file with
+# probability 1/2, with 1 or 2 replicates whose peaks vary with the seed
+genMsp() {
+  awk -v seed="$1" 'BEGIN {
+    AA = "ACDEFGHIKLMNPQRSTVWY";
+    srand(11);
+    for (i = 0; i < 200; i++) {
+      len = 7 + int(rand() * 9);
+      pep[i] = "";
+      for (k = 0; k < len - 1; k++) pep[i] = pep[i] substr(AA, 1 + int(rand() * 20), 1);
+      pep[i] = pep[i] (rand() < 0.5 ? "K" : "R");
+      charge[i] = 1 + int(rand() * 3);
+      numPeaks[i] = 15 + int(rand() * 25);
+      mz = 100.0;
+      for (p = 0; p < numPeaks[i]; p++) {
+        mz += 5.0 + rand() * 40.0;
+        peakMz[i, p] = mz;
+        peakInten[i, p] = 50.0 + rand() * 950.0;
+      }
+    }
+    srand(seed);
+    for (i = 0; i < 200; i++) {
+      if (rand() < 0.5) continue;
+      numReps = 1 + int(rand() * 2);
+      for (r = 0; r < numReps; r++) {
+        mw = 110.0 * length(pep[i]) + 18.0;
+        printf("Name: %s/%d\nMW: %.4f\n", pep[i], charge[i], mw);
+        printf("Comment: Mods=0 Parent=%.4f Prob=%.3f Spec=Raw\n", (mw + charge[i] * 1.007) / charge[i], 0.9 + rand() * 0.1);
+        n = 0;
+        for (p = 0; p < numPeaks[i]; p++) {
+          if (rand() < 0.9) {
+            outMz[n] = peakMz[i, p] + (rand() - 0.5) * 0.1;
+            outInten[n++] = peakInten[i, p] * (0.7 + rand() * 0.6);
+          }
+        }
+        printf("Num peaks: %d\n", n);
+        for (p = 0; p < n; p++) printf("%.3f\t%.1f\t?\n", outMz[p], outInten[p]);
+        printf("\n");
+      }
+    }
+  }' > "$2"
+}
+
+# importMsp <seed> <name> - generates <name>.msp and imports it as <name>.splib
+importMsp() {
+  genMsp $1 $2.msp
+  "$SPECTRAST" -cN$2 $2.msp > /dev/null 2>&1 || { echo "FAILED: cannot import $2.msp"; exit 1; }
+}
+
+NUMFAILED=0
+
+# check <label> <option>... - builds the consensus library of all files from scratch, and by updating old.splib,
+# both with the options given, and compares the two. They are built as lib.splib in different directories, since
+# the name of the library is in its preamble.
+check() {
+  label="$1"
+  shift
+  rm -rf full update
+  mkdir full update
+  "$SPECTRAST" -cNfull/lib -cAC "$@" r1.splib r2.splib r3.splib r4.splib > /dev/null 2>&1
+  "$SPECTRAST" -cNupdate/lib -cAC "$@" -c_INCold.splib r1.splib r2.splib r3.splib r4.splib > /dev/null 2>&1
+  copied=`grep "Incremental update of" spectrast.log | tail -1 | sed 's/.*: \([0-9]*\) peptide ions copied, \([0-9]*\) recomputed.*/\1 copied, \2 recomputed/'`
+  if [ ! -s full/lib.splib ] || [ ! -s update/lib.splib ]; then
+    echo "FAILED: $label: no library built"
+    NUMFAILED=`expr $NUMFAILED + 1`
+  elif cmp -s full/lib.splib update/lib.splib; then
+    echo "$label: same as built from scratch ($copied)"
+  else
+    echo "FAILED: $label: differs from the library built from scratch ($copied)"
+    NUMFAILED=`expr $NUMFAILED + 1`
+  fi
+}
+
+importMsp 1 r1
+importMsp 2 r2
+importMsp 3 r3
+"$SPECTRAST" -cNold -cAC r1.splib r2.splib r3.splib > /dev/null 2>&1 || { echo "FAILED: cannot build old.splib"; exit 1; }
+
+# r3 changes, r4 is new
+sleep 1
+importMsp 33 r3
+importMsp 4 r4
+
+check "changed and added files"
+check "filter criteria (-cf)" "-cfProb>0.95"
+check "reduced spectra (-cQ)" -cQ10
+check "annotated peaks (-c_ANN)" -c_ANN
+check "fragmentation type (-cI)" -cIHCD
+check "number of replicates (-cr)" -cr2
+
+if [ $NUMFAILED -gt 0 ]; then
+  echo "$NUMFAILED incremental update(s) differ from the library built from scratch"
+  exit 1
+fi
+exit 0
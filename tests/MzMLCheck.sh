@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# MzMLCheck - checks the native mzML reader of RAMP: imports tests/mzml_fixture.mzML and tests/mzml_fixture.mzXML,
+# which hold the same spectra, and compares the two libraries. In the mzML, the scan headers are spread over
+# cvParams (some through a referenceableParamGroup, retention times in minutes or seconds), and the peaks are in
+# 64- and 32-bit float and 32-bit integer arrays, uncompressed, zlib-compressed and MS-Numpress (linear + zlib, pic)
+# compressed, all found through the indexedmzML offset list. The mzXML holds exactly the values the mzML encodes.
+#
+# Usage: MzMLCheck.sh <spectrast executable>
+#
+
+if [ $# -ne 1 ] || [ ! -x "$1" ]; then
+  echo "Usage: $0 <spectrast executable>"
+  exit 2
+fi
+
+case "$1" in
+  /*) SPECTRAST="$1" ;;
+  *) SPECTRAST="`pwd`/$1" ;;
+esac
+
+FIXTURES="`dirname $0`"
+case "$FIXTURES" in
+  /*) ;;
+  *) FIXTURES="`pwd`/$FIXTURES" ;;
+esac
+
+WORKDIR=`mktemp -d /tmp/MzMLCheck.XXXXXX` || exit 2
+trap 'rm -rf "$WORKDIR"' 0
+cd "$WORKDIR" || exit 2
+
+cp "$FIXTURES/mzml_fixture.mzML" "$FIXTURES/mzml_fixture.mzXML" . || exit 2
+
+NUMFAILED=0
+
+for ext in mzML mzXML; do
+  "$SPECTRAST" -cNfrom_$ext mzml_fixture.$ext > /dev/null 2>&1 || { echo "FAILED: cannot import mzml_fixture.$ext"; exit 1; }
+  # the preamble names the files, and the offsets of the entries depend on it
+  grep -v "^###" from_$ext.sptxt | sed 's/BinaryFileOffset=[0-9]* //' > from_$ext.txt
+  grep "Imported \"mzml_fixture" spectrast.log | tail -1 | sed "s/mzml_fixture.$ext/mzml_fixture/" > from_$ext.log
+done
+
+if [ `grep -c "^Name: " from_mzXML.txt` -ne 4 ]; then
+  echo "FAILED: expected 4 spectra imported from mzml_fixture.mzXML"
+  NUMFAILED=`expr $NUMFAILED + 1`
+fi
+
+if cmp -s from_mzML.txt from_mzXML.txt; then
+  echo "mzML import: `grep -c "^Name: " from_mzML.txt` spectra, same as imported from mzXML"
+else
+  echo "FAILED: the spectra imported from mzml_fixture.mzML differ from those imported from mzml_fixture.mzXML"
+  diff from_mzML.txt from_mzXML.txt | head -20
+  NUMFAILED=`expr $NUMFAILED + 1`
+fi
+
+if ! cmp -s from_mzML.log from_mzXML.log; then
+  echo "FAILED: the scans counted in mzml_fixture.mzML differ from those counted in mzml_fixture.mzXML"
+  cat from_mzML.log from_mzXML.log
+  NUMFAILED=`expr $NUMFAILED + 1`
+fi
+
+if [ $NUMFAILED -gt 0 ]; then
+  exit 1
+fi
+exit 0
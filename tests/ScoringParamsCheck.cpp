@@ -0,0 +1,138 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <string>
+
+#include "../SpectraSTSearchParams.hpp"
+#include "../SpectraSTLog.hpp"
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Program: ScoringParamsCheck
+ *
+ * Checks that every search param declared in SpectraSTSearchParams.hpp is either in the key of the result cache
+ * (printed by SpectraSTSearchParams::printScoringParams) or declared non-scoring (SpectraSTSearchParams::isNonScoringParam),
+ * and not both. A new param that is in neither would make the result cache serve stale results when it is changed.
+ *
+ * Usage: ScoringParamsCheck <SpectraSTSearchParams.hpp>
+ *
+ */
+
+using namespace std;
+
+bool g_verbose = false;
+bool g_quiet = true;
+SpectraSTLog* g_log = NULL;
+
+// readDeclaredParams - reads the names of the params declared in the header, between the comment starting the
+// parameters and the one starting the methods. Returns false if the header cannot be read.
+static bool readDeclaredParams(string headerFileName, set<string>& params) {
+
+  ifstream fin(headerFileName.c_str());
+  if (!fin.good()) {
+    return (false);
+  }
+
+  bool inParams = false;
+  string line;
+  while (getline(fin, line)) {
+
+    string::size_type start = line.find_first_not_of(" \t\r");
+    if (start == string::npos) continue;
+    line = line.substr(start);
+
+    if (line.compare(0, 17, "// the parameters") == 0) {
+      inParams = true;
+    } else if (line.compare(0, 10, "// methods") == 0) {
+      break;
+    } else if (inParams && line.compare(0, 2, "//") != 0) {
+      // <type> <name>;
+      string::size_type semicolon = line.find(';');
+      if (semicolon == string::npos) continue;
+      string::size_type nameStart = line.find_last_of(" \t*&", semicolon);
+      if (nameStart == string::npos) continue;
+      params.insert(line.substr(nameStart + 1, semicolon - nameStart - 1));
+    }
+  }
+  return (true);
+}
+
+int main(int argc, char** argv) {
+
+  if (argc != 2) {
+    cerr << "Usage: ScoringParamsCheck <SpectraSTSearchParams.hpp>" << endl;
+    return (2);
+  }
+
+  set<string> declared;
+  if (!readDeclaredParams(argv[1], declared) || declared.empty()) {
+    cerr << "Cannot read the params declared in \"" << argv[1] << "\"." << endl;
+    return (2);
+  }
+
+  // the names of the params in the key, "<param> = <value>" one per line
+  SpectraSTSearchParams params;
+  stringstream key;
+  params.printScoringParams(key);
+  set<string> scoring;
+  string line;
+  while (getline(key, line)) {
+    scoring.insert(line.substr(0, line.find(" = ")));
+  }
+
+  int numFailed = 0;
+  int numNonScoring = 0;
+  for (set<string>::iterator p = declared.begin(); p != declared.end(); p++) {
+    bool inKey = (scoring.find(*p) != scoring.end());
+    bool nonScoring = SpectraSTSearchParams::isNonScoringParam(*p);
+    if (nonScoring) numNonScoring++;
+    if (!inKey && !nonScoring) {
+      cout << "FAILED: " << *p << " is neither printed by printScoringParams nor declared non-scoring" << endl;
+      numFailed++;
+    } else if (inKey && nonScoring) {
+      cout << "FAILED: " << *p << " is printed by printScoringParams but declared non-scoring" << endl;
+      numFailed++;
+    }
+  }
+  for (set<string>::iterator s = scoring.begin(); s != scoring.end(); s++) {
+    if (declared.find(*s) == declared.end()) {
+      cout << "FAILED: printScoringParams prints " << *s << ", which is not a declared param" << endl;
+      numFailed++;
+    }
+  }
+
+  cout << declared.size() << " params: " << scoring.size() << " in the result cache key, ";
+  cout << numNonScoring << " non-scoring; " << numFailed << " failed" << endl;
+
+  return (numFailed > 0 ? 1 : 0);
+}
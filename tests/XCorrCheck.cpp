@@ -0,0 +1,260 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <string>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+// the original implementation below needs the bins of the peak list
+#define private public
+#include "../SpectraSTPeakList.hpp"
+#undef private
+#include "../SpectraSTLog.hpp"
+#include "../Peptide.hpp"
+
+/*
+
+Program       : Spectrast
+Author        : Henry Lam <hlam@systemsbiology.org>
+Date          : 03.06.06
+
+
+Copyright (C) 2006 Henry Lam
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307, USA
+
+Henry Lam
+Insitute for Systems Biology
+1441 North 34th St.
+Seattle, WA  98103  USA
+hlam@systemsbiology.org
+
+*/
+
+/* Program: XCorrCheck
+ *
+ * Checks SpectraSTPeakList::calcXCorr() against the original implementation, which took the mean of the dot products
+ * at 151 shifts, on synthetic spectra. The results may differ by float rounding only. Also checks that scoring the
+ * same spectra from several threads (each reusing its own scratch storage) gives exactly the same results, and
+ * times both implementations.
+ *
+ * Usage: XCorrCheck [numSpectra]
+ *
+ */
+
+using namespace std;
+
+bool g_verbose = false;
+bool g_quiet = true;
+SpectraSTLog* g_log = NULL;
+
+#define NUM_THREADS 4
+
+// oldCalcXCorr - the original calcXCorr(), with the 151 shifted dot products
+static double oldCalcXCorr(SpectraSTPeakList* pl) {
+
+  Peptide* pep = pl->m_pep;
+  pl->m_parentMz = pep->monoisotopicMZ();
+
+  pl->discardBinIndex();
+  pl->binPeaks(0.0, 1.0, 1.0, 1, 0.0, true);
+
+  vector<float>& bins = *(pl->m_bins);
+  unsigned int numBins = (unsigned int)(bins.size());
+  unsigned int regionSize = numBins / 10 + 1;
+
+  float maxIntInRegion[10];
+  bool emptyRegion[10];
+  for (unsigned int r = 0; r < 10; r++) {
+    maxIntInRegion[r] = 0.1;
+    emptyRegion[r] = true;
+  }
+  for (unsigned int b = 0; b < numBins; b++) {
+    unsigned int region = b / regionSize;
+    if (maxIntInRegion[region] < bins[b]) {
+      maxIntInRegion[region] = bins[b];
+      emptyRegion[region] = false;
+    }
+  }
+  for (unsigned int b = 0; b < numBins; b++) {
+    unsigned int region = b / regionSize;
+    if (!emptyRegion[region]) {
+      bins[b] = bins[b] * 50.0 / maxIntInRegion[region];
+    } else {
+      bins[b] = 0.0;
+    }
+  }
+
+  map<int, float> theoSpec;
+  pep->SEQUESTTheoreticalSpectrum(theoSpec);
+  vector<float> theoBins(numBins, 0.0);
+  for (map<int, float>::iterator t = theoSpec.begin(); t != theoSpec.end(); t++) {
+    theoBins[pl->calcBinNumber((double)(t->first))] += t->second;
+  }
+
+  float sumDots = 0.0;
+  float xcorr = 0.0;
+  for (int tau = -75; tau <= 75; tau++) {
+    float dot = 0.0;
+    for (unsigned int b = 0; b < numBins; b++) {
+      if ((int)b + tau >= 0 && (int)b + tau < (int)numBins) {
+        dot += bins[b] * theoBins[b + tau] / 10000.0;
+      }
+    }
+    sumDots += dot;
+    if (tau == 0) {
+      xcorr = dot;
+    }
+  }
+  xcorr = xcorr - (sumDots / 151.0);
+  xcorr *= 1.45;
+
+  pl->discardBins();
+
+  return ((double)(xcorr));
+}
+
+// makeSpectrum - a random tryptic peptide, with most of its theoretical fragments present at random intensities,
+// plus random noise peaks
+static SpectraSTPeakList* makeSpectrum(vector<Peptide*>& peptides) {
+
+  static const char* aas = "ACDEFGHILMNPQSTVWY";
+
+  string seq;
+  int len = 7 + rand() % 18;
+  for (int k = 0; k < len - 1; k++) {
+    seq += aas[rand() % 18];
+  }
+  seq += (rand() % 2 ? 'K' : 'R');
+
+  Peptide* pep = new Peptide(seq, 2 + rand() % 2);
+  peptides.push_back(pep);
+
+  map<int, float> theoSpec;
+  pep->SEQUESTTheoreticalSpectrum(theoSpec);
+
+  SpectraSTPeakList* pl = new SpectraSTPeakList(pep->monoisotopicMZ(), pep->charge, 0, false);
+  pl->setPeptidePtr(pep);
+
+  map<double, float> peaks;
+  for (map<int, float>::iterator t = theoSpec.begin(); t != theoSpec.end(); t++) {
+    if (rand() % 4 != 0) {
+      peaks[(double)(t->first) + (double)(rand() % 100) / 250.0] = (float)(1 + rand() % 10000);
+    }
+  }
+  int numNoise = 50 + rand() % 250;
+  for (int n = 0; n < numNoise; n++) {
+    peaks[100.0 + (double)(rand() % 180000) / 100.0] = (float)(1 + rand() % 3000);
+  }
+  for (map<double, float>::iterator p = peaks.begin(); p != peaks.end(); p++) {
+    pl->insert(p->first, p->second, "", "");
+  }
+
+  return (pl);
+}
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((double)(tv.tv_sec) + (double)(tv.tv_usec) / 1000000.0);
+}
+
+typedef struct {
+  vector<SpectraSTPeakList*>* spectra;
+  vector<double>* xcorrs;
+  unsigned int first;
+} XCorrThreadArg;
+
+static void* calcXCorrsInThread(void* arg) {
+
+  XCorrThreadArg* a = (XCorrThreadArg*)arg;
+  for (unsigned int k = a->first; k < (unsigned int)(a->spectra->size()); k += NUM_THREADS) {
+    (*(a->xcorrs))[k] = (*(a->spectra))[k]->calcXCorr();
+  }
+  return (NULL);
+}
+
+int main(int argc, char* argv[]) {
+
+  unsigned int numSpectra = 3000;
+  if (argc > 1) numSpectra = (unsigned int)atoi(argv[1]);
+
+  Peptide::defaultTables();
+  srand(31);
+
+  vector<Peptide*> peptides;
+  vector<SpectraSTPeakList*> spectra;
+  for (unsigned int k = 0; k < numSpectra; k++) {
+    spectra.push_back(makeSpectrum(peptides));
+  }
+
+  vector<double> oldXCorrs(numSpectra, 0.0);
+  vector<double> newXCorrs(numSpectra, 0.0);
+
+  double t0 = now();
+  for (unsigned int k = 0; k < numSpectra; k++) {
+    oldXCorrs[k] = oldCalcXCorr(spectra[k]);
+  }
+  double t1 = now();
+  for (unsigned int k = 0; k < numSpectra; k++) {
+    newXCorrs[k] = spectra[k]->calcXCorr();
+  }
+  double t2 = now();
+
+  double maxDiff = 0.0;
+  unsigned int numBad = 0;
+  for (unsigned int k = 0; k < numSpectra; k++) {
+    double diff = fabs(newXCorrs[k] - oldXCorrs[k]);
+    if (diff > maxDiff) maxDiff = diff;
+    if (diff > 1.0e-4 * (1.0 + fabs(oldXCorrs[k]))) {
+      if (numBad++ < 10) {
+        cout << "MISMATCH " << spectra[k]->m_pep->interactStyleWithCharge() << " old " << oldXCorrs[k] << " new " << newXCorrs[k] << endl;
+      }
+    }
+  }
+
+  // the same spectra again, from several threads
+  vector<double> threadXCorrs(numSpectra, 0.0);
+  pthread_t threads[NUM_THREADS];
+  XCorrThreadArg args[NUM_THREADS];
+  for (unsigned int t = 0; t < NUM_THREADS; t++) {
+    args[t].spectra = &spectra;
+    args[t].xcorrs = &threadXCorrs;
+    args[t].first = t;
+    pthread_create(&(threads[t]), NULL, calcXCorrsInThread, &(args[t]));
+  }
+  for (unsigned int t = 0; t < NUM_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  unsigned int numThreadBad = 0;
+  for (unsigned int k = 0; k < numSpectra; k++) {
+    if (threadXCorrs[k] != newXCorrs[k]) numThreadBad++;
+  }
+
+  cout << numSpectra << " spectra: max |new - old| = " << maxDiff << ", " << numBad << " out of tolerance, ";
+  cout << numThreadBad << " differing when scored from " << NUM_THREADS << " threads" << endl;
+  cout << "old: " << t1 - t0 << " s, new: " << t2 - t1 << " s" << endl;
+
+  for (unsigned int k = 0; k < numSpectra; k++) {
+    delete (spectra[k]);
+    delete (peptides[k]);
+  }
+
+  return ((numBad == 0 && numThreadBad == 0) ? 0 : 1);
+}